@@ -0,0 +1,104 @@
+#!/bin/bash
+set -u
+
+# Runs the benchmarks in mempager-bench against a fresh MMU for each
+# configuration and prints one CSV (or JSON, with -j) row per run.
+# The configuration matrix can be overridden through the variables
+# below, e.g., `FRAMES="4 64" CLIENTS="1 64" ./bench.sh -j`.
+
+FRAMES=${FRAMES:-"4 16 64"}
+BLOCKS=${BLOCKS:-"256"}
+SYSLOG_BYTES=${SYSLOG_BYTES:-"16 1024 65536 1048576"}
+MACRO_FRAMES=${MACRO_FRAMES:-"16 64 256"}
+MACRO_BLOCKS=${MACRO_BLOCKS:-"256 1024"}
+CLIENTS=${CLIENTS:-"1 8 64"}
+REPS=${REPS:-200}
+WARMUP=${WARMUP:-20}
+# If set, syslog records are written to this file instead of stdout.
+SYSLOG_SINK=${SYSLOG_SINK:-""}
+[ -n "$SYSLOG_SINK" ] && export MMU_SYSLOG=$SYSLOG_SINK
+# Frame pools (and clock hands) in the pager; see src/pager.c.
+export PAGER_SHARDS=${SHARDS:-1}
+# Let clients restore pages the clock only unprotected to track
+# references, without a fault round trip; see src/pager.c.
+export PAGER_SOFTREF=${SOFTREF:-0}
+# One frame pool per NUMA node, bound to the node's memory, and
+# page coloring (-1 sizes colors from the L2); see src/pager.c.
+export PAGER_NUMA=${NUMA:-0}
+export PAGER_COLORS=${COLORS:-0}
+# Swap in this file (or device) instead of memory, behind the I/O
+# scheduler queueing IOSCHED_DEPTH page writes; see src/iosched.h.
+SWAP_FILE=${SWAP_FILE:-""}
+[ -n "$SWAP_FILE" ] && export MMU_SWAP_FILE=$SWAP_FILE
+export MMU_IOSCHED_DEPTH=${IOSCHED_DEPTH:-64}
+# Pages each client reads per pass in the bandwidth benchmark.
+BANDWIDTH_PAGES=${BANDWIDTH_PAGES:-"16 64"}
+
+fmt=""
+if [ $# -gt 0 ] && [ "$1" = "-j" ] ; then
+    fmt="-j"
+fi
+
+# Logging to files dominates the fault path; benchmark without it.
+make LOGFLAGS= > /dev/null
+
+header="-H"
+[ -n "$fmt" ] && header=""
+
+run () {
+    local frames=$1 blocks=$2
+    shift 2
+    local fifo=mmu.bench.ready
+    rm -rf mmu.sock mmu.pmem.img.* $fifo
+    mkfifo $fifo
+    MMU_READY_FD=3 ./bin/mmu $frames $blocks &> /dev/null 3> $fifo &
+    local mmu=$!
+    local ready=""
+    read -r ready < $fifo
+    rm -f $fifo
+    if [ "$ready" != "READY" ] ; then
+        echo "mmu failed to start with $frames frames $blocks blocks" >&2
+        wait $mmu
+        return
+    fi
+    ./bin/bench $fmt $header -f $frames -b $blocks -r $REPS -w $WARMUP "$@"
+    header=""
+    kill -SIGINT $mmu
+    wait $mmu
+    rm -rf mmu.sock mmu.pmem.img.*
+}
+
+for frames in $FRAMES ; do
+    for blocks in $BLOCKS ; do
+        run $frames $blocks extend
+        run $frames $blocks fault
+        run $frames $blocks readevict
+        run $frames $blocks writeevict
+        run $frames $blocks hotcold
+        for bytes in $SYSLOG_BYTES ; do
+            run $frames $blocks -n $bytes syslog
+            # batched records must fit in a single page
+            [ $bytes -gt $(getconf PAGESIZE) ] && continue
+            run $frames $blocks -n $bytes syslogv
+            run $frames $blocks -n $bytes syslogasync
+        done
+    done
+done
+
+for frames in $MACRO_FRAMES ; do
+    for blocks in $MACRO_BLOCKS ; do
+        for clients in $CLIENTS ; do
+            run $frames $blocks -c $clients -w 2 macro
+        done
+    done
+done
+
+for frames in $MACRO_FRAMES ; do
+    for pages in $BANDWIDTH_PAGES ; do
+        for clients in $CLIENTS ; do
+            # only working sets that stay resident measure bandwidth
+            [ $((pages * clients)) -gt $frames ] && continue
+            run $frames $((pages * clients)) -c $clients -p $pages bandwidth
+        done
+    done
+done
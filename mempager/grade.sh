@@ -5,26 +5,63 @@ TESTSPEC=mempager-tests/tests.spec
 
 make
 
-while read -r num frames blocks nodiff ; do
-    num=$((num))
-    frames=$((frames))
-    blocks=$((blocks))
-    nodiff=$((nodiff))
-    echo "running test$num"
-    rm -rf mmu.sock mmu.pmem.img.*
-    ./bin/mmu $frames $blocks &> test$num.mmu.out &
-    sleep 1s
-    ./bin/test$num &> test$num.out
-    kill -SIGINT %1
-    wait
-    rm -rf mmu.sock mmu.pmem.img.*
-    if [ $nodiff -eq 1 ] ; then
-        continue
-    fi
-    if ! diff mempager-tests/test$num.mmu.out test$num.mmu.out > /dev/null ; then
-        echo "test$num.mmu.out differs"
+now_ms () {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Runs test $1 against a dedicated MMU with $2 frames and $3 blocks,
+# comparing its output if $4 is 0 and its exit status otherwise.
+# Each test uses its own socket, so tests run in parallel.  The MMU
+# writes READY to the fifo passed in MMU_READY_FD once it accepts
+# connections, so there is no need to sleep before starting the test.
+runtest () {
+    local num=$1 frames=$2 blocks=$3 nodiff=$4
+    local sock=mmu.test$num.sock
+    local fifo=mmu.test$num.ready
+    local start=$(now_ms)
+    local status=""
+    rm -f $sock $fifo
+    mkfifo $fifo
+    MMU_SOCK=$sock MMU_READY_FD=3 ./bin/mmu $frames $blocks \
+            &> test$num.mmu.out 3> $fifo &
+    local mmu=$!
+    local ready=""
+    read -r ready < $fifo
+    rm -f $fifo
+    if [ "$ready" != "READY" ] ; then
+        wait $mmu
+        echo "test$num: mmu failed to start"
+        return
     fi
-    if ! diff mempager-tests/test$num.out test$num.out > /dev/null ; then
-        echo "test$num.out differs"
+    MMU_SOCK=$sock ./bin/test$num &> test$num.out
+    local rc=$?
+    kill -SIGINT $mmu
+    wait $mmu
+    rm -f $sock
+    if [ $nodiff -eq 0 ] ; then
+        if ! diff mempager-tests/test$num.mmu.out test$num.mmu.out > /dev/null ; then
+            status="$status test$num.mmu.out differs"
+        fi
+        if ! diff mempager-tests/test$num.out test$num.out > /dev/null ; then
+            status="$status test$num.out differs"
+        fi
+    elif [ $rc -ne 0 ] ; then
+        # tests without expected output check themselves and fail
+        # with a non-zero exit status
+        status="$status FAIL (exit status $rc)"
     fi
+    printf "test%-3d %6d ms%s\n" $num $(( $(now_ms) - start )) "$status"
+}
+
+start=$(now_ms)
+while read -r num frames blocks nodiff ; do
+    runtest $((num)) $((frames)) $((blocks)) $((nodiff)) \
+            > test$((num)).grade &
+done < $TESTSPEC
+wait
+
+while read -r num frames blocks nodiff ; do
+    cat test$((num)).grade
+    rm -f test$((num)).grade
 done < $TESTSPEC
+echo "total $(( $(now_ms) - start )) ms"
@@ -0,0 +1,512 @@
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+/* Benchmark driver for the MMU/UVM fault and request paths.  Each
+ * invocation runs one benchmark against an already running MMU and
+ * prints one result row.  See mempager-bench/README.md. */
+
+#define BENCH_FMT_CSV 0
+#define BENCH_FMT_JSON 1
+
+struct bench_opts {/*{{{*/
+	const char *name;
+	int nframes;
+	int nblocks;
+	int reps;
+	int warmup;
+	int bytes;
+	int batch;
+	int clients;
+	int pages;
+	int loops;
+	int fmt;
+	int header;
+};/*}}}*/
+
+static struct bench_opts opts = {
+	.name = NULL,
+	.nframes = 4,
+	.nblocks = 256,
+	.reps = 100,
+	.warmup = 10,
+	.bytes = 4096,
+	.batch = 64,
+	.clients = 1,
+	.pages = 32,
+	.loops = 32,
+	.fmt = BENCH_FMT_CSV,
+	.header = 0,
+};
+static size_t PAGESIZE = 0;
+static int MAXPAGES = 0;
+
+/****************************************************************************
+ * timing and reporting
+ ***************************************************************************/
+static uint64_t now_ns(void)/*{{{*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}/*}}}*/
+
+static int cmp_u64(const void *a, const void *b)/*{{{*/
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}/*}}}*/
+
+static uint64_t percentile(const uint64_t *sorted, int n, int p)/*{{{*/
+{
+	/* nearest-rank percentile */
+	int rank = (int)(((long)p * n + 99) / 100);
+	if(rank < 1) rank = 1;
+	return sorted[rank-1];
+}/*}}}*/
+
+static void report(uint64_t *samples, int n, uint64_t wall_ns)/*{{{*/
+{
+	if(opts.header && opts.fmt == BENCH_FMT_CSV) {
+		printf("bench,frames,blocks,clients,bytes,reps,"
+				"mean_ns,p50_ns,p90_ns,p99_ns,max_ns,ops_per_sec\n");
+	}
+	if(n == 0) {
+		fprintf(stderr, "%s: no samples collected\n", opts.name);
+		exit(EXIT_FAILURE);
+	}
+	qsort(samples, n, sizeof(samples[0]), cmp_u64);
+	uint64_t sum = 0;
+	for(int i = 0; i < n; ++i) sum += samples[i];
+	double ops = wall_ns ? (double)n * 1e9 / (double)wall_ns : 0;
+	const char *fmt = opts.fmt == BENCH_FMT_JSON ?
+		"{\"bench\": \"%s\", \"frames\": %d, \"blocks\": %d, "
+		"\"clients\": %d, \"bytes\": %d, \"reps\": %d, "
+		"\"mean_ns\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+		"\"p99_ns\": %llu, \"max_ns\": %llu, \"ops_per_sec\": %.1f}\n" :
+		"%s,%d,%d,%d,%d,%d,%llu,%llu,%llu,%llu,%llu,%.1f\n";
+	printf(fmt, opts.name, opts.nframes, opts.nblocks, opts.clients,
+			opts.bytes, n,
+			(unsigned long long)(sum / n),
+			(unsigned long long)percentile(samples, n, 50),
+			(unsigned long long)percentile(samples, n, 90),
+			(unsigned long long)percentile(samples, n, 99),
+			(unsigned long long)samples[n-1], ops);
+}/*}}}*/
+
+/****************************************************************************
+ * microbenchmarks
+ ***************************************************************************/
+static char ** extend_pages(int n)/*{{{*/
+{
+	char **pages = malloc(n * sizeof(pages[0]));
+	if(!pages) exit(EXIT_FAILURE);
+	for(int i = 0; i < n; ++i) {
+		pages[i] = uvm_extend();
+		if(!pages[i]) {
+			fprintf(stderr, "uvm_extend failed after %d pages\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return pages;
+}/*}}}*/
+
+static int clamp_reps(int avail)/*{{{*/
+{
+	/* benchmarks that consume a fresh page per sample are bounded by
+	 * the managed address space and the number of disk blocks. */
+	if(opts.warmup + opts.reps > avail) {
+		int reps = avail - opts.warmup;
+		if(reps < 1) {
+			fprintf(stderr, "%s: not enough pages\n", opts.name);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "%s: clamping reps from %d to %d\n", opts.name,
+				opts.reps, reps);
+		return reps;
+	}
+	return opts.reps;
+}/*}}}*/
+
+static void bench_extend(void)/*{{{*/
+{
+	int avail = opts.nblocks < MAXPAGES ? opts.nblocks : MAXPAGES;
+	int reps = clamp_reps(avail);
+	uint64_t *samples = malloc(reps * sizeof(samples[0]));
+	for(int i = 0; i < opts.warmup; ++i) uvm_extend();
+	uint64_t start = now_ns();
+	for(int i = 0; i < reps; ++i) {
+		uint64_t t0 = now_ns();
+		void *p = uvm_extend();
+		samples[i] = now_ns() - t0;
+		if(!p) exit(EXIT_FAILURE);
+	}
+	report(samples, reps, now_ns() - start);
+	free(samples);
+}/*}}}*/
+
+static void bench_fault(void)/*{{{*/
+{
+	/* first touch of a never-accessed page: zero fill and remap. */
+	int avail = opts.nblocks < MAXPAGES ? opts.nblocks : MAXPAGES;
+	int reps = clamp_reps(avail);
+	char **pages = extend_pages(opts.warmup + reps);
+	uint64_t *samples = malloc(reps * sizeof(samples[0]));
+	volatile char c;
+	for(int i = 0; i < opts.warmup; ++i) c = pages[i][0];
+	uint64_t start = now_ns();
+	for(int i = 0; i < reps; ++i) {
+		uint64_t t0 = now_ns();
+		c = pages[opts.warmup + i][0];
+		samples[i] = now_ns() - t0;
+	}
+	(void)c;
+	report(samples, reps, now_ns() - start);
+	free(samples);
+	free(pages);
+}/*}}}*/
+
+static void bench_evict(int write)/*{{{*/
+{
+	/* Cycling sequentially over a working set larger than physical
+	 * memory makes every access miss under second chance, so each
+	 * sample is a swap-in of a page that was written to disk. */
+	int avail = opts.nblocks < MAXPAGES ? opts.nblocks : MAXPAGES;
+	int wss = 2 * opts.nframes;
+	if(wss > avail) wss = avail;
+	if(wss <= opts.nframes) {
+		fprintf(stderr, "%s: need more blocks than frames\n", opts.name);
+		exit(EXIT_FAILURE);
+	}
+	char **pages = extend_pages(wss);
+	for(int i = 0; i < wss; ++i) pages[i][0] = 'a';
+
+	uint64_t *samples = malloc(opts.reps * sizeof(samples[0]));
+	volatile char c;
+	for(int i = 0; i < opts.warmup; ++i) c = pages[i % wss][0];
+	uint64_t start = now_ns();
+	for(int i = 0; i < opts.reps; ++i) {
+		char *p = pages[(opts.warmup + i) % wss];
+		uint64_t t0 = now_ns();
+		if(write) p[0] = 'b';
+		else c = p[0];
+		samples[i] = now_ns() - t0;
+	}
+	(void)c;
+	report(samples, opts.reps, now_ns() - start);
+	free(samples);
+	free(pages);
+}/*}}}*/
+
+static void bench_hotcold(void)/*{{{*/
+{
+	/* A hot set of NFRAMES/2 pages is read after every access to a
+	 * stream of cold pages that always miss.  Cold pages are never
+	 * re-referenced, so the clock evicts them, but it clears the
+	 * reference bits of the hot pages it passes on the way.  Hot
+	 * accesses are thus hits or faults that only re-reference a
+	 * resident page (see PAGER_SOFTREF in src/pager.c). */
+	int hot = opts.nframes / 2;
+	int cold = opts.nframes;
+	int avail = opts.nblocks < MAXPAGES ? opts.nblocks : MAXPAGES;
+	if(opts.nframes - hot < 2 || hot + cold > avail) {
+		fprintf(stderr, "%s: need at least 4 frames and more blocks\n",
+				opts.name);
+		exit(EXIT_FAILURE);
+	}
+	char **pages = extend_pages(hot + cold);
+	for(int i = 0; i < hot + cold; ++i) pages[i][0] = 'a';
+
+	int nsamples = opts.reps * hot;
+	uint64_t *samples = malloc(nsamples * sizeof(samples[0]));
+	volatile char c;
+	int n = 0;
+	uint64_t start = 0;
+	for(int i = 0; i < opts.warmup + opts.reps; ++i) {
+		if(i == opts.warmup) start = now_ns();
+		c = pages[hot + i % cold][0];
+		for(int j = 0; j < hot; ++j) {
+			uint64_t t0 = now_ns();
+			c = pages[j][0];
+			if(i >= opts.warmup) samples[n++] = now_ns() - t0;
+		}
+	}
+	(void)c;
+	report(samples, nsamples, now_ns() - start);
+	free(samples);
+	free(pages);
+}/*}}}*/
+
+static void bench_syslog(void)/*{{{*/
+{
+	int npages = (opts.bytes + PAGESIZE - 1) / PAGESIZE;
+	if(npages < 1) npages = 1;
+	if(npages > MAXPAGES || npages > opts.nblocks) {
+		fprintf(stderr, "%s: %d bytes do not fit\n", opts.name, opts.bytes);
+		exit(EXIT_FAILURE);
+	}
+	char **pages = extend_pages(npages);
+	for(int i = 0; i < npages; ++i) memset(pages[i], 'a', PAGESIZE);
+
+	uint64_t *samples = malloc(opts.reps * sizeof(samples[0]));
+	for(int i = 0; i < opts.warmup; ++i) uvm_syslog(pages[0], opts.bytes);
+	uint64_t start = now_ns();
+	for(int i = 0; i < opts.reps; ++i) {
+		uint64_t t0 = now_ns();
+		if(uvm_syslog(pages[0], opts.bytes)) exit(EXIT_FAILURE);
+		samples[i] = now_ns() - t0;
+	}
+	report(samples, opts.reps, now_ns() - start);
+	free(samples);
+	free(pages);
+}/*}}}*/
+
+static void bench_syslogv(int async)/*{{{*/
+{
+	/* REPS records of BYTES bytes each, submitted BATCH records per
+	 * call.  Every record in a batch is charged an equal share of the
+	 * call, so results compare directly against `syslog`. */
+	if(opts.bytes > (int)PAGESIZE) {
+		fprintf(stderr, "%s: records must fit a page\n", opts.name);
+		exit(EXIT_FAILURE);
+	}
+	char **pages = extend_pages(1);
+	memset(pages[0], 'a', PAGESIZE);
+	struct iovec *iov = malloc(opts.batch * sizeof(iov[0]));
+	for(int i = 0; i < opts.batch; ++i) {
+		iov[i].iov_base = pages[0];
+		iov[i].iov_len = opts.bytes;
+	}
+	int (*logv)(const struct iovec *, int) = async ? uvm_syslogv_async :
+			uvm_syslogv;
+
+	uint64_t *samples = malloc(opts.reps * sizeof(samples[0]));
+	for(int i = 0; i < opts.warmup; ++i) logv(iov, 1);
+	if(uvm_syslog_sync()) exit(EXIT_FAILURE);
+	uint64_t start = now_ns();
+	for(int i = 0; i < opts.reps; i += opts.batch) {
+		int n = opts.reps - i < opts.batch ? opts.reps - i : opts.batch;
+		uint64_t t0 = now_ns();
+		if(logv(iov, n)) exit(EXIT_FAILURE);
+		uint64_t share = (now_ns() - t0) / n;
+		for(int j = 0; j < n; ++j) samples[i+j] = share;
+	}
+	if(uvm_syslog_sync()) exit(EXIT_FAILURE);
+	report(samples, opts.reps, now_ns() - start);
+	free(samples);
+	free(iov);
+	free(pages);
+}/*}}}*/
+
+/****************************************************************************
+ * multi-process workloads
+ ***************************************************************************/
+static int fork_clients(void)/*{{{*/
+{
+	/* returns 0 in the parent and 1..CLIENTS-1 in the children */
+	for(int i = 1; i < opts.clients; ++i) {
+		pid_t pid = fork();
+		if(pid == -1) exit(EXIT_FAILURE);
+		if(pid == 0) return i;
+	}
+	return 0;
+}/*}}}*/
+
+static void wait_clients(void)/*{{{*/
+{
+	for(int i = 1; i < opts.clients; ++i) {
+		int status;
+		wait(&status);
+	}
+}/*}}}*/
+
+static void bench_macro(void)/*{{{*/
+{
+	/* test12's loop: `clients` processes each extend `pages` pages
+	 * and repeatedly write and syslog ten bytes of every page.
+	 * Per-operation latencies from all clients are collected in a
+	 * shared buffer and reported together. */
+	int per_client = opts.pages * opts.loops;
+	size_t bufsz = (size_t)opts.clients * per_client * sizeof(uint64_t);
+	uint64_t *samples = mmap(NULL, bufsz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(samples == MAP_FAILED) exit(EXIT_FAILURE);
+
+	uint64_t start = now_ns();
+	int id = fork_clients();
+
+	pid_t pid = getpid();
+	uvm_create();
+	char **pages = malloc(opts.pages * sizeof(pages[0]));
+	for(int i = 0; i < opts.pages; ++i) pages[i] = uvm_extend();
+
+	uint64_t *mine = samples + (size_t)id * per_client;
+	int n = 0;
+	for(int i = 0; i < opts.warmup + opts.loops; ++i) {
+		for(int j = 0; j < opts.pages; ++j) {
+			uint64_t t0 = now_ns();
+			if(pages[j]) {
+				sprintf(pages[j]+10, "%d", (int)pid);
+				uvm_syslog(pages[j]+10, 10);
+			} else {
+				int r = uvm_syslog((char *)UVM_BASEADDR +
+						j*PAGESIZE, 6);
+				assert(r == -1);
+			}
+			if(i >= opts.warmup) mine[n++] = now_ns() - t0;
+		}
+	}
+	if(id != 0) exit(EXIT_SUCCESS);
+
+	wait_clients();
+	uint64_t wall = now_ns() - start;
+	report(samples, opts.clients * per_client, wall);
+	munmap(samples, bufsz);
+	free(pages);
+}/*}}}*/
+
+static void bench_bandwidth(void)/*{{{*/
+{
+	/* `clients` processes each fault in `pages` pages and then time
+	 * full read passes over them, so samples measure the memory
+	 * bandwidth of resident frames rather than the pager.  Sizes
+	 * where all pages fit in physical memory are the interesting
+	 * ones; throughput times BYTES is the aggregate bandwidth. */
+	opts.bytes = opts.pages * PAGESIZE;
+	size_t bufsz = (size_t)opts.clients * opts.reps * sizeof(uint64_t);
+	uint64_t *samples = mmap(NULL, bufsz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(samples == MAP_FAILED) exit(EXIT_FAILURE);
+
+	uint64_t start = now_ns();
+	int id = fork_clients();
+
+	uvm_create();
+	char **pages = extend_pages(opts.pages);
+	for(int i = 0; i < opts.pages; ++i) memset(pages[i], 'a', PAGESIZE);
+
+	uint64_t *mine = samples + (size_t)id * opts.reps;
+	volatile uint64_t sum = 0;
+	for(int i = 0; i < opts.warmup + opts.reps; ++i) {
+		uint64_t t0 = now_ns();
+		uint64_t acc = 0;
+		for(int j = 0; j < opts.pages; ++j) {
+			const uint64_t *w = (const uint64_t *)pages[j];
+			for(size_t k = 0; k < PAGESIZE / sizeof(*w); ++k) acc += w[k];
+		}
+		sum += acc;
+		if(i >= opts.warmup) mine[i - opts.warmup] = now_ns() - t0;
+	}
+	(void)sum;
+	if(id != 0) exit(EXIT_SUCCESS);
+
+	wait_clients();
+	uint64_t wall = now_ns() - start;
+	report(samples, opts.clients * opts.reps, wall);
+	munmap(samples, bufsz);
+	free(pages);
+}/*}}}*/
+
+/****************************************************************************
+ * main() and argparse
+ ***************************************************************************/
+static void usage(int argc, char **argv)/*{{{*/
+{
+	printf("usage: %s [options] BENCH\n", argv[0]);
+	printf("\n");
+	printf("BENCH is one of:\n");
+	printf("  extend      latency of uvm_extend\n");
+	printf("  fault       first-touch (zero-fill) read fault\n");
+	printf("  readevict   read of a page previously swapped out\n");
+	printf("  writeevict  write to a page previously swapped out\n");
+	printf("  hotcold     re-reference fault on a resident page\n");
+	printf("  syslog      uvm_syslog of BYTES bytes\n");
+	printf("  syslogv     uvm_syslogv, BATCH records of BYTES bytes per call\n");
+	printf("  syslogasync uvm_syslogv_async, then one uvm_syslog_sync\n");
+	printf("  macro       test12-style loop over CLIENTS processes\n");
+	printf("  bandwidth   read passes over PAGES resident pages per process\n");
+	printf("\n");
+	printf("options:\n");
+	printf("  -f NFRAMES  frames in the running MMU [%d]\n", opts.nframes);
+	printf("  -b NBLOCKS  blocks in the running MMU [%d]\n", opts.nblocks);
+	printf("  -r REPS     measured repetitions [%d]\n", opts.reps);
+	printf("  -w WARMUP   unmeasured warm-up repetitions [%d]\n",
+			opts.warmup);
+	printf("  -n BYTES    syslog length [%d]\n", opts.bytes);
+	printf("  -k BATCH    records per call in syslogv [%d]\n", opts.batch);
+	printf("  -c CLIENTS  processes in macro and bandwidth [%d]\n",
+			opts.clients);
+	printf("  -p PAGES    pages per process in macro and bandwidth [%d]\n",
+			opts.pages);
+	printf("  -l LOOPS    loops over pages in macro [%d]\n", opts.loops);
+	printf("  -j          print JSON instead of CSV\n");
+	printf("  -H          print CSV header\n");
+	exit(EXIT_FAILURE);
+}/*}}}*/
+
+int main(int argc, char **argv)/*{{{*/
+{
+	PAGESIZE = sysconf(_SC_PAGESIZE);
+	MAXPAGES = (UVM_MAXADDR - UVM_BASEADDR + 1) / PAGESIZE;
+	int opt;
+	while((opt = getopt(argc, argv, "f:b:r:w:n:k:c:p:l:jH")) != -1) {
+		switch(opt) {
+		case 'f': opts.nframes = atoi(optarg); break;
+		case 'b': opts.nblocks = atoi(optarg); break;
+		case 'r': opts.reps = atoi(optarg); break;
+		case 'w': opts.warmup = atoi(optarg); break;
+		case 'n': opts.bytes = atoi(optarg); break;
+		case 'k': opts.batch = atoi(optarg); break;
+		case 'c': opts.clients = atoi(optarg); break;
+		case 'p': opts.pages = atoi(optarg); break;
+		case 'l': opts.loops = atoi(optarg); break;
+		case 'j': opts.fmt = BENCH_FMT_JSON; break;
+		case 'H': opts.header = 1; break;
+		default: usage(argc, argv);
+		}
+	}
+	if(optind != argc - 1) usage(argc, argv);
+	if(opts.reps < 1 || opts.warmup < 0 || opts.clients < 1 ||
+			opts.batch < 1)
+		usage(argc, argv);
+	opts.name = argv[optind];
+	if(strncmp(opts.name, "syslog", 6)) opts.bytes = 0;
+
+	if(!strcmp(opts.name, "macro")) {
+		bench_macro();
+		exit(EXIT_SUCCESS);
+	}
+	if(!strcmp(opts.name, "bandwidth")) {
+		bench_bandwidth();
+		exit(EXIT_SUCCESS);
+	}
+	if(opts.clients != 1) {
+		fprintf(stderr, "-c only applies to macro and bandwidth\n");
+		opts.clients = 1;
+	}
+	uvm_create();
+	if(!strcmp(opts.name, "extend")) bench_extend();
+	else if(!strcmp(opts.name, "fault")) bench_fault();
+	else if(!strcmp(opts.name, "readevict")) bench_evict(0);
+	else if(!strcmp(opts.name, "writeevict")) bench_evict(1);
+	else if(!strcmp(opts.name, "hotcold")) bench_hotcold();
+	else if(!strcmp(opts.name, "syslog")) bench_syslog();
+	else if(!strcmp(opts.name, "syslogv")) bench_syslogv(0);
+	else if(!strcmp(opts.name, "syslogasync")) bench_syslogv(1);
+	else usage(argc, argv);
+	exit(EXIT_SUCCESS);
+}/*}}}*/
@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+/* Stress benchmark for the lock-free pool allocator.  Each thread
+ * repeatedly allocates up to HOLD identifiers and frees them in
+ * allocation order.  An owner table detects identifiers handed out
+ * twice.  The same workload runs against a mutex-protected bitmap
+ * for comparison. */
+
+#define MODE_STRICT 0
+#define MODE_RELAXED 1
+#define MODE_MUTEX 2
+
+static const char *mode_names[] = {"strict", "relaxed", "mutex"};
+
+struct bench {/*{{{*/
+	int mode;
+	int size;
+	int hold;
+	int iters;
+	struct pool *pool;
+	pthread_mutex_t mutex;
+	char *bitmap;
+	int *owner;
+};/*}}}*/
+
+struct worker {/*{{{*/
+	struct bench *b;
+	int id;
+	pthread_t thread;
+	long failed;
+};/*}}}*/
+
+static uint64_t now_ns(void)/*{{{*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}/*}}}*/
+
+static int bench_alloc(struct bench *b, int hint)/*{{{*/
+{
+	switch(b->mode) {
+	case MODE_STRICT:
+		return pool_alloc(b->pool);
+	case MODE_RELAXED:
+		return pool_alloc_near(b->pool, hint);
+	default:
+		pthread_mutex_lock(&b->mutex);
+		for(int i = 0; i < b->size; ++i) {
+			if(b->bitmap[i]) continue;
+			b->bitmap[i] = 1;
+			pthread_mutex_unlock(&b->mutex);
+			return i;
+		}
+		pthread_mutex_unlock(&b->mutex);
+		return -1;
+	}
+}/*}}}*/
+
+static void bench_free(struct bench *b, int id)/*{{{*/
+{
+	if(b->mode != MODE_MUTEX) {
+		pool_free(b->pool, id);
+		return;
+	}
+	pthread_mutex_lock(&b->mutex);
+	b->bitmap[id] = 0;
+	pthread_mutex_unlock(&b->mutex);
+}/*}}}*/
+
+static void * worker_thread(void *vw)/*{{{*/
+{
+	struct worker *w = vw;
+	struct bench *b = w->b;
+	int *held = malloc(b->hold * sizeof(held[0]));
+	int hint = (int)((long)w->id * b->size / 64);
+	for(int i = 0; i < b->iters; ++i) {
+		int n = 0;
+		while(n < b->hold) {
+			int id = bench_alloc(b, hint);
+			if(id == -1) {
+				w->failed++;
+				break;
+			}
+			if(__atomic_exchange_n(&b->owner[id], w->id + 1,
+						__ATOMIC_RELAXED) != 0) {
+				fprintf(stderr, "identifier %d allocated twice\n", id);
+				exit(EXIT_FAILURE);
+			}
+			held[n++] = id;
+			hint = id + 1;
+		}
+		for(int j = 0; j < n; ++j) {
+			__atomic_store_n(&b->owner[held[j]], 0, __ATOMIC_RELAXED);
+			bench_free(b, held[j]);
+		}
+	}
+	free(held);
+	return NULL;
+}/*}}}*/
+
+static void run(int mode, int nthreads, int size, int hold, int iters)/*{{{*/
+{
+	struct bench b;
+	b.mode = mode;
+	b.size = size;
+	b.hold = hold;
+	b.iters = iters;
+	b.pool = pool_create(size);
+	pthread_mutex_init(&b.mutex, NULL);
+	b.bitmap = calloc(size, sizeof(b.bitmap[0]));
+	b.owner = calloc(size, sizeof(b.owner[0]));
+	if(!b.pool || !b.bitmap || !b.owner) exit(EXIT_FAILURE);
+
+	struct worker *ws = calloc(nthreads, sizeof(ws[0]));
+	uint64_t start = now_ns();
+	for(int i = 0; i < nthreads; ++i) {
+		ws[i].b = &b;
+		ws[i].id = i;
+		pthread_create(&ws[i].thread, NULL, worker_thread, &ws[i]);
+	}
+	long failed = 0;
+	for(int i = 0; i < nthreads; ++i) {
+		pthread_join(ws[i].thread, NULL);
+		failed += ws[i].failed;
+	}
+	uint64_t wall = now_ns() - start;
+	if(mode != MODE_MUTEX && pool_nfree(b.pool) != size) {
+		fprintf(stderr, "pool leaked %d identifiers\n",
+				size - pool_nfree(b.pool));
+		exit(EXIT_FAILURE);
+	}
+	double ops = 2.0 * nthreads * iters * hold;
+	printf("%s,%d,%d,%d,%.1f,%.1f,%ld\n", mode_names[mode], nthreads, size,
+			hold, ops * 1e9 / wall, (double)wall / ops, failed);
+
+	free(ws);
+	free(b.owner);
+	free(b.bitmap);
+	pthread_mutex_destroy(&b.mutex);
+	pool_destroy(b.pool);
+}/*}}}*/
+
+int main(int argc, char **argv)/*{{{*/
+{
+	int size = 1024;
+	int hold = 8;
+	int iters = 100000;
+	int maxthreads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while((opt = getopt(argc, argv, "n:k:i:t:")) != -1) {
+		switch(opt) {
+		case 'n': size = atoi(optarg); break;
+		case 'k': hold = atoi(optarg); break;
+		case 'i': iters = atoi(optarg); break;
+		case 't': maxthreads = atoi(optarg); break;
+		default:
+			printf("usage: %s [-n SIZE] [-k HOLD] [-i ITERS] "
+					"[-t MAXTHREADS]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(size < 1 || hold < 1 || iters < 1 || maxthreads < 1) {
+		exit(EXIT_FAILURE);
+	}
+
+	printf("mode,threads,size,hold,ops_per_sec,ns_per_op,failed\n");
+	for(int t = 1; t <= maxthreads; t *= 2) {
+		for(int mode = MODE_STRICT; mode <= MODE_MUTEX; ++mode) {
+			run(mode, t, size, hold, iters);
+		}
+	}
+	exit(EXIT_SUCCESS);
+}/*}}}*/
@@ -0,0 +1,107 @@
+#include <sys/mman.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Microbenchmark for the client side of a REMAP_REP.  A pmem-like
+ * file of FRAMES frames is mapped page by page into a window of
+ * PAGES pages, the way uvm_proto_remap_rep installs frames, and each
+ * remap is followed by a read so the page-table entry is populated.
+ * The `unmap` mode is the old munmap+mmap+mprotect sequence and the
+ * `fixed` mode is a single mmap(MAP_FIXED).  Syscalls are counted
+ * as they are issued by each sequence. */
+
+#define MODE_UNMAP 0
+#define MODE_FIXED 1
+
+static const char *mode_names[] = {"unmap", "fixed"};
+static size_t PAGESIZE = 0;
+static long nsyscalls = 0;
+
+static uint64_t now_ns(void)/*{{{*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}/*}}}*/
+
+static void remap(int mode, int fd, char *addr, off_t off, int prot)/*{{{*/
+{
+	void *r;
+	if(mode == MODE_UNMAP) {
+		munmap(addr, PAGESIZE);
+		r = mmap(addr, PAGESIZE, prot, MAP_SHARED, fd, off);
+		mprotect(addr, PAGESIZE, prot);
+		nsyscalls += 3;
+	} else {
+		r = mmap(addr, PAGESIZE, prot, MAP_SHARED | MAP_FIXED, fd, off);
+		nsyscalls += 1;
+	}
+	if(r != addr) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+}/*}}}*/
+
+static void run(int mode, int fd, int frames, int pages, int reps)/*{{{*/
+{
+	/* reserve the window so the old sequence's hint is honored */
+	char *base = mmap(NULL, pages * PAGESIZE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED) exit(EXIT_FAILURE);
+
+	nsyscalls = 0;
+	volatile char c = 0;
+	uint64_t start = now_ns();
+	for(int i = 0; i < reps; ++i) {
+		char *addr = base + (size_t)(i % pages) * PAGESIZE;
+		off_t off = (off_t)((i * 7) % frames) * PAGESIZE;
+		int prot = (i & 1) ? PROT_READ | PROT_WRITE : PROT_READ;
+		remap(mode, fd, addr, off, prot);
+		c += addr[0];
+	}
+	uint64_t wall = now_ns() - start;
+	(void)c;
+	printf("%s,%d,%d,%d,%.2f,%.1f\n", mode_names[mode], frames, pages,
+			reps, (double)nsyscalls / reps, (double)wall / reps);
+	munmap(base, pages * PAGESIZE);
+}/*}}}*/
+
+int main(int argc, char **argv)/*{{{*/
+{
+	PAGESIZE = sysconf(_SC_PAGESIZE);
+	int frames = 64;
+	int pages = 256;
+	int reps = 100000;
+	int opt;
+	while((opt = getopt(argc, argv, "f:p:r:")) != -1) {
+		switch(opt) {
+		case 'f': frames = atoi(optarg); break;
+		case 'p': pages = atoi(optarg); break;
+		case 'r': reps = atoi(optarg); break;
+		default:
+			printf("usage: %s [-f FRAMES] [-p PAGES] [-r REPS]\n",
+					argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(frames < 1 || pages < 1 || reps < 1) exit(EXIT_FAILURE);
+
+	char fn[] = "mmu.remapbench.XXXXXX";
+	int fd = mkstemp(fn);
+	if(fd == -1) exit(EXIT_FAILURE);
+	unlink(fn);
+	if(ftruncate(fd, (off_t)frames * PAGESIZE) == -1) exit(EXIT_FAILURE);
+
+	printf("mode,frames,pages,reps,syscalls_per_remap,ns_per_remap\n");
+	for(int mode = MODE_UNMAP; mode <= MODE_FIXED; ++mode) {
+		run(mode, fd, frames, pages, reps);
+	}
+	close(fd);
+	exit(EXIT_SUCCESS);
+}/*}}}*/
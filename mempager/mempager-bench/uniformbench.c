@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uniform.h"
+
+/* Microbenchmark for the uniform page detection kernels in
+ * `src/uniform.c`.  Each kernel the CPU supports checks pages whose
+ * contents cost it the most (uniform, or differing only in the last
+ * byte) and the least (differing in the first bytes, or random).
+ * Pages cycle through a working set larger than the last-level cache
+ * by default, as frames picked by the clock are usually cold. */
+
+#define PATTERN_UNIFORM 0
+#define PATTERN_LAST 1
+#define PATTERN_FIRST 2
+#define PATTERN_RANDOM 3
+
+static const char *pattern_names[] = {"uniform", "lastbyte", "firstbyte",
+		"random"};
+static const char *impl_names[] = {"avx2", "sse2", "scalar"};
+
+static uint64_t now_ns(void)/*{{{*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}/*}}}*/
+
+static void fill_pages(char *mem, int npages, size_t pagesz, int pattern)/*{{{*/
+{
+	memset(mem, '0', npages * pagesz);
+	for(int i = 0; i < npages; ++i) {
+		char *page = mem + i * pagesz;
+		switch(pattern) {
+		case PATTERN_LAST:
+			page[pagesz - 1] = '1';
+			break;
+		case PATTERN_FIRST:
+			sprintf(page, "page%d", i);
+			break;
+		case PATTERN_RANDOM:
+			for(size_t j = 0; j < pagesz; ++j) page[j] = (char)rand();
+			break;
+		}
+	}
+}/*}}}*/
+
+static void run(const char *impl, int pattern, char *mem, int npages,/*{{{*/
+		size_t pagesz, int iters)
+{
+	int expect = pattern == PATTERN_UNIFORM ? '0' : -1;
+	uint64_t start = now_ns();
+	long found = 0;
+	for(int it = 0; it < iters; ++it) {
+		for(int i = 0; i < npages; ++i) {
+			int r = uniform_byte(mem + i * pagesz, pagesz);
+			if(r != expect) {
+				fprintf(stderr, "%s: page %d of %s pattern: got %d\n",
+						impl, i, pattern_names[pattern], r);
+				exit(EXIT_FAILURE);
+			}
+			found += r != -1;
+		}
+	}
+	uint64_t wall = now_ns() - start;
+	double pages = (double)iters * npages;
+	printf("%s,%s,%zu,%d,%.1f,%.2f,%ld\n", impl, pattern_names[pattern],
+			pagesz, npages, (double)wall / pages,
+			pages * pagesz / wall, found);
+}/*}}}*/
+
+int main(int argc, char **argv)/*{{{*/
+{
+	int npages = 16384;
+	int iters = 20;
+	int opt;
+	while((opt = getopt(argc, argv, "p:i:")) != -1) {
+		switch(opt) {
+		case 'p': npages = atoi(optarg); break;
+		case 'i': iters = atoi(optarg); break;
+		default:
+			printf("usage: %s [-p PAGES] [-i ITERS]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(npages < 1 || iters < 1) exit(EXIT_FAILURE);
+
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	void *mem;
+	if(posix_memalign(&mem, pagesz, npages * pagesz)) exit(EXIT_FAILURE);
+
+	printf("impl,pattern,page_bytes,pages,ns_per_page,bytes_per_ns,"
+			"uniform\n");
+	for(int pattern = PATTERN_UNIFORM; pattern <= PATTERN_RANDOM;
+			++pattern) {
+		fill_pages(mem, npages, pagesz, pattern);
+		for(size_t i = 0; i < sizeof(impl_names) / sizeof(impl_names[0]);
+				++i) {
+			if(uniform_select(impl_names[i])) continue;
+			run(impl_names[i], pattern, mem, npages, pagesz, iters);
+		}
+	}
+	free(mem);
+	exit(EXIT_SUCCESS);
+}/*}}}*/
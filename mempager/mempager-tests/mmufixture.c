@@ -0,0 +1,74 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmufixture.h"
+
+char tmp_dir[32];
+char sock_path[64];
+char err_path[64];
+char out_path[64];
+pid_t mmu_pid = -1;
+static pid_t main_pid;
+
+static void cleanup(void) {
+	if(getpid() != main_pid) return; /* a client */
+	/* runs after uvm_exit if registered before uvm_create */
+	if(mmu_pid != -1) stop_mmu(SIGINT);
+	char cmd[96];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", tmp_dir);
+	if(system(cmd) != 0) exit(EXIT_FAILURE);
+}
+
+void fixture_init(const char *name) {
+	snprintf(tmp_dir, sizeof(tmp_dir), "mmu.%s.XXXXXX", name);
+	if(!mkdtemp(tmp_dir)) exit(EXIT_FAILURE);
+	snprintf(sock_path, sizeof(sock_path), "%s/mmu.sock", tmp_dir);
+	snprintf(err_path, sizeof(err_path), "%s/mmu.err", tmp_dir);
+	snprintf(out_path, sizeof(out_path), "%s/mmu.out", tmp_dir);
+	setenv("MMU_SOCK", sock_path, 1);
+	main_pid = getpid();
+	atexit(cleanup);
+}
+
+void start_mmu(char *const env[], char *const args[], int flags) {
+	int fds[2];
+	if(pipe(fds) == -1) exit(EXIT_FAILURE);
+	pid_t pid = fork();
+	if(pid == 0) {
+		dup2(fds[1], 3);
+		if(!freopen(flags & FIXTURE_STDOUT ? out_path : "/dev/null", "w",
+					stdout))
+			exit(EXIT_FAILURE);
+		if(flags & FIXTURE_STDERR && !freopen(err_path, "w", stderr))
+			exit(EXIT_FAILURE);
+		setenv("MMU_READY_FD", "3", 1);
+		for(int i = 0; env && env[i]; ++i) putenv(env[i]);
+		int n = 0;
+		while(args[n]) n++;
+		char *argv[n + 2];
+		argv[0] = "mmu";
+		memcpy(argv + 1, args, (n + 1) * sizeof(argv[0]));
+		execv("./bin/mmu", argv);
+		exit(EXIT_FAILURE);
+	}
+	close(fds[1]);
+	char buf[8] = "";
+	if(read(fds[0], buf, sizeof(buf) - 1) <= 0) exit(EXIT_FAILURE);
+	close(fds[0]);
+	assert(strncmp(buf, "READY", 5) == 0);
+	mmu_pid = pid;
+}
+
+void stop_mmu(int signum) {
+	kill(mmu_pid, signum);
+	waitpid(mmu_pid, NULL, 0);
+	mmu_pid = -1;
+	unlink(sock_path);
+}
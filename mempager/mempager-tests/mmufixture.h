@@ -0,0 +1,31 @@
+#ifndef __MMUFIXTURE_HEADER__
+#define __MMUFIXTURE_HEADER__
+
+#include <sys/types.h>
+
+// For tests that run their own MMUs instead of the one grade.sh starts.
+// `fixture_init` makes a temporary directory `mmu.<name>.XXXXXX` for
+// the MMU's socket and output, points MMU_SOCK at the socket, and
+// registers an atexit handler that stops the MMU and removes the
+// directory when the process that called it exits.
+extern char tmp_dir[32];
+extern char sock_path[64];
+extern char err_path[64]; // the MMU's stderr with FIXTURE_STDERR
+extern char out_path[64]; // the MMU's stdout with FIXTURE_STDOUT
+extern pid_t mmu_pid; // -1 if not running
+
+#define FIXTURE_STDERR 0x1
+#define FIXTURE_STDOUT 0x2
+
+void fixture_init(const char *name);
+
+// `start_mmu` runs ./bin/mmu with the NULL-terminated `args`, after
+// setting the NAME=value strings in the NULL-terminated `env`, and
+// waits until it accepts connections.  Its stdout goes to /dev/null
+// unless `flags` has FIXTURE_STDOUT; its stderr is inherited unless
+// `flags` has FIXTURE_STDERR.  `stop_mmu` sends `signum` to the MMU
+// and waits for it to exit.
+void start_mmu(char *const env[], char *const args[], int flags);
+void stop_mmu(int signum);
+
+#endif
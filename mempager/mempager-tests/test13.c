@@ -0,0 +1,76 @@
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// syslogv
+// syslogv with invalid records
+// syslogv_async and syslog_sync
+// async failures reported by the next syslogv
+// batches larger than MMU_PROTO_SYSLOG_BATCH_MAX
+int num_pages = 6;
+int num_recs = 100;
+size_t PAGESIZE = 0;
+int main(void) {
+	PAGESIZE = sysconf(_SC_PAGESIZE);
+	uvm_create();
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d", i);
+	}
+
+	struct iovec iov[num_recs];
+	for(int i = 0; i < num_pages; ++i) {
+		iov[i].iov_base = pages[i];
+		iov[i].iov_len = 5;
+	}
+	int r = uvm_syslogv(iov, num_pages);
+	assert(r == 0);
+
+	/* one record past the last page */
+	iov[num_pages].iov_base = pages[num_pages-1] + PAGESIZE;
+	iov[num_pages].iov_len = 6;
+	r = uvm_syslogv(iov, num_pages+1);
+	assert(r == -1);
+	assert(errno == EINVAL);
+
+	r = uvm_syslogv_async(iov, num_pages);
+	assert(r == 0);
+	r = uvm_syslog_sync();
+	assert(r == 0);
+	r = uvm_syslogv_async(iov, num_pages+1);
+	assert(r == 0);
+	r = uvm_syslog_sync();
+	assert(r == -1);
+	assert(errno == EINVAL);
+	r = uvm_syslog_sync();
+	assert(r == 0);
+	/* an async failure is reported by the next syslogv */
+	r = uvm_syslogv_async(iov, num_pages+1);
+	assert(r == 0);
+	r = uvm_syslogv(iov, num_pages);
+	assert(r == -1);
+	assert(errno == EINVAL);
+	r = uvm_syslog_sync();
+	assert(r == 0);
+
+	for(int i = 0; i < num_recs; ++i) {
+		iov[i].iov_base = pages[i % num_pages];
+		iov[i].iov_len = 5;
+	}
+	r = uvm_syslogv(iov, num_recs);
+	assert(r == 0);
+	r = uvm_syslogv(iov, 0);
+	assert(r == 0);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
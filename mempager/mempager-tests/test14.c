@@ -0,0 +1,70 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMUs with a checkpoint directory
+// MMU checkpoints and exits on SIGINT, client resumes on a new MMU
+// MMU checkpoints on SIGUSR1 and crashes, client resumes from it
+int num_pages = 6;
+char *mmu_args[] = {"-c", NULL, "-d", NULL, "4", "8", NULL};
+
+void check_pages(char **pages, int round) {
+	char buf[32];
+	for(int i = 0; i < num_pages; ++i) {
+		sprintf(buf, "page%d round%d", i, round);
+		assert(strcmp(pages[i], buf) == 0);
+	}
+}
+
+// `state` is replaced by a rename once a checkpoint is synced
+ino_t state_ino(void) {
+	char path[64];
+	snprintf(path, sizeof(path), "%s/state", tmp_dir);
+	struct stat st;
+	return stat(path, &st) == -1 ? 0 : st.st_ino;
+}
+
+int main(void) {
+	/* stops the MMU after uvm_exit */
+	fixture_init("test14");
+	mmu_args[1] = mmu_args[3] = tmp_dir;
+	setenv("UVM_RECONNECT", "10", 1);
+	start_mmu(NULL, mmu_args, 0);
+	uvm_create();
+
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d round0", i);
+	}
+
+	stop_mmu(SIGINT);
+	start_mmu(NULL, mmu_args, 0);
+	check_pages(pages, 0);
+	for(int i = 0; i < num_pages; ++i)
+		sprintf(pages[i], "page%d round1", i);
+	assert(uvm_syslog(pages[0], 13) == 0);
+
+	ino_t prev = state_ino();
+	kill(mmu_pid, SIGUSR1);
+	while(state_ino() == prev) usleep(1000);
+	stop_mmu(SIGKILL);
+	start_mmu(NULL, mmu_args, 0);
+	check_pages(pages, 1);
+	assert(uvm_syslog(pages[num_pages-1], 13) == 0);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
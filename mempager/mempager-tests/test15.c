@@ -0,0 +1,64 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// uvm_fork shares pages, some resident and some on disk
+// writes in the child are not seen by the parent and vice versa
+// uvm_fork fails with ENOSPC when blocks cannot back a copy
+int num_pages = 6;
+int num_frames = 4;
+
+void check_pages(char **pages, const char *who, int n) {
+	char buf[32];
+	for(int i = 0; i < n; ++i) {
+		sprintf(buf, "%s%d", who, i);
+		assert(strcmp(pages[i], buf) == 0);
+	}
+}
+
+int main(void) {
+	uvm_create();
+	char **pages = malloc(2 * num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "parent%d", i);
+	}
+
+	pid_t pid = uvm_fork();
+	assert(pid != -1);
+	if(pid == 0) {
+		check_pages(pages, "parent", num_pages);
+		for(int i = 0; i < num_pages; i += 2)
+			sprintf(pages[i], "child%d", i);
+		for(int i = 0; i < num_pages; ++i)
+			assert(strncmp(pages[i], i % 2 ? "parent" : "child", 5) == 0);
+		uvm_syslog(pages[0], 6);
+		exit(EXIT_SUCCESS);
+	}
+	/* the child runs while we touch the same pages */
+	for(int i = num_frames; i < num_pages; ++i)
+		sprintf(pages[i], "parent%d", i);
+	int status;
+	waitpid(pid, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	check_pages(pages, "parent", num_pages);
+	uvm_syslog(pages[0], 7);
+
+	/* 12 pages with 16 blocks leave no room for a copy */
+	for(int i = num_pages; i < 2 * num_pages; ++i)
+		pages[i] = uvm_extend();
+	pid = uvm_fork();
+	assert(pid == -1 && errno == ENOSPC);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
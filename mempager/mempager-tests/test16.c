@@ -0,0 +1,75 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// a segment mapped twice shows the same contents at both addresses
+// private pages evict the segment, which is read back once
+// a uvm_fork child shares the segment instead of copying it
+int num_pages = 4;
+
+void check_pages(char **pages, const char *who, int n) {
+	char buf[32];
+	for(int i = 0; i < n; ++i) {
+		sprintf(buf, "%s%d", who, i);
+		assert(strcmp(pages[i], buf) == 0);
+	}
+}
+
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *shm[num_pages], *alias[num_pages], *priv[num_pages];
+	int id = -1;
+	char *base = uvm_shm_create(num_pages, &id);
+	assert(base != NULL && id >= 0);
+	for(int i = 0; i < num_pages; ++i) {
+		shm[i] = base + i * pagesz;
+		sprintf(shm[i], "shm%d", i);
+	}
+	for(int i = 0; i < num_pages; ++i) {
+		priv[i] = uvm_extend();
+		sprintf(priv[i], "priv%d", i);
+	}
+
+	base = uvm_shm_attach(id);
+	assert(base != NULL && base > priv[num_pages-1]);
+	for(int i = 0; i < num_pages; ++i)
+		alias[i] = base + i * pagesz;
+	check_pages(alias, "shm", num_pages);
+	sprintf(alias[1], "alias1");
+	assert(strcmp(shm[1], "alias1") == 0);
+	sprintf(shm[1], "shm1");
+
+	pid_t pid = uvm_fork();
+	assert(pid != -1);
+	if(pid == 0) {
+		check_pages(shm, "shm", num_pages);
+		for(int i = 0; i < num_pages; i += 2)
+			sprintf(shm[i], "child%d", i);
+		sprintf(priv[0], "child0");
+		uvm_syslog(alias[0], 6);
+		exit(EXIT_SUCCESS);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	for(int i = 0; i < num_pages; ++i)
+		assert(strncmp(alias[i], i % 2 ? "shm" : "child", 3) == 0);
+	check_pages(priv, "priv", num_pages);
+	uvm_syslog(alias[2], 6);
+
+	assert(uvm_shm_attach(id + 1) == NULL && errno == EINVAL);
+	assert(uvm_shm_create(0, &id) == NULL && errno == EINVAL);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
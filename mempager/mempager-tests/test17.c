@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// dropped and released pages read back zero-filled
+// released pages at the end return their blocks and addresses
+// advice hints are accepted and do not change page contents
+int num_pages = 8;
+
+int zeroed(const char *page) {
+	return strncmp(page, "00000000", 8) == 0;
+}
+
+void check_pages(char **pages, int first, int last) {
+	char buf[32];
+	for(int i = first; i < last; ++i) {
+		sprintf(buf, "page%d", i);
+		assert(strcmp(pages[i], buf) == 0);
+	}
+}
+
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *pages[num_pages];
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d", i);
+	}
+	assert(uvm_extend() == NULL);
+
+	/* page 0 is on disk and page 7 is resident */
+	assert(uvm_advise(pages[0], 1, UVM_ADV_DONTNEED) == 0);
+	assert(uvm_advise(pages[7], pagesz, UVM_ADV_DONTNEED) == 0);
+	assert(zeroed(pages[0]) && zeroed(pages[7]));
+	sprintf(pages[0], "page0");
+	sprintf(pages[7], "page7");
+
+	assert(uvm_release(pages[3], 1) == 0);
+	assert(zeroed(pages[3]));
+	sprintf(pages[3], "page3");
+
+	assert(uvm_release(pages[6], 2) == 0);
+	for(int i = 6; i < num_pages; ++i) {
+		assert(uvm_extend() == pages[i]);
+		assert(zeroed(pages[i]));
+		sprintf(pages[i], "page%d", i);
+	}
+	assert(uvm_extend() == NULL);
+
+	assert(uvm_advise(pages[0], num_pages * pagesz,
+				UVM_ADV_SEQUENTIAL) == 0);
+	check_pages(pages, 0, num_pages);
+	assert(uvm_advise(pages[2], 2 * pagesz, UVM_ADV_WILLNEED) == 0);
+	assert(uvm_advise(pages[0], num_pages * pagesz, UVM_ADV_RANDOM) == 0);
+	check_pages(pages, 0, num_pages);
+	uvm_syslog(pages[2], 5);
+
+	assert(uvm_advise(pages[0] + 1, 1, UVM_ADV_NORMAL) == -1 &&
+			errno == EINVAL);
+	assert(uvm_advise(pages[0], 1, 99) == -1 && errno == EINVAL);
+	assert(uvm_release(pages[7], 2) == -1 && errno == EINVAL);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
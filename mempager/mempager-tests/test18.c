@@ -0,0 +1,73 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMU with free-frame watermarks
+// pages survive eviction by the background reclaim thread
+// MMU reports the frames reclaimed in the background on SIGINT
+int num_pages = 20;
+int rounds = 3;
+char *mmu_env[] = {"PAGER_WMARK_LOW=2", "PAGER_WMARK_HIGH=4", NULL};
+char *mmu_args[] = {"8", "32", NULL};
+
+void run_client(void) {
+	uvm_create();
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d round0", i);
+	}
+	char buf[32];
+	for(int r = 1; r < rounds; ++r) {
+		for(int i = 0; i < num_pages; ++i) {
+			sprintf(buf, "page%d round%d", i, r - 1);
+			assert(strcmp(pages[i], buf) == 0);
+			sprintf(pages[i], "page%d round%d", i, r);
+		}
+	}
+	assert(uvm_syslog(pages[num_pages-1], 13) == 0);
+	exit(EXIT_SUCCESS);
+}
+
+int main(void) {
+	fixture_init("test18");
+	start_mmu(mmu_env, mmu_args, FIXTURE_STDERR);
+
+	/* the client exits before the MMU goes away */
+	pid_t pid = fork();
+	if(pid == 0) run_client();
+	int status;
+	waitpid(pid, &status, 0);
+	stop_mmu(SIGINT);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	FILE *fp = fopen(err_path, "r");
+	assert(fp);
+	int low = 0, high = 0;
+	long wakeups = 0, frames = 0, written = 0, direct = 0;
+	char line[256];
+	int found = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "reclaim: watermarks %d/%d, %ld wakeups, "
+				"%ld frames freed, %ld written, %ld direct", &low, &high,
+				&wakeups, &frames, &written, &direct) == 6)
+			found = 1;
+	}
+	fclose(fp);
+	assert(found && low == 2 && high == 4);
+	assert(wakeups > 0 && frames > 0 && written > 0);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
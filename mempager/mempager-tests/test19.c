@@ -0,0 +1,93 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// regions are placed at the hint or top-down, above the break
+// region pages are paged out and back in like heap pages
+// unmapped pages read back zero-filled when mapped again
+// bad hints are relocated; bad ranges and sizes are rejected
+int num_heap = 3;
+int num_top = 4;
+
+int zeroed(const char *page) {
+	return strncmp(page, "00000000", 8) == 0;
+}
+
+void check_page(char *page, int i) {
+	char buf[32];
+	sprintf(buf, "page%d", i);
+	assert(strcmp(page, buf) == 0);
+}
+
+int main(void) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char *pages[16];
+	for(int i = 0; i < num_heap - 1; ++i)
+		pages[i] = uvm_extend();
+
+	char *hint = (char *)(UVM_MAXADDR + 1 - num_top * pagesz);
+	char *top = uvm_map(hint, num_top);
+	assert(top == hint);
+	char *below = uvm_map(NULL, 2);
+	assert(below == top - 2 * pagesz);
+	pages[num_heap - 1] = uvm_extend();
+	assert(pages[num_heap - 1] == pages[0] + (num_heap - 1) * pagesz);
+
+	for(int i = 0; i < num_top; ++i)
+		pages[num_heap + i] = top + i * pagesz;
+	pages[num_heap + num_top] = below;
+	pages[num_heap + num_top + 1] = below + pagesz;
+	int n = num_heap + num_top + 2;
+	for(int i = 0; i < n; ++i)
+		sprintf(pages[i], "page%d", i);
+	for(int i = 0; i < n; ++i)
+		check_page(pages[i], i);
+	uvm_syslog(top, 5);
+
+	/* a hole in the middle of the top region */
+	assert(uvm_unmap(top + pagesz, 2) == 0);
+	assert(uvm_unmap(top + pagesz, 1) == -1 && errno == EINVAL);
+	assert(uvm_unmap(below, 3) == -1 && errno == EINVAL);
+	char *hole = uvm_map(top + pagesz, 2);
+	assert(hole == top + pagesz);
+	assert(zeroed(hole) && zeroed(hole + pagesz));
+	check_page(top, num_heap);
+	check_page(top + 3 * pagesz, num_heap + 3);
+
+	/* taken hints are ignored */
+	char *moved = uvm_map(top, 2);
+	assert(moved && moved != top && moved < below);
+	sprintf(moved, "moved");
+
+	pid_t pid = uvm_fork();
+	assert(pid != -1);
+	if(pid == 0) {
+		check_page(below, num_heap + num_top);
+		assert(strcmp(moved, "moved") == 0);
+		sprintf(below, "child");
+		exit(EXIT_SUCCESS);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	check_page(below, num_heap + num_top);
+
+	assert(uvm_map(NULL, 0) == NULL && errno == EINVAL);
+	assert(uvm_map(top + 1, 1) == NULL && errno == EINVAL);
+	assert(uvm_map(NULL, 1024) == NULL && errno == ENOMEM);
+	assert(uvm_map(NULL, 64) == NULL && errno == ENOSPC);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
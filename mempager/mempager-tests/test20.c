@@ -0,0 +1,84 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMUs with swap readahead and free-frame watermarks
+// sequential scans over swapped pages hit pages read ahead
+// pages advised UVM_ADV_RANDOM are not read ahead
+// MMU reports readahead reads and hits on SIGINT
+int num_pages = 20;
+int rounds = 3;
+char *mmu_env[] = {"PAGER_WMARK_LOW=2", "PAGER_WMARK_HIGH=6",
+		"PAGER_SWAP_READAHEAD=4", NULL};
+char *mmu_args[] = {"8", "32", NULL};
+
+void run_client(int random) {
+	uvm_create();
+	long pagesz = sysconf(_SC_PAGESIZE);
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "page%d round0", i);
+	}
+	if(random)
+		assert(uvm_advise(pages[0], num_pages * pagesz,
+					UVM_ADV_RANDOM) == 0);
+	char buf[32];
+	for(int r = 1; r < rounds; ++r) {
+		for(int i = 0; i < num_pages; ++i) {
+			sprintf(buf, "page%d round%d", i, r - 1);
+			assert(strcmp(pages[i], buf) == 0);
+			sprintf(pages[i], "page%d round%d", i, r);
+		}
+	}
+	assert(uvm_syslog(pages[num_pages-1], 13) == 0);
+	exit(EXIT_SUCCESS);
+}
+
+void run(int random, long *reads, long *hits) {
+	start_mmu(mmu_env, mmu_args, FIXTURE_STDERR);
+	/* the client exits before the MMU goes away */
+	pid_t pid = fork();
+	if(pid == 0) run_client(random);
+	int status;
+	waitpid(pid, &status, 0);
+	stop_mmu(SIGINT);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	FILE *fp = fopen(err_path, "r");
+	assert(fp);
+	int window = 0;
+	char line[256];
+	int found = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "readahead: window %d, %ld pages read, %ld hits",
+				&window, reads, hits) == 3)
+			found = 1;
+	}
+	fclose(fp);
+	assert(found && window == 4);
+}
+
+int main(void) {
+	fixture_init("test20");
+
+	long reads, hits;
+	run(0, &reads, &hits);
+	assert(reads > 0 && hits > 0 && hits <= reads);
+	run(1, &reads, &hits);
+	assert(reads == 0 && hits == 0);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
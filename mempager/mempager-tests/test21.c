@@ -0,0 +1,98 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMU with uniform page detection
+// pages holding one repeated byte are paged out without disk writes
+// and read back filled; pages changed after a fill are written
+// MMU reports the pages checked and not written on SIGINT
+int num_pages = 20;
+int rounds = 3;
+char *mmu_env[] = {"PAGER_UNIFORM=1", NULL};
+char *mmu_args[] = {"4", "32", NULL};
+
+int filler(int page, int round) {
+	return 'a' + (page + round) % 26;
+}
+
+void check_page(char *page, int i, int round) {
+	/* odd pages are uniform, even pages are not */
+	long pagesz = sysconf(_SC_PAGESIZE);
+	if(i % 2) {
+		for(int j = 0; j < pagesz; ++j)
+			assert(page[j] == filler(i, round));
+	} else {
+		char buf[32];
+		sprintf(buf, "page%d round%d", i, round);
+		assert(strcmp(page, buf) == 0);
+	}
+}
+
+void write_page(char *page, int i, int round) {
+	if(i % 2) memset(page, filler(i, round), sysconf(_SC_PAGESIZE));
+	else sprintf(page, "page%d round%d", i, round);
+}
+
+void run_client(void) {
+	uvm_create();
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		write_page(pages[i], i, 0);
+	}
+	for(int r = 1; r < rounds; ++r) {
+		for(int i = 0; i < num_pages; ++i) {
+			check_page(pages[i], i, r - 1);
+			write_page(pages[i], i, r);
+		}
+	}
+	/* a filled page that stops being uniform must reach the disk */
+	pages[1][0] = 'X';
+	for(int i = 2; i < num_pages; ++i) check_page(pages[i], i, rounds - 1);
+	assert(pages[1][0] == 'X' && pages[1][1] == filler(1, rounds - 1));
+	assert(uvm_syslog(pages[1], 2) == 0);
+	exit(EXIT_SUCCESS);
+}
+
+int main(void) {
+	fixture_init("test21");
+	start_mmu(mmu_env, mmu_args, FIXTURE_STDERR);
+
+	/* the client exits before the MMU goes away */
+	pid_t pid = fork();
+	if(pid == 0) run_client();
+	int status;
+	waitpid(pid, &status, 0);
+	stop_mmu(SIGINT);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	FILE *fp = fopen(err_path, "r");
+	assert(fp);
+	char impl[16] = "";
+	long checked = 0, uniform = 0;
+	char line[256];
+	int found = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "uniform: %15[a-z0-9], %ld pages checked, "
+				"%ld not written", impl, &checked, &uniform) == 3)
+			found = 1;
+	}
+	fclose(fp);
+	assert(found && impl[0]);
+	/* about half the pages evicted were uniform */
+	assert(uniform > 0 && 3 * uniform < 2 * checked);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// threads of one process fault and log concurrently
+// each thread owns some pages and writes its own byte in shared ones
+// pages are evicted and read back while other threads wait on faults
+int num_threads = 4;
+int own_pages = 3;
+int shared_pages = 4;
+int rounds = 5;
+char **pages;
+
+void write_own(int t, int i, int round) {
+	sprintf(pages[t * own_pages + i], "thread%d page%d round%d", t, i,
+			round);
+}
+
+void check_own(int t, int i, int round) {
+	char buf[48];
+	sprintf(buf, "thread%d page%d round%d", t, i, round);
+	assert(strcmp(pages[t * own_pages + i], buf) == 0);
+}
+
+void * run_thread(void *arg) {
+	int t = (int)(intptr_t)arg;
+	char *shared = pages[num_threads * own_pages];
+	for(int round = 0; round < rounds; ++round) {
+		for(int i = 0; i < own_pages; ++i) write_own(t, i, round);
+		for(int i = 0; i < shared_pages; ++i)
+			pages[num_threads * own_pages + i][64 + t] = 'a' + round;
+		for(int i = 0; i < own_pages; ++i) check_own(t, i, round);
+		for(int i = 0; i < shared_pages; ++i)
+			assert(pages[num_threads * own_pages + i][64 + t] ==
+					'a' + round);
+		assert(uvm_syslog(pages[t * own_pages], 6) == 0);
+		assert(uvm_syslog(shared, 1) == 0);
+	}
+	return NULL;
+}
+
+int main(void) {
+	uvm_create();
+	int num_pages = num_threads * own_pages + shared_pages;
+	pages = malloc(num_pages * sizeof(pages[0]));
+	assert(pages);
+	for(int i = 0; i < num_pages; ++i) {
+		pages[i] = uvm_extend();
+		assert(pages[i]);
+		pages[i][0] = '\0';
+	}
+
+	pthread_t threads[num_threads];
+	for(int t = 0; t < num_threads; ++t)
+		assert(pthread_create(&threads[t], NULL, run_thread,
+					(void *)(intptr_t)t) == 0);
+	for(int t = 0; t < num_threads; ++t)
+		assert(pthread_join(threads[t], NULL) == 0);
+
+	for(int t = 0; t < num_threads; ++t)
+		for(int i = 0; i < own_pages; ++i) check_own(t, i, rounds - 1);
+	for(int i = 0; i < shared_pages; ++i)
+		for(int t = 0; t < num_threads; ++t)
+			assert(pages[num_threads * own_pages + i][64 + t] ==
+					'a' + rounds - 1);
+	free(pages);
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,70 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+// a client timing its faults reports every stage on exit
+// faults go through the disk, so each stage sees every fault
+int num_pages = 8;
+int rounds = 3;
+char err_path[] = "test23.faults";
+const char *stages[] = {"request", "send", "queue", "pager", "ack",
+		"disk", "reply", "wakeup", "total"};
+
+void run_client(void) {
+	freopen(err_path, "w", stderr);
+	setenv("UVM_FAULTSTATS", "1", 1);
+	uvm_create();
+	char *pages[num_pages];
+	for(int i = 0; i < num_pages; ++i) pages[i] = uvm_extend();
+	for(int round = 0; round < rounds; ++round) {
+		for(int i = 0; i < num_pages; ++i)
+			sprintf(pages[i], "page%d round%d", i, round);
+	}
+	char buf[32];
+	for(int i = 0; i < num_pages; ++i) {
+		sprintf(buf, "page%d round%d", i, rounds - 1);
+		assert(strcmp(pages[i], buf) == 0);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+long stage_count(FILE *f, const char *stage) {
+	char line[160];
+	char name[16];
+	long n;
+	rewind(f);
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, " %15s n %ld", name, &n) != 2) continue;
+		if(strcmp(name, stage) == 0) return n;
+	}
+	return -1;
+}
+
+int main(void) {
+	pid_t pid = fork();
+	assert(pid != -1);
+	if(pid == 0) run_client();
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	FILE *f = fopen(err_path, "r");
+	assert(f);
+	long total = stage_count(f, "total");
+	/* at least one fault per page and round */
+	assert(total >= num_pages * rounds);
+	for(int i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i)
+		assert(stage_count(f, stages[i]) == total);
+	fclose(f);
+	unlink(err_path);
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
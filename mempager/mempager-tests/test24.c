@@ -0,0 +1,93 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMU with the swap in a file behind the I/O scheduler
+// sweeping over more pages than frames evicts runs of adjacent blocks,
+// which reach the file in fewer writes than pages
+// MMU reports the pages written and the write calls on SIGINT
+int num_pages = 24;
+int num_blocks = 32;
+int rounds = 3;
+char swap_path[64];
+char swap_env[96];
+char *mmu_env[] = {swap_env, "MMU_IOSCHED_DEPTH=16",
+		"MMU_IOSCHED_DELAY_MS=50", NULL};
+char *mmu_args[] = {"4", NULL, NULL};
+
+void run_client(void) {
+	uvm_create();
+	char **pages = malloc(num_pages * sizeof(pages[0]));
+	for(int i = 0; i < num_pages; ++i) pages[i] = uvm_extend();
+	char buf[32];
+	for(int r = 0; r < rounds; ++r) {
+		for(int i = 0; i < num_pages; ++i) {
+			if(r) {
+				sprintf(buf, "page%d round%d", i, r - 1);
+				assert(strcmp(pages[i], buf) == 0);
+			}
+			sprintf(pages[i], "page%d round%d", i, r);
+		}
+	}
+	for(int i = 0; i < num_pages; ++i) {
+		sprintf(buf, "page%d round%d", i, rounds - 1);
+		assert(strcmp(pages[i], buf) == 0);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int main(void) {
+	fixture_init("test24");
+	snprintf(swap_path, sizeof(swap_path), "%s/swap", tmp_dir);
+	snprintf(swap_env, sizeof(swap_env), "MMU_SWAP_FILE=%s", swap_path);
+	char blocks[16];
+	sprintf(blocks, "%d", num_blocks);
+	mmu_args[1] = blocks;
+	start_mmu(mmu_env, mmu_args, FIXTURE_STDERR);
+
+	pid_t pid = fork();
+	if(pid == 0) run_client();
+	int status;
+	waitpid(pid, &status, 0);
+	stop_mmu(SIGINT);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	struct stat st;
+	assert(stat(swap_path, &st) == 0);
+	assert(st.st_size == (off_t)num_blocks * sysconf(_SC_PAGESIZE));
+
+	FILE *fp = fopen(err_path, "r");
+	assert(fp);
+	int depth = 0;
+	long written = 0, ios = 0, reads = 0;
+	char line[256];
+	int found = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "iosched: depth %d, %ld pages written in %ld "
+				"writes (%*f pages per write), %*d coalesced, "
+				"%*d flushes of %*f pages (max %*d), %ld reads",
+				&depth, &written, &ios, &reads) == 4)
+			found = 1;
+	}
+	fclose(fp);
+	assert(found && depth == 16);
+	/* every page but those resident was evicted each round */
+	assert(written >= (num_pages - 4) * (rounds - 1));
+	assert(reads > 0);
+	assert(ios > 0 && ios < written);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
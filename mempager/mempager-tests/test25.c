@@ -0,0 +1,137 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMU with one worker and mixed QoS classes
+// batch clients thrash while a latency client keeps touching its pages
+// the clocks evict batch frames first, so the latency client's pages
+// are never paged out, and the MMU reports faults per class on SIGINT
+int num_frames = 8;
+int lat_pages = 4;
+int lat_rounds = 50;
+int num_batch = 3;
+int batch_pages = 12;
+int batch_rounds = 4;
+char *mmu_env[] = {"MMU_WORKERS=1", NULL};
+char *mmu_args[] = {NULL, "64", NULL};
+
+void run_latency(int ready_fd) {
+	setenv("UVM_QOS", "latency", 1);
+	uvm_create();
+	char *pages[lat_pages];
+	for(int i = 0; i < lat_pages; ++i) {
+		pages[i] = uvm_extend();
+		sprintf(pages[i], "latency%d", i);
+	}
+	/* created and resident before any batch client */
+	if(write(ready_fd, "r", 1) != 1) exit(EXIT_FAILURE);
+	close(ready_fd);
+	char buf[32];
+	for(int r = 0; r < lat_rounds; ++r) {
+		for(int i = 0; i < lat_pages; ++i) {
+			sprintf(buf, "latency%d", i);
+			assert(strcmp(pages[i], buf) == 0);
+			pages[i][100] = (char)r; /* a write, past the string */
+		}
+		usleep(2000);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+void run_batch(int n) {
+	setenv("UVM_QOS", "batch", 1);
+	uvm_create();
+	char *pages[batch_pages];
+	for(int i = 0; i < batch_pages; ++i) pages[i] = uvm_extend();
+	char buf[48];
+	for(int r = 0; r < batch_rounds; ++r) {
+		for(int i = 0; i < batch_pages; ++i) {
+			if(r) {
+				sprintf(buf, "batch%d page%d round%d", n, i, r - 1);
+				assert(strcmp(pages[i], buf) == 0);
+			}
+			sprintf(pages[i], "batch%d page%d round%d", n, i, r);
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
+
+long class_faults(FILE *fp, const char *name) {
+	char line[256];
+	char cls[16];
+	long n;
+	rewind(fp);
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, " %15s n %ld", cls, &n) != 2) continue;
+		if(strcmp(cls, name) == 0) return n;
+	}
+	return -1;
+}
+
+int main(void) {
+	fixture_init("test25");
+	char frames[16];
+	sprintf(frames, "%d", num_frames);
+	mmu_args[0] = frames;
+	start_mmu(mmu_env, mmu_args, FIXTURE_STDOUT | FIXTURE_STDERR);
+
+	int fds[2];
+	if(pipe(fds) == -1) exit(EXIT_FAILURE);
+	pid_t pids[1 + num_batch];
+	pids[0] = fork();
+	if(pids[0] == 0) {
+		close(fds[0]);
+		run_latency(fds[1]);
+	}
+	close(fds[1]);
+	char c;
+	assert(read(fds[0], &c, 1) == 1);
+	close(fds[0]);
+	for(int i = 0; i < num_batch; ++i) {
+		pids[1 + i] = fork();
+		if(pids[1 + i] == 0) run_batch(i);
+	}
+	for(int i = 0; i < 1 + num_batch; ++i) {
+		int status;
+		waitpid(pids[i], &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	}
+	stop_mmu(SIGINT);
+
+	FILE *fp = fopen(err_path, "r");
+	assert(fp);
+	long lat = class_faults(fp, "latency");
+	long normal = class_faults(fp, "normal");
+	long batch = class_faults(fp, "batch");
+	fclose(fp);
+	assert(lat > 0 && normal == 0);
+	assert(batch >= num_batch * batch_pages * batch_rounds);
+
+	/* the latency client, pid 0, never lost a frame */
+	fp = fopen(out_path, "r");
+	assert(fp);
+	char line[256];
+	long evicted = 0, batch_evicted = 0;
+	int pid;
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "mmu_nonresident pid %d", &pid) != 1) continue;
+		if(pid == 0) evicted++;
+		else batch_evicted++;
+	}
+	fclose(fp);
+	assert(evicted == 0 && batch_evicted > 0);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
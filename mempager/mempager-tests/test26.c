@@ -0,0 +1,60 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmu.h"
+#include "uvm.h"
+
+#include "mmufixture.h"
+
+// runs its own MMU with soft reference bits
+// more clients than reference map slices run one after the other,
+// each evicting its pages; ids and their cleared slices are reused
+// MMU still accepts clients once the first ids are reused
+int num_clients = 300;
+int num_pages = 6;
+int rounds = 3;
+char *mmu_env[] = {"PAGER_SOFTREF=1", NULL};
+char *mmu_args[] = {"4", "16", NULL};
+
+void run_client(int n) {
+	uvm_create();
+	char *pages[num_pages];
+	for(int i = 0; i < num_pages; ++i) pages[i] = uvm_extend();
+	char buf[48];
+	for(int r = 0; r < rounds; ++r) {
+		for(int i = 0; i < num_pages; ++i) {
+			if(r) {
+				sprintf(buf, "client%d page%d round%d", n, i, r - 1);
+				assert(strcmp(pages[i], buf) == 0);
+			}
+			sprintf(pages[i], "client%d page%d round%d", n, i, r);
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int main(void) {
+	fixture_init("test26");
+	start_mmu(mmu_env, mmu_args, FIXTURE_STDERR);
+
+	for(int n = 0; n < num_clients; ++n) {
+		pid_t pid = fork();
+		if(pid == 0) run_client(n);
+		int status;
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	}
+	int status;
+	assert(waitpid(mmu_pid, &status, WNOHANG) == 0);
+	stop_mmu(SIGINT);
+
+	printf("ok\n");
+	exit(EXIT_SUCCESS);
+}
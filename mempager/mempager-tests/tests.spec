@@ -10,3 +10,17 @@
 10 4 8 0
 11 2 3 1
 12 256 1024 1
+13 4 8 1
+14 4 8 1
+15 4 16 1
+16 4 16 1
+17 4 8 1
+18 4 8 1
+19 4 32 1
+20 4 8 1
+21 4 8 1
+22 4 16 1
+23 4 8 1
+24 4 8 1
+25 4 8 1
+26 4 8 1
@@ -167,6 +167,16 @@ void cyc_file_unlock(struct cyclic *cyc)/*{{{*/
 	pthread_mutex_unlock(&cyc->lock);
 }/*}}}*/
 
+void cyc_fork_prepare(struct cyclic *cyc)/*{{{*/
+{
+	pthread_mutex_lock(&cyc->mutex);
+}/*}}}*/
+
+void cyc_fork_release(struct cyclic *cyc)/*{{{*/
+{
+	pthread_mutex_unlock(&cyc->mutex);
+}/*}}}*/
+
 /*****************************************************************************
  * static function implementations
  ****************************************************************************/
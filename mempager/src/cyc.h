@@ -48,4 +48,10 @@ void cyc_flush(struct cyclic *cyc);
 void cyc_file_lock(struct cyclic *cyc);
 void cyc_file_unlock(struct cyclic *cyc);
 
+/* These functions hold the handle's mutex across fork(2) so that the child
+ * does not inherit it locked by another thread.  Call `cyc_fork_release`
+ * in both the parent and the child. */
+void cyc_fork_prepare(struct cyclic *cyc);
+void cyc_fork_release(struct cyclic *cyc);
+
 #endif
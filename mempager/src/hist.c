@@ -0,0 +1,87 @@
+#include "hist.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#define HIST_LINE 128
+
+static int hist_bucket(uint64_t ns);
+static void hist_format(char *buf, const char *name, const struct hist *h);
+
+uint64_t hist_now(void)/*{{{*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}/*}}}*/
+
+void hist_init(struct hist *h)/*{{{*/
+{
+	memset(h, 0, sizeof(*h));
+}/*}}}*/
+
+void hist_add(struct hist *h, uint64_t ns)/*{{{*/
+{
+	__atomic_add_fetch(&h->buckets[hist_bucket(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum, ns, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while(ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+}/*}}}*/
+
+uint64_t hist_quantile(const struct hist *h, double q)/*{{{*/
+{
+	uint64_t count = 0;
+	for(int i = 0; i < HIST_BUCKETS; ++i) count += h->buckets[i];
+	if(!count) return 0;
+	uint64_t rank = (uint64_t)(q * count + 0.5);
+	if(rank < 1) rank = 1;
+	uint64_t seen = 0;
+	int i = 0;
+	for(; i < HIST_BUCKETS - 1; ++i) {
+		seen += h->buckets[i];
+		if(seen >= rank) break;
+	}
+	uint64_t end = i ? 1ULL << i : 0;
+	return end < h->max && i < HIST_BUCKETS - 1 ? end : h->max;
+}/*}}}*/
+
+void hist_print(FILE *f, const char *name, const struct hist *h)/*{{{*/
+{
+	char buf[HIST_LINE];
+	hist_format(buf, name, h);
+	fprintf(f, "%s\n", buf);
+}/*}}}*/
+
+void hist_log(unsigned verbosity, const char *name, const struct hist *h)/*{{{*/
+{
+	char buf[HIST_LINE];
+	hist_format(buf, name, h);
+	logd(verbosity, "%s\n", buf);
+	for(int i = 0; i < HIST_BUCKETS; ++i) {
+		if(!h->buckets[i]) continue;
+		logd(verbosity, "  %-8s < %10llu ns %llu\n", name,
+				i ? 1ULL << i : 1ULL,
+				(unsigned long long)h->buckets[i]);
+	}
+}/*}}}*/
+
+int hist_bucket(uint64_t ns)/*{{{*/
+{
+	if(!ns) return 0;
+	int i = 64 - __builtin_clzll(ns);
+	return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}/*}}}*/
+
+void hist_format(char *buf, const char *name, const struct hist *h)/*{{{*/
+{
+	double mean = h->count ? (double)h->sum / h->count : 0.0;
+	snprintf(buf, HIST_LINE, "  %-8s n %-8llu mean %9.1f p50 %9.1f "
+			"p99 %9.1f max %9.1f us", name,
+			(unsigned long long)h->count, mean / 1000.0,
+			hist_quantile(h, 0.5) / 1000.0,
+			hist_quantile(h, 0.99) / 1000.0, h->max / 1000.0);
+}/*}}}*/
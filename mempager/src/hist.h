@@ -0,0 +1,46 @@
+/* This module keeps latency histograms with power-of-two buckets of
+ * nanoseconds: bucket 0 counts zero-length samples and bucket `i`
+ * samples in [2^(i-1), 2^i), up to the last bucket, which also counts
+ * every longer sample (above about two seconds).  Samples may be
+ * added from several threads at once; a reader racing with them may
+ * see a sample in some fields and not yet in others.
+ *
+ * Times come from `CLOCK_MONOTONIC`, which is shared by every process
+ * on the machine, so stamps taken by the MMU and its clients can be
+ * subtracted from one another. */
+
+#ifndef __HIST_HEADER__
+#define __HIST_HEADER__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define HIST_BUCKETS 32
+
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+/* `hist_now` returns the current time in nanoseconds; it may be
+ * called from signal handlers. */
+uint64_t hist_now(void);
+
+void hist_init(struct hist *h);
+void hist_add(struct hist *h, uint64_t ns);
+
+/* `hist_quantile` returns an upper bound of the `q`-quantile of the
+ * samples, 0 < `q` <= 1: the end of the bucket holding it, or the
+ * largest sample if smaller.  Returns 0 if `h` is empty. */
+uint64_t hist_quantile(const struct hist *h, double q);
+
+/* `hist_print` writes a line with the sample count and the mean,
+ * median, 99th percentile and maximum, in microseconds.  `hist_log`
+ * writes the same line and then each non-empty bucket through `logd`
+ * with `verbosity`. */
+void hist_print(FILE *f, const char *name, const struct hist *h);
+void hist_log(unsigned verbosity, const char *name, const struct hist *h);
+
+#endif
@@ -0,0 +1,355 @@
+#include "iosched.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IOSCHED_FREE 0
+#define IOSCHED_QUEUED 1
+#define IOSCHED_INFLIGHT 2 /* being written by the flusher */
+#define IOSCHED_MAX_IOV 1024 /* UIO_MAXIOV, pages per pwritev */
+
+struct iosched_slot {/*{{{*/
+	int block; /* -1 if free */
+	int state;
+	char *buf;
+};/*}}}*/
+struct iosched_run {/*{{{*/
+	int block;
+	int slot;
+};/*}}}*/
+struct iosched {/*{{{*/
+	int fd;
+	size_t pagesize;
+	int depth;
+	uint64_t delay; /* nanoseconds */
+	pthread_t flusher;
+	pthread_mutex_t lock; /* protects everything below */
+	pthread_cond_t work; /* for the flusher: writes queued, reads done */
+	pthread_cond_t done; /* for callers: the flusher freed slots */
+	struct iosched_slot *slots;
+	char *bufs;
+	struct iosched_run *batch; /* slots being written */
+	struct iovec *iov;
+	int nqueued;
+	int ninflight;
+	int nreading; /* reads issued to the file */
+	int nflush; /* callers waiting for the queue to empty */
+	uint64_t oldest; /* when the oldest queued write was queued */
+	int stop;
+	int error; /* errno of a failed write, 0 if none */
+	struct iosched_stats stats;
+};/*}}}*/
+
+static void * iosched_thread(void *data);
+static int iosched_due(const struct iosched *s);
+static void iosched_write_batch(struct iosched *s);
+static struct iosched_slot * iosched_find(struct iosched *s, int block);
+static int iosched_run_cmp(const void *a, const void *b);
+static int iosched_pwritev_all(int fd, struct iovec *iov, int cnt,
+		off_t off);
+static int iosched_pread_all(int fd, void *buf, size_t len, off_t off);
+static uint64_t iosched_now(void);
+
+struct iosched * iosched_create(int fd, size_t pagesize, int depth,/*{{{*/
+		int delay_ms)
+{
+	struct iosched *s = calloc(1, sizeof(*s));
+	if(!s) return NULL;
+	s->fd = fd;
+	s->pagesize = pagesize;
+	s->depth = depth > 0 ? depth : 0;
+	s->delay = (uint64_t)(delay_ms > 0 ? delay_ms : 0) * 1000000ULL;
+	s->stats.depth = s->depth;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->work, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&s->done, NULL);
+	if(!s->depth) return s;
+
+	s->slots = calloc(s->depth, sizeof(s->slots[0]));
+	s->batch = calloc(s->depth, sizeof(s->batch[0]));
+	s->iov = calloc(s->depth < IOSCHED_MAX_IOV ? s->depth : IOSCHED_MAX_IOV,
+			sizeof(s->iov[0]));
+	/* page-aligned, as O_DIRECT needs */
+	if(!s->slots || !s->batch || !s->iov || posix_memalign(
+				(void **)&s->bufs, pagesize, s->depth * pagesize))
+		goto out;
+	for(int i = 0; i < s->depth; ++i) {
+		s->slots[i].block = -1;
+		s->slots[i].buf = s->bufs + (size_t)i * pagesize;
+	}
+	if(pthread_create(&s->flusher, NULL, iosched_thread, s)) goto out;
+	return s;
+out:
+	free(s->bufs);
+	free(s->iov);
+	free(s->batch);
+	free(s->slots);
+	free(s);
+	return NULL;
+}/*}}}*/
+
+int iosched_destroy(struct iosched *s)/*{{{*/
+{
+	if(s->depth) {
+		pthread_mutex_lock(&s->lock);
+		s->stop = 1;
+		pthread_cond_signal(&s->work);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->flusher, NULL);
+	}
+	int error = s->error;
+	pthread_cond_destroy(&s->done);
+	pthread_cond_destroy(&s->work);
+	pthread_mutex_destroy(&s->lock);
+	free(s->bufs);
+	free(s->iov);
+	free(s->batch);
+	free(s->slots);
+	free(s);
+	if(!error) return 0;
+	errno = error;
+	return -1;
+}/*}}}*/
+
+int iosched_read(struct iosched *s, int block, void *buf)/*{{{*/
+{
+	pthread_mutex_lock(&s->lock);
+	if(s->error) {
+		errno = s->error;
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	s->stats.reads++;
+	struct iosched_slot *slot = iosched_find(s, block);
+	if(slot) {
+		memcpy(buf, slot->buf, s->pagesize);
+		s->stats.read_hits++;
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+	s->nreading++;
+	pthread_mutex_unlock(&s->lock);
+
+	int ret = iosched_pread_all(s->fd, buf, s->pagesize,
+			(off_t)block * s->pagesize);
+
+	pthread_mutex_lock(&s->lock);
+	if(--s->nreading == 0 && s->nqueued) pthread_cond_signal(&s->work);
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}/*}}}*/
+
+int iosched_write(struct iosched *s, int block, const void *buf)/*{{{*/
+{
+	struct iovec iov = {(void *)buf, s->pagesize};
+	if(!s->depth) {
+		int ret = iosched_pwritev_all(s->fd, &iov, 1,
+				(off_t)block * s->pagesize);
+		pthread_mutex_lock(&s->lock);
+		s->stats.writes++;
+		if(!ret) s->stats.written++;
+		s->stats.ios++;
+		pthread_mutex_unlock(&s->lock);
+		return ret;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	struct iosched_slot *slot;
+	for(;;) {
+		if(s->error) {
+			errno = s->error;
+			pthread_mutex_unlock(&s->lock);
+			return -1;
+		}
+		slot = iosched_find(s, block);
+		if(slot && slot->state == IOSCHED_QUEUED) {
+			s->stats.coalesced++;
+			break;
+		}
+		/* a copy being written must not change under the flusher */
+		if(!slot && (slot = iosched_find(s, -1))) {
+			slot->block = block;
+			slot->state = IOSCHED_QUEUED;
+			if(s->nqueued++ == 0) s->oldest = iosched_now();
+			if(s->nqueued == 1 || 2 * s->nqueued >= s->depth)
+				pthread_cond_signal(&s->work);
+			break;
+		}
+		pthread_cond_signal(&s->work);
+		pthread_cond_wait(&s->done, &s->lock);
+	}
+	memcpy(slot->buf, buf, s->pagesize);
+	s->stats.writes++;
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}/*}}}*/
+
+int iosched_flush(struct iosched *s)/*{{{*/
+{
+	pthread_mutex_lock(&s->lock);
+	s->nflush++;
+	pthread_cond_signal(&s->work);
+	while((s->nqueued || s->ninflight) && !s->error)
+		pthread_cond_wait(&s->done, &s->lock);
+	s->nflush--;
+	int error = s->error;
+	pthread_mutex_unlock(&s->lock);
+	if(!error) return 0;
+	errno = error;
+	return -1;
+}/*}}}*/
+
+void iosched_stats(struct iosched *s, struct iosched_stats *stats)/*{{{*/
+{
+	pthread_mutex_lock(&s->lock);
+	*stats = s->stats;
+	pthread_mutex_unlock(&s->lock);
+}/*}}}*/
+
+void * iosched_thread(void *data)/*{{{*/
+{
+	struct iosched *s = data;
+	pthread_mutex_lock(&s->lock);
+	while(!s->stop || s->nqueued) {
+		if(iosched_due(s)) {
+			iosched_write_batch(s);
+		} else if(s->nqueued && !s->nreading) {
+			uint64_t deadline = s->oldest + s->delay;
+			struct timespec ts = {deadline / 1000000000ULL,
+					deadline % 1000000000ULL};
+			pthread_cond_timedwait(&s->work, &s->lock, &ts);
+		} else {
+			pthread_cond_wait(&s->work, &s->lock);
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}/*}}}*/
+
+int iosched_due(const struct iosched *s)/*{{{*/
+{
+	if(!s->nqueued) return 0;
+	if(s->nqueued == s->depth || s->nflush || s->stop) return 1;
+	if(s->nreading) return 0;
+	return 2 * s->nqueued >= s->depth ||
+			iosched_now() >= s->oldest + s->delay;
+}/*}}}*/
+
+void iosched_write_batch(struct iosched *s)/*{{{*/
+{
+	/* takes every queued write off the queue and writes runs of
+	 * adjacent blocks with one call each; `s->lock` is held on entry
+	 * and exit but not while writing */
+	int n = 0;
+	for(int i = 0; i < s->depth; ++i) {
+		if(s->slots[i].state != IOSCHED_QUEUED) continue;
+		s->slots[i].state = IOSCHED_INFLIGHT;
+		s->batch[n].block = s->slots[i].block;
+		s->batch[n].slot = i;
+		n++;
+	}
+	s->nqueued = 0;
+	s->ninflight = n;
+	s->stats.flushes++;
+	s->stats.queued += n;
+	if(n > s->stats.queued_max) s->stats.queued_max = n;
+	int error = s->error;
+	pthread_mutex_unlock(&s->lock);
+
+	qsort(s->batch, n, sizeof(s->batch[0]), iosched_run_cmp);
+	long ios = 0;
+	for(int i = 0; i < n && !error; ) {
+		int cnt = 0;
+		do {
+			struct iosched_slot *slot = &s->slots[s->batch[i + cnt].slot];
+			s->iov[cnt].iov_base = slot->buf;
+			s->iov[cnt].iov_len = s->pagesize;
+			cnt++;
+		} while(i + cnt < n && cnt < IOSCHED_MAX_IOV && s->batch[i + cnt].block ==
+				s->batch[i + cnt - 1].block + 1);
+		if(iosched_pwritev_all(s->fd, s->iov, cnt,
+					(off_t)s->batch[i].block * s->pagesize))
+			error = errno;
+		ios++;
+		i += cnt;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	for(int i = 0; i < n; ++i) {
+		struct iosched_slot *slot = &s->slots[s->batch[i].slot];
+		slot->block = -1;
+		slot->state = IOSCHED_FREE;
+	}
+	s->ninflight = 0;
+	if(!error) s->stats.written += n;
+	s->stats.ios += ios;
+	s->error = error;
+	/* writes queued meanwhile wait for a full delay from now */
+	if(s->nqueued) s->oldest = iosched_now();
+	pthread_cond_broadcast(&s->done);
+}/*}}}*/
+
+struct iosched_slot * iosched_find(struct iosched *s, int block)/*{{{*/
+{
+	for(int i = 0; i < s->depth; ++i)
+		if(s->slots[i].block == block) return &s->slots[i];
+	return NULL;
+}/*}}}*/
+
+int iosched_run_cmp(const void *a, const void *b)/*{{{*/
+{
+	const struct iosched_run *ra = a, *rb = b;
+	return ra->block < rb->block ? -1 : ra->block > rb->block;
+}/*}}}*/
+
+int iosched_pwritev_all(int fd, struct iovec *iov, int cnt, off_t off)/*{{{*/
+{
+	while(cnt > 0) {
+		ssize_t len = pwritev(fd, iov, cnt, off);
+		if(len == -1 && errno == EINTR) continue;
+		if(len == 0) errno = EIO;
+		if(len <= 0) return -1;
+		off += len;
+		for(; cnt > 0 && (size_t)len >= iov->iov_len; iov++, cnt--)
+			len -= iov->iov_len;
+		if(cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+	return 0;
+}/*}}}*/
+
+int iosched_pread_all(int fd, void *buf, size_t len, off_t off)/*{{{*/
+{
+	char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = pread(fd, p, len, off);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt == 0) errno = EIO;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		off += cnt;
+		len -= cnt;
+	}
+	return 0;
+}/*}}}*/
+
+uint64_t iosched_now(void)/*{{{*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}/*}}}*/
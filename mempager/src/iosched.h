@@ -0,0 +1,57 @@
+/* This module schedules page-sized I/O to the MMU's swap file (or
+ * device).  Writes are copied into a queue of `depth` page buffers
+ * and return at once.  A flusher thread writes the queue out sorted
+ * by block, with one `pwritev` per run of adjacent blocks, once half
+ * the queue is filled or the oldest queued write has waited
+ * `delay_ms`.  A write to a block already queued replaces the queued
+ * copy; a writer finding the queue full waits for the flusher.  With
+ * `depth` 0, every write goes straight to the file.
+ *
+ * Reads take priority over writes: they are issued at once, never
+ * behind queued writes, and served from the queue when their block
+ * is there.  The flusher holds off while reads are in progress,
+ * unless the queue is full or a flush was requested.
+ *
+ * The functions are thread-safe.  They return 0 on success and -1
+ * with `errno` set on failure; once a background write fails, every
+ * later call fails with its error. */
+
+#ifndef __IOSCHED_HEADER__
+#define __IOSCHED_HEADER__
+
+#include <stddef.h>
+
+struct iosched;
+
+struct iosched_stats {
+	int depth;
+	long reads; /* pages read */
+	long read_hits; /* reads served from the queue */
+	long writes; /* pages written by callers */
+	long coalesced; /* writes replacing a queued copy */
+	long written; /* pages written to the file */
+	long ios; /* write calls that wrote them */
+	long flushes; /* batches taken off the queue */
+	long queued; /* pages in those batches, the queue depth summed */
+	int queued_max;
+};
+
+/* `iosched_create` schedules I/O to `fd`, whose block `i` is at
+ * offset `i * pagesize`, and starts the flusher.  Returns NULL if
+ * memory or the thread cannot be allocated.  `iosched_destroy`
+ * writes out the queue, stops the flusher and frees `s`, but leaves
+ * `fd` open; it fails if any write failed. */
+struct iosched * iosched_create(int fd, size_t pagesize, int depth,
+		int delay_ms);
+int iosched_destroy(struct iosched *s);
+
+int iosched_read(struct iosched *s, int block, void *buf);
+int iosched_write(struct iosched *s, int block, const void *buf);
+
+/* `iosched_flush` writes out the queue at once, not waiting for it
+ * to fill, and returns once the queue is empty. */
+int iosched_flush(struct iosched *s);
+
+void iosched_stats(struct iosched *s, struct iosched_stats *stats);
+
+#endif
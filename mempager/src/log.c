@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 extern int errno;
 
 #include "cyc.h"
@@ -13,8 +14,12 @@ extern int errno;
  ****************************************************************************/
 static unsigned log_verbosity = 0;
 static struct cyclic *cyc = NULL;
+static pthread_once_t log_atfork_once = PTHREAD_ONCE_INIT;
 
 static void log_error(const char *file, int line);
+static void log_atfork(void);
+static void log_fork_prepare(void);
+static void log_fork_release(void);
 
 /*****************************************************************************
  * public function implementations
@@ -26,6 +31,7 @@ void log_init(unsigned verbosity, const char *path,
 	log_verbosity = verbosity;
 	cyc = cyc_init_filesize(path, nbackups, maxsize);
 	if(!cyc) log_error(__FILE__, __LINE__);
+	pthread_once(&log_atfork_once, log_atfork);
 }
 
 void log_destroy(void)
@@ -93,3 +99,20 @@ static void log_error(const char *file, int line)
 	if(errno) perror("log_error");
 	fprintf(stderr, "%s:%d: logging not working.\n", file, line);
 }
+
+static void log_atfork(void)
+{
+	pthread_atfork(log_fork_prepare, log_fork_release, log_fork_release);
+}
+
+/* uvm_fork forks threaded clients; a child must not inherit the log
+ * mutex held by a thread that does not exist on its side. */
+static void log_fork_prepare(void)
+{
+	if(cyc) cyc_fork_prepare(cyc);
+}
+
+static void log_fork_release(void)
+{
+	if(cyc) cyc_fork_release(cyc);
+}
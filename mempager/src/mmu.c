@@ -1,69 +1,369 @@
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <linux/mempolicy.h>
+
 #include "log.h"
 
+#include "hist.h"
+#include "iosched.h"
+#include "mmu.h"
 #include "pager.h"
 #include "mmuproto.h"
+#include "probes.h"
+#include "slab.h"
 
 #define MMU_MAX_EVENTS 32
 #define MMU_MAX_SOCK 1024
 
+/* If set, the MMU writes "READY\n" to this file descriptor once it
+ * accepts connections, so test drivers need not sleep. */
+#define MMU_READY_FD_ENV "MMU_READY_FD"
+
+/* Directory where the physical memory image is created, overridden
+ * by the -d command-line option.  Defaults to the current directory. */
+#define MMU_PMEM_DIR_ENV "MMU_PMEM_DIR"
+#define MMU_PMEM_TEMPLATE "mmu.pmem.img.XXXXXX"
+
+/* File where syslog records are appended, overridden by the -y
+ * command-line option.  Records go to stdout in hex by default. */
+#define MMU_SYSLOG_ENV "MMU_SYSLOG"
+
+/* NUMA topology as exported by the kernel.  Machines without it are
+ * treated as a single node holding every CPU. */
+#define MMU_NODE_DIR "/sys/devices/system/node"
+#define MMU_MAX_NODES 64
+
+/* Directory holding the checkpoint, overridden by the -c
+ * command-line option.  If set, the MMU restores the checkpoint
+ * found there on startup, writes an incremental checkpoint on
+ * SIGUSR1, and detaches its clients and writes a final checkpoint
+ * on SIGINT.  The directory holds `state`, the client page maps and
+ * pager tables, and two generations of images of physical memory
+ * and disk, `frames.0`/`blocks.0` and `frames.1`/`blocks.1`.
+ * Checkpoint `seq` updates the images of generation `seq % 2`, those
+ * of checkpoint `seq - 2`, with the frames and blocks changed since
+ * then, syncs them, and replaces `state`, which carries `seq`,
+ * atomically.  A crash at any point leaves `state` naming images
+ * that were synced before it was written. */
+#define MMU_CKPT_DIR_ENV "MMU_CKPT_DIR"
+#define MMU_CKPT_MAGIC "MMUCKPT2"
+#define MMU_CKPT_DIRTY 0x1 /* changed since the last checkpoint */
+#define MMU_CKPT_WRITABLE 0x2 /* mapped writable, so always copied */
+#define MMU_CKPT_PREV 0x4 /* changed since the one before */
+
+/* Threads servicing requests.  Each client's own thread only reads
+ * its messages, so requests from several threads of a client are
+ * serviced at once, up to this many in the whole MMU. */
+#define MMU_WORKERS_ENV "MMU_WORKERS"
+#define MMU_WORKERS_DEFAULT 8
+#define MMU_MAX_WORKERS 256
+
+/* Weights of the QoS classes (`UVM_QOS_*` in mmu.h) clients declare
+ * in CREATE_REQ, as a comma-separated list, e.g., "8,4,1".  Workers
+ * pick queued requests in self-clocked weighted-fair order: each
+ * request is stamped with a virtual finish time `1/weight` after the
+ * later of its class's previous stamp and the stamp of the request
+ * last picked, and workers pick the earliest stamp.  Under load each
+ * class gets a share of the workers proportional to its weight, and
+ * a class gets no credit for time it was idle.  Requests of a client
+ * stay in order, as they are all in its class's queue. */
+#define MMU_QOS_WEIGHTS_ENV "MMU_QOS_WEIGHTS"
+#define MMU_QOS_WEIGHTS_DEFAULT {8, 4, 1}
+#define MMU_QOS_UNIT (1 << 20) /* virtual time of a request at weight 1 */
+
+/* File or block device holding the swap.  If unset, the swap is kept
+ * in memory.  Otherwise blocks go through the I/O scheduler in
+ * iosched.c, which queues up to `MMU_IOSCHED_DEPTH` page writes (0
+ * writes each page at once) and writes them out sorted and merged
+ * once half the queue is filled or the oldest has waited
+ * `MMU_IOSCHED_DELAY_MS`.  Checkpoints need the swap in memory. */
+#define MMU_SWAP_FILE_ENV "MMU_SWAP_FILE"
+#define MMU_IOSCHED_DEPTH_ENV "MMU_IOSCHED_DEPTH"
+#define MMU_IOSCHED_DEPTH_DEFAULT 64
+#define MMU_IOSCHED_DELAY_ENV "MMU_IOSCHED_DELAY_MS"
+#define MMU_IOSCHED_DELAY_DEFAULT 5
+
+/* Stages of the faults clients time (see mmuproto.h), as the MMU
+ * sees them; they are reported on shutdown. */
+#define MMU_FAULT_SEND 0 /* from the client's send to its thread */
+#define MMU_FAULT_QUEUE 1 /* waiting for a worker */
+#define MMU_FAULT_PAGER 2 /* in the pager, but for the next two */
+#define MMU_FAULT_ACK 3 /* REMAP and CHPROT round trips */
+#define MMU_FAULT_DISK 4
+#define MMU_FAULT_MMU 5 /* from the receipt to the reply */
+#define MMU_FAULT_STAGES 6
+
 
 pid_t id2pid[UINT8_MAX];
-uint8_t nextid = 0;
+/* Ids not in use, a queue handed out oldest-freed first, so ids count
+ * up from 0 until the first is reused.  Each id owns a reference map
+ * slice, so there are no more ids than slices. */
+static uint8_t freeids[MMU_PROTO_REFMAP_SLOTS];
+static int freeids_head = 0;
+static int freeids_count = 0;
+static pthread_mutex_t ids_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /****************************************************************************
  * structure definitions and static variables
  ***************************************************************************/
+struct mmu_qos {/*{{{*/
+	/* a class's queue, protected by `jobs_lock` */
+	int weight;
+	struct mmu_job *jobs; /* oldest first */
+	struct mmu_job *jobs_tail;
+	uint64_t vfinish; /* stamp of the class's last request */
+	struct hist fault_hist; /* from receipt to reply */
+};/*}}}*/
 struct mmu_data {/*{{{*/
 	int running;
 	int npages;
+	int nblocks;
 	char *pmem;
-	char *disk;
+	char *disk; /* NULL if the swap is in a file */
+	int swap_fd;
+	struct iosched *iosched;
 	char *pmem_fn;
 	int pmem_fd;
+	size_t pmem_size; /* frames followed by the reference map */
+	uint32_t *refmap; /* see mmuproto.h */
+	int refmap_pages; /* entries per client */
 	int sock;
+	const char *sock_path;
 	struct mmu_client * sock2client[MMU_MAX_SOCK];
+	int syslog_fd; /* -1 if printing to stdout */
+	pthread_mutex_t syslog_mutex; /* held only to output a record */
+	int nnodes;
+	int node_ids[MMU_MAX_NODES]; /* kernel node number of each node */
+	int ncpus;
+	int *cpu2node; /* index into `node_ids`, -1 if unknown */
+	const char *ckpt_dir; /* NULL if not checkpointing */
+	volatile sig_atomic_t ckpt_requested;
+	volatile sig_atomic_t stopping;
+	int ckpt_seq;
+	uint8_t *frame_flags; /* MMU_CKPT_DIRTY, _WRITABLE and _PREV */
+	uint8_t *block_flags;
+	pthread_rwlock_t ckpt_lock; /* read-held while servicing requests */
+	pthread_t reclaim_thread; /* calls `pager_reclaim` when woken */
+	pthread_mutex_t reclaim_mutex;
+	pthread_cond_t reclaim_cond;
+	int reclaim_wanted;
+	int reclaim_stop;
+	/* clients restored from a checkpoint that have not reconnected,
+	 * indexed by id; they are never freed before `mmu_destroy` */
+	struct mmu_client *detached[UINT8_MAX];
+	struct slab *client_slab;
+	struct slab *map_slab; /* of `refmap_pages` entries */
+	struct slab *job_slab;
+	int nworkers;
+	pthread_t *workers;
+	pthread_mutex_t jobs_lock; /* protects the queue and clients' jobs */
+	pthread_cond_t jobs_cond; /* a job was queued, or workers stop */
+	pthread_cond_t jobs_idle; /* a client's last job finished */
+	struct mmu_qos qos[UVM_QOS_CLASSES];
+	uint64_t qos_vtime; /* stamp of the request last picked */
+	int jobs_queued;
+	int jobs_stop;
+	struct hist fault_hist[MMU_FAULT_STAGES];
+};/*}}}*/
+struct mmu_ckpt_header {/*{{{*/
+	char magic[8];
+	int32_t pagesize;
+	int32_t npages;
+	int32_t nblocks;
+	int32_t maxpages; /* map entries per client */
+	int32_t seq;
+	int32_t nclients; /* each followed by its pid and map */
+	int32_t nextid;
+	int32_t id2pid[UINT8_MAX];
+};/*}}}*/
+struct mmu_map {/*{{{*/
+	int32_t frame; /* -1 if not mapped */
+	int32_t prot;
 };/*}}}*/
 struct mmu_client {/*{{{*/
 	int running;
 	int sock;
 	pid_t pid;
 	pthread_t thread;
+	int cpu; /* CPU of the last fault, -1 if unknown */
+	/* `lock` serializes updates to `map` and the REMAP and CHPROT
+	 * exchanges that install them.  `map` is NULL before CREATE_REQ
+	 * and in placeholders whose process has reconnected. */
+	pthread_mutex_t lock;
+	struct mmu_map *map;
+	/* The client's thread receives the acknowledgement of the
+	 * exchange in progress and sets `acked`; `dead` is set once it
+	 * stops reading, and no acknowledgement will come. */
+	pthread_mutex_t ack_lock;
+	pthread_cond_t ack_cond;
+	int acked;
+	int dead;
+	pthread_mutex_t send_lock; /* keeps messages to the client whole */
+	int qos; /* UVM_QOS_*, written holding `jobs_lock` */
+	int njobs; /* requests queued or being serviced */
+	struct mmu_job *exit_job; /* EXIT_REQ, queued once `njobs` is 0 */
+};/*}}}*/
+struct mmu_job {/*{{{*/
+	/* a request read by the client's thread, awaiting a worker */
+	struct mmu_client *c;
+	struct mmu_job *next;
+	int qos;
+	uint64_t vfinish;
+	uint64_t t_recv; /* timed SEGV_REQ only, else 0 */
+	uint64_t t_queued; /* SEGV_REQ only */
+	size_t len;
+	char req[sizeof(struct mmu_proto_syslog_batch_req)];
 };/*}}}*/
 static struct mmu_data *mmu = NULL;
 const char *pmem = NULL;
 static size_t PAGESIZE = 0;
+static const char *opt_sock_path = NULL;
+static const char *opt_pmem_dir = NULL;
+static const char *opt_syslog_fn = NULL;
+static const char *opt_ckpt_dir = NULL;
+static const char *mmu_fault_stages[MMU_FAULT_STAGES] = {"send", "queue",
+		"pager", "ack", "disk", "mmu"};
+static const char *mmu_qos_names[UVM_QOS_CLASSES] = {"latency", "normal",
+		"batch"};
+/* time the worker servicing a timed fault spends in round trips and
+ * disk copies; `on` is 0 while it services anything else */
+static __thread struct {
+	int on;
+	uint64_t ack;
+	uint64_t disk;
+} mmu_fault_timer;
+/* the part of the syslog record a worker is gathering that is not
+ * written yet: copies of earlier slices for the syslog file, or their
+ * hex for stdout */
+static __thread struct {
+	char *buf;
+	size_t len;
+	size_t cap;
+} mmu_syslog_rec;
 
 /****************************************************************************
  * static function declarations
  ***************************************************************************/
 static void mmu_destroy(void);
+static void mmu_ids_init(int next);
+static int mmu_id_alloc(pid_t pid);
+static void mmu_id_free(pid_t pid);
+static void mmu_syslog_append(const struct iovec *iov, int iovcnt,
+		int hex);
 static void mmu_client_destroy(struct mmu_client *c);
+static void mmu_client_free(struct mmu_client *c);
+static void mmu_client_fail(struct mmu_client *c);
 static void mmu_shutdown_action(int signum, siginfo_t *si, void *context);
 static void mmu_accept_loop(void);
 static void * mmu_client_thread(void *vclient);
+static void * mmu_worker_thread(void *data);
+static int mmu_job_read(struct mmu_client *c, uint32_t type);
+static void mmu_job_queue(struct mmu_job *job);
+static void mmu_job_push(struct mmu_job *job);
+static struct mmu_job * mmu_job_pop(void);
+static void mmu_job_run(struct mmu_job *job);
+static void mmu_job_done(struct mmu_job *job);
+static void mmu_client_ack(struct mmu_client *c);
+static void mmu_client_stop(struct mmu_client *c);
+static int mmu_client_send(struct mmu_client *c, const void *msg,
+		size_t len);
+static int mmu_client_exchange(struct mmu_client *c, const void *msg,
+		size_t len);
+static uint32_t * mmu_refmap_entry(pid_t pid, void *vaddr);
+struct mmu_client * mmu_client_search(pid_t pid);
+static struct mmu_client * mmu_client_find(pid_t pid);
+static struct mmu_client * mmu_client_new(int sock, pid_t pid);
+static struct mmu_map * mmu_map_new(void);
+static struct mmu_client * mmu_client_lock(pid_t pid);
+static void mmu_map_set(struct mmu_client *c, void *vaddr, int frame,
+		int prot);
+static void mmu_send_remap(struct mmu_client *c, void *vaddr, int frame,
+		int prot);
+static void mmu_send_chprot(struct mmu_client *c, void *vaddr, int prot);
+static void mmu_send_detach(struct mmu_client *c);
+static void mmu_ckpt_action(int signum, siginfo_t *si, void *context);
+static void mmu_detach_clients(void);
+static void mmu_checkpoint(int final);
+static void mmu_restore(void);
+static int mmu_ckpt_open(const char *name, int flags);
+static int mmu_ckpt_copy(int fd, const char *mem, uint8_t *flags, int n,
+		int *ncopied);
+static int mmu_write_all(int fd, const void *buf, size_t len);
+static int mmu_read_all(int fd, void *buf, size_t len);
+static int mmu_pwrite_all(int fd, const void *buf, size_t len, off_t off);
+static int mmu_pread_all(int fd, void *buf, size_t len, off_t off);
+#ifdef MMUFREE
+void pager_free(void);
+#endif
 
 int get_pid_id(pid_t pid) {
 	int i = 0;
-	for(; id2pid[i] != pid; i++);
+	for(; i < UINT8_MAX && id2pid[i] != pid; i++);
 	return i;
 }
 
+void mmu_ids_init(int next)/*{{{*/
+{
+	/* queues the ids `id2pid` leaves free, counting up from `next` */
+	freeids_head = 0;
+	freeids_count = 0;
+	for(int i = 0; i < MMU_PROTO_REFMAP_SLOTS; ++i) {
+		int id = (next + i) % MMU_PROTO_REFMAP_SLOTS;
+		if(id2pid[id] == -1) freeids[freeids_count++] = (uint8_t)id;
+	}
+}/*}}}*/
+
+int mmu_id_alloc(pid_t pid)/*{{{*/
+{
+	/* returns the id given to `pid`, or -1 if none is free */
+	pthread_mutex_lock(&ids_lock);
+	int id = -1;
+	if(freeids_count > 0) {
+		id = freeids[freeids_head];
+		freeids_head = (freeids_head + 1) % MMU_PROTO_REFMAP_SLOTS;
+		freeids_count--;
+		id2pid[id] = pid;
+	}
+	pthread_mutex_unlock(&ids_lock);
+	return id;
+}/*}}}*/
+
+void mmu_id_free(pid_t pid)/*{{{*/
+{
+	/* once the pager has forgotten `pid`; its reference map slice is
+	 * cleared for the next client given the id */
+	pthread_mutex_lock(&ids_lock);
+	int id = get_pid_id(pid);
+	if(id < UINT8_MAX) {
+		memset(mmu->refmap + id * mmu->refmap_pages, 0,
+				mmu->refmap_pages * sizeof(mmu->refmap[0]));
+		id2pid[id] = -1;
+		int tail = (freeids_head + freeids_count) % MMU_PROTO_REFMAP_SLOTS;
+		freeids[tail] = (uint8_t)id;
+		freeids_count++;
+	}
+	pthread_mutex_unlock(&ids_lock);
+}/*}}}*/
+
 /****************************************************************************
  * initialization functions {{{
  ***************************************************************************/
@@ -72,6 +372,14 @@ static void mmu_init_disk(int nblocks);
 static void mmu_init_pmem(int npages);
 static void mmu_init_sock(void);
 static void mmu_init_sigs(void);
+static void mmu_init_syslog(void);
+static void mmu_init_numa(void);
+static void mmu_init_ckpt(void);
+static void mmu_init_reclaim(void);
+static void mmu_init_workers(void);
+static void * mmu_reclaim_thread(void *data);
+static int mmu_parse_list(const char *fn, int *ids, int max);
+static void mmu_notify_ready(void);
 
 void mmu_init(int npages, int nblocks)/*{{{*/
 {
@@ -81,58 +389,258 @@ void mmu_init(int npages, int nblocks)/*{{{*/
 	if(!mmu) logea(__FILE__, __LINE__, NULL);
 	mmu->running = 1;
 	mmu->npages = npages;
+	mmu->nblocks = nblocks;
 
 	mmu_init_disk(nblocks);
 	mmu_init_pmem(npages);
 	mmu_init_sock();
 	mmu_init_sigs();
+	mmu_init_syslog();
+	mmu_init_numa();
 	memset(mmu->sock2client, 0, MMU_MAX_SOCK*sizeof(mmu->sock2client[0]));
+	mmu_init_ckpt();
+	mmu_init_reclaim();
+	mmu_init_workers();
 }/*}}}*/
 
 void mmu_init_disk(int nblocks)/*{{{*/
 {
 	size_t disksz = PAGESIZE * nblocks;
-	mmu->disk = malloc(disksz);
-	if(!mmu->disk) logea(__FILE__, __LINE__, NULL);
-	logd(LOG_INFO, "%s: %zu bytes in %d blocks\n", __func__, disksz, nblocks);
+	const char *fn = getenv(MMU_SWAP_FILE_ENV);
+	mmu->swap_fd = -1;
+	mmu->iosched = NULL;
+	if(!fn || !fn[0]) {
+		mmu->disk = malloc(disksz);
+		if(!mmu->disk) logea(__FILE__, __LINE__, NULL);
+		logd(LOG_INFO, "%s: %zu bytes in %d blocks\n", __func__, disksz,
+				nblocks);
+		return;
+	}
+
+	mmu->disk = NULL;
+	mmu->swap_fd = open(fn, O_RDWR | O_CREAT, 0600);
+	if(mmu->swap_fd == -1) logea(__FILE__, __LINE__, fn);
+	struct stat st;
+	if(fstat(mmu->swap_fd, &st) == -1) logea(__FILE__, __LINE__, NULL);
+	if(S_ISREG(st.st_mode) && ftruncate(mmu->swap_fd, disksz) == -1)
+		logea(__FILE__, __LINE__, NULL);
+	const char *env = getenv(MMU_IOSCHED_DEPTH_ENV);
+	int depth = env ? atoi(env) : MMU_IOSCHED_DEPTH_DEFAULT;
+	env = getenv(MMU_IOSCHED_DELAY_ENV);
+	int delay = env ? atoi(env) : MMU_IOSCHED_DELAY_DEFAULT;
+	mmu->iosched = iosched_create(mmu->swap_fd, PAGESIZE, depth, delay);
+	if(!mmu->iosched) logea(__FILE__, __LINE__, NULL);
+	logd(LOG_INFO, "%s: %zu bytes in %d blocks in %s, queue depth %d, "
+			"delay %d ms\n", __func__, disksz, nblocks, fn, depth, delay);
 }/*}}}*/
 
 void mmu_init_pmem(int npages)/*{{{*/
 {
-	mmu->pmem_fn = strdup("mmu.pmem.img.XXXXXX");
+	const char *dir = opt_pmem_dir ? opt_pmem_dir : getenv(MMU_PMEM_DIR_ENV);
+	if(dir && dir[0]) {
+		size_t len = strlen(dir) + strlen(MMU_PMEM_TEMPLATE) + 2;
+		mmu->pmem_fn = malloc(len);
+		if(mmu->pmem_fn)
+			snprintf(mmu->pmem_fn, len, "%s/%s", dir, MMU_PMEM_TEMPLATE);
+	} else {
+		mmu->pmem_fn = strdup(MMU_PMEM_TEMPLATE);
+	}
 	if(mmu->pmem_fn == NULL) logea(__FILE__, __LINE__, NULL);
+	/* clients receive the path in `mmu_proto_create_rep`: */
+	if(strlen(mmu->pmem_fn) >= MMU_PROTO_PATH_MAX)
+		logea(__FILE__, __LINE__, "pmem path too long");
 	mmu->pmem_fd = mkstemp(mmu->pmem_fn);
 	if(mmu->pmem_fd == -1) logea(__FILE__, __LINE__, NULL);
 	logd(LOG_INFO, "%s: mmap fd %d path %s\n", __func__, mmu->pmem_fd,
 			mmu->pmem_fn);
 
 	size_t memsz = PAGESIZE * npages;
-	for(size_t i = 0; i < npages*PAGESIZE; ++i) {
-		write(mmu->pmem_fd, "z", 1);
+	char *page = malloc(PAGESIZE);
+	if(!page) logea(__FILE__, __LINE__, NULL);
+	memset(page, 'z', PAGESIZE);
+	for(int i = 0; i < npages; ++i) {
+		if(write(mmu->pmem_fd, page, PAGESIZE) != PAGESIZE)
+			logea(__FILE__, __LINE__, NULL);
 	}
+	free(page);
+
+	/* the reference map is zero-filled by extending the file */
+	mmu->refmap_pages = (UVM_MAXADDR - UVM_BASEADDR + 1) / PAGESIZE;
+	size_t refsz = MMU_PROTO_REFMAP_SLOTS * mmu->refmap_pages *
+			sizeof(uint32_t);
+	mmu->pmem_size = memsz + (refsz + PAGESIZE - 1) / PAGESIZE * PAGESIZE;
+	if(ftruncate(mmu->pmem_fd, mmu->pmem_size) == -1)
+		logea(__FILE__, __LINE__, NULL);
 
 	int prot = PROT_READ | PROT_WRITE;
-	mmu->pmem = mmap(NULL, memsz, prot, MAP_SHARED, mmu->pmem_fd, 0);
+	mmu->pmem = mmap(NULL, mmu->pmem_size, prot, MAP_SHARED,
+			mmu->pmem_fd, 0);
 	if(mmu->pmem == MAP_FAILED) logea(__FILE__, __LINE__, NULL);
 	pmem = mmu->pmem;
+	mmu->refmap = (uint32_t *)(mmu->pmem + memsz);
 	logd(LOG_INFO, "%s: %zu bytes in %d pages\n", __func__, memsz, npages);
 }/*}}}*/
 
+void mmu_init_numa(void)/*{{{*/
+{
+	mmu->ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if(mmu->ncpus < 1) mmu->ncpus = 1;
+	mmu->cpu2node = malloc(mmu->ncpus * sizeof(mmu->cpu2node[0]));
+	if(!mmu->cpu2node) logea(__FILE__, __LINE__, NULL);
+	for(int i = 0; i < mmu->ncpus; ++i) mmu->cpu2node[i] = -1;
+
+	mmu->nnodes = mmu_parse_list(MMU_NODE_DIR "/online", mmu->node_ids,
+			MMU_MAX_NODES);
+	if(mmu->nnodes <= 0) {
+		mmu->nnodes = 1;
+		mmu->node_ids[0] = 0;
+		for(int i = 0; i < mmu->ncpus; ++i) mmu->cpu2node[i] = 0;
+		logd(LOG_INFO, "%s: no NUMA topology, using one node\n", __func__);
+		return;
+	}
+	int *cpus = malloc(mmu->ncpus * sizeof(cpus[0]));
+	if(!cpus) logea(__FILE__, __LINE__, NULL);
+	for(int n = 0; n < mmu->nnodes; ++n) {
+		char fn[64];
+		snprintf(fn, sizeof(fn), MMU_NODE_DIR "/node%d/cpulist",
+				mmu->node_ids[n]);
+		int ncpus = mmu_parse_list(fn, cpus, mmu->ncpus);
+		for(int i = 0; i < ncpus; ++i) mmu->cpu2node[cpus[i]] = n;
+		logd(LOG_INFO, "%s: node %d has %d cpus\n", __func__,
+				mmu->node_ids[n], ncpus);
+	}
+	free(cpus);
+}/*}}}*/
+
+void mmu_init_ckpt(void)/*{{{*/
+{
+	mmu->ckpt_dir = opt_ckpt_dir ? opt_ckpt_dir : getenv(MMU_CKPT_DIR_ENV);
+	if(mmu->ckpt_dir && !mmu->ckpt_dir[0]) mmu->ckpt_dir = NULL;
+	if(mmu->ckpt_dir && !mmu->disk)
+		logea(__FILE__, __LINE__, "checkpoints need the swap in memory");
+	mmu->ckpt_requested = 0;
+	mmu->stopping = 0;
+	mmu->ckpt_seq = 0;
+	memset(mmu->detached, 0, sizeof(mmu->detached));
+	mmu->client_slab = slab_create("clients", sizeof(struct mmu_client));
+	mmu->map_slab = slab_create("maps",
+			mmu->refmap_pages * sizeof(struct mmu_map));
+	if(!mmu->client_slab || !mmu->map_slab)
+		logea(__FILE__, __LINE__, NULL);
+	/* writers first, or a busy client could hold a checkpoint off */
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&mmu->ckpt_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	/* everything is copied by the first checkpoint */
+	mmu->frame_flags = malloc(mmu->npages);
+	mmu->block_flags = malloc(mmu->nblocks);
+	if(!mmu->frame_flags || !mmu->block_flags)
+		logea(__FILE__, __LINE__, NULL);
+	memset(mmu->frame_flags, MMU_CKPT_DIRTY, mmu->npages);
+	memset(mmu->block_flags, MMU_CKPT_DIRTY, mmu->nblocks);
+	if(mmu->ckpt_dir)
+		logd(LOG_INFO, "%s: checkpoints in %s\n", __func__, mmu->ckpt_dir);
+}/*}}}*/
+
+void mmu_init_reclaim(void)/*{{{*/
+{
+	pthread_mutex_init(&mmu->reclaim_mutex, NULL);
+	pthread_cond_init(&mmu->reclaim_cond, NULL);
+	mmu->reclaim_wanted = 0;
+	mmu->reclaim_stop = 0;
+	if(pthread_create(&mmu->reclaim_thread, NULL, mmu_reclaim_thread,
+				NULL))
+		logea(__FILE__, __LINE__, NULL);
+}/*}}}*/
+
+void mmu_init_workers(void)/*{{{*/
+{
+	const char *env = getenv(MMU_WORKERS_ENV);
+	mmu->nworkers = env ? atoi(env) : MMU_WORKERS_DEFAULT;
+	if(mmu->nworkers < 1) mmu->nworkers = 1;
+	if(mmu->nworkers > MMU_MAX_WORKERS) mmu->nworkers = MMU_MAX_WORKERS;
+	mmu->job_slab = slab_create("jobs", sizeof(struct mmu_job));
+	mmu->workers = malloc(mmu->nworkers * sizeof(mmu->workers[0]));
+	if(!mmu->job_slab || !mmu->workers) logea(__FILE__, __LINE__, NULL);
+	pthread_mutex_init(&mmu->jobs_lock, NULL);
+	pthread_cond_init(&mmu->jobs_cond, NULL);
+	pthread_cond_init(&mmu->jobs_idle, NULL);
+	int weights[UVM_QOS_CLASSES] = MMU_QOS_WEIGHTS_DEFAULT;
+	env = getenv(MMU_QOS_WEIGHTS_ENV);
+	for(int i = 0; env && *env && i < UVM_QOS_CLASSES; ++i) {
+		char *end;
+		long w = strtol(env, &end, 10);
+		if(end == env) break;
+		weights[i] = w < 1 ? 1 : (w > MMU_QOS_UNIT ? MMU_QOS_UNIT : w);
+		env = *end == ',' ? end + 1 : end;
+	}
+	for(int i = 0; i < UVM_QOS_CLASSES; ++i) {
+		mmu->qos[i].weight = weights[i];
+		mmu->qos[i].jobs = NULL;
+		mmu->qos[i].jobs_tail = NULL;
+		mmu->qos[i].vfinish = 0;
+		hist_init(&mmu->qos[i].fault_hist);
+	}
+	mmu->qos_vtime = 0;
+	mmu->jobs_queued = 0;
+	mmu->jobs_stop = 0;
+	for(int i = 0; i < MMU_FAULT_STAGES; ++i)
+		hist_init(&mmu->fault_hist[i]);
+	for(int i = 0; i < mmu->nworkers; ++i) {
+		if(pthread_create(&mmu->workers[i], NULL, mmu_worker_thread,
+					NULL))
+			logea(__FILE__, __LINE__, NULL);
+	}
+	logd(LOG_INFO, "%s: %d workers, class weights %d/%d/%d\n", __func__,
+			mmu->nworkers, weights[UVM_QOS_LATENCY],
+			weights[UVM_QOS_NORMAL], weights[UVM_QOS_BATCH]);
+}/*}}}*/
+
+int mmu_parse_list(const char *fn, int *ids, int max)/*{{{*/
+{
+	/* parses the kernel's list format, e.g., "0-3,8,10-11"; ids
+	 * outside [0, max) are dropped */
+	FILE *fp = fopen(fn, "r");
+	if(!fp) return -1;
+	int cnt = 0;
+	int lo, hi;
+	char sep;
+	while(fscanf(fp, "%d", &lo) == 1) {
+		hi = lo;
+		if(fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+			if(fscanf(fp, "%d", &hi) != 1) break;
+			if(fscanf(fp, "%c", &sep) != 1) sep = 0;
+		}
+		for(int id = lo; id <= hi; ++id) {
+			if(id >= 0 && id < max && cnt < max) ids[cnt++] = id;
+		}
+		if(sep != ',') break;
+	}
+	fclose(fp);
+	return cnt;
+}/*}}}*/
+
 void mmu_init_sock(void)/*{{{*/
 {
+	mmu->sock_path = opt_sock_path ? opt_sock_path : mmu_proto_unix_path();
+	if(strlen(mmu->sock_path) >= MMU_PROTO_PATH_MAX)
+		logea(__FILE__, __LINE__, "socket path too long");
 	mmu->sock = socket(AF_UNIX, SOCK_STREAM, 0);
 	if(mmu->sock == -1)
 		logea(__FILE__, __LINE__, NULL);
 	struct sockaddr_un addr;
 	addr.sun_family = AF_UNIX;
 	addr.sun_path[0] = '\0';
-	strcat(addr.sun_path, MMU_PROTO_UNIX_PATH);
+	strcat(addr.sun_path, mmu->sock_path);
 	if(bind(mmu->sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
 		logea(__FILE__, __LINE__, NULL);
 	if(listen(mmu->sock, 32) == -1)
 		logea(__FILE__, __LINE__, NULL);
 	logd(LOG_INFO, "%s: unix socket %d at %s\n", __func__, mmu->sock,
-			MMU_PROTO_UNIX_PATH);
+			mmu->sock_path);
 }/*}}}*/
 
 void mmu_init_sigs(void)/*{{{*/
@@ -143,6 +651,35 @@ void mmu_init_sigs(void)/*{{{*/
 	new.sa_sigaction = mmu_shutdown_action;
 	sigaction(SIGINT, &new, NULL);
 	logd(LOG_INFO, "%s: SIGINT triggers shutdown\n", __func__);
+	new.sa_sigaction = mmu_ckpt_action;
+	sigaction(SIGUSR1, &new, NULL);
+	/* clients may die while the pager is talking to them: */
+	signal(SIGPIPE, SIG_IGN);
+}
+/*}}}*/
+
+void mmu_init_syslog(void)/*{{{*/
+{
+	pthread_mutex_init(&mmu->syslog_mutex, NULL);
+	mmu->syslog_fd = -1;
+	const char *fn = opt_syslog_fn ? opt_syslog_fn : getenv(MMU_SYSLOG_ENV);
+	if(!fn || !fn[0]) return;
+	mmu->syslog_fd = open(fn, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(mmu->syslog_fd == -1) logea(__FILE__, __LINE__, NULL);
+	logd(LOG_INFO, "%s: syslog records to %s\n", __func__, fn);
+}
+/*}}}*/
+
+void mmu_notify_ready(void)/*{{{*/
+{
+	char *env = getenv(MMU_READY_FD_ENV);
+	if(!env) return;
+	int fd = atoi(env);
+	const char *msg = "READY\n";
+	if(write(fd, msg, strlen(msg)) != strlen(msg))
+		loge(LOG_WARN, __FILE__, __LINE__);
+	close(fd);
+	logd(LOG_INFO, "%s: notified fd %d\n", __func__, fd);
 }
 /*}}}*/
 /*}}}*/
@@ -154,16 +691,124 @@ void mmu_destroy(void)/*{{{*/
 {
 	logd(LOG_DEBUG, "%s: starting\n", __func__);
 	assert(mmu);
+	mmu->running = 0;
+	/* detached clients reconnect as soon as their sockets close */
+	close(mmu->sock);
+	unlink(mmu->sock_path);
 	unlink(mmu->pmem_fn);
 	free(mmu->pmem_fn);
+	/* workers waiting for acknowledgements give up, and drop the
+	 * requests still queued */
+	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
+		struct mmu_client *c = mmu->sock2client[i];
+		if(!c) continue;
+		pthread_mutex_lock(&c->ack_lock);
+		c->dead = 1;
+		pthread_cond_broadcast(&c->ack_cond);
+		pthread_mutex_unlock(&c->ack_lock);
+	}
+	pthread_mutex_lock(&mmu->jobs_lock);
+	mmu->jobs_stop = 1;
+	pthread_cond_broadcast(&mmu->jobs_cond);
+	pthread_mutex_unlock(&mmu->jobs_lock);
+	for(int i = 0; i < mmu->nworkers; ++i) {
+		/* a worker gets here if a pid is not found */
+		if(pthread_equal(mmu->workers[i], pthread_self())) continue;
+		pthread_join(mmu->workers[i], NULL);
+	}
 	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
 		if(!mmu->sock2client[i]) continue;
 		mmu_client_destroy(mmu->sock2client[i]);
 	}
-	munmap(mmu->pmem, mmu->npages * PAGESIZE);
+	for(int i = 0; i < UINT8_MAX; ++i) {
+		struct mmu_client *c = mmu->detached[i];
+		if(!c) continue;
+		mmu_client_free(c);
+	}
+	pthread_mutex_lock(&mmu->reclaim_mutex);
+	mmu->reclaim_stop = 1;
+	pthread_cond_signal(&mmu->reclaim_cond);
+	pthread_mutex_unlock(&mmu->reclaim_mutex);
+	pthread_join(mmu->reclaim_thread, NULL);
+	pthread_cond_destroy(&mmu->reclaim_cond);
+	pthread_mutex_destroy(&mmu->reclaim_mutex);
+	struct pager_reclaim_stats stats;
+	pager_reclaim_stats(&stats);
+	if(stats.wmark_low)
+		fprintf(stderr, "reclaim: watermarks %d/%d, %ld wakeups, "
+				"%ld frames freed, %ld written, %ld direct\n",
+				stats.wmark_low, stats.wmark_high, stats.wakeups,
+				stats.frames, stats.written, stats.direct);
+	struct pager_swapra_stats rastats;
+	pager_swapra_stats(&rastats);
+	if(rastats.window)
+		fprintf(stderr, "readahead: window %d, %ld pages read, "
+				"%ld hits (%.1f%%)\n", rastats.window, rastats.reads,
+				rastats.hits, rastats.reads ?
+				100.0 * rastats.hits / rastats.reads : 0.0);
+	struct pager_uniform_stats ustats;
+	pager_uniform_stats(&ustats);
+	if(ustats.impl)
+		fprintf(stderr, "uniform: %s, %ld pages checked, %ld not "
+				"written\n", ustats.impl, ustats.checked, ustats.pages);
+	int qos_used = 0;
+	for(int i = 0; i < UVM_QOS_CLASSES; ++i)
+		if(i != UVM_QOS_NORMAL && mmu->qos[i].fault_hist.count) qos_used = 1;
+	if(qos_used) {
+		fprintf(stderr, "qos: faults per class, weights %d/%d/%d\n",
+				mmu->qos[UVM_QOS_LATENCY].weight,
+				mmu->qos[UVM_QOS_NORMAL].weight,
+				mmu->qos[UVM_QOS_BATCH].weight);
+		logd(LOG_INFO, "qos: faults per class\n");
+		for(int i = 0; i < UVM_QOS_CLASSES; ++i) {
+			hist_print(stderr, mmu_qos_names[i], &mmu->qos[i].fault_hist);
+			hist_log(LOG_INFO, mmu_qos_names[i], &mmu->qos[i].fault_hist);
+		}
+	}
+	if(mmu->iosched) {
+		/* the reclaim thread and the workers no longer write */
+		struct iosched_stats iostats;
+		if(iosched_flush(mmu->iosched)) loge(LOG_WARN, __FILE__, __LINE__);
+		iosched_stats(mmu->iosched, &iostats);
+		fprintf(stderr, "iosched: depth %d, %ld pages written in %ld "
+				"writes (%.2f pages per write), %ld coalesced, "
+				"%ld flushes of %.1f pages (max %d), %ld reads, "
+				"%ld from the queue\n", iostats.depth, iostats.written,
+				iostats.ios, iostats.ios ?
+				(double)iostats.written / iostats.ios : 0.0,
+				iostats.coalesced, iostats.flushes, iostats.flushes ?
+				(double)iostats.queued / iostats.flushes : 0.0,
+				iostats.queued_max, iostats.reads, iostats.read_hits);
+		if(iosched_destroy(mmu->iosched)) loge(LOG_WARN, __FILE__, __LINE__);
+		close(mmu->swap_fd);
+	}
+	if(mmu->fault_hist[MMU_FAULT_MMU].count) {
+		fprintf(stderr, "faults: stages seen by the MMU\n");
+		logd(LOG_INFO, "faults: stages seen by the MMU\n");
+		for(int i = 0; i < MMU_FAULT_STAGES; ++i) {
+			hist_print(stderr, mmu_fault_stages[i], &mmu->fault_hist[i]);
+			hist_log(LOG_INFO, mmu_fault_stages[i], &mmu->fault_hist[i]);
+		}
+	}
+	#ifdef MMUFREE
+	/* after the reclaim thread, which calls into the pager */
+	pager_free();
+	#endif
+	pthread_rwlock_destroy(&mmu->ckpt_lock);
+	slab_destroy(mmu->client_slab);
+	slab_destroy(mmu->map_slab);
+	slab_destroy(mmu->job_slab);
+	free(mmu->workers);
+	pthread_cond_destroy(&mmu->jobs_idle);
+	pthread_cond_destroy(&mmu->jobs_cond);
+	pthread_mutex_destroy(&mmu->jobs_lock);
+	free(mmu->cpu2node);
+	free(mmu->frame_flags);
+	free(mmu->block_flags);
+	munmap(mmu->pmem, mmu->pmem_size);
 	free(mmu->disk);
-	close(mmu->sock);
-	unlink(MMU_PROTO_UNIX_PATH);
+	if(mmu->syslog_fd != -1) close(mmu->syslog_fd);
+	pthread_mutex_destroy(&mmu->syslog_mutex);
 	free(mmu);
 	mmu = NULL;
 }
@@ -172,7 +817,16 @@ void mmu_destroy(void)/*{{{*/
 void mmu_shutdown_action(int signum, siginfo_t *si, void *context)/*{{{*/
 {
 	assert(si->si_signo == SIGINT);
-	mmu->running = 0;
+	/* with checkpoints, the accept loop stops after the last one */
+	if(mmu->ckpt_dir) mmu->stopping = 1;
+	else mmu->running = 0;
+}
+/*}}}*/
+
+void mmu_ckpt_action(int signum, siginfo_t *si, void *context)/*{{{*/
+{
+	assert(si->si_signo == SIGUSR1);
+	mmu->ckpt_requested = 1;
 }
 /*}}}*/
 /*}}}*/
@@ -180,6 +834,30 @@ void mmu_shutdown_action(int signum, siginfo_t *si, void *context)/*{{{*/
 /****************************************************************************
  * main loop and client functions {{{
  ***************************************************************************/
+void * mmu_reclaim_thread(void *data)/*{{{*/
+{
+	sigset_t sigset;
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+	pthread_mutex_lock(&mmu->reclaim_mutex);
+	for(;;) {
+		while(!mmu->reclaim_wanted && !mmu->reclaim_stop)
+			pthread_cond_wait(&mmu->reclaim_cond, &mmu->reclaim_mutex);
+		if(mmu->reclaim_stop) break;
+		mmu->reclaim_wanted = 0;
+		pthread_mutex_unlock(&mmu->reclaim_mutex);
+		/* pager tables must not change during a checkpoint */
+		pthread_rwlock_rdlock(&mmu->ckpt_lock);
+		if(mmu->running) pager_reclaim();
+		pthread_rwlock_unlock(&mmu->ckpt_lock);
+		pthread_mutex_lock(&mmu->reclaim_mutex);
+	}
+	pthread_mutex_unlock(&mmu->reclaim_mutex);
+	return NULL;
+}/*}}}*/
+
 void mmu_accept_loop(void)/*{{{*/
 {
 	while(mmu->running) {
@@ -187,15 +865,22 @@ void mmu_accept_loop(void)/*{{{*/
 		socklen_t addrlen = sizeof(addr);
 		logd(LOG_DEBUG, "%s: accepting connection\n", __func__);
 		int nsock = accept(mmu->sock, (struct sockaddr *)&addr, &addrlen);
-		if(nsock == -1) continue;
+		if(nsock == -1) {
+			/* signals are only delivered to this thread */
+			if(mmu->ckpt_requested) {
+				mmu->ckpt_requested = 0;
+				mmu_checkpoint(0);
+			}
+			if(mmu->stopping) {
+				mmu_detach_clients();
+				mmu_checkpoint(1);
+			}
+			continue;
+		}
 		logd(LOG_DEBUG, "%s: sock %d\n", __func__, nsock);
 		logd(LOG_DEBUG, "%s: creating thread\n", __func__);
-		struct mmu_client *c = malloc(sizeof(*c));
-		if(!c) logea(__FILE__, __LINE__, NULL);
+		struct mmu_client *c = mmu_client_new(nsock, 0);
 		mmu->sock2client[nsock] = c;
-		c->running = 1;
-		c->sock = nsock;
-		c->pid = 0;
 		pthread_create(&c->thread, NULL, mmu_client_thread, c);
 		pthread_detach(c->thread);
 	}
@@ -203,15 +888,32 @@ void mmu_accept_loop(void)/*{{{*/
 }/*}}}*/
 
 static void mmu_client_log(const struct mmu_client *c, const char *fname, const char *msg);
-static void mmu_client_create(struct mmu_client *c);
-static void mmu_client_extend(struct mmu_client *c);
-static void mmu_client_syslog(struct mmu_client *c);
-static void mmu_client_segv(struct mmu_client *c);
-static void mmu_client_exit(struct mmu_client *c);
+static void mmu_client_create(struct mmu_client *c, const void *data);
+static void mmu_client_fork(struct mmu_client *c, const void *data);
+static uint64_t mmu_client_refmap_off(int id);
+static void mmu_client_extend(struct mmu_client *c, const void *data);
+static void mmu_client_shm(struct mmu_client *c, const void *data);
+static void mmu_client_release(struct mmu_client *c, const void *data);
+static void mmu_client_map(struct mmu_client *c, const void *data);
+static void mmu_client_advise(struct mmu_client *c, const void *data);
+static void mmu_client_syslog(struct mmu_client *c, const void *data);
+static void mmu_client_syslog_batch(struct mmu_client *c, const void *data);
+static void mmu_client_segv(struct mmu_client *c, const void *data,
+		uint64_t t_recv);
+static void mmu_fault_account(const struct mmu_proto_segv_req *req,
+		const struct mmu_proto_segv_rep *rep);
+static void mmu_client_exit(struct mmu_client *c, const void *data);
 
 void * mmu_client_thread(void *vclient)/*{{{*/
 {
+	/* Reads the client's messages: acknowledgements go to the thread
+	 * waiting for them, requests to the workers. */
 	struct mmu_client *c = vclient;
+	sigset_t sigset;
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 	while(mmu->running && c->running) {
 		mmu_client_log(c, __func__, "recv");
 		uint32_t type;
@@ -222,105 +924,580 @@ void * mmu_client_thread(void *vclient)/*{{{*/
 		}
 		if(cnt != sizeof(type)) goto out_client;
 		switch(type) {
-		case MMU_PROTO_CREATE_REQ:
-			mmu_client_create(c);
-			break;
-		case MMU_PROTO_EXTEND_REQ:
-			mmu_client_extend(c);
-			break;
-		case MMU_PROTO_SYSLOG_REQ:
-			mmu_client_syslog(c);
-			break;
-		case MMU_PROTO_SEGV_REQ:
-			mmu_client_segv(c);
-			break;
 		case MMU_PROTO_REMAP_REQ:
 		case MMU_PROTO_CHPROT_REQ:
-			/* these messages are handled by the pager thread */
-			break;
-		case MMU_PROTO_EXIT_REQ:
-			mmu_client_exit(c);
+		case MMU_PROTO_DETACH_REQ:
+			/* all three are a bare type */
+			if(recv(c->sock, &type, sizeof(type), 0) != sizeof(type))
+				goto out_client;
+			mmu_client_ack(c);
 			break;
 		default:
-			mmu_client_log(c, __func__, "invalid message type");
-			goto out_client;
+			if(mmu_job_read(c, type)) goto out_client;
 			break;
 		}
 	}
+	mmu_client_stop(c);
 	mmu_client_log(c, __func__, "finished");
-	free(c);
+	/* after EXIT_REQ, or if the MMU is going away */
+	mmu->sock2client[c->sock] = NULL;
+	close(c->sock);
+	mmu_client_free(c);
 	pthread_exit(NULL);
 
 	out_client:
+	mmu_client_stop(c);
 	mmu_client_destroy(c);
+	/* `mmu_client_stop` waited for the client's jobs */
+	mmu_client_free(c);
 	pthread_exit(NULL);
 }/*}}}*/
 
+void * mmu_worker_thread(void *data)/*{{{*/
+{
+	sigset_t sigset;
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+	pthread_mutex_lock(&mmu->jobs_lock);
+	for(;;) {
+		while(!mmu->jobs_queued && !mmu->jobs_stop)
+			pthread_cond_wait(&mmu->jobs_cond, &mmu->jobs_lock);
+		struct mmu_job *job = mmu_job_pop();
+		if(!job) break;
+		pthread_mutex_unlock(&mmu->jobs_lock);
+		mmu_job_run(job);
+		pthread_mutex_lock(&mmu->jobs_lock);
+		mmu_job_done(job);
+	}
+	pthread_mutex_unlock(&mmu->jobs_lock);
+	return NULL;
+}/*}}}*/
+
+int mmu_job_read(struct mmu_client *c, uint32_t type)/*{{{*/
+{
+	/* Reads the request of `type` at the head of the socket and
+	 * queues it.  Returns -1 if the client is gone or the request is
+	 * invalid. */
+	size_t len;
+	switch(type) {
+	case MMU_PROTO_CREATE_REQ:
+		len = sizeof(struct mmu_proto_create_req); break;
+	case MMU_PROTO_FORK_REQ:
+		len = sizeof(struct mmu_proto_fork_req); break;
+	case MMU_PROTO_EXTEND_REQ:
+		len = sizeof(struct mmu_proto_extend_req); break;
+	case MMU_PROTO_SHM_CREATE_REQ:
+	case MMU_PROTO_SHM_ATTACH_REQ:
+		len = sizeof(struct mmu_proto_shm_req); break;
+	case MMU_PROTO_RELEASE_REQ:
+		len = sizeof(struct mmu_proto_release_req); break;
+	case MMU_PROTO_ADVISE_REQ:
+		len = sizeof(struct mmu_proto_advise_req); break;
+	case MMU_PROTO_MAP_REQ:
+	case MMU_PROTO_UNMAP_REQ:
+		len = sizeof(struct mmu_proto_map_req); break;
+	case MMU_PROTO_SYSLOG_REQ:
+		len = sizeof(struct mmu_proto_syslog_req); break;
+	case MMU_PROTO_SYSLOG_BATCH_REQ:
+		len = MMU_PROTO_SYSLOG_BATCH_SIZE(0); break;
+	case MMU_PROTO_SEGV_REQ:
+		len = sizeof(struct mmu_proto_segv_req); break;
+	case MMU_PROTO_EXIT_REQ:
+		len = sizeof(struct mmu_proto_exit_req); break;
+	default:
+		mmu_client_log(c, __func__, "invalid message type");
+		return -1;
+	}
+	struct mmu_job *job = slab_alloc(mmu->job_slab);
+	if(!job) logea(__FILE__, __LINE__, NULL);
+	job->c = c;
+	if(recv(c->sock, job->req, len, MSG_WAITALL) != (ssize_t)len)
+		goto out_job;
+	if(type == MMU_PROTO_SYSLOG_BATCH_REQ) {
+		struct mmu_proto_syslog_batch_req *req = (void *)job->req;
+		if(req->count > MMU_PROTO_SYSLOG_BATCH_MAX) {
+			mmu_client_log(c, __func__, "batch too large");
+			goto out_job;
+		}
+		size_t recsz = req->count * sizeof(req->recs[0]);
+		if(recsz > 0 && recv(c->sock, req->recs, recsz, MSG_WAITALL) !=
+				(ssize_t)recsz)
+			goto out_job;
+		len += recsz;
+	}
+	job->t_recv = 0;
+	job->t_queued = 0;
+	if(type == MMU_PROTO_SEGV_REQ) {
+		job->t_queued = hist_now();
+		if(((struct mmu_proto_segv_req *)job->req)->t_fault)
+			job->t_recv = job->t_queued;
+	}
+	job->len = len;
+	mmu_job_queue(job);
+	return 0;
+
+	out_job:
+	slab_free(mmu->job_slab, job);
+	return -1;
+}/*}}}*/
+
+void mmu_job_queue(struct mmu_job *job)/*{{{*/
+{
+	/* EXIT_REQ waits for the client's other requests, which may
+	 * still need the client's pages. */
+	struct mmu_client *c = job->c;
+	uint32_t type = ((struct mmu_proto_hdr *)job->req)->type;
+	pthread_mutex_lock(&mmu->jobs_lock);
+	if(mmu->jobs_stop) {
+		pthread_mutex_unlock(&mmu->jobs_lock);
+		slab_free(mmu->job_slab, job);
+		return;
+	}
+	if(type == MMU_PROTO_EXIT_REQ && c->njobs) {
+		c->exit_job = job;
+		pthread_mutex_unlock(&mmu->jobs_lock);
+		return;
+	}
+	c->njobs++;
+	mmu_job_push(job);
+	pthread_mutex_unlock(&mmu->jobs_lock);
+}/*}}}*/
+
+void mmu_job_push(struct mmu_job *job)/*{{{*/
+{
+	/* `mmu->jobs_lock` must be held.  Stamps `job` and appends it to
+	 * its client's class queue. */
+	struct mmu_qos *q = &mmu->qos[job->c->qos];
+	job->qos = job->c->qos;
+	uint64_t start = q->vfinish > mmu->qos_vtime ? q->vfinish :
+			mmu->qos_vtime;
+	job->vfinish = start + MMU_QOS_UNIT / q->weight;
+	q->vfinish = job->vfinish;
+	job->next = NULL;
+	if(q->jobs_tail) q->jobs_tail->next = job;
+	else q->jobs = job;
+	q->jobs_tail = job;
+	mmu->jobs_queued++;
+	pthread_cond_signal(&mmu->jobs_cond);
+}/*}}}*/
+
+struct mmu_job * mmu_job_pop(void)/*{{{*/
+{
+	/* `mmu->jobs_lock` must be held.  Removes the queued request
+	 * with the earliest stamp; returns NULL if there is none. */
+	struct mmu_qos *best = NULL;
+	for(int i = 0; i < UVM_QOS_CLASSES; ++i) {
+		struct mmu_qos *q = &mmu->qos[i];
+		if(q->jobs && (!best || q->jobs->vfinish < best->jobs->vfinish))
+			best = q;
+	}
+	if(!best) return NULL;
+	struct mmu_job *job = best->jobs;
+	best->jobs = job->next;
+	if(!best->jobs) best->jobs_tail = NULL;
+	mmu->jobs_queued--;
+	mmu->qos_vtime = job->vfinish;
+	return job;
+}/*}}}*/
+
+void mmu_job_run(struct mmu_job *job)/*{{{*/
+{
+	/* requests are serviced between checkpoints */
+	struct mmu_client *c = job->c;
+	pthread_rwlock_rdlock(&mmu->ckpt_lock);
+	if(!mmu->running) {
+		/* after the final checkpoint; the client resends the
+		 * request to the next MMU */
+		pthread_rwlock_unlock(&mmu->ckpt_lock);
+		return;
+	}
+	switch(((struct mmu_proto_hdr *)job->req)->type) {
+	case MMU_PROTO_CREATE_REQ:
+		mmu_client_create(c, job->req);
+		break;
+	case MMU_PROTO_FORK_REQ:
+		mmu_client_fork(c, job->req);
+		break;
+	case MMU_PROTO_EXTEND_REQ:
+		mmu_client_extend(c, job->req);
+		break;
+	case MMU_PROTO_SHM_CREATE_REQ:
+	case MMU_PROTO_SHM_ATTACH_REQ:
+		mmu_client_shm(c, job->req);
+		break;
+	case MMU_PROTO_RELEASE_REQ:
+		mmu_client_release(c, job->req);
+		break;
+	case MMU_PROTO_ADVISE_REQ:
+		mmu_client_advise(c, job->req);
+		break;
+	case MMU_PROTO_MAP_REQ:
+	case MMU_PROTO_UNMAP_REQ:
+		mmu_client_map(c, job->req);
+		break;
+	case MMU_PROTO_SYSLOG_REQ:
+		mmu_client_syslog(c, job->req);
+		break;
+	case MMU_PROTO_SYSLOG_BATCH_REQ:
+		mmu_client_syslog_batch(c, job->req);
+		break;
+	case MMU_PROTO_SEGV_REQ:
+		mmu_client_segv(c, job->req, job->t_recv);
+		hist_add(&mmu->qos[job->qos].fault_hist,
+				hist_now() - job->t_queued);
+		break;
+	case MMU_PROTO_EXIT_REQ:
+		mmu_client_exit(c, job->req);
+		break;
+	}
+	pthread_rwlock_unlock(&mmu->ckpt_lock);
+}/*}}}*/
+
+void mmu_job_done(struct mmu_job *job)/*{{{*/
+{
+	/* `mmu->jobs_lock` must be held. */
+	struct mmu_client *c = job->c;
+	slab_free(mmu->job_slab, job);
+	if(--c->njobs) return;
+	if(c->exit_job && !mmu->jobs_stop) {
+		job = c->exit_job;
+		c->exit_job = NULL;
+		c->njobs++;
+		mmu_job_push(job);
+		return;
+	}
+	pthread_cond_broadcast(&mmu->jobs_idle);
+}/*}}}*/
+
+void mmu_client_ack(struct mmu_client *c)/*{{{*/
+{
+	pthread_mutex_lock(&c->ack_lock);
+	c->acked = 1;
+	pthread_cond_signal(&c->ack_cond);
+	pthread_mutex_unlock(&c->ack_lock);
+}/*}}}*/
+
+void mmu_client_stop(struct mmu_client *c)/*{{{*/
+{
+	/* Called by the client's thread once it stops reading.  Threads
+	 * waiting for an acknowledgement give up, and the client's
+	 * requests finish before it is freed or destroyed. */
+	pthread_mutex_lock(&c->ack_lock);
+	c->dead = 1;
+	pthread_cond_broadcast(&c->ack_cond);
+	pthread_mutex_unlock(&c->ack_lock);
+	pthread_mutex_lock(&mmu->jobs_lock);
+	while(c->njobs)
+		pthread_cond_wait(&mmu->jobs_idle, &mmu->jobs_lock);
+	if(c->exit_job) slab_free(mmu->job_slab, c->exit_job);
+	c->exit_job = NULL;
+	pthread_mutex_unlock(&mmu->jobs_lock);
+}/*}}}*/
+
 void mmu_client_log(const struct mmu_client *c, const char *fname, const char *msg)/*{{{*/
 {
 	logd(LOG_DEBUG, "%s sock %d pid %d: %s\n", fname, c->sock,
 			(int)c->pid, msg);
 }/*}}}*/
 
-void mmu_client_create(struct mmu_client *c)/*{{{*/
+void mmu_client_create(struct mmu_client *c, const void *data)/*{{{*/
 {
 	char msg[96];
 	struct mmu_proto_create_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
+	memcpy(&req, data, sizeof(req));
 	assert(req.type == MMU_PROTO_CREATE_REQ);
 
-	c->pid = (pid_t)req.pid;
-	int id = nextid;
-	id2pid[nextid++] = c->pid;
-	printf("pager_create pid %d\n", id);
-	pager_create(c->pid);
-	snprintf(msg, 96, "create pid %d", id);
+	int resume = (req.flags & MMU_PROTO_CREATE_RESUME) != 0;
+	int id;
+	if(resume) {
+		/* take over the map of the placeholder left by the restore */
+		pid_t pid = (pid_t)req.pid;
+		id = get_pid_id(pid);
+		struct mmu_client *ph = id < UINT8_MAX ? mmu->detached[id] : NULL;
+		if(!ph || !ph->map) {
+			mmu_client_log(c, __func__, "no checkpointed state to resume");
+			goto out_client;
+		}
+		pthread_mutex_lock(&ph->lock);
+		c->map = ph->map;
+		ph->map = NULL;
+		__atomic_store_n(&c->pid, pid, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&ph->lock);
+		snprintf(msg, 96, "resume pid %d", id);
+	} else {
+		id = mmu_id_alloc((pid_t)req.pid);
+		if(id == -1) {
+			mmu_client_log(c, __func__, "no free client id");
+			goto out_client;
+		}
+		c->map = mmu_map_new();
+		c->pid = (pid_t)req.pid;
+		printf("pager_create pid %d\n", id);
+		pager_create(c->pid);
+		snprintf(msg, 96, "create pid %d", id);
+	}
 	mmu_client_log(c, __func__, msg);
+	PROBE3(mmu, client_create, c->pid, id, resume);
+	int qos = req.qos < UVM_QOS_CLASSES ? (int)req.qos : UVM_QOS_NORMAL;
+	pager_set_qos(c->pid, qos);
+	pthread_mutex_lock(&mmu->jobs_lock);
+	c->qos = qos;
+	pthread_mutex_unlock(&mmu->jobs_lock);
 
 	struct mmu_proto_create_rep rep;
 	rep.type = MMU_PROTO_CREATE_REP;
 	memset(rep.pmem_fn, '\0', MMU_PROTO_PATH_MAX);
-	strncat(rep.pmem_fn, mmu->pmem_fn, MMU_PROTO_PATH_MAX);
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	strncat(rep.pmem_fn, mmu->pmem_fn, MMU_PROTO_PATH_MAX-1);
+	rep.refmap_off = mmu_client_refmap_off(id);
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
+	if(!resume) return;
+
+	/* replay the mappings in the map, then let the client go on */
+	for(int vpn = 0; vpn < mmu->refmap_pages; ++vpn) {
+		pthread_mutex_lock(&c->lock);
+		struct mmu_map m = c->map[vpn];
+		if(m.frame != -1) {
+			void *vaddr = (void *)(UVM_BASEADDR + vpn * PAGESIZE);
+			mmu_send_remap(c, vaddr, m.frame, m.prot);
+			if(m.prot & PROT_WRITE)
+				__atomic_or_fetch(&mmu->frame_flags[m.frame],
+						MMU_CKPT_WRITABLE, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&c->lock);
+	}
+	struct mmu_proto_resume_rep rrep;
+	rrep.type = MMU_PROTO_RESUME_REP;
+	pthread_mutex_lock(&c->lock);
+	int r = mmu_client_send(c, &rrep, sizeof(rrep));
+	pthread_mutex_unlock(&c->lock);
+	if(r) goto out_client;
 	return;
 
 	out_client:
-	mmu_client_destroy(c);
+	mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_extend(struct mmu_client *c)/*{{{*/
+void mmu_client_fork(struct mmu_client *c, const void *data)/*{{{*/
 {
 	char msg[96];
-	struct mmu_proto_extend_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	struct mmu_proto_fork_req req;
+	memcpy(&req, data, sizeof(req));
+	assert(req.type == MMU_PROTO_FORK_REQ);
+
+	struct mmu_proto_fork_rep rep;
+	rep.type = MMU_PROTO_FORK_REP;
+	rep.retcode = 0;
+	rep.refmap_off = 0;
+	pid_t parent = (pid_t)req.parent;
+	struct mmu_client *pc = mmu_client_find(parent);
+	int id = -1;
+	if(c->pid || !pc || !pc->map) {
+		mmu_client_log(c, __func__, "no such parent");
+		rep.retcode = ESRCH;
+	} else if((id = mmu_id_alloc((pid_t)req.pid)) == -1) {
+		mmu_client_log(c, __func__, "no free client id");
+		rep.retcode = EAGAIN;
+	} else {
+		c->map = mmu_map_new();
+		c->pid = (pid_t)req.pid;
+		int pid = get_pid_id(parent);
+		printf("pager_fork pid %d parent %d\n", id, pid);
+		if(pager_fork(parent, c->pid) == -1) rep.retcode = errno;
+		pthread_mutex_lock(&mmu->jobs_lock);
+		c->qos = pc->qos;
+		pthread_mutex_unlock(&mmu->jobs_lock);
+		rep.refmap_off = mmu_client_refmap_off(id);
+		snprintf(msg, 96, "fork pid %d parent %d retcode %d", id, pid,
+				(int)rep.retcode);
+		mmu_client_log(c, __func__, msg);
+		PROBE3(mmu, client_fork, c->pid, parent, rep.retcode);
+	}
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_fail(c);
+}/*}}}*/
+
+uint64_t mmu_client_refmap_off(int id)/*{{{*/
+{
+	/* offset of the client's reference map in pmem, 0 if none */
+	if(id >= MMU_PROTO_REFMAP_SLOTS) return 0;
+	uint32_t *refmap = mmu->refmap + id * mmu->refmap_pages;
+	return (uint64_t)((char *)refmap - mmu->pmem);
+}/*}}}*/
+
+void mmu_client_extend(struct mmu_client *c, const void *data)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_extend_req req;
+	memcpy(&req, data, sizeof(req));
 	assert(req.type == MMU_PROTO_EXTEND_REQ);
 
 	int id = get_pid_id(c->pid);
 	void *vaddr = pager_extend(c->pid);
 	printf("pager_extend pid %d vaddr %p\n", id, vaddr);
+	PROBE2(mmu, extend, c->pid, vaddr);
 	snprintf(msg, 96, "extend vaddr %p", vaddr);
 	mmu_client_log(c, __func__, msg);
 
 	struct mmu_proto_extend_rep rep;
 	rep.type = MMU_PROTO_EXTEND_REP;
 	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
 	return;
 
 	out_client:
-	mmu_client_destroy(c);
+	mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_syslog(struct mmu_client *c)/*{{{*/
+void mmu_client_shm(struct mmu_client *c, const void *data)/*{{{*/
 {
 	char msg[96];
-	struct mmu_proto_syslog_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	struct mmu_proto_shm_req req;
+	memcpy(&req, data, sizeof(req));
+
+	struct mmu_proto_shm_rep rep;
+	rep.type = MMU_PROTO_SHM_REP;
+	rep.retcode = 0;
+	rep.id = req.id;
+	int id = get_pid_id(c->pid);
+	int npages = req.npages;
+	void *vaddr = NULL;
+	if(req.type == MMU_PROTO_SHM_CREATE_REQ) {
+		rep.id = pager_shm_create(c->pid, req.npages, &vaddr);
+		if(rep.id == -1) rep.retcode = errno;
+		printf("pager_shm_create pid %d npages %d id %d vaddr %p\n",
+				id, npages, (int)rep.id, vaddr);
+	} else {
+		vaddr = pager_shm_attach(c->pid, req.id, &npages);
+		if(!vaddr) rep.retcode = errno;
+		printf("pager_shm_attach pid %d id %d vaddr %p\n", id,
+				(int)req.id, vaddr);
+	}
+	snprintf(msg, 96, "shm id %d vaddr %p retcode %d", (int)rep.id,
+			vaddr, (int)rep.retcode);
+	mmu_client_log(c, __func__, msg);
+
+	rep.npages = npages;
+	rep.vaddr = (intptr_t)vaddr;
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_release(struct mmu_client *c, const void *data)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_release_req req;
+	memcpy(&req, data, sizeof(req));
+	assert(req.type == MMU_PROTO_RELEASE_REQ);
+
+	int id = get_pid_id(c->pid);
+	void *vaddr = (void *)(intptr_t)req.addr;
+	printf("pager_release pid %d vaddr %p npages %u\n", id, vaddr,
+			(unsigned)req.npages);
+	int r = pager_release(c->pid, vaddr, (int)req.npages);
+	snprintf(msg, 96, "release vaddr %p npages %u left %d", vaddr,
+			(unsigned)req.npages, r);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_release_rep rep;
+	rep.type = MMU_PROTO_RELEASE_REP;
+	rep.retcode = r == -1 ? errno : 0;
+	rep.npages = r == -1 ? 0 : (uint32_t)r;
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_map(struct mmu_client *c, const void *data)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_map_req req;
+	memcpy(&req, data, sizeof(req));
+
+	struct mmu_proto_map_rep rep;
+	rep.retcode = 0;
+	int id = get_pid_id(c->pid);
+	void *addr = (void *)(intptr_t)req.addr;
+	void *vaddr = NULL;
+	if(req.type == MMU_PROTO_MAP_REQ) {
+		rep.type = MMU_PROTO_MAP_REP;
+		vaddr = pager_map(c->pid, addr, (int)req.npages);
+		if(!vaddr) rep.retcode = errno;
+		printf("pager_map pid %d addr %p npages %d vaddr %p\n", id,
+				addr, (int)req.npages, vaddr);
+	} else {
+		rep.type = MMU_PROTO_UNMAP_REP;
+		if(pager_unmap(c->pid, addr, (int)req.npages))
+			rep.retcode = errno;
+		printf("pager_unmap pid %d vaddr %p npages %d\n", id, addr,
+				(int)req.npages);
+	}
+	snprintf(msg, 96, "map addr %p npages %d vaddr %p retcode %d", addr,
+			(int)req.npages, vaddr, (int)rep.retcode);
+	mmu_client_log(c, __func__, msg);
+
+	rep.vaddr = (intptr_t)vaddr;
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_advise(struct mmu_client *c, const void *data)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_advise_req req;
+	memcpy(&req, data, sizeof(req));
+	assert(req.type == MMU_PROTO_ADVISE_REQ);
+
+	int id = get_pid_id(c->pid);
+	void *vaddr = (void *)(intptr_t)req.addr;
+	printf("pager_advise pid %d vaddr %p len %llu advice %d\n", id,
+			vaddr, (unsigned long long)req.len, (int)req.advice);
+	struct mmu_proto_advise_rep rep;
+	rep.type = MMU_PROTO_ADVISE_REP;
+	rep.retcode = 0;
+	if(pager_advise(c->pid, vaddr, (size_t)req.len, (int)req.advice))
+		rep.retcode = errno;
+	snprintf(msg, 96, "advise vaddr %p advice %d retcode %d", vaddr,
+			(int)req.advice, (int)rep.retcode);
+	mmu_client_log(c, __func__, msg);
+
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
+		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_syslog(struct mmu_client *c, const void *data)/*{{{*/
+{
+	char msg[96];
+	struct mmu_proto_syslog_req req;
+	memcpy(&req, data, sizeof(req));
 	assert(req.type == MMU_PROTO_SYSLOG_REQ);
 
 	assert(req.addr < UINTPTR_MAX);
@@ -328,6 +1505,7 @@ void mmu_client_syslog(struct mmu_client *c)/*{{{*/
 	size_t len = (size_t)req.len;
 	int id = get_pid_id(c->pid);
 	printf("pager_syslog pid %d %p\n", id, vaddr);
+	PROBE3(mmu, syslog, c->pid, vaddr, len);
 	int status = pager_syslog(c->pid, vaddr, len);
 	snprintf(msg, 96, "vaddr %p len %zu retcode %d", vaddr, len, status);
 	mmu_client_log(c, __func__, msg);
@@ -335,77 +1513,301 @@ void mmu_client_syslog(struct mmu_client *c)/*{{{*/
 	struct mmu_proto_syslog_rep rep;
 	rep.type = MMU_PROTO_SYSLOG_REP;
 	rep.retcode = (uint32_t)status;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
 	return;
 
 	out_client:
-	mmu_client_destroy(c);
+	mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_segv(struct mmu_client *c)/*{{{*/
+void mmu_client_syslog_batch(struct mmu_client *c, const void *data)/*{{{*/
 {
 	char msg[96];
-	struct mmu_proto_segv_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
+	struct mmu_proto_syslog_batch_req req;
+	/* the count was checked by `mmu_job_read` */
+	memcpy(&req, data, MMU_PROTO_SYSLOG_BATCH_SIZE(0));
+	assert(req.type == MMU_PROTO_SYSLOG_BATCH_REQ);
+	memcpy(req.recs, (const char *)data + MMU_PROTO_SYSLOG_BATCH_SIZE(0),
+			req.count * sizeof(req.recs[0]));
+
+	int id = get_pid_id(c->pid);
+	uint32_t nerrors = 0;
+	for(uint32_t i = 0; i < req.count; ++i) {
+		assert(req.recs[i].addr < UINTPTR_MAX);
+		void *vaddr = (void *)(uintptr_t)req.recs[i].addr;
+		size_t len = (size_t)req.recs[i].len;
+		printf("pager_syslog pid %d %p\n", id, vaddr);
+		PROBE3(mmu, syslog, c->pid, vaddr, len);
+		if(pager_syslog(c->pid, vaddr, len) != 0) nerrors++;
+	}
+	snprintf(msg, 96, "count %u flags %u errors %u", req.count,
+			req.flags, nerrors);
+	mmu_client_log(c, __func__, msg);
+
+	struct mmu_proto_syslog_batch_rep rep;
+	rep.type = MMU_PROTO_SYSLOG_BATCH_REP;
+	rep.flags = req.flags;
+	rep.nerrors = nerrors;
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
+	return;
+
+	out_client:
+	mmu_client_fail(c);
+}/*}}}*/
+
+void mmu_client_segv(struct mmu_client *c, const void *data,/*{{{*/
+		uint64_t t_recv)
+{
+	char msg[96];
+	struct mmu_proto_segv_req req;
+	memcpy(&req, data, sizeof(req));
 	assert(req.type == MMU_PROTO_SEGV_REQ);
 
 	assert(req.addr < UINTPTR_MAX);
 	void *vaddr = (void *)(uintptr_t)req.addr;
 	int code = (int)req.code;
-	snprintf(msg, 96, "vaddr %p code %d", vaddr, code);
+	c->cpu = req.cpu;
+	snprintf(msg, 96, "vaddr %p code %d cpu %d", vaddr, code, c->cpu);
 	mmu_client_log(c, __func__, msg);
 
+	struct mmu_proto_segv_rep rep;
+	memset(&rep, 0, sizeof(rep));
+	if(t_recv) {
+		rep.t_recv = t_recv;
+		rep.t_start = hist_now();
+		mmu_fault_timer.on = 1;
+		mmu_fault_timer.ack = 0;
+		mmu_fault_timer.disk = 0;
+	}
 	int id = get_pid_id(c->pid);
 	printf("pager_fault pid %d vaddr %p\n", id, vaddr);
+	PROBE3(mmu, fault_entry, c->pid, vaddr, c->cpu);
 	pager_fault(c->pid, vaddr);
+	PROBE2(mmu, fault_return, c->pid, vaddr);
+	if(t_recv) {
+		rep.t_done = hist_now();
+		rep.ns_ack = mmu_fault_timer.ack;
+		rep.ns_disk = mmu_fault_timer.disk;
+		mmu_fault_timer.on = 0;
+		mmu_fault_account(&req, &rep);
+	}
 
-	struct mmu_proto_segv_rep rep;
 	rep.type = MMU_PROTO_SEGV_REP;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+	rep.tag = req.tag;
+	if(mmu_client_send(c, &rep, sizeof(rep)))
 		goto out_client;
 	return;
 
 	out_client:
-	mmu_client_destroy(c);
+	mmu_client_fail(c);
 }/*}}}*/
 
-void mmu_client_exit(struct mmu_client *c)/*{{{*/
+void mmu_fault_account(const struct mmu_proto_segv_req *req,/*{{{*/
+		const struct mmu_proto_segv_rep *rep)
+{
+	struct hist *h = mmu->fault_hist;
+	uint64_t pager = rep->t_done - rep->t_start;
+	pager -= rep->ns_ack + rep->ns_disk;
+	/* the client's stamp comes from another clock only if the MMU
+	 * runs in another time namespace */
+	if(rep->t_recv >= req->t_send)
+		hist_add(&h[MMU_FAULT_SEND], rep->t_recv - req->t_send);
+	hist_add(&h[MMU_FAULT_QUEUE], rep->t_start - rep->t_recv);
+	hist_add(&h[MMU_FAULT_PAGER], pager);
+	hist_add(&h[MMU_FAULT_ACK], rep->ns_ack);
+	hist_add(&h[MMU_FAULT_DISK], rep->ns_disk);
+	hist_add(&h[MMU_FAULT_MMU], rep->t_done - rep->t_recv);
+}/*}}}*/
+
+void mmu_client_exit(struct mmu_client *c, const void *data)/*{{{*/
 {
 	struct mmu_proto_exit_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
+	memcpy(&req, data, sizeof(req));
 	mmu_client_log(c, __func__, "exiting cleanly");
 	assert(req.type == MMU_PROTO_EXIT_REQ);
 	assert(c->pid);
 	int id = get_pid_id(c->pid);
 	printf("pager_destroy pid %d\n", id);
+	PROBE2(mmu, client_destroy, c->pid, 1);
 	pager_destroy(c->pid);
+	mmu_id_free(c->pid);
 
-	struct mmu_proto_segv_rep rep;
+	struct mmu_proto_exit_rep rep;
 	rep.type = MMU_PROTO_EXIT_REP;
-	send(c->sock, &rep, sizeof(rep), 0); /* ignoring return value */
+	rep.tag = req.tag;
+	mmu_client_send(c, &rep, sizeof(rep)); /* ignoring return value */
 
-	mmu->sock2client[c->sock] = NULL;
+	/* the client's thread closes the socket */
 	c->running = 0;
-	close(c->sock);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	shutdown(c->sock, SHUT_RDWR);
 }/*}}}*/
 
 void mmu_client_destroy(struct mmu_client *c)/*{{{*/
 {
 	loge(LOG_WARN, __FILE__, __LINE__);
 	mmu_client_log(c, __func__, "running");
-	mmu->sock2client[c->sock] = NULL;
 	c->running = 0;
-	close(c->sock);
+	PROBE2(mmu, client_destroy, c->pid, 0);
 	if(c->pid) { /* may get here before CREATE_REQ happens */
+		/* Other clients' faults may be evicting this client's pages
+		 * concurrently, so the client must remain visible to
+		 * `mmu_client_search` until the pager has released them. */
 		pager_destroy(c->pid);
+		mmu_id_free(c->pid);
 	}
+	mmu->sock2client[c->sock] = NULL;
+	close(c->sock);
+}/*}}}*/
+
+void mmu_client_fail(struct mmu_client *c)/*{{{*/
+{
+	/* Called by workers, which may be servicing another client's
+	 * request while holding pager locks.  Shutting down the socket
+	 * makes the client's own thread destroy it. */
+	loge(LOG_WARN, __FILE__, __LINE__);
+	mmu_client_log(c, __func__, "shutting down");
+	shutdown(c->sock, SHUT_RDWR);
+}/*}}}*/
+
+struct mmu_client * mmu_client_new(int sock, pid_t pid)/*{{{*/
+{
+	struct mmu_client *c = slab_alloc(mmu->client_slab);
+	if(!c) logea(__FILE__, __LINE__, NULL);
+	c->running = 1;
+	c->sock = sock;
+	c->pid = pid;
+	c->cpu = -1;
+	pthread_mutex_init(&c->lock, NULL);
+	c->map = NULL;
+	pthread_mutex_init(&c->ack_lock, NULL);
+	pthread_cond_init(&c->ack_cond, NULL);
+	c->acked = 0;
+	c->dead = 0;
+	pthread_mutex_init(&c->send_lock, NULL);
+	c->qos = UVM_QOS_NORMAL;
+	c->njobs = 0;
+	c->exit_job = NULL;
+	return c;
+}/*}}}*/
+
+void mmu_client_free(struct mmu_client *c)/*{{{*/
+{
+	pthread_mutex_destroy(&c->lock);
+	pthread_mutex_destroy(&c->ack_lock);
+	pthread_cond_destroy(&c->ack_cond);
+	pthread_mutex_destroy(&c->send_lock);
+	if(c->map) slab_free(mmu->map_slab, c->map);
+	slab_free(mmu->client_slab, c);
+}/*}}}*/
+
+struct mmu_map * mmu_map_new(void)/*{{{*/
+{
+	struct mmu_map *map = slab_alloc(mmu->map_slab);
+	if(!map) logea(__FILE__, __LINE__, NULL);
+	for(int i = 0; i < mmu->refmap_pages; ++i) {
+		map[i].frame = -1;
+		map[i].prot = PROT_NONE;
+	}
+	return map;
+}/*}}}*/
+
+struct mmu_client * mmu_client_lock(pid_t pid)/*{{{*/
+{
+	/* Returns the client with its lock held.  A placeholder found
+	 * while its process resumes has no map; the live client has it. */
+	for(;;) {
+		struct mmu_client *c = mmu_client_search(pid);
+		pthread_mutex_lock(&c->lock);
+		if(c->map) return c;
+		pthread_mutex_unlock(&c->lock);
+		sched_yield();
+	}
+}/*}}}*/
+
+void mmu_map_set(struct mmu_client *c, void *vaddr, int frame, int prot)/*{{{*/
+{
+	/* `c->lock` must be held.  Frames mapped writable may change
+	 * under the MMU, so checkpoints copy them whether dirty or not. */
+	int vpn = ((intptr_t)vaddr - UVM_BASEADDR) / PAGESIZE;
+	assert(vpn >= 0 && vpn < mmu->refmap_pages);
+	struct mmu_map *m = &c->map[vpn];
+	if(m->frame != -1 && m->frame != frame)
+		__atomic_and_fetch(&mmu->frame_flags[m->frame],
+				(uint8_t)~MMU_CKPT_WRITABLE, __ATOMIC_RELAXED);
+	if(frame != -1 && (prot & PROT_WRITE))
+		__atomic_or_fetch(&mmu->frame_flags[frame], MMU_CKPT_WRITABLE,
+				__ATOMIC_RELAXED);
+	else if(frame != -1)
+		__atomic_and_fetch(&mmu->frame_flags[frame],
+				(uint8_t)~MMU_CKPT_WRITABLE, __ATOMIC_RELAXED);
+	m->frame = frame;
+	m->prot = prot;
+}/*}}}*/
+
+void mmu_send_remap(struct mmu_client *c, void *vaddr, int frame, int prot)/*{{{*/
+{
+	/* We need these functions to wait for the application to
+	 * effect the protection change before we return to the pager. */
+	struct mmu_proto_remap_rep rep;
+	rep.type = MMU_PROTO_REMAP_REP;
+	rep.prot = (int32_t)prot;
+	rep.offset = (uint64_t)(PAGESIZE * frame);
+	rep.vaddr = (intptr_t)vaddr;
+	PROBE4(mmu, remap_entry, c->pid, vaddr, frame, prot);
+	if(mmu_client_exchange(c, &rep, sizeof(rep))) mmu_client_fail(c);
+	PROBE2(mmu, remap_return, c->pid, vaddr);
+}/*}}}*/
+
+void mmu_send_chprot(struct mmu_client *c, void *vaddr, int prot)/*{{{*/
+{
+	struct mmu_proto_chprot_rep rep;
+	rep.type = MMU_PROTO_CHPROT_REP;
+	rep.prot = (int32_t)prot;
+	rep.vaddr = (intptr_t)vaddr;
+	PROBE3(mmu, chprot_entry, c->pid, vaddr, prot);
+	if(mmu_client_exchange(c, &rep, sizeof(rep))) mmu_client_fail(c);
+	PROBE2(mmu, chprot_return, c->pid, vaddr);
+}/*}}}*/
+
+void mmu_send_detach(struct mmu_client *c)/*{{{*/
+{
+	struct mmu_proto_detach_rep rep;
+	rep.type = MMU_PROTO_DETACH_REP;
+	if(mmu_client_exchange(c, &rep, sizeof(rep))) mmu_client_fail(c);
+}/*}}}*/
+
+int mmu_client_send(struct mmu_client *c, const void *msg, size_t len)/*{{{*/
+{
+	/* Workers reply to the same client at once. */
+	pthread_mutex_lock(&c->send_lock);
+	ssize_t cnt = send(c->sock, msg, len, 0);
+	pthread_mutex_unlock(&c->send_lock);
+	return cnt == (ssize_t)len ? 0 : -1;
+}/*}}}*/
+
+int mmu_client_exchange(struct mmu_client *c, const void *msg, size_t len)/*{{{*/
+{
+	/* Sends a REMAP, CHPROT or DETACH message and waits until the
+	 * client's thread receives its acknowledgement.  `c->lock` must
+	 * be held, so a single exchange is in progress per client.
+	 * Returns -1 if the client is gone. */
+	uint64_t start = mmu_fault_timer.on ? hist_now() : 0;
+	pthread_mutex_lock(&c->ack_lock);
+	c->acked = 0;
+	int dead = c->dead;
+	pthread_mutex_unlock(&c->ack_lock);
+	if(dead || mmu_client_send(c, msg, len)) return -1;
+	pthread_mutex_lock(&c->ack_lock);
+	while(!c->acked && !c->dead)
+		pthread_cond_wait(&c->ack_cond, &c->ack_lock);
+	int r = c->acked ? 0 : -1;
+	pthread_mutex_unlock(&c->ack_lock);
+	if(start) mmu_fault_timer.ack += hist_now() - start;
+	return r;
 }/*}}}*/
 /*}}}*/
 
@@ -414,10 +1816,8 @@ void mmu_client_destroy(struct mmu_client *c)/*{{{*/
  ***************************************************************************/
 struct mmu_client * mmu_client_search(pid_t pid)/*{{{*/
 {
-	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
-		if(!mmu->sock2client[i]) continue;
-		if(mmu->sock2client[i]->pid == pid) return mmu->sock2client[i];
-	}
+	struct mmu_client *c = mmu_client_find(pid);
+	if(c) return c;
 	printf("error: pid %d not found.  aborting.\n", (int)pid);
 	logd(LOG_FATAL, "pid %d not found.  aborting.\n", (int)pid);
 	mmu_destroy();
@@ -428,7 +1828,19 @@ void mmu_zero_fill(int frame)/*{{{*/
 {
 	printf("%s frame %u\n", __func__, frame);
 	logd(LOG_DEBUG, "%s frame %u\n", __func__, frame);
+	PROBE1(mmu, zero_fill, frame);
 	memset(mmu->pmem + (PAGESIZE*frame), '0', PAGESIZE);
+	__atomic_or_fetch(&mmu->frame_flags[frame], MMU_CKPT_DIRTY,
+			__ATOMIC_RELAXED);
+}/*}}}*/
+
+void mmu_fill(int frame, int byte)/*{{{*/
+{
+	printf("%s frame %u byte %d\n", __func__, frame, byte);
+	logd(LOG_DEBUG, "%s frame %u byte %d\n", __func__, frame, byte);
+	memset(mmu->pmem + (PAGESIZE*frame), byte, PAGESIZE);
+	__atomic_or_fetch(&mmu->frame_flags[frame], MMU_CKPT_DIRTY,
+			__ATOMIC_RELAXED);
 }/*}}}*/
 
 void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)/*{{{*/
@@ -438,36 +1850,10 @@ void mmu_resident(pid_t pid, void *vaddr, int frame, int prot)/*{{{*/
 			id, vaddr, prot, frame);
 	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d frame %u\n", __func__,
 			id, vaddr, prot, frame);
-	struct mmu_client *c = mmu_client_search(pid);
-	struct mmu_proto_remap_rep rep;
-	rep.type = MMU_PROTO_REMAP_REP;
-	rep.prot = (int32_t)prot;
-	rep.offset = (uint64_t)(PAGESIZE * frame);
-	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	/* We need these functions to wait for the application to
-	 * effect the protection change before we return to the
-	 * pager.  This loop is necessary because mmu_client_thread
-	 * is already in the pager and blocked here (so we cannot
-	 * wait on a condition variable to be signaled forward as
-	 * there is no one else to recv the REMAP_REQ message).  An
-	 * alternative approach would be to use two sockets or
-	 * threads. */
-	uint32_t t;
-	do {
-		 if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_REMAP_REQ);
-	struct mmu_proto_remap_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_REMAP_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	struct mmu_client *c = mmu_client_lock(pid);
+	mmu_map_set(c, vaddr, frame, prot);
+	if(c->sock != -1) mmu_send_remap(c, vaddr, frame, prot);
+	pthread_mutex_unlock(&c->lock);
 }/*}}}*/
 
 
@@ -476,27 +1862,10 @@ void mmu_nonresident(pid_t pid, void *vaddr)/*{{{*/
 	int id = get_pid_id(pid);
 	printf("%s pid %d vaddr %p\n", __func__, id, vaddr);
 	logd(LOG_DEBUG, "%s pid %d vaddr %p\n", __func__, id, vaddr);
-	struct mmu_client *c = mmu_client_search(pid);
-	struct mmu_proto_chprot_rep rep;
-	rep.type = MMU_PROTO_CHPROT_REP;
-	rep.prot = PROT_NONE;
-	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
-
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
-
-	out_client:
-	mmu_client_destroy(c);
+	struct mmu_client *c = mmu_client_lock(pid);
+	mmu_map_set(c, vaddr, -1, PROT_NONE);
+	if(c->sock != -1) mmu_send_chprot(c, vaddr, PROT_NONE);
+	pthread_mutex_unlock(&c->lock);
 }/*}}}*/
 
 void mmu_chprot(pid_t pid, void *vaddr, int prot)/*{{{*/
@@ -505,27 +1874,117 @@ void mmu_chprot(pid_t pid, void *vaddr, int prot)/*{{{*/
 	printf("%s pid %d vaddr %p prot %d\n", __func__, id, vaddr, prot);
 	logd(LOG_DEBUG, "%s pid %d vaddr %p prot %d\n", __func__,
 			id, vaddr,prot);
+	struct mmu_client *c = mmu_client_lock(pid);
+	int vpn = ((intptr_t)vaddr - UVM_BASEADDR) / PAGESIZE;
+	mmu_map_set(c, vaddr, c->map[vpn].frame, prot);
+	if(c->sock != -1) mmu_send_chprot(c, vaddr, prot);
+	pthread_mutex_unlock(&c->lock);
+}/*}}}*/
+
+struct mmu_client * mmu_client_find(pid_t pid)/*{{{*/
+{
+	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
+		if(!mmu->sock2client[i]) continue;
+		if(mmu->sock2client[i]->pid == pid) return mmu->sock2client[i];
+	}
+	for(int i = 0; i < UINT8_MAX; ++i) {
+		if(!mmu->detached[i] || !mmu->detached[i]->map) continue;
+		if(mmu->detached[i]->pid == pid) return mmu->detached[i];
+	}
+	return NULL;
+}/*}}}*/
+
+uint32_t * mmu_refmap_entry(pid_t pid, void *vaddr)/*{{{*/
+{
+	int id = get_pid_id(pid);
+	if(id >= MMU_PROTO_REFMAP_SLOTS) return NULL;
+	int vpn = ((intptr_t)vaddr - UVM_BASEADDR) / PAGESIZE;
+	assert(vpn >= 0 && vpn < mmu->refmap_pages);
+	return &mmu->refmap[id * mmu->refmap_pages + vpn];
+}/*}}}*/
+
+int mmu_refclear(pid_t pid, void *vaddr, int prot)/*{{{*/
+{
+	mmu_chprot(pid, vaddr, PROT_NONE);
+	uint32_t *e = mmu_refmap_entry(pid, vaddr);
+	if(!e) return 0;
+	if(prot & PROT_WRITE) {
+		/* the process may make the frame writable again */
+		struct mmu_client *c = mmu_client_lock(pid);
+		int vpn = ((intptr_t)vaddr - UVM_BASEADDR) / PAGESIZE;
+		if(c->map[vpn].frame != -1)
+			__atomic_or_fetch(&mmu->frame_flags[c->map[vpn].frame],
+					MMU_CKPT_WRITABLE, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&c->lock);
+	}
+	assert(__atomic_load_n(e, __ATOMIC_RELAXED) == 0);
+	__atomic_store_n(e, (uint32_t)prot & MMU_PROTO_REF_PROT,
+			__ATOMIC_RELEASE);
+	return 1;
+}/*}}}*/
+
+int mmu_reftake(pid_t pid, void *vaddr)/*{{{*/
+{
+	uint32_t *e = mmu_refmap_entry(pid, vaddr);
+	if(!e) return 0;
+	uint32_t v = __atomic_load_n(e, __ATOMIC_ACQUIRE);
+	for(;;) {
+		if(v & MMU_PROTO_REF_BUSY) {
+			/* the client is in mprotect; it may also have died */
+			if(kill(pid, 0) == -1 && errno == ESRCH) break;
+			sched_yield();
+			v = __atomic_load_n(e, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		if(__atomic_compare_exchange_n(e, &v, 0, 0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE))
+			break;
+	}
+	__atomic_store_n(e, 0, __ATOMIC_RELEASE);
+	return (v & MMU_PROTO_REF_USED) != 0;
+}/*}}}*/
+
+int mmu_numa_nodes(void)/*{{{*/
+{
+	return mmu->nnodes;
+}/*}}}*/
+
+int mmu_fault_node(pid_t pid)/*{{{*/
+{
 	struct mmu_client *c = mmu_client_search(pid);
-	struct mmu_proto_chprot_rep rep;
-	rep.type = MMU_PROTO_CHPROT_REP;
-	rep.prot = (int32_t)prot;
-	rep.vaddr = (intptr_t)vaddr;
-	if(send(c->sock, &rep, sizeof(rep), 0) != sizeof(rep))
-		goto out_client;
+	int cpu = c->cpu;
+	if(cpu < 0 || cpu >= mmu->ncpus) return -1;
+	return mmu->cpu2node[cpu];
+}/*}}}*/
 
-	uint32_t t;
-	do {
-		if(recv(c->sock, &t, sizeof(t), MSG_PEEK) != sizeof(t))
-			goto out_client;
-	} while(t != MMU_PROTO_CHPROT_REQ);
-	struct mmu_proto_chprot_req req;
-	if(recv(c->sock, &req, sizeof(req), 0) != sizeof(req))
-		goto out_client;
-	assert(req.type == MMU_PROTO_CHPROT_REQ);
-	return;
+int mmu_pmem_bind(int first, int nframes, int node)/*{{{*/
+{
+	assert(node >= 0 && node < mmu->nnodes);
+	assert(first >= 0 && first + nframes <= mmu->npages);
+	int nid = mmu->node_ids[node];
+	unsigned long mask[MMU_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+	memset(mask, 0, sizeof(mask));
+	mask[nid / (8 * sizeof(unsigned long))] |=
+			1UL << (nid % (8 * sizeof(unsigned long)));
+	/* MPOL_MF_MOVE migrates frames the 'z' fill already placed */
+	if(syscall(SYS_mbind, mmu->pmem + (size_t)first * PAGESIZE,
+				(size_t)nframes * PAGESIZE, MPOL_BIND, mask,
+				(unsigned long)(nid + 2), MPOL_MF_MOVE) == -1) {
+		logd(LOG_WARN, "%s: frames %d-%d node %d: %s\n", __func__, first,
+				first + nframes - 1, nid, strerror(errno));
+		return -1;
+	}
+	logd(LOG_INFO, "%s: frames %d-%d on node %d\n", __func__, first,
+			first + nframes - 1, nid);
+	return 0;
+}/*}}}*/
 
-	out_client:
-	mmu_client_destroy(c);
+void mmu_reclaim_wake(void)/*{{{*/
+{
+	pthread_mutex_lock(&mmu->reclaim_mutex);
+	mmu->reclaim_wanted = 1;
+	pthread_cond_signal(&mmu->reclaim_cond);
+	pthread_mutex_unlock(&mmu->reclaim_mutex);
 }/*}}}*/
 
 void mmu_disk_read(int block_from, int frame_to)/*{{{*/
@@ -534,8 +1993,19 @@ void mmu_disk_read(int block_from, int frame_to)/*{{{*/
 			block_from, frame_to);
 	logd(LOG_DEBUG, "%s from block %d to frame %d\n", __func__,
 			block_from, frame_to);
-	memcpy(mmu->pmem + frame_to*PAGESIZE, mmu->disk + block_from*PAGESIZE,
-			PAGESIZE);
+	PROBE2(mmu, disk_read, block_from, frame_to);
+	uint64_t start = mmu_fault_timer.on ? hist_now() : 0;
+	if(mmu->iosched) {
+		if(iosched_read(mmu->iosched, block_from,
+					mmu->pmem + frame_to*PAGESIZE))
+			logea(__FILE__, __LINE__, NULL);
+	} else {
+		memcpy(mmu->pmem + frame_to*PAGESIZE,
+				mmu->disk + block_from*PAGESIZE, PAGESIZE);
+	}
+	if(start) mmu_fault_timer.disk += hist_now() - start;
+	__atomic_or_fetch(&mmu->frame_flags[frame_to], MMU_CKPT_DIRTY,
+			__ATOMIC_RELAXED);
 }/*}}}*/
 
 void mmu_disk_write(int frame_from, int block_to)/*{{{*/
@@ -544,41 +2014,442 @@ void mmu_disk_write(int frame_from, int block_to)/*{{{*/
 			frame_from, block_to);
 	logd(LOG_DEBUG, "%s from frame %d to block %d\n", __func__,
 			frame_from, block_to);
-	memcpy(mmu->disk + block_to*PAGESIZE, mmu->pmem + frame_from*PAGESIZE,
-			PAGESIZE);
+	PROBE2(mmu, disk_write, frame_from, block_to);
+	uint64_t start = mmu_fault_timer.on ? hist_now() : 0;
+	if(mmu->iosched) {
+		if(iosched_write(mmu->iosched, block_to,
+					mmu->pmem + frame_from*PAGESIZE))
+			logea(__FILE__, __LINE__, NULL);
+	} else {
+		memcpy(mmu->disk + block_to*PAGESIZE,
+				mmu->pmem + frame_from*PAGESIZE, PAGESIZE);
+	}
+	if(start) mmu_fault_timer.disk += hist_now() - start;
+	__atomic_or_fetch(&mmu->block_flags[block_to], MMU_CKPT_DIRTY,
+			__ATOMIC_RELAXED);
+}/*}}}*/
+
+void mmu_syslog_begin(pid_t pid)/*{{{*/
+{
+	mmu_syslog_rec.len = 0;
+	logd(LOG_DEBUG, "%s pid %d\n", __func__, get_pid_id(pid));
+}/*}}}*/
+
+void mmu_syslog_write(const struct iovec *iov, int iovcnt, int last)/*{{{*/
+{
+	/* The slices point into pmem, pinned by the pager only until we
+	 * return.  Records are output whole under the syslog mutex, so
+	 * the slices of a record spanning several calls are copied until
+	 * its last call; a record gathered in one call is written
+	 * without copying. */
+	if(mmu->syslog_fd != -1) {
+		if(!last) {
+			mmu_syslog_append(iov, iovcnt, 0);
+			return;
+		}
+		struct iovec all[iovcnt + 2];
+		int cnt = 0;
+		if(mmu_syslog_rec.len > 0) {
+			all[cnt].iov_base = mmu_syslog_rec.buf;
+			all[cnt++].iov_len = mmu_syslog_rec.len;
+		}
+		memcpy(all + cnt, iov, iovcnt * sizeof(iov[0]));
+		cnt += iovcnt;
+		all[cnt].iov_base = "\n";
+		all[cnt++].iov_len = 1;
+		pthread_mutex_lock(&mmu->syslog_mutex);
+		if(writev(mmu->syslog_fd, all, cnt) == -1)
+			loge(LOG_WARN, __FILE__, __LINE__);
+		pthread_mutex_unlock(&mmu->syslog_mutex);
+	} else {
+		mmu_syslog_append(iov, iovcnt, 1);
+		if(!last) return;
+		if(mmu_syslog_rec.len > 0) {
+			pthread_mutex_lock(&mmu->syslog_mutex);
+			printf("%.*s\n", (int)mmu_syslog_rec.len, mmu_syslog_rec.buf);
+			pthread_mutex_unlock(&mmu->syslog_mutex);
+		}
+	}
+	/* workers exit without a destructor for their buffer */
+	free(mmu_syslog_rec.buf);
+	mmu_syslog_rec.buf = NULL;
+	mmu_syslog_rec.len = 0;
+	mmu_syslog_rec.cap = 0;
+}/*}}}*/
+
+void mmu_syslog_append(const struct iovec *iov, int iovcnt, int hex)/*{{{*/
+{
+	for(int i = 0; i < iovcnt; ++i) {
+		size_t need = mmu_syslog_rec.len +
+				(hex ? 2*iov[i].iov_len + 1 : iov[i].iov_len);
+		if(need > mmu_syslog_rec.cap) {
+			size_t cap = mmu_syslog_rec.cap ? mmu_syslog_rec.cap : PAGESIZE;
+			while(cap < need) cap *= 2;
+			char *buf = realloc(mmu_syslog_rec.buf, cap);
+			if(!buf) logea(__FILE__, __LINE__, NULL);
+			mmu_syslog_rec.buf = buf;
+			mmu_syslog_rec.cap = cap;
+		}
+		if(!hex) {
+			memcpy(mmu_syslog_rec.buf + mmu_syslog_rec.len,
+					iov[i].iov_base, iov[i].iov_len);
+			mmu_syslog_rec.len += iov[i].iov_len;
+			continue;
+		}
+		const unsigned char *src = iov[i].iov_base;
+		for(size_t j = 0; j < iov[i].iov_len; ++j) {
+			sprintf(mmu_syslog_rec.buf + mmu_syslog_rec.len, "%02x",
+					(unsigned)src[j]);
+			mmu_syslog_rec.len += 2;
+		}
+	}
+}/*}}}*/
+/*}}}*/
+
+/****************************************************************************
+ * checkpoint and restore {{{
+ ***************************************************************************/
+void mmu_detach_clients(void)/*{{{*/
+{
+	/* Detached clients cannot touch physical memory, so the final
+	 * checkpoint is exact.  Requests they sent before detaching are
+	 * still serviced, and their mappings are recorded in the maps. */
+	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
+		struct mmu_client *c = mmu->sock2client[i];
+		if(!c || !c->pid) continue;
+		pthread_mutex_lock(&c->lock);
+		if(c->map) mmu_send_detach(c);
+		pthread_mutex_unlock(&c->lock);
+	}
+}/*}}}*/
+
+void mmu_checkpoint(int final)/*{{{*/
+{
+	/* Requests are held off while the checkpoint is taken.  Unless
+	 * clients were detached, frames mapped writable may change as
+	 * they are copied; they stay marked and are copied again by the
+	 * next checkpoint. */
+	if(!mmu->ckpt_dir) {
+		logd(LOG_WARN, "%s: no checkpoint directory\n", __func__);
+		return;
+	}
+	pthread_rwlock_wrlock(&mmu->ckpt_lock);
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	int nframes = 0;
+	int nblocks = 0;
+	int r = -1;
+	struct mmu_client **clients = NULL;
+	int seq = mmu->ckpt_seq + 1;
+	char name[16];
+	int sfd = mmu_ckpt_open("state.tmp", O_WRONLY | O_CREAT | O_TRUNC);
+	snprintf(name, sizeof(name), "frames.%d", seq % 2);
+	int ffd = mmu_ckpt_open(name, O_RDWR | O_CREAT);
+	snprintf(name, sizeof(name), "blocks.%d", seq % 2);
+	int bfd = mmu_ckpt_open(name, O_RDWR | O_CREAT);
+	int dfd = open(mmu->ckpt_dir, O_RDONLY);
+	if(sfd == -1 || ffd == -1 || bfd == -1 || dfd == -1) goto out;
+
+	clients = malloc((MMU_MAX_SOCK + UINT8_MAX) * sizeof(clients[0]));
+	if(!clients) goto out;
+	int n = 0;
+	for(int i = 3; i < MMU_MAX_SOCK; ++i) {
+		struct mmu_client *c = mmu->sock2client[i];
+		if(c && c->pid && c->map) clients[n++] = c;
+	}
+	for(int i = 0; i < UINT8_MAX; ++i) {
+		if(mmu->detached[i] && mmu->detached[i]->map)
+			clients[n++] = mmu->detached[i];
+	}
+
+	struct mmu_ckpt_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MMU_CKPT_MAGIC, sizeof(hdr.magic));
+	hdr.pagesize = PAGESIZE;
+	hdr.npages = mmu->npages;
+	hdr.nblocks = mmu->nblocks;
+	hdr.maxpages = mmu->refmap_pages;
+	hdr.seq = seq;
+	hdr.nclients = n;
+	hdr.nextid = freeids_count ? freeids[freeids_head] : 0;
+	for(int i = 0; i < UINT8_MAX; ++i) hdr.id2pid[i] = id2pid[i];
+	if(mmu_write_all(sfd, &hdr, sizeof(hdr))) goto out;
+	for(int i = 0; i < n; ++i) {
+		int32_t pid = clients[i]->pid;
+		size_t mapsz = mmu->refmap_pages * sizeof(clients[i]->map[0]);
+		if(mmu_write_all(sfd, &pid, sizeof(pid))) goto out;
+		if(mmu_write_all(sfd, clients[i]->map, mapsz)) goto out;
+	}
+	if(pager_checkpoint(sfd)) goto out;
+
+	if(ftruncate(ffd, (off_t)mmu->npages * PAGESIZE) == -1) goto out;
+	if(ftruncate(bfd, (off_t)mmu->nblocks * PAGESIZE) == -1) goto out;
+	if(mmu_ckpt_copy(ffd, mmu->pmem, mmu->frame_flags, mmu->npages,
+				&nframes))
+		goto out;
+	if(mmu_ckpt_copy(bfd, mmu->disk, mmu->block_flags, mmu->nblocks,
+				&nblocks))
+		goto out;
+	if(fsync(ffd) == -1 || fsync(bfd) == -1 || fsync(sfd) == -1) goto out;
+
+	char tmp[PATH_MAX], path[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s/state.tmp", mmu->ckpt_dir);
+	snprintf(path, sizeof(path), "%s/state", mmu->ckpt_dir);
+	if(rename(tmp, path) == -1 || fsync(dfd) == -1) goto out;
+	mmu->ckpt_seq = seq;
+	r = 0;
+
+	out:
+	if(r) {
+		loge(LOG_WARN, __FILE__, __LINE__);
+		fprintf(stderr, "checkpoint failed: %s\n", strerror(errno));
+		/* the images `state` does not name may be partly written;
+		 * copy everything into them next time */
+		for(int i = 0; i < mmu->npages; ++i)
+			__atomic_or_fetch(&mmu->frame_flags[i], MMU_CKPT_DIRTY,
+					__ATOMIC_RELAXED);
+		memset(mmu->block_flags, MMU_CKPT_DIRTY, mmu->nblocks);
+	}
+	free(clients);
+	if(sfd != -1) close(sfd);
+	if(ffd != -1) close(ffd);
+	if(bfd != -1) close(bfd);
+	if(dfd != -1) close(dfd);
+	if(final) mmu->running = 0;
+	pthread_rwlock_unlock(&mmu->ckpt_lock);
+	gettimeofday(&end, NULL);
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 +
+			(end.tv_usec - start.tv_usec) / 1e3;
+	if(r == 0) {
+		fprintf(stderr, "checkpoint %d: %d/%d frames, %d/%d blocks, "
+				"%.1f ms\n", mmu->ckpt_seq, nframes, mmu->npages,
+				nblocks, mmu->nblocks, ms);
+	}
+}/*}}}*/
+
+void mmu_restore(void)/*{{{*/
+{
+	if(!mmu->ckpt_dir) return;
+	int sfd = mmu_ckpt_open("state", O_RDONLY);
+	if(sfd == -1) {
+		if(errno != ENOENT) logea(__FILE__, __LINE__, NULL);
+		logd(LOG_INFO, "%s: no checkpoint in %s\n", __func__,
+				mmu->ckpt_dir);
+		return;
+	}
+	struct mmu_ckpt_header hdr;
+	if(mmu_read_all(sfd, &hdr, sizeof(hdr)))
+		logea(__FILE__, __LINE__, NULL);
+	if(memcmp(hdr.magic, MMU_CKPT_MAGIC, sizeof(hdr.magic)) ||
+			hdr.pagesize != (int32_t)PAGESIZE ||
+			hdr.npages != mmu->npages || hdr.nblocks != mmu->nblocks ||
+			hdr.maxpages != mmu->refmap_pages ||
+			hdr.nextid < 0 || hdr.nextid > UINT8_MAX)
+		logea(__FILE__, __LINE__, "checkpoint does not match NFRAMES "
+				"and NBLOCKS");
+	for(int i = 0; i < UINT8_MAX; ++i) id2pid[i] = hdr.id2pid[i];
+	mmu_ids_init(hdr.nextid);
+	mmu->ckpt_seq = hdr.seq;
+
+	/* clients that exited while the MMU was down are dropped once
+	 * the pager tables are back */
+	pid_t *dead = malloc((hdr.nclients + 1) * sizeof(dead[0]));
+	if(!dead) logea(__FILE__, __LINE__, NULL);
+	int ndead = 0;
+	for(int i = 0; i < hdr.nclients; ++i) {
+		int32_t pid;
+		struct mmu_map *map = mmu_map_new();
+		size_t mapsz = mmu->refmap_pages * sizeof(map[0]);
+		if(mmu_read_all(sfd, &pid, sizeof(pid)) ||
+				mmu_read_all(sfd, map, mapsz))
+			logea(__FILE__, __LINE__, NULL);
+		int id = get_pid_id(pid);
+		if(kill(pid, 0) == -1 && errno == ESRCH) {
+			dead[ndead++] = pid;
+			slab_free(mmu->map_slab, map);
+			continue;
+		}
+		struct mmu_client *c = mmu_client_new(-1, pid);
+		c->map = map;
+		mmu->detached[id] = c;
+	}
+	if(pager_restore(sfd)) logea(__FILE__, __LINE__, NULL);
+	close(sfd);
+
+	char name[16];
+	snprintf(name, sizeof(name), "frames.%d", mmu->ckpt_seq % 2);
+	int ffd = mmu_ckpt_open(name, O_RDONLY);
+	snprintf(name, sizeof(name), "blocks.%d", mmu->ckpt_seq % 2);
+	int bfd = mmu_ckpt_open(name, O_RDONLY);
+	if(ffd == -1 || bfd == -1) logea(__FILE__, __LINE__, NULL);
+	if(mmu_pread_all(ffd, mmu->pmem, (size_t)mmu->npages * PAGESIZE, 0) ||
+			mmu_pread_all(bfd, mmu->disk,
+				(size_t)mmu->nblocks * PAGESIZE, 0))
+		logea(__FILE__, __LINE__, NULL);
+	close(ffd);
+	close(bfd);
+	/* the other generation is behind by changes we do not know */
+	memset(mmu->frame_flags, MMU_CKPT_PREV, mmu->npages);
+	memset(mmu->block_flags, MMU_CKPT_PREV, mmu->nblocks);
+
+	for(int i = 0; i < ndead; ++i) {
+		pager_destroy(dead[i]);
+		mmu_id_free(dead[i]);
+	}
+	free(dead);
+	fprintf(stderr, "restored checkpoint %d: %d clients, %d exited\n",
+			mmu->ckpt_seq, hdr.nclients - ndead, ndead);
+}/*}}}*/
+
+int mmu_ckpt_open(const char *name, int flags)/*{{{*/
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", mmu->ckpt_dir, name);
+	return open(path, flags, 0644);
+}/*}}}*/
+
+int mmu_ckpt_copy(int fd, const char *mem, uint8_t *flags, int n,/*{{{*/
+		int *ncopied)
+{
+	/* writes runs of marked pages with one pwrite each; the pages
+	 * changed since the last checkpoint are then marked as changed
+	 * since the one before, for the next generation */
+	int i = 0;
+	while(i < n) {
+		if(!flags[i]) {
+			i++;
+			continue;
+		}
+		int j = i;
+		for(; j < n && flags[j]; ++j) {
+			uint8_t old = __atomic_fetch_and(&flags[j],
+					(uint8_t)~(MMU_CKPT_DIRTY | MMU_CKPT_PREV),
+					__ATOMIC_RELAXED);
+			if(old & MMU_CKPT_DIRTY)
+				__atomic_or_fetch(&flags[j], MMU_CKPT_PREV,
+						__ATOMIC_RELAXED);
+		}
+		if(mmu_pwrite_all(fd, mem + (size_t)i * PAGESIZE,
+					(size_t)(j - i) * PAGESIZE, (off_t)i * PAGESIZE))
+			return -1;
+		*ncopied += j - i;
+		i = j;
+	}
+	return 0;
+}/*}}}*/
+
+int mmu_write_all(int fd, const void *buf, size_t len)/*{{{*/
+{
+	const char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = write(fd, p, len);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		len -= cnt;
+	}
+	return 0;
+}/*}}}*/
+
+int mmu_read_all(int fd, void *buf, size_t len)/*{{{*/
+{
+	char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = read(fd, p, len);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt == 0) errno = EIO;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		len -= cnt;
+	}
+	return 0;
+}/*}}}*/
+
+int mmu_pwrite_all(int fd, const void *buf, size_t len, off_t off)/*{{{*/
+{
+	const char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = pwrite(fd, p, len, off);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		off += cnt;
+		len -= cnt;
+	}
+	return 0;
+}/*}}}*/
+
+int mmu_pread_all(int fd, void *buf, size_t len, off_t off)/*{{{*/
+{
+	char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = pread(fd, p, len, off);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt == 0) errno = EIO;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		off += cnt;
+		len -= cnt;
+	}
+	return 0;
 }/*}}}*/
 /*}}}*/
 
 /****************************************************************************
  * main() and argparse
  ***************************************************************************/
-#ifdef MMUFREE
-void pager_free(void);
-#endif
 void usage(int argc, char **argv) {/*{{{*/
-	printf("usage: %s NFRAMES NBLOCKS\n", argv[0]);
+	printf("usage: %s [-s SOCKPATH] [-d PMEMDIR] [-y SYSLOGFILE] "
+			"[-c CKPTDIR] NFRAMES NBLOCKS\n", argv[0]);
 	printf("\n");
 	printf("valid ranges: 2 <= NFRAMES <= 256\n");
 	printf("              4 <= NBLOCKS <= 1024\n");
+	printf("\n");
+	printf("-s SOCKPATH  listen on SOCKPATH [$%s or %s]\n",
+			MMU_PROTO_SOCK_ENV, MMU_PROTO_UNIX_PATH);
+	printf("-d PMEMDIR   create physical memory image in PMEMDIR "
+			"[$%s or .]\n", MMU_PMEM_DIR_ENV);
+	printf("-y SYSLOGFILE  append raw syslog records to SYSLOGFILE "
+			"[$%s or hex on stdout]\n", MMU_SYSLOG_ENV);
+	printf("-c CKPTDIR   restore from and checkpoint to CKPTDIR "
+			"[$%s or none]\n", MMU_CKPT_DIR_ENV);
+	printf("             (SIGUSR1 checkpoints, SIGINT checkpoints "
+			"and exits)\n");
+	printf("\n");
+	printf("clients connect to the socket named in $%s.\n",
+			MMU_PROTO_SOCK_ENV);
 	exit(EXIT_FAILURE);
 }/*}}}*/
 
 int main(int argc, char **argv) {/*{{{*/
-	if(argc != 3) usage(argc, argv);
-	int npages = atoi(argv[1]);
+	int opt;
+	while((opt = getopt(argc, argv, "s:d:y:c:")) != -1) {
+		switch(opt) {
+		case 's': opt_sock_path = optarg; break;
+		case 'd': opt_pmem_dir = optarg; break;
+		case 'y': opt_syslog_fn = optarg; break;
+		case 'c': opt_ckpt_dir = optarg; break;
+		default: usage(argc, argv);
+		}
+	}
+	if(argc - optind != 2) usage(argc, argv);
+	int npages = atoi(argv[optind]);
 	if(npages < 1 || npages > 256) usage(argc, argv);
-	int nblocks = atoi(argv[2]);
+	int nblocks = atoi(argv[optind+1]);
 	if(nblocks < 2 || nblocks > 1024) usage(argc, argv);
 	#ifdef MMULOG
-	log_init(LOG_EXTRA, "mmu.log", 1, 1<<20);
+	char log_path[MMU_PROTO_PATH_MAX + 16];
+	mmu_proto_log_path(log_path, sizeof(log_path),
+			opt_sock_path ? opt_sock_path : mmu_proto_unix_path(), "mmu");
+	log_init(LOG_EXTRA, log_path, 1, 1<<20);
 	#endif
 	memset(id2pid, 255, UINT8_MAX * sizeof(pid_t));
+	mmu_ids_init(0);
 	mmu_init(npages, nblocks);
 	pager_init(npages, nblocks);
+	mmu_restore();
+	mmu_notify_ready();
 	mmu_accept_loop();
-	#ifdef MMUFREE
-	pager_free();
-	#endif
 	mmu_destroy();
 	#ifdef MMULOG
 	log_destroy();
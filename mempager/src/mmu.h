@@ -5,6 +5,8 @@
 #ifndef __MMU_HEADER__
 #define __MMU_HEADER__
 
+#include <sys/uio.h>
+
 /* `UVM_BASEADDR` is where virtual pages will be mapped in process
  * virtual address spaces.  This address is not normally used by the
  * Linux kernel.  The page size for the architecture can be obtained
@@ -19,6 +21,24 @@
  * and `UVM_MAXADDR` are sent to the pager. */
 #define UVM_MAXADDR ((intptr_t)0x600FFFFF)
 
+/* Access hints given with `uvm_advise` and passed on to
+ * `pager_advise`. */
+#define UVM_ADV_NORMAL 0
+#define UVM_ADV_RANDOM 1
+#define UVM_ADV_SEQUENTIAL 2
+#define UVM_ADV_WILLNEED 3
+#define UVM_ADV_DONTNEED 4
+
+/* Quality-of-service classes a program declares when it binds with
+ * `uvm_create` (see `UVM_QOS` in uvm.c), from the most to the least
+ * latency-sensitive.  The MMU services queued requests of the
+ * classes with weighted-fair queueing, and the pager evicts frames of
+ * later classes first (see `pager_set_qos`). */
+#define UVM_QOS_LATENCY 0
+#define UVM_QOS_NORMAL 1
+#define UVM_QOS_BATCH 2
+#define UVM_QOS_CLASSES 3
+
 /* `pmem` points to the physical memory maintained by the MMU.  Your
  * pager should never write to `pmem`.  */
 extern const char *pmem;
@@ -32,6 +52,11 @@ extern const char *pmem;
  * allowing read access to a page.  */
 void mmu_zero_fill(int frame);
 
+/* `mmu_fill` fills every byte of `frame` with `byte`.  The pager
+ * uses it to page in pages it found to hold a single repeated byte
+ * when they were evicted, instead of writing them to disk. */
+void mmu_fill(int frame, int byte);
+
 /* `mmu_resident` will map address `vaddr` in process `pid` to
  * `frame` with protection level `prot`.  `vaddr` should be
  * page-aligned (i.e., `vaddr & (PAGESIZE-1)` should be zero).
@@ -49,6 +74,35 @@ void mmu_nonresident(pid_t pid, void *vaddr);
  * on `vaddr` and `prot`.  */
 void mmu_chprot(pid_t pid, void *vaddr, int prot);
 
+/* `mmu_refclear` revokes access to the page at `vaddr` like
+ * `mmu_chprot(pid, vaddr, PROT_NONE)`, but lets process `pid`
+ * restore protection `prot` by itself on its next access, without
+ * calling `pager_fault`.  Returns 1 if the process may do so, or 0 if
+ * it cannot (the page is then simply inaccessible).  After a call
+ * that returns 1, `mmu_reftake` must be called on the page before
+ * any other function in this module changes its mapping or reads
+ * its frame on behalf of the process.  `mmu_reftake` withdraws the
+ * permission and returns 1 if the process used it (the page is then
+ * mapped with `prot` and was referenced), or 0 otherwise.  */
+int mmu_refclear(pid_t pid, void *vaddr, int prot);
+int mmu_reftake(pid_t pid, void *vaddr);
+
+/* `mmu_numa_nodes` returns the number of NUMA nodes, numbered from
+ * zero; it is 1 on machines without NUMA.  `mmu_pmem_bind` binds the
+ * `nframes` frames starting at `first` to memory on `node`, migrating
+ * pages already allocated; returns 0 on success or -1 if the kernel
+ * refused (frames then keep the default policy).  `mmu_fault_node`
+ * returns the node of the CPU process `pid` was running on when it
+ * sent its last fault, or -1 if unknown.  */
+int mmu_numa_nodes(void);
+int mmu_pmem_bind(int first, int nframes, int node);
+int mmu_fault_node(pid_t pid);
+
+/* `mmu_reclaim_wake` asks the MMU's background reclaim thread to
+ * call `pager_reclaim`.  It returns at once; wakeups made while the
+ * thread is busy are merged into one further call. */
+void mmu_reclaim_wake(void);
+
 /* `mmu_disk_read` copies content from disk block `block_from` into
  * physical frame `frame_to`.  `mmu_disk_write` copies content from
  * frame `frame_from` to disk block `block_to`.  Your pager shoudl
@@ -56,4 +110,17 @@ void mmu_chprot(pid_t pid, void *vaddr, int prot);
 void mmu_disk_read(int block_from, int frame_to);
 void mmu_disk_write(int frame_from, int block_to);
 
+/* `mmu_syslog_begin` starts a syslog record for process `pid`, and
+ * `mmu_syslog_write` adds the `iovcnt` byte ranges in `iov` to it;
+ * the record ends with the call where `last` is nonzero.  Ranges
+ * should point directly into `pmem`, and the pager must keep the
+ * frames they cover from being reused until `mmu_syslog_write`
+ * returns.  Each record is written whole, with one `writev`, to the
+ * file given to the MMU with -y, or printed to stdout in hex
+ * otherwise.  Several threads may gather records at once; a record
+ * gathered over several calls is copied until it ends.  No lock is
+ * held between the calls, only while the record is output. */
+void mmu_syslog_begin(pid_t pid);
+void mmu_syslog_write(const struct iovec *iov, int iovcnt, int last);
+
 #endif
@@ -10,9 +10,9 @@
  * are sent from the MMU (mmu.c) to clients.
  *
  * The `CREATE` message and its reply are exchanged before the
- * `vmu_thread` starts.  Clients send their PID to the MMU, and
- * receive the path to the memory-mapped file representing physical
- * memory.
+ * `vmu_thread` starts.  Clients send their PID and QoS class to the
+ * MMU, and receive the path to the memory-mapped file representing
+ * physical memory.
  *
  * The `EXTEND` and `SEGV` messages are generated by the client when
  * they allocate memory and experience a segmentation fault,
@@ -20,6 +20,78 @@
  * `uvm_segv_action`) wait on a condition variable for the request
  * to be serviced.
  *
+ * Every request other than `CREATE` starts with `struct
+ * mmu_proto_hdr`, and its reply carries the request's tag back.
+ * Several threads of a client may have requests outstanding at
+ * once; the MMU services them concurrently and replies in any
+ * order, and the client wakes the thread whose tag the reply
+ * carries.  The MMU reads every message from a client on one
+ * thread, so acknowledgements of `REMAP`, `CHPROT` and `DETACH`,
+ * which carry no tag, may arrive between requests.  A client has
+ * at most one of these exchanges in progress at a time.
+ *
+ * A client timing its faults stamps `SEGV_REQ` with the time the
+ * fault reached it and the time the request was sent, and the MMU
+ * stamps the reply with the times it received the request and
+ * started and finished servicing it, and with how long it waited for
+ * acknowledgements and copied to and from disk meanwhile.  Stamps
+ * are `CLOCK_MONOTONIC` nanoseconds; they are 0 if the client does
+ * not time faults.
+ *
+ * `SYSLOG_BATCH` carries up to `MMU_PROTO_SYSLOG_BATCH_MAX`
+ * (addr, len) records in a single exchange.  The reply reports how
+ * many records failed and echoes the request flags.  Clients do not
+ * wait for the reply to batches with `MMU_PROTO_SYSLOG_ASYNC` set,
+ * but send no other request until it arrives, so records are
+ * logged in the order they are sent.
+ *
+ * The pmem file ends with a reference map: `MMU_PROTO_REFMAP_SLOTS`
+ * arrays with one `uint32_t` entry per page in the managed range,
+ * one array per client.  `CREATE_REP` carries the offset of the
+ * client's array in the file, or zero if it has none.  An entry
+ * holds the protection (`MMU_PROTO_REF_PROT`) the client may restore
+ * on its own when it faults on the page, saving the round trip of
+ * a fault that only sets the pager's reference bit.  The client
+ * claims a nonzero entry by setting `MMU_PROTO_REF_BUSY`, calls
+ * mprotect, and then replaces `BUSY` with `MMU_PROTO_REF_USED`.  The
+ * MMU only publishes an entry after the page is mapped `PROT_NONE`,
+ * and zeroes it (waiting while it is `BUSY`) before changing the
+ * page's mapping again.
+ *
+ * An MMU started with a checkpoint directory sends `DETACH_REP` to
+ * every client before it shuts down.  The client makes all its
+ * pages inaccessible, acknowledges with `DETACH_REQ`, and holds new
+ * requests until it is resumed; from then on it acknowledges
+ * `REMAP` and `CHPROT` messages without applying them.  A client
+ * that reconnects to a restarted MMU sends `CREATE_REQ` with
+ * `MMU_PROTO_CREATE_RESUME` set, receives the new pmem path in
+ * `CREATE_REP`, then a `REMAP` for each page mapped at checkpoint
+ * time, and finally `RESUME_REP`, after which it resends the requests
+ * left unanswered when the old MMU went away, if any.
+ *
+ * A process created by `uvm_fork` starts with all its pages
+ * inaccessible, connects, and sends `FORK_REQ` with its parent's
+ * PID instead of `CREATE_REQ`, with `uvm_thread` already running.
+ * The MMU clones the parent's page table, sending `CHPROT` to the
+ * parent and `REMAP` to the child for shared frames, and then
+ * replies with `FORK_REP`, which carries zero or an errno value and
+ * the child's reference map offset.  The child keeps using the pmem
+ * file descriptor inherited from its parent.
+ *
+ * `SHM_CREATE` and `SHM_ATTACH` map a shared memory segment at the
+ * end of the client's address space; both are answered with
+ * `SHM_REP`, which carries zero or an errno value, the segment's
+ * identifier and size, and the address of its first page.
+ *
+ * `RELEASE` and `ADVISE` carry a range of the client's pages and are
+ * answered after the pager has acted on them; `RELEASE_REP` also
+ * carries the client's number of pages afterwards.
+ *
+ * `MAP` asks for a region of pages, at the request's address if it
+ * is not zero and free, and is answered with the region's address;
+ * `UNMAP` removes pages of a region.  Both replies carry zero or an
+ * errno value.
+ *
  * The `REMAP` and `CHPROT` messages are generated by the MMU and
  * are processed by `uvm_thread` asynchronously.  These messages are
  * used to service sergmentation faults and whenever the pager pages
@@ -28,10 +100,39 @@
 #ifndef __MMUPROTO_HEADER__
 #define __MMUPROTO_HEADER__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 /* From UNIX_PATH_MAX, see man (7) unix: */
 #define MMU_PROTO_PATH_MAX 108
 #define MMU_PROTO_UNIX_PATH "mmu.sock"
 
+/* The socket path can be overridden by setting `MMU_PROTO_SOCK_ENV`
+ * in the environment of both the MMU and its clients, which allows
+ * running several MMU instances concurrently. */
+#define MMU_PROTO_SOCK_ENV "MMU_SOCK"
+
+static inline const char * mmu_proto_unix_path(void)
+{
+	const char *path = getenv(MMU_PROTO_SOCK_ENV);
+	return (path && path[0]) ? path : MMU_PROTO_UNIX_PATH;
+}
+
+/* Writes to `buf` the path of the log `name` (mmu or uvm) that goes
+ * with socket `sock`: `sock` with a trailing ".sock" replaced by
+ * ".<name>.log", so MMU instances and their clients on different
+ * sockets never share a log. */
+static inline void mmu_proto_log_path(char *buf, size_t len,
+		const char *sock, const char *name)
+{
+	size_t n = strlen(sock);
+	if(n >= 5 && strcmp(sock + n - 5, ".sock") == 0) n -= 5;
+	snprintf(buf, len, "%.*s.%s.log", (int)n, sock, name);
+}
+
 #define MMU_PROTO_CREATE_REQ 1
 #define MMU_PROTO_CREATE_REP 2
 #define MMU_PROTO_EXTEND_REQ 3
@@ -44,43 +145,117 @@
 #define MMU_PROTO_REMAP_REP 10
 #define MMU_PROTO_CHPROT_REQ 11
 #define MMU_PROTO_CHPROT_REP 12
+#define MMU_PROTO_SYSLOG_BATCH_REQ 13
+#define MMU_PROTO_SYSLOG_BATCH_REP 14
+#define MMU_PROTO_DETACH_REP 15
+#define MMU_PROTO_DETACH_REQ 16
+#define MMU_PROTO_RESUME_REP 17
+#define MMU_PROTO_FORK_REQ 18
+#define MMU_PROTO_FORK_REP 19
+#define MMU_PROTO_SHM_CREATE_REQ 20
+#define MMU_PROTO_SHM_ATTACH_REQ 21
+#define MMU_PROTO_SHM_REP 22
+#define MMU_PROTO_RELEASE_REQ 23
+#define MMU_PROTO_RELEASE_REP 24
+#define MMU_PROTO_ADVISE_REQ 25
+#define MMU_PROTO_ADVISE_REP 26
+#define MMU_PROTO_MAP_REQ 27
+#define MMU_PROTO_MAP_REP 28
+#define MMU_PROTO_UNMAP_REQ 29
+#define MMU_PROTO_UNMAP_REP 30
 #define MMU_PROTO_EXIT_REQ 32
 #define MMU_PROTO_EXIT_REP 33
 
+/* Leads every request but `CREATE_REQ` and every reply to one;
+ * `tag` is chosen by the client and echoed in the reply. */
+struct mmu_proto_hdr {
+	uint32_t type;
+	uint32_t tag;
+} __attribute__((packed));
+
+#define MMU_PROTO_CREATE_RESUME 0x1
+
 struct mmu_proto_create_req {
 	uint32_t type;
 	uint32_t pid;
+	uint32_t flags;
+	uint32_t qos; /* UVM_QOS_* in mmu.h */
 } __attribute__((packed));
 struct mmu_proto_create_rep {
 	uint32_t type;
 	char pmem_fn[MMU_PROTO_PATH_MAX];
+	uint64_t refmap_off;
 } __attribute__((packed));
 
+#define MMU_PROTO_REFMAP_SLOTS UINT8_MAX
+#define MMU_PROTO_REF_PROT 0x7
+#define MMU_PROTO_REF_USED 0x100
+#define MMU_PROTO_REF_BUSY 0x200
+
 struct mmu_proto_extend_req {
 	uint32_t type;
+	uint32_t tag;
 } __attribute__((packed));
 struct mmu_proto_extend_rep {
 	uint32_t type;
+	uint32_t tag;
 	uint64_t vaddr;
 } __attribute__((packed));
 
 struct mmu_proto_syslog_req {
 	uint32_t type;
+	uint32_t tag;
 	uint32_t len;
 	uint64_t addr;
 } __attribute__((packed));
 struct mmu_proto_syslog_rep {
 	uint32_t type;
+	uint32_t tag;
 	uint32_t retcode;
 } __attribute__((packed));
 
+#define MMU_PROTO_SYSLOG_BATCH_MAX 64
+#define MMU_PROTO_SYSLOG_ASYNC 0x1
+
+struct mmu_proto_syslog_rec {
+	uint64_t addr;
+	uint32_t len;
+} __attribute__((packed));
+struct mmu_proto_syslog_batch_req {
+	uint32_t type;
+	uint32_t tag;
+	uint32_t flags;
+	uint32_t count;
+	struct mmu_proto_syslog_rec recs[MMU_PROTO_SYSLOG_BATCH_MAX];
+} __attribute__((packed));
+/* only the first `count` records are sent: */
+#define MMU_PROTO_SYSLOG_BATCH_SIZE(count) \
+		(offsetof(struct mmu_proto_syslog_batch_req, recs) + \
+		(count) * sizeof(struct mmu_proto_syslog_rec))
+struct mmu_proto_syslog_batch_rep {
+	uint32_t type;
+	uint32_t tag;
+	uint32_t flags;
+	uint32_t nerrors;
+} __attribute__((packed));
+
 struct mmu_proto_segv_req {
 	uint32_t type;
+	uint32_t tag;
 	int32_t code;
 	uint64_t addr;
+	int32_t cpu; /* CPU the fault was taken on, -1 if unknown */
+	uint64_t t_fault;
+	uint64_t t_send;
 } __attribute__((packed));
 struct mmu_proto_segv_rep {
 	uint32_t type;
+	uint32_t tag;
+	uint64_t t_recv;
+	uint64_t t_start;
+	uint64_t t_done;
+	uint64_t ns_ack; /* waiting for REMAP and CHPROT acknowledgements */
+	uint64_t ns_disk;
 } __attribute__((packed));
 // segv causes remap and chprot to happen
 
@@ -103,11 +278,90 @@ struct mmu_proto_chprot_rep {
 	uint64_t vaddr;
 } __attribute__((packed));
 
+struct mmu_proto_detach_req {
+	uint32_t type;
+} __attribute__((packed));
+struct mmu_proto_detach_rep {
+	uint32_t type;
+} __attribute__((packed));
+struct mmu_proto_resume_rep {
+	uint32_t type;
+} __attribute__((packed));
+
+struct mmu_proto_fork_req {
+	uint32_t type;
+	uint32_t tag;
+	uint32_t pid;
+	uint32_t parent;
+} __attribute__((packed));
+struct mmu_proto_fork_rep {
+	uint32_t type;
+	uint32_t tag;
+	int32_t retcode; /* 0 or errno */
+	uint64_t refmap_off;
+} __attribute__((packed));
+
+struct mmu_proto_shm_req {
+	uint32_t type;
+	uint32_t tag;
+	int32_t npages; /* SHM_CREATE only */
+	int32_t id; /* SHM_ATTACH only */
+} __attribute__((packed));
+struct mmu_proto_shm_rep {
+	uint32_t type;
+	uint32_t tag;
+	int32_t retcode; /* 0 or errno */
+	int32_t id;
+	int32_t npages;
+	uint64_t vaddr;
+} __attribute__((packed));
+
+struct mmu_proto_release_req {
+	uint32_t type;
+	uint32_t tag;
+	uint32_t npages;
+	uint64_t addr;
+} __attribute__((packed));
+struct mmu_proto_release_rep {
+	uint32_t type;
+	uint32_t tag;
+	int32_t retcode; /* 0 or errno */
+	uint32_t npages; /* pages left in the address space */
+} __attribute__((packed));
+
+struct mmu_proto_advise_req {
+	uint32_t type;
+	uint32_t tag;
+	int32_t advice;
+	uint64_t addr;
+	uint64_t len;
+} __attribute__((packed));
+struct mmu_proto_advise_rep {
+	uint32_t type;
+	uint32_t tag;
+	int32_t retcode; /* 0 or errno */
+} __attribute__((packed));
+
+struct mmu_proto_map_req {
+	uint32_t type; /* MAP_REQ or UNMAP_REQ */
+	uint32_t tag;
+	int32_t npages;
+	uint64_t addr; /* a hint for MAP_REQ, 0 if none */
+} __attribute__((packed));
+struct mmu_proto_map_rep {
+	uint32_t type; /* MAP_REP or UNMAP_REP */
+	uint32_t tag;
+	int32_t retcode; /* 0 or errno */
+	uint64_t vaddr; /* MAP_REP only */
+} __attribute__((packed));
+
 struct mmu_proto_exit_req {
 	uint32_t type;
+	uint32_t tag;
 } __attribute__((packed));
 struct mmu_proto_exit_rep {
 	uint32_t type;
+	uint32_t tag;
 } __attribute__((packed));
 
 #endif
@@ -0,0 +1,2249 @@
+/* UNIVERSIDADE FEDERAL DE MINAS GERAIS     *
+ * DEPARTAMENTO DE CIENCIA DA COMPUTACAO    *
+ * Copyright (c) Italo Fernando Scota Cunha */
+
+/* Second-chance pager over frames split into shards, each with its
+ * own lock, clock hand and lock-free pool of free frames.
+ *
+ * Locking: a process's page table is protected by its mutex, except
+ * for the fields of a resident or cached page that eviction updates
+ * (`frame`, `prot`, `dirty`, `ondisk`, `fill` and `cache`), which
+ * are protected by the lock of the shard holding the frame.  Holders
+ * of only the process mutex read `frame` and `cache` atomically and
+ * check them again under the shard lock.  Locks are acquired in the
+ * order process, segment, shard, at most one shard at a time; the
+ * MMU's syslog mutex comes last and takes no lock under it. */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#include "pager.h"
+#include "mmu.h"
+#include "pool.h"
+#include "slab.h"
+#include "uniform.h"
+
+#define PAGER_HASH_SIZE 64
+
+/* Number of shards.  With one (the default), faults take the
+ * lowest-numbered free frame, as pager.h requires. */
+#define PAGER_SHARDS_ENV "PAGER_SHARDS"
+
+/* If set, frames and blocks are allocated near the process's last
+ * allocation instead of lowest-numbered first. */
+#define PAGER_RELAXED_ENV "PAGER_RELAXED"
+
+/* If set, the clock clears reference bits with `mmu_refclear`, so
+ * processes restore access to referenced pages without a fault. */
+#define PAGER_SOFTREF_ENV "PAGER_SOFTREF"
+
+/* If set, there is one shard per NUMA node, bound to its memory, and
+ * faults allocate from the node the process faulted on. */
+#define PAGER_NUMA_ENV "PAGER_NUMA"
+
+/* N > 0 gives a process's consecutive pages frames of consecutive
+ * colors (frame number modulo N); -1 derives N from the L2 cache. */
+#define PAGER_COLORS_ENV "PAGER_COLORS"
+
+/* N > 0 wakes the MMU's reclaim thread when fewer than N frames are
+ * free, to evict frames until PAGER_WMARK_HIGH (2N) are free. */
+#define PAGER_WMARK_LOW_ENV "PAGER_WMARK_LOW"
+#define PAGER_WMARK_HIGH_ENV "PAGER_WMARK_HIGH"
+#define PAGER_RECLAIM_BATCH 8 /* frames evicted per shard lock hold */
+
+/* N > 0 reads up to N pages on disk following a swapped-in page
+ * into spare frames, the swap cache. */
+#define PAGER_SWAP_READAHEAD_ENV "PAGER_SWAP_READAHEAD"
+
+/* If set, dirty frames holding one repeated byte are not written at
+ * eviction; the page keeps the byte in `fill`. */
+#define PAGER_UNIFORM_ENV "PAGER_UNIFORM"
+
+#define PAGER_DEFAULT_COLORS 16
+#define PAGER_SYSLOG_IOV 64
+#define PAGER_READAHEAD 4 /* pages read ahead of sequential faults */
+#define PAGER_SHM_PID(id) (-1 - (id))
+/* page tables are radix trees of PAGER_PT_FANOUT entries per node */
+#define PAGER_PT_BITS 6
+#define PAGER_PT_FANOUT (1 << PAGER_PT_BITS)
+#define PAGER_PT_MASK (PAGER_PT_FANOUT - 1)
+
+/****************************************************************************
+ * structure definitions and static variables
+ ***************************************************************************/
+struct pager_page {/*{{{*/
+	int frame; /* -1 if not resident */
+	int block;
+	int prot; /* protection currently granted to the process */
+	int dirty; /* frame differs from block */
+	int ondisk; /* block holds the page's contents */
+	int soft; /* protection the process may restore itself, or 0 */
+	int shm; /* segment mapped by the page, or -1 if private */
+	int shm_page;
+	int advice; /* UVM_ADV_* */
+	int cache; /* frame read ahead from `block`, or -1; see `frame` */
+	int fill; /* byte the page holds, or -1; see `ondisk` */
+};/*}}}*/
+struct pager_sharer {/*{{{*/
+	struct pager_proc *proc;
+	int page;
+	struct pager_sharer *next;
+};/*}}}*/
+struct pager_proc {/*{{{*/
+	pid_t pid;
+	int shard; /* home shard */
+	int frame_hint; /* allocation hints for relaxed mode */
+	int block_hint;
+	int color; /* color of the next frame, if coloring */
+	int qos; /* UVM_QOS_*; atomic, clocks read it under a shard lock */
+	int npages; /* pages below the break */
+	int nshm; /* pages mapping shared memory segments */
+	int nmapped; /* pages in regions */
+	void *pt; /* root of the page table, NULL if empty */
+	struct pager_region *regions; /* treap root */
+	struct arena arena; /* page table nodes and regions */
+	pthread_mutex_t mutex;
+	struct pager_proc *next; /* hash chain */
+};/*}}}*/
+struct pager_pt {/*{{{*/
+	int n; /* children */
+	void *child[PAGER_PT_FANOUT];
+};/*}}}*/
+struct pager_ptleaf {/*{{{*/
+	uint64_t valid; /* bitmap of pages with an entry */
+	struct pager_page pages[PAGER_PT_FANOUT];
+};/*}}}*/
+struct pager_region {/*{{{*/
+	int start;
+	int npages;
+	unsigned prio; /* heap-ordered; a hash of `start` */
+	struct pager_region *left;
+	struct pager_region *right;
+};/*}}}*/
+struct pager_shm {/*{{{*/
+	/* A segment's pages are the primary mapping of their frames and
+	 * hold the contents; client pages mapping them are `shared`. */
+	int id;
+	int refs; /* client pages mapping the segment */
+	struct pager_proc *proc; /* the segment's pages */
+	struct pager_shm *next;
+};/*}}}*/
+struct pager_frame {/*{{{*/
+	struct pager_proc *proc; /* NULL if free or being installed */
+	int page;
+	int ref;
+	int pins; /* pending syslog slices; the clock skips pinned frames */
+	struct pager_sharer *shared; /* other pages mapping the frame */
+};/*}}}*/
+struct pager_shard {/*{{{*/
+	pthread_mutex_t mutex;
+	int first;
+	int nframes;
+	int hand;
+	int rhand; /* reclaim hand */
+	struct pool *free; /* frame `first + i` is identifier `i` */
+};/*}}}*/
+struct pager_data {/*{{{*/
+	int nframes;
+	int nblocks;
+	int nshards;
+	int maxpages;
+	int ptlevels; /* page table nodes from root to leaf */
+	int nextshard;
+	int relaxed;
+	int softref;
+	int numa; /* shard `i` is on NUMA node `i` */
+	int ncolors; /* 0 if not coloring */
+	int wmark_low; /* free frames; 0 if not reclaiming in background */
+	int wmark_high;
+	struct pager_reclaim_stats stats; /* updated atomically */
+	int swapra; /* pages read ahead of swap-ins; 0 if disabled */
+	struct pager_swapra_stats rastats; /* updated atomically */
+	int uniform; /* check dirty frames at eviction */
+	struct pager_uniform_stats ustats; /* updated atomically */
+	int qos_procs[UVM_QOS_CLASSES]; /* processes, not segments; atomic */
+	struct pager_frame *frames;
+	struct pager_shard *shards;
+	struct pool *blocks;
+	int *block_refs; /* pages referencing each block */
+	int navail; /* blocks minus block references */
+	struct slab *proc_slab;
+	struct slab *sharer_slab;
+	struct slab *chunk_slab; /* of process arenas */
+	pthread_rwlock_t procs_lock;
+	struct pager_proc *procs[PAGER_HASH_SIZE];
+	pthread_mutex_t shm_lock; /* protects `shms`, `nextshm`, and refs */
+	struct pager_shm *shms;
+	int nextshm;
+};/*}}}*/
+static struct pager_data *pager = NULL;
+static size_t PAGESIZE = 0;
+
+/****************************************************************************
+ * static function declarations
+ ***************************************************************************/
+static struct pager_proc * pager_proc_new(pid_t pid);
+static struct pager_proc * pager_proc_get(pid_t pid);
+static void pager_proc_free(struct pager_proc *proc);
+static struct pager_shm * pager_shm_get(int id);
+static void pager_shm_put(int id);
+static void * pager_shm_map(struct pager_proc *proc, struct pager_shm *shm);
+static void pager_shm_access(struct pager_proc *proc, int vpn, int write);
+static struct pager_shard * pager_shard_of(int frame);
+static int pager_frame_take(struct pager_shard *s, struct pager_proc *proc);
+static int pager_frame_alloc(struct pager_proc *proc);
+static int pager_home(struct pager_proc *proc);
+static int pager_cache_colors(void);
+static int pager_clock(struct pager_shard *s, int *hand);
+static void pager_qos_range(int *lo, int *hi);
+static void pager_revoke(struct pager_proc *proc, int vpn);
+static int pager_evict(int frame);
+static int pager_nfree(void);
+static void pager_page_out(struct pager_page *pg, int written, int fill);
+static void pager_frame_load(struct pager_page *pg, int frame);
+static int pager_frame_drop(int frame, struct pager_proc *proc, int vpn);
+static void pager_page_in(struct pager_proc *proc, int vpn);
+static void pager_access(struct pager_proc *proc, int vpn, int write);
+static void pager_cow(struct pager_proc *proc, int vpn, int frame);
+static void pager_dontneed(struct pager_proc *proc, int vpn);
+static void pager_readahead(struct pager_proc *proc, int vpn);
+static void pager_swap_readahead(struct pager_proc *proc, int vpn);
+static int pager_frame_spare(struct pager_proc *proc);
+static int pager_cache_take(struct pager_page *pg);
+static int pager_block_alloc(struct pager_proc *proc);
+static void pager_block_put(int block);
+static int pager_block_private(int block);
+static int pager_pin(struct pager_proc *proc, int vpn);
+static void pager_soft_sync(struct pager_proc *proc, int vpn);
+static void pager_syslog_flush(const struct iovec *iov, const int *frames,
+		int n, int last);
+static void * pager_vaddr(int vpn);
+static int pager_restore_pages(struct pager_proc *proc);
+static int pager_shm_valid(const struct pager_page *pg);
+static struct pager_page * pager_pte(struct pager_proc *proc, int vpn);
+static struct pager_page * pager_pte_add(struct pager_proc *proc, int vpn);
+static struct pager_page * pager_pte_get(struct pager_proc *proc, int vpn);
+static void pager_pte_del(struct pager_proc *proc, int vpn);
+static int pager_pte_next(struct pager_proc *proc, int vpn);
+static int pager_pt_next(void *node, int level, int base, int vpn);
+static int pager_pt_del(struct arena *a, void **slot, int level, int vpn);
+static int pager_mapped(struct pager_proc *proc, intptr_t start, size_t len);
+static int pager_brk_room(struct pager_proc *proc, int npages);
+static struct pager_region * pager_region_new(struct pager_proc *proc,
+		int start, int npages);
+static struct pager_region * pager_region_find(struct pager_region *t,
+		int vpn);
+static int pager_region_overlaps(struct pager_region *t, int first, int n);
+static void pager_region_insert(struct pager_region **t,
+		struct pager_region *r);
+static void pager_region_remove(struct pager_region **t, int start);
+static void pager_region_split(struct pager_region *t, int start,
+		struct pager_region **l, struct pager_region **r);
+static struct pager_region * pager_region_merge(struct pager_region *l,
+		struct pager_region *r);
+static int pager_region_gap(struct pager_region *t, int *hi, int npages);
+static struct pager_region * pager_region_copy(struct pager_proc *proc,
+		struct pager_region *t);
+static int pager_region_count(struct pager_region *t);
+static int pager_region_save(int fd, struct pager_region *t);
+static struct pager_sharer * pager_sharer_new(struct pager_proc *proc,
+		int page, struct pager_sharer *next);
+static int pager_ckpt_pages(int fd, struct pager_proc *proc);
+static int pager_restore_ptes(int fd, struct pager_proc *proc, int nptes);
+static int pager_write_all(int fd, const void *buf, size_t len);
+static int pager_read_all(int fd, void *buf, size_t len);
+
+/****************************************************************************
+ * external functions
+ ***************************************************************************/
+void pager_init(int nframes, int nblocks)/*{{{*/
+{
+	PAGESIZE = sysconf(_SC_PAGESIZE);
+	assert(pager == NULL);
+	pager = malloc(sizeof(*pager));
+	if(!pager) logea(__FILE__, __LINE__, NULL);
+	pager->nframes = nframes;
+	pager->nblocks = nblocks;
+	pager->maxpages = (UVM_MAXADDR - UVM_BASEADDR + 1) / PAGESIZE;
+	pager->ptlevels = 1;
+	while(pager->ptlevels * PAGER_PT_BITS < 31 &&
+			pager->maxpages > 1 << (pager->ptlevels * PAGER_PT_BITS))
+		pager->ptlevels++;
+	pager->nextshard = 0;
+
+	char *env = getenv(PAGER_SHARDS_ENV);
+	pager->nshards = env ? atoi(env) : 1;
+	if(pager->nshards < 1) pager->nshards = 1;
+	if(pager->nshards > nframes) pager->nshards = nframes;
+	env = getenv(PAGER_RELAXED_ENV);
+	pager->relaxed = env ? atoi(env) : 0;
+	env = getenv(PAGER_SOFTREF_ENV);
+	pager->softref = env ? atoi(env) : 0;
+	env = getenv(PAGER_NUMA_ENV);
+	pager->numa = env ? atoi(env) : 0;
+	if(pager->numa) {
+		pager->nshards = mmu_numa_nodes();
+		if(pager->nshards > nframes) pager->nshards = nframes;
+	}
+	env = getenv(PAGER_COLORS_ENV);
+	pager->ncolors = env ? atoi(env) : 0;
+	if(pager->ncolors < 0) pager->ncolors = pager_cache_colors();
+	if(pager->ncolors == 1) pager->ncolors = 0;
+	env = getenv(PAGER_WMARK_LOW_ENV);
+	pager->wmark_low = env ? atoi(env) : 0;
+	if(pager->wmark_low < 0) pager->wmark_low = 0;
+	if(pager->wmark_low >= nframes) pager->wmark_low = nframes - 1;
+	env = getenv(PAGER_WMARK_HIGH_ENV);
+	pager->wmark_high = env ? atoi(env) : 2 * pager->wmark_low;
+	if(pager->wmark_high < pager->wmark_low)
+		pager->wmark_high = pager->wmark_low;
+	if(pager->wmark_high >= nframes) pager->wmark_high = nframes - 1;
+	memset(&pager->stats, 0, sizeof(pager->stats));
+	env = getenv(PAGER_SWAP_READAHEAD_ENV);
+	pager->swapra = env ? atoi(env) : 0;
+	if(pager->swapra < 0) pager->swapra = 0;
+	if(pager->swapra > nframes / 2) pager->swapra = nframes / 2;
+	memset(&pager->rastats, 0, sizeof(pager->rastats));
+	pager->rastats.window = pager->swapra;
+	env = getenv(PAGER_UNIFORM_ENV);
+	pager->uniform = env ? atoi(env) : 0;
+	memset(&pager->ustats, 0, sizeof(pager->ustats));
+	if(pager->uniform) pager->ustats.impl = uniform_impl();
+	memset(pager->qos_procs, 0, sizeof(pager->qos_procs));
+
+	pager->frames = calloc(nframes, sizeof(pager->frames[0]));
+	if(!pager->frames) logea(__FILE__, __LINE__, NULL);
+	pager->shards = calloc(pager->nshards, sizeof(pager->shards[0]));
+	if(!pager->shards) logea(__FILE__, __LINE__, NULL);
+	for(int i = 0; i < pager->nshards; ++i) {
+		struct pager_shard *s = &pager->shards[i];
+		pthread_mutex_init(&s->mutex, NULL);
+		s->first = (int)((long)nframes * i / pager->nshards);
+		s->nframes = (int)((long)nframes * (i+1) / pager->nshards) -
+				s->first;
+		s->hand = 0;
+		s->rhand = 0;
+		s->free = pool_create(s->nframes);
+		if(!s->free) logea(__FILE__, __LINE__, NULL);
+		if(pager->numa) mmu_pmem_bind(s->first, s->nframes, i);
+	}
+
+	pager->blocks = pool_create(nblocks);
+	if(!pager->blocks) logea(__FILE__, __LINE__, NULL);
+	pager->block_refs = calloc(nblocks, sizeof(pager->block_refs[0]));
+	if(!pager->block_refs) logea(__FILE__, __LINE__, NULL);
+	pager->navail = nblocks;
+	pager->proc_slab = slab_create("procs", sizeof(struct pager_proc));
+	pager->sharer_slab = slab_create("sharers", sizeof(struct pager_sharer));
+	pager->chunk_slab = slab_create("page tables", ARENA_CHUNK);
+	if(!pager->proc_slab || !pager->sharer_slab || !pager->chunk_slab)
+		logea(__FILE__, __LINE__, NULL);
+	pthread_rwlock_init(&pager->procs_lock, NULL);
+	memset(pager->procs, 0, sizeof(pager->procs));
+	pthread_mutex_init(&pager->shm_lock, NULL);
+	pager->shms = NULL;
+	pager->nextshm = 0;
+	logd(LOG_INFO, "%s: %d frames in %d shards, %d blocks, "
+			"%d colors, watermarks %d/%d, readahead %d%s%s%s%s\n",
+			__func__, nframes, pager->nshards, nblocks, pager->ncolors,
+			pager->wmark_low, pager->wmark_high, pager->swapra,
+			pager->relaxed ? ", relaxed" : "",
+			pager->softref ? ", soft references" : "",
+			pager->numa ? ", per NUMA node" : "",
+			pager->uniform ? ", uniform pages" : "");
+}/*}}}*/
+
+void pager_create(pid_t pid)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_new(pid);
+	__atomic_add_fetch(&pager->qos_procs[proc->qos], 1, __ATOMIC_RELAXED);
+	pthread_rwlock_wrlock(&pager->procs_lock);
+	proc->shard = pager->nextshard;
+	pager->nextshard = (pager->nextshard + 1) % pager->nshards;
+	int h = (unsigned)pid % PAGER_HASH_SIZE;
+	proc->next = pager->procs[h];
+	pager->procs[h] = proc;
+	pthread_rwlock_unlock(&pager->procs_lock);
+}/*}}}*/
+
+void pager_set_qos(pid_t pid, int qos)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	if(qos < 0 || qos >= UVM_QOS_CLASSES) qos = UVM_QOS_NORMAL;
+	pthread_mutex_lock(&proc->mutex);
+	__atomic_sub_fetch(&pager->qos_procs[proc->qos], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pager->qos_procs[qos], 1, __ATOMIC_RELAXED);
+	/* read by clocks holding only a shard lock */
+	__atomic_store_n(&proc->qos, qos, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&proc->mutex);
+}/*}}}*/
+
+void * pager_extend(pid_t pid)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	if(!pager_brk_room(proc, 1)) {
+		pthread_mutex_unlock(&proc->mutex);
+		return NULL;
+	}
+	if(__atomic_sub_fetch(&pager->navail, 1, __ATOMIC_RELAXED) < 0) {
+		__atomic_add_fetch(&pager->navail, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&proc->mutex);
+		return NULL;
+	}
+	int block = pager_block_alloc(proc);
+
+	int vpn = proc->npages++;
+	pager_pte_add(proc, vpn)->block = block;
+	pthread_mutex_unlock(&proc->mutex);
+	return pager_vaddr(vpn);
+}/*}}}*/
+
+int pager_shm_create(pid_t pid, int npages, void **addr)/*{{{*/
+{
+	if(npages <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	if(!pager_brk_room(proc, npages)) {
+		pthread_mutex_unlock(&proc->mutex);
+		errno = ENOMEM;
+		return -1;
+	}
+	if(__atomic_sub_fetch(&pager->navail, npages, __ATOMIC_RELAXED) < 0) {
+		__atomic_add_fetch(&pager->navail, npages, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&proc->mutex);
+		errno = ENOSPC;
+		return -1;
+	}
+	struct pager_shm *shm = malloc(sizeof(*shm));
+	if(!shm) logea(__FILE__, __LINE__, NULL);
+	shm->proc = pager_proc_new(0);
+	for(int i = 0; i < npages; ++i)
+		pager_pte_add(shm->proc, i)->block = pager_block_alloc(proc);
+	shm->proc->npages = npages;
+	shm->proc->shard = proc->shard;
+
+	pthread_mutex_lock(&pager->shm_lock);
+	shm->id = pager->nextshm++;
+	shm->proc->pid = PAGER_SHM_PID(shm->id);
+	shm->refs = npages;
+	shm->next = pager->shms;
+	pager->shms = shm;
+	pthread_mutex_unlock(&pager->shm_lock);
+
+	*addr = pager_shm_map(proc, shm);
+	pthread_mutex_unlock(&proc->mutex);
+	return shm->id;
+}/*}}}*/
+
+void * pager_shm_attach(pid_t pid, int id, int *npages)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	pthread_mutex_lock(&pager->shm_lock);
+	struct pager_shm *shm = pager_shm_get(id);
+	if(!shm || !pager_brk_room(proc, shm->proc->npages)) {
+		pthread_mutex_unlock(&pager->shm_lock);
+		pthread_mutex_unlock(&proc->mutex);
+		errno = shm ? ENOMEM : EINVAL;
+		return NULL;
+	}
+	shm->refs += shm->proc->npages;
+	pthread_mutex_unlock(&pager->shm_lock);
+	*npages = shm->proc->npages;
+	void *vaddr = pager_shm_map(proc, shm);
+	pthread_mutex_unlock(&proc->mutex);
+	return vaddr;
+}/*}}}*/
+
+int pager_fork(pid_t parent, pid_t child)/*{{{*/
+{
+	/* Resident frames are mapped read-only in both and list the
+	 * child's pages in `shared`; blocks are reference counted, and
+	 * writes copy them in `pager_cow` or `pager_access`. */
+	struct pager_proc *pp = pager_proc_get(parent);
+	pthread_mutex_lock(&pp->mutex);
+	int nprivate = pp->npages - pp->nshm + pp->nmapped;
+	if(__atomic_sub_fetch(&pager->navail, nprivate, __ATOMIC_RELAXED) < 0) {
+		__atomic_add_fetch(&pager->navail, nprivate, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&pp->mutex);
+		errno = ENOSPC;
+		return -1;
+	}
+	pager_create(child);
+	struct pager_proc *cp = pager_proc_get(child);
+	pthread_mutex_lock(&cp->mutex);
+	cp->shard = pp->shard;
+	cp->frame_hint = pp->frame_hint;
+	cp->block_hint = pp->block_hint;
+	cp->color = pp->color;
+	__atomic_sub_fetch(&pager->qos_procs[cp->qos], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pager->qos_procs[pp->qos], 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&cp->qos, pp->qos, __ATOMIC_RELAXED);
+	for(int vpn = pager_pte_next(pp, 0); vpn != -1;
+			vpn = pager_pte_next(pp, vpn + 1)) {
+		struct pager_page *pg = pager_pte(pp, vpn);
+		struct pager_page *cpg = pager_pte_add(cp, vpn);
+		if(pg->shm == -1) {
+			if(pg->block != -1)
+				__atomic_add_fetch(&pager->block_refs[pg->block], 1,
+						__ATOMIC_RELAXED);
+		} else {
+			/* segment mappings are shared, not copied */
+			pthread_mutex_lock(&pager->shm_lock);
+			pager_shm_get(pg->shm)->refs++;
+			pthread_mutex_unlock(&pager->shm_lock);
+		}
+		for(;;) {
+			int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+			if(frame == -1) {
+				*cpg = *pg;
+				cpg->cache = -1; /* the parent's */
+				break;
+			}
+			struct pager_shard *s = pager_shard_of(frame);
+			pthread_mutex_lock(&s->mutex);
+			if(pg->frame != frame) {
+				pthread_mutex_unlock(&s->mutex);
+				continue;
+			}
+			pager_soft_sync(pp, vpn);
+			void *vaddr = pager_vaddr(vpn);
+			if(pg->shm == -1 && (pg->prot & PROT_WRITE)) {
+				mmu_chprot(parent, vaddr, PROT_READ);
+				pg->prot = PROT_READ;
+			}
+			/* a readable page was referenced since the clock
+			 * last passed, so the child may read it too */
+			*cpg = *pg;
+			cpg->cache = -1;
+			mmu_resident(child, vaddr, frame, cpg->prot);
+			pager->frames[frame].shared = pager_sharer_new(cp, vpn,
+					pager->frames[frame].shared);
+			pthread_mutex_unlock(&s->mutex);
+			break;
+		}
+	}
+	cp->npages = pp->npages;
+	cp->nshm = pp->nshm;
+	cp->nmapped = pp->nmapped;
+	cp->regions = pager_region_copy(cp, pp->regions);
+	pthread_mutex_unlock(&cp->mutex);
+	pthread_mutex_unlock(&pp->mutex);
+	return 0;
+}/*}}}*/
+
+void pager_fault(pid_t pid, void *addr)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	int vpn = ((intptr_t)addr - UVM_BASEADDR) / PAGESIZE;
+	struct pager_page *pg = pager_pte_get(proc, vpn);
+	assert(pg);
+	/* The infrastructure does not tell reads from writes.  A fault
+	 * on a page the process can already read must be a write. */
+	int miss = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE) == -1;
+	pager_access(proc, vpn, 1);
+	if(miss && pg->advice == UVM_ADV_SEQUENTIAL)
+		pager_readahead(proc, vpn);
+	pthread_mutex_unlock(&proc->mutex);
+}/*}}}*/
+
+int pager_syslog(pid_t pid, void *addr, size_t len)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	intptr_t start = (intptr_t)addr;
+	if(!pager_mapped(proc, start, len)) {
+		pthread_mutex_unlock(&proc->mutex);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(len == 0) {
+		pthread_mutex_unlock(&proc->mutex);
+		return 0;
+	}
+
+	/* The record is handed to the MMU as slices of pmem.  Frames
+	 * are pinned while their slices are pending, and pending slices
+	 * are flushed before faulting pages in, so no thread ever waits
+	 * for a frame while holding pins. */
+	struct iovec iov[PAGER_SYSLOG_IOV];
+	int frames[PAGER_SYSLOG_IOV];
+	int n = 0;
+	mmu_syslog_begin(pid);
+	size_t i = 0;
+	while(i < len) {
+		intptr_t va = start + (intptr_t)i;
+		int vpn = (va - UVM_BASEADDR) / PAGESIZE;
+		size_t off = (va - UVM_BASEADDR) % PAGESIZE;
+		size_t cnt = PAGESIZE - off;
+		if(cnt > len - i) cnt = len - i;
+		int frame = pager_pin(proc, vpn);
+		if(frame == -1) {
+			pager_syslog_flush(iov, frames, n, 0);
+			n = 0;
+			pager_access(proc, vpn, 0);
+			continue;
+		}
+		iov[n].iov_base = (void *)(pmem + frame*PAGESIZE + off);
+		iov[n].iov_len = cnt;
+		frames[n++] = frame;
+		i += cnt;
+		if(n == PAGER_SYSLOG_IOV) {
+			pager_syslog_flush(iov, frames, n, 0);
+			n = 0;
+		}
+	}
+	pager_syslog_flush(iov, frames, n, 1);
+	pthread_mutex_unlock(&proc->mutex);
+	return 0;
+}/*}}}*/
+
+int pager_release(pid_t pid, void *addr, int npages)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	intptr_t off = (intptr_t)addr - UVM_BASEADDR;
+	int first = off / (intptr_t)PAGESIZE;
+	if(off % PAGESIZE || npages <= 0 ||
+			!pager_mapped(proc, (intptr_t)addr, npages * PAGESIZE)) {
+		pthread_mutex_unlock(&proc->mutex);
+		errno = EINVAL;
+		return -1;
+	}
+	for(int vpn = first; vpn < first + npages; ++vpn) {
+		if(!pager_pte(proc, vpn)) continue;
+		pager_dontneed(proc, vpn);
+		/* region pages are as good as new without an entry */
+		if(vpn >= proc->npages) pager_pte_del(proc, vpn);
+	}
+	if(first + npages == proc->npages) {
+		/* the address space shrinks, like sbrk with a negative
+		 * increment */
+		for(int vpn = first; vpn < first + npages; ++vpn) {
+			struct pager_page *pg = pager_pte(proc, vpn);
+			if(pg->shm == -1) {
+				__atomic_add_fetch(&pager->navail, 1, __ATOMIC_RELAXED);
+			} else {
+				pager_shm_put(pg->shm);
+				proc->nshm--;
+			}
+			pager_pte_del(proc, vpn);
+		}
+		proc->npages = first;
+	}
+	int r = proc->npages;
+	pthread_mutex_unlock(&proc->mutex);
+	return r;
+}/*}}}*/
+
+int pager_advise(pid_t pid, void *addr, size_t len, int advice)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	intptr_t off = (intptr_t)addr - UVM_BASEADDR;
+	if(off % PAGESIZE || !pager_mapped(proc, (intptr_t)addr, len) ||
+			advice < UVM_ADV_NORMAL || advice > UVM_ADV_DONTNEED) {
+		pthread_mutex_unlock(&proc->mutex);
+		errno = EINVAL;
+		return -1;
+	}
+	int first = off / (intptr_t)PAGESIZE;
+	int last = (off + (intptr_t)len + PAGESIZE - 1) / PAGESIZE;
+	for(int vpn = first; vpn < last; ++vpn) {
+		struct pager_page *pg = pager_pte(proc, vpn);
+		switch(advice) {
+		case UVM_ADV_WILLNEED:
+			/* more would evict the first pages brought in */
+			if(vpn - first >= pager->nframes / 2) break;
+			if(!pg || __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE) == -1)
+				pager_access(proc, vpn, 0);
+			break;
+		case UVM_ADV_DONTNEED:
+			if(pg) pager_dontneed(proc, vpn);
+			break;
+		default:
+			/* untouched pages have the default advice */
+			if(!pg && advice == UVM_ADV_NORMAL) break;
+			pager_pte_get(proc, vpn)->advice = advice;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&proc->mutex);
+	return 0;
+}/*}}}*/
+
+void * pager_map(pid_t pid, void *addr, int npages)/*{{{*/
+{
+	if(npages <= 0 || (intptr_t)addr % PAGESIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	int first = -1;
+	intptr_t off = (intptr_t)addr - UVM_BASEADDR;
+	if(addr && off >= 0) {
+		/* the hint is taken if the pages are free, like mmap's */
+		int vpn = off / PAGESIZE;
+		if(vpn >= proc->npages && vpn < pager->maxpages &&
+				npages <= pager->maxpages - vpn &&
+				!pager_region_overlaps(proc->regions, vpn, npages))
+			first = vpn;
+	}
+	if(first == -1) {
+		/* the highest free range, so the break can grow below */
+		int hi = pager->maxpages;
+		first = pager_region_gap(proc->regions, &hi, npages);
+		if(first == -1 && hi - proc->npages >= npages) first = hi - npages;
+	}
+	if(first == -1) {
+		pthread_mutex_unlock(&proc->mutex);
+		errno = ENOMEM;
+		return NULL;
+	}
+	if(__atomic_sub_fetch(&pager->navail, npages, __ATOMIC_RELAXED) < 0) {
+		__atomic_add_fetch(&pager->navail, npages, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&proc->mutex);
+		errno = ENOSPC;
+		return NULL;
+	}
+	pager_region_insert(&proc->regions,
+			pager_region_new(proc, first, npages));
+	proc->nmapped += npages;
+	pthread_mutex_unlock(&proc->mutex);
+	return pager_vaddr(first);
+}/*}}}*/
+
+int pager_unmap(pid_t pid, void *addr, int npages)/*{{{*/
+{
+	struct pager_proc *proc = pager_proc_get(pid);
+	pthread_mutex_lock(&proc->mutex);
+	intptr_t off = (intptr_t)addr - UVM_BASEADDR;
+	int first = off / (intptr_t)PAGESIZE;
+	struct pager_region *r = NULL;
+	if(off >= 0 && off % PAGESIZE == 0 && npages > 0)
+		r = pager_region_find(proc->regions, first);
+	if(!r || npages > r->start + r->npages - first) {
+		pthread_mutex_unlock(&proc->mutex);
+		errno = EINVAL;
+		return -1;
+	}
+	for(int vpn = pager_pte_next(proc, first);
+			vpn != -1 && vpn < first + npages;
+			vpn = pager_pte_next(proc, vpn + 1)) {
+		pager_dontneed(proc, vpn);
+		pager_pte_del(proc, vpn);
+	}
+	/* what is left of the region on either side stays mapped */
+	int start = r->start, end = r->start + r->npages;
+	pager_region_remove(&proc->regions, start);
+	arena_free(&proc->arena, r, sizeof(*r));
+	if(first > start)
+		pager_region_insert(&proc->regions,
+				pager_region_new(proc, start, first - start));
+	if(first + npages < end)
+		pager_region_insert(&proc->regions, pager_region_new(proc,
+				first + npages, end - first - npages));
+	proc->nmapped -= npages;
+	__atomic_add_fetch(&pager->navail, npages, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&proc->mutex);
+	return 0;
+}/*}}}*/
+
+void pager_destroy(pid_t pid)/*{{{*/
+{
+	pthread_rwlock_wrlock(&pager->procs_lock);
+	struct pager_proc **pp = &pager->procs[(unsigned)pid % PAGER_HASH_SIZE];
+	while(*pp && (*pp)->pid != pid) pp = &(*pp)->next;
+	struct pager_proc *proc = *pp;
+	if(proc) *pp = proc->next;
+	pthread_rwlock_unlock(&pager->procs_lock);
+	if(!proc) return;
+	pthread_mutex_lock(&proc->mutex);
+	__atomic_sub_fetch(&pager->qos_procs[proc->qos], 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&proc->mutex);
+	pager_proc_free(proc);
+}/*}}}*/
+
+int pager_reclaim(void)/*{{{*/
+{
+	/* Runs on the MMU's reclaim thread.  The reclaim hands run
+	 * ahead of the fault hands, so faults rarely run a clock. */
+	if(!pager->wmark_low) return 0;
+	__atomic_add_fetch(&pager->stats.wakeups, 1, __ATOMIC_RELAXED);
+	int nfreed = 0;
+	int nfree = pager_nfree();
+	while(nfree < pager->wmark_high) {
+		int progress = 0;
+		for(int i = 0; i < pager->nshards && nfree < pager->wmark_high;
+				++i) {
+			struct pager_shard *s = &pager->shards[i];
+			int frames[PAGER_RECLAIM_BATCH];
+			int n = 0, written = 0;
+			pthread_mutex_lock(&s->mutex);
+			while(n < PAGER_RECLAIM_BATCH &&
+					nfree + n < pager->wmark_high) {
+				int frame = pager_clock(s, &s->rhand);
+				if(frame == -1) break;
+				written += pager_evict(frame);
+				frames[n++] = frame;
+			}
+			pthread_mutex_unlock(&s->mutex);
+			for(int j = 0; j < n; ++j)
+				pool_free(s->free, frames[j] - s->first);
+			__atomic_add_fetch(&pager->stats.frames, n, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&pager->stats.written, written,
+					__ATOMIC_RELAXED);
+			progress += n;
+			nfree += n;
+		}
+		nfreed += progress;
+		if(!progress) break; /* every frame is pinned or being installed */
+		nfree = pager_nfree();
+	}
+	logd(LOG_INFO, "%s: %d frames freed, %d free\n", __func__, nfreed,
+			pager_nfree());
+	return nfreed;
+}/*}}}*/
+
+void pager_reclaim_stats(struct pager_reclaim_stats *stats)/*{{{*/
+{
+	stats->wmark_low = pager->wmark_low;
+	stats->wmark_high = pager->wmark_high;
+	stats->wakeups = __atomic_load_n(&pager->stats.wakeups, __ATOMIC_RELAXED);
+	stats->frames = __atomic_load_n(&pager->stats.frames, __ATOMIC_RELAXED);
+	stats->written = __atomic_load_n(&pager->stats.written, __ATOMIC_RELAXED);
+	stats->direct = __atomic_load_n(&pager->stats.direct, __ATOMIC_RELAXED);
+}/*}}}*/
+
+void pager_swapra_stats(struct pager_swapra_stats *stats)/*{{{*/
+{
+	stats->window = pager->rastats.window;
+	stats->reads = __atomic_load_n(&pager->rastats.reads, __ATOMIC_RELAXED);
+	stats->hits = __atomic_load_n(&pager->rastats.hits, __ATOMIC_RELAXED);
+}/*}}}*/
+
+void pager_uniform_stats(struct pager_uniform_stats *stats)/*{{{*/
+{
+	stats->impl = pager->ustats.impl;
+	stats->checked = __atomic_load_n(&pager->ustats.checked,
+			__ATOMIC_RELAXED);
+	stats->pages = __atomic_load_n(&pager->ustats.pages, __ATOMIC_RELAXED);
+}/*}}}*/
+
+void pager_free(void)/*{{{*/
+{
+	for(int h = 0; h < PAGER_HASH_SIZE; ++h) {
+		while(pager->procs[h]) pager_destroy(pager->procs[h]->pid);
+	}
+	for(int i = 0; i < pager->nshards; ++i) {
+		pthread_mutex_destroy(&pager->shards[i].mutex);
+		pool_destroy(pager->shards[i].free);
+	}
+	pthread_rwlock_destroy(&pager->procs_lock);
+	assert(!pager->shms); /* freed with their last mapping */
+	struct slab *slabs[] = {pager->proc_slab, pager->sharer_slab,
+			pager->chunk_slab};
+	for(size_t i = 0; i < sizeof(slabs) / sizeof(slabs[0]); ++i) {
+		struct slab_stats st;
+		slab_stats(slabs[i], &st);
+		logd(LOG_INFO, "%s: slab %s: %ld chunks, %ld objects of %zu "
+				"bytes\n", __func__, st.name, st.chunks, st.objects,
+				st.size);
+		slab_destroy(slabs[i]);
+	}
+	pthread_mutex_destroy(&pager->shm_lock);
+	pool_destroy(pager->blocks);
+	free(pager->block_refs);
+	free(pager->shards);
+	free(pager->frames);
+	free(pager);
+	pager = NULL;
+}/*}}}*/
+
+/****************************************************************************
+ * checkpoint and restore
+ ***************************************************************************/
+struct pager_ckpt_header {/*{{{*/
+	int32_t nframes;
+	int32_t nblocks;
+	int32_t nshards;
+	int32_t nprocs;
+	int32_t nshms;
+	int32_t nextshm;
+};/*}}}*/
+struct pager_ckpt_frame {/*{{{*/
+	int32_t pid; /* 0 if free, negative for segments */
+	int32_t page;
+	int32_t ref;
+};/*}}}*/
+struct pager_ckpt_proc {/*{{{*/
+	int32_t pid;
+	int32_t shard;
+	int32_t frame_hint;
+	int32_t block_hint;
+	int32_t color;
+	int32_t npages;
+	int32_t nregions; /* followed by the regions and the page table */
+};/*}}}*/
+struct pager_ckpt_shm {/*{{{*/
+	int32_t id;
+	int32_t refs;
+	int32_t shard;
+	int32_t npages; /* followed by the page table */
+};/*}}}*/
+struct pager_ckpt_region {/*{{{*/
+	int32_t start;
+	int32_t npages;
+};/*}}}*/
+struct pager_ckpt_pte {/*{{{*/
+	int32_t vpn; /* a table is a count followed by its entries */
+	struct pager_page page;
+};/*}}}*/
+
+int pager_checkpoint(int fd)/*{{{*/
+{
+	/* Pins are only held within a syslog request, and soft pages
+	 * are saved as they are: the restored MMU starts with an empty
+	 * reference map, so `pager_soft_sync` finds them unreferenced. */
+	pthread_rwlock_rdlock(&pager->procs_lock);
+	struct pager_ckpt_header hdr;
+	hdr.nframes = pager->nframes;
+	hdr.nblocks = pager->nblocks;
+	hdr.nshards = pager->nshards;
+	hdr.nprocs = 0;
+	for(int h = 0; h < PAGER_HASH_SIZE; ++h) {
+		for(struct pager_proc *p = pager->procs[h]; p; p = p->next)
+			hdr.nprocs++;
+	}
+	hdr.nshms = 0;
+	for(struct pager_shm *shm = pager->shms; shm; shm = shm->next)
+		hdr.nshms++;
+	hdr.nextshm = pager->nextshm;
+	int r = pager_write_all(fd, &hdr, sizeof(hdr));
+	for(int i = 0; r == 0 && i < pager->nshards; ++i) {
+		int32_t hand = pager->shards[i].hand;
+		r = pager_write_all(fd, &hand, sizeof(hand));
+	}
+	for(int f = 0; r == 0 && f < pager->nframes; ++f) {
+		struct pager_frame *fr = &pager->frames[f];
+		assert(fr->pins == 0);
+		struct pager_ckpt_frame cf;
+		cf.pid = fr->proc ? fr->proc->pid : 0;
+		/* the swap cache is not saved */
+		if(fr->proc && pager_pte(fr->proc, fr->page)->cache == f)
+			cf.pid = 0;
+		cf.page = fr->page;
+		cf.ref = fr->ref;
+		r = pager_write_all(fd, &cf, sizeof(cf));
+	}
+	for(int h = 0; h < PAGER_HASH_SIZE; ++h) {
+		for(struct pager_proc *p = pager->procs[h]; r == 0 && p;
+				p = p->next) {
+			struct pager_ckpt_proc cp;
+			cp.pid = p->pid;
+			cp.shard = p->shard;
+			cp.frame_hint = p->frame_hint;
+			cp.block_hint = p->block_hint;
+			cp.color = p->color;
+			cp.npages = p->npages;
+			cp.nregions = pager_region_count(p->regions);
+			r = pager_write_all(fd, &cp, sizeof(cp));
+			if(r == 0) r = pager_region_save(fd, p->regions);
+			if(r == 0) r = pager_ckpt_pages(fd, p);
+		}
+	}
+	for(struct pager_shm *shm = pager->shms; r == 0 && shm;
+			shm = shm->next) {
+		struct pager_ckpt_shm cs;
+		cs.id = shm->id;
+		cs.refs = shm->refs;
+		cs.shard = shm->proc->shard;
+		cs.npages = shm->proc->npages;
+		r = pager_write_all(fd, &cs, sizeof(cs));
+		if(r == 0) r = pager_ckpt_pages(fd, shm->proc);
+	}
+	pthread_rwlock_unlock(&pager->procs_lock);
+	return r;
+}/*}}}*/
+
+int pager_restore(int fd)/*{{{*/
+{
+	struct pager_ckpt_header hdr;
+	if(pager_read_all(fd, &hdr, sizeof(hdr))) return -1;
+	if(hdr.nframes != pager->nframes || hdr.nblocks != pager->nblocks) {
+		errno = EINVAL;
+		return -1;
+	}
+	for(int i = 0; i < hdr.nshards; ++i) {
+		int32_t hand;
+		if(pager_read_all(fd, &hand, sizeof(hand))) return -1;
+		/* hands are only kept if the shards are the same */
+		if(hdr.nshards == pager->nshards) pager->shards[i].hand = hand;
+	}
+	struct pager_ckpt_frame *cf = malloc(pager->nframes * sizeof(cf[0]));
+	if(!cf) logea(__FILE__, __LINE__, NULL);
+	int r = pager_read_all(fd, cf, pager->nframes * sizeof(cf[0]));
+	for(int i = 0; r == 0 && i < hdr.nprocs; ++i) {
+		struct pager_ckpt_proc cp;
+		r = pager_read_all(fd, &cp, sizeof(cp));
+		if(r) break;
+		if(cp.npages < 0 || cp.npages > pager->maxpages ||
+				cp.nregions < 0) {
+			errno = EINVAL;
+			r = -1;
+			break;
+		}
+		pager_create(cp.pid);
+		struct pager_proc *proc = pager_proc_get(cp.pid);
+		proc->shard = cp.shard % pager->nshards;
+		proc->frame_hint = cp.frame_hint;
+		proc->block_hint = cp.block_hint;
+		proc->color = cp.color;
+		proc->npages = cp.npages;
+		for(int j = 0; r == 0 && j < cp.nregions; ++j) {
+			struct pager_ckpt_region cr;
+			r = pager_read_all(fd, &cr, sizeof(cr));
+			if(r) break;
+			if(cr.start < proc->npages || cr.npages <= 0 ||
+					cr.npages > pager->maxpages - cr.start ||
+					pager_region_overlaps(proc->regions, cr.start,
+						cr.npages)) {
+				errno = EINVAL;
+				r = -1;
+				break;
+			}
+			pager_region_insert(&proc->regions,
+					pager_region_new(proc, cr.start, cr.npages));
+			proc->nmapped += cr.npages;
+		}
+		if(r == 0) r = pager_restore_ptes(fd, proc, cp.npages);
+		if(r == 0) r = pager_restore_pages(proc);
+	}
+	pager->nextshm = hdr.nextshm;
+	for(int i = 0; r == 0 && i < hdr.nshms; ++i) {
+		struct pager_ckpt_shm cs;
+		r = pager_read_all(fd, &cs, sizeof(cs));
+		if(r) break;
+		if(cs.npages <= 0 || cs.npages > pager->maxpages) {
+			errno = EINVAL;
+			r = -1;
+			break;
+		}
+		struct pager_shm *shm = malloc(sizeof(*shm));
+		if(!shm) logea(__FILE__, __LINE__, NULL);
+		shm->id = cs.id;
+		shm->refs = cs.refs;
+		shm->proc = pager_proc_new(PAGER_SHM_PID(cs.id));
+		shm->proc->shard = cs.shard % pager->nshards;
+		shm->proc->npages = cs.npages;
+		shm->next = pager->shms;
+		pager->shms = shm;
+		r = pager_restore_ptes(fd, shm->proc, cs.npages);
+		if(r == 0) r = pager_restore_pages(shm->proc);
+	}
+	for(int f = 0; r == 0 && f < pager->nframes; ++f) {
+		struct pager_frame *fr = &pager->frames[f];
+		if(cf[f].pid < 0) {
+			struct pager_shm *shm = pager_shm_get(-1 - cf[f].pid);
+			if(!shm) {
+				errno = EINVAL;
+				r = -1;
+				break;
+			}
+			fr->proc = shm->proc;
+		} else {
+			fr->proc = cf[f].pid ? pager_proc_get(cf[f].pid) : NULL;
+		}
+		if(fr->proc && !pager_pte(fr->proc, cf[f].page)) {
+			errno = EINVAL;
+			r = -1;
+			break;
+		}
+		fr->page = cf[f].page;
+		fr->ref = cf[f].ref;
+		fr->pins = 0;
+	}
+	/* pages sharing a frame with the one saved in the frame table */
+	for(int h = 0; r == 0 && h < PAGER_HASH_SIZE; ++h) {
+		for(struct pager_proc *p = pager->procs[h]; p; p = p->next) {
+			for(int vpn = pager_pte_next(p, 0); vpn != -1;
+					vpn = pager_pte_next(p, vpn + 1)) {
+				struct pager_page *pg = pager_pte(p, vpn);
+				if(pg->shm != -1 && !pager_shm_valid(pg)) {
+					errno = EINVAL;
+					r = -1;
+					break;
+				}
+				int frame = pg->frame;
+				if(frame == -1) continue;
+				struct pager_frame *fr = &pager->frames[frame];
+				if(fr->proc == p && fr->page == vpn) continue;
+				fr->shared = pager_sharer_new(p, vpn, fr->shared);
+			}
+		}
+	}
+	if(r == 0) {
+		/* rebuild the free pools: take everything, return the rest */
+		for(int i = 0; i < pager->nshards; ++i) {
+			struct pager_shard *s = &pager->shards[i];
+			while(pool_alloc(s->free) != -1);
+			for(int id = 0; id < s->nframes; ++id) {
+				if(!pager->frames[s->first + id].proc)
+					pool_free(s->free, id);
+			}
+		}
+		while(pool_alloc(pager->blocks) != -1);
+		for(int b = 0; b < pager->nblocks; ++b) {
+			if(!pager->block_refs[b]) pool_free(pager->blocks, b);
+		}
+	}
+	free(cf);
+	return r;
+}/*}}}*/
+
+int pager_restore_pages(struct pager_proc *proc)/*{{{*/
+{
+	/* Checks and accounts for the pages of a restored process or
+	 * segment; segment mappings are checked by `pager_shm_valid`
+	 * once all segments are restored.  Region pages hold their
+	 * share of `navail` whether or not they have an entry. */
+	pager->navail -= proc->nmapped;
+	for(int vpn = pager_pte_next(proc, 0); vpn != -1;
+			vpn = pager_pte_next(proc, vpn + 1)) {
+		struct pager_page *pg = pager_pte(proc, vpn);
+		if(pg->frame < -1 || pg->frame >= pager->nframes ||
+				pg->fill < -1 || pg->fill > UINT8_MAX ||
+				(pg->shm == -1 && (pg->block < -1 ||
+				pg->block >= pager->nblocks ||
+				(pg->block == -1 && (pg->frame != -1 ||
+				pg->ondisk))))) {
+			errno = EINVAL;
+			return -1;
+		}
+		if(pg->shm != -1) {
+			proc->nshm++;
+			continue;
+		}
+		if(pg->block != -1) pager->block_refs[pg->block]++;
+		if(vpn < proc->npages) pager->navail--;
+	}
+	return 0;
+}/*}}}*/
+
+int pager_ckpt_pages(int fd, struct pager_proc *proc)/*{{{*/
+{
+	int32_t n = 0;
+	for(int vpn = pager_pte_next(proc, 0); vpn != -1;
+			vpn = pager_pte_next(proc, vpn + 1))
+		n++;
+	int r = pager_write_all(fd, &n, sizeof(n));
+	for(int vpn = pager_pte_next(proc, 0); r == 0 && vpn != -1;
+			vpn = pager_pte_next(proc, vpn + 1)) {
+		struct pager_ckpt_pte cpte;
+		cpte.vpn = vpn;
+		cpte.page = *pager_pte(proc, vpn);
+		cpte.page.cache = -1;
+		r = pager_write_all(fd, &cpte, sizeof(cpte));
+	}
+	return r;
+}/*}}}*/
+
+int pager_restore_ptes(int fd, struct pager_proc *proc, int npages)/*{{{*/
+{
+	/* Reads a page table saved by `pager_ckpt_pages` into `proc`,
+	 * whose break is `npages` and regions are already restored.
+	 * Every page below the break has an entry. */
+	int32_t n;
+	if(pager_read_all(fd, &n, sizeof(n))) return -1;
+	int nbrk = 0;
+	for(int i = 0; i < n; ++i) {
+		struct pager_ckpt_pte cpte;
+		if(pager_read_all(fd, &cpte, sizeof(cpte))) return -1;
+		int vpn = cpte.vpn;
+		if(vpn < 0 || vpn >= pager->maxpages || pager_pte(proc, vpn) ||
+				(vpn >= npages &&
+				!pager_region_find(proc->regions, vpn))) {
+			errno = EINVAL;
+			return -1;
+		}
+		cpte.page.cache = -1;
+		*pager_pte_add(proc, vpn) = cpte.page;
+		if(vpn < npages) nbrk++;
+	}
+	if(nbrk != npages) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}/*}}}*/
+
+int pager_shm_valid(const struct pager_page *pg)/*{{{*/
+{
+	struct pager_shm *shm = pager_shm_get(pg->shm);
+	if(!shm || pg->shm_page < 0 || pg->shm_page >= shm->proc->npages)
+		return 0;
+	int frame = pager_pte(shm->proc, pg->shm_page)->frame;
+	return pg->frame == -1 || pg->frame == frame;
+}/*}}}*/
+
+/****************************************************************************
+ * page tables and regions
+ ***************************************************************************/
+struct pager_page * pager_pte(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Returns page `vpn`'s entry, or NULL if it has none.  Needs
+	 * `proc->mutex`, or the lock of the shard holding the page's
+	 * frame while the page is resident. */
+	if(vpn < 0 || vpn >= pager->maxpages) return NULL;
+	void *node = __atomic_load_n(&proc->pt, __ATOMIC_ACQUIRE);
+	for(int l = pager->ptlevels - 1; node && l > 0; --l) {
+		struct pager_pt *pt = node;
+		int i = (vpn >> (l * PAGER_PT_BITS)) & PAGER_PT_MASK;
+		node = __atomic_load_n(&pt->child[i], __ATOMIC_ACQUIRE);
+	}
+	if(!node) return NULL;
+	struct pager_ptleaf *leaf = node;
+	int i = vpn & PAGER_PT_MASK;
+	uint64_t valid = __atomic_load_n(&leaf->valid, __ATOMIC_ACQUIRE);
+	return (valid >> i) & 1 ? &leaf->pages[i] : NULL;
+}/*}}}*/
+
+struct pager_page * pager_pte_add(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Creates an entry for page `vpn`, which has none, for a page
+	 * that is not resident and has no block.  `proc->mutex` must be
+	 * held. */
+	void **slot = &proc->pt;
+	struct pager_pt *parent = NULL;
+	for(int l = pager->ptlevels - 1; ; --l) {
+		if(!*slot) {
+			void *node = arena_alloc(&proc->arena, l ?
+					sizeof(struct pager_pt) : sizeof(struct pager_ptleaf));
+			if(!node) logea(__FILE__, __LINE__, NULL);
+			if(parent) parent->n++;
+			__atomic_store_n(slot, node, __ATOMIC_RELEASE);
+		}
+		if(l == 0) break;
+		parent = *slot;
+		slot = &parent->child[(vpn >> (l * PAGER_PT_BITS)) & PAGER_PT_MASK];
+	}
+	struct pager_ptleaf *leaf = *slot;
+	int i = vpn & PAGER_PT_MASK;
+	struct pager_page *pg = &leaf->pages[i];
+	pg->frame = -1;
+	pg->block = -1;
+	pg->prot = PROT_NONE;
+	pg->dirty = 0;
+	pg->ondisk = 0;
+	pg->soft = 0;
+	pg->shm = -1;
+	pg->shm_page = 0;
+	pg->advice = UVM_ADV_NORMAL;
+	pg->cache = -1;
+	pg->fill = -1;
+	__atomic_or_fetch(&leaf->valid, (uint64_t)1 << i, __ATOMIC_RELEASE);
+	return pg;
+}/*}}}*/
+
+struct pager_page * pager_pte_get(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Like `pager_pte`, but gives a region page touched for the
+	 * first time its entry.  Returns NULL if `vpn` is not mapped.
+	 * `proc->mutex` must be held. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	if(pg || vpn < proc->npages) return pg;
+	if(!pager_region_find(proc->regions, vpn)) return NULL;
+	return pager_pte_add(proc, vpn);
+}/*}}}*/
+
+void pager_pte_del(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Removes the entry of page `vpn`, which must not be resident
+	 * or hold a block.  `proc->mutex` must be held. */
+	pager_pt_del(&proc->arena, &proc->pt, pager->ptlevels - 1, vpn);
+}/*}}}*/
+
+int pager_pt_del(struct arena *a, void **slot, int level, int vpn)/*{{{*/
+{
+	/* Returns 1 if the node at `slot` became empty and was freed. */
+	if(level == 0) {
+		struct pager_ptleaf *leaf = *slot;
+		uint64_t bit = (uint64_t)1 << (vpn & PAGER_PT_MASK);
+		if(__atomic_and_fetch(&leaf->valid, ~bit, __ATOMIC_RELEASE))
+			return 0;
+	} else {
+		struct pager_pt *pt = *slot;
+		int i = (vpn >> (level * PAGER_PT_BITS)) & PAGER_PT_MASK;
+		if(!pager_pt_del(a, &pt->child[i], level - 1, vpn)) return 0;
+		if(--pt->n > 0) return 0;
+	}
+	void *node = *slot;
+	__atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+	arena_free(a, node, level ?
+			sizeof(struct pager_pt) : sizeof(struct pager_ptleaf));
+	return 1;
+}/*}}}*/
+
+int pager_pte_next(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Returns the first page from `vpn` on with an entry, or -1;
+	 * empty subtrees are skipped whole. */
+	return pager_pt_next(proc->pt, pager->ptlevels - 1, 0, vpn);
+}/*}}}*/
+
+int pager_pt_next(void *node, int level, int base, int vpn)/*{{{*/
+{
+	/* `node` holds the entries of the pages from `base` on. */
+	if(!node) return -1;
+	if(level == 0) {
+		struct pager_ptleaf *leaf = node;
+		int i = vpn > base ? vpn - base : 0;
+		if(i >= PAGER_PT_FANOUT) return -1;
+		uint64_t valid = leaf->valid & (~(uint64_t)0 << i);
+		return valid ? base + __builtin_ctzll(valid) : -1;
+	}
+	struct pager_pt *pt = node;
+	int shift = level * PAGER_PT_BITS;
+	for(int i = vpn > base ? (vpn - base) >> shift : 0;
+			i < PAGER_PT_FANOUT; ++i) {
+		int r = pager_pt_next(pt->child[i], level - 1,
+				base + (i << shift), vpn);
+		if(r != -1) return r;
+	}
+	return -1;
+}/*}}}*/
+
+int pager_mapped(struct pager_proc *proc, intptr_t start, size_t len)/*{{{*/
+{
+	/* Returns 1 if `len` bytes from `start` are all mapped pages,
+	 * where an empty range may end at the break. */
+	intptr_t brk = UVM_BASEADDR + (intptr_t)(proc->npages * PAGESIZE);
+	if(start < UVM_BASEADDR) return 0;
+	if(start + (intptr_t)len <= brk) return 1;
+	if(len == 0 || start + (intptr_t)len - 1 > UVM_MAXADDR) return 0;
+	int vpn = (start - UVM_BASEADDR) / PAGESIZE;
+	int last = (start + (intptr_t)len - 1 - UVM_BASEADDR) / PAGESIZE;
+	if(vpn < proc->npages) vpn = proc->npages;
+	while(vpn <= last) {
+		struct pager_region *r = pager_region_find(proc->regions, vpn);
+		if(!r) return 0;
+		vpn = r->start + r->npages;
+	}
+	return 1;
+}/*}}}*/
+
+int pager_brk_room(struct pager_proc *proc, int npages)/*{{{*/
+{
+	/* Returns 1 if the break can grow by `npages`. */
+	return npages <= pager->maxpages - proc->npages &&
+			!pager_region_overlaps(proc->regions, proc->npages, npages);
+}/*}}}*/
+
+struct pager_region * pager_region_new(struct pager_proc *proc,/*{{{*/
+		int start, int npages)
+{
+	struct pager_region *r = arena_alloc(&proc->arena, sizeof(*r));
+	if(!r) logea(__FILE__, __LINE__, NULL);
+	r->start = start;
+	r->npages = npages;
+	/* Knuth's multiplicative hash: balanced like random priorities
+	 * for any placement, and the same tree after a restore */
+	r->prio = (unsigned)start * 2654435761u;
+	r->left = NULL;
+	r->right = NULL;
+	return r;
+}/*}}}*/
+
+struct pager_region * pager_region_find(struct pager_region *t,/*{{{*/
+		int vpn)
+{
+	while(t) {
+		if(vpn < t->start) t = t->left;
+		else if(vpn >= t->start + t->npages) t = t->right;
+		else return t;
+	}
+	return NULL;
+}/*}}}*/
+
+int pager_region_overlaps(struct pager_region *t, int first, int n)/*{{{*/
+{
+	/* Regions are disjoint, so at most one path holds candidates. */
+	while(t) {
+		if(first + n <= t->start) t = t->left;
+		else if(first >= t->start + t->npages) t = t->right;
+		else return 1;
+	}
+	return 0;
+}/*}}}*/
+
+void pager_region_insert(struct pager_region **t,/*{{{*/
+		struct pager_region *r)
+{
+	while(*t && (*t)->prio >= r->prio)
+		t = r->start < (*t)->start ? &(*t)->left : &(*t)->right;
+	pager_region_split(*t, r->start, &r->left, &r->right);
+	*t = r;
+}/*}}}*/
+
+void pager_region_remove(struct pager_region **t, int start)/*{{{*/
+{
+	/* Unlinks the region starting at `start`, which must exist. */
+	while((*t)->start != start)
+		t = start < (*t)->start ? &(*t)->left : &(*t)->right;
+	*t = pager_region_merge((*t)->left, (*t)->right);
+}/*}}}*/
+
+void pager_region_split(struct pager_region *t, int start,/*{{{*/
+		struct pager_region **l, struct pager_region **r)
+{
+	/* Splits `t` into the regions before `start` and the rest. */
+	while(t) {
+		if(t->start < start) {
+			*l = t;
+			l = &t->right;
+			t = t->right;
+		} else {
+			*r = t;
+			r = &t->left;
+			t = t->left;
+		}
+	}
+	*l = NULL;
+	*r = NULL;
+}/*}}}*/
+
+struct pager_region * pager_region_merge(struct pager_region *l,/*{{{*/
+		struct pager_region *r)
+{
+	/* Every region in `l` comes before every region in `r`. */
+	if(!l) return r;
+	if(!r) return l;
+	if(l->prio >= r->prio) {
+		l->right = pager_region_merge(l->right, r);
+		return l;
+	}
+	r->left = pager_region_merge(l, r->left);
+	return r;
+}/*}}}*/
+
+int pager_region_gap(struct pager_region *t, int *hi, int npages)/*{{{*/
+{
+	/* Visits regions from the top down, with `*hi` the first page
+	 * above the free range below the regions visited so far.
+	 * Returns the first page of the highest free range of `npages`
+	 * pages between two regions or above them, or -1 with `*hi` the
+	 * start of the lowest region. */
+	if(!t) return -1;
+	int r = pager_region_gap(t->right, hi, npages);
+	if(r != -1) return r;
+	if(*hi - (t->start + t->npages) >= npages) return *hi - npages;
+	*hi = t->start;
+	return pager_region_gap(t->left, hi, npages);
+}/*}}}*/
+
+struct pager_region * pager_region_copy(struct pager_proc *proc,/*{{{*/
+		struct pager_region *t)
+{
+	/* Copies treap `t` into the arena of `proc`. */
+	if(!t) return NULL;
+	struct pager_region *r = pager_region_new(proc, t->start, t->npages);
+	r->left = pager_region_copy(proc, t->left);
+	r->right = pager_region_copy(proc, t->right);
+	return r;
+}/*}}}*/
+
+int pager_region_count(struct pager_region *t)/*{{{*/
+{
+	if(!t) return 0;
+	return 1 + pager_region_count(t->left) + pager_region_count(t->right);
+}/*}}}*/
+
+int pager_region_save(int fd, struct pager_region *t)/*{{{*/
+{
+	if(!t) return 0;
+	struct pager_ckpt_region cr;
+	cr.start = t->start;
+	cr.npages = t->npages;
+	if(pager_write_all(fd, &cr, sizeof(cr))) return -1;
+	if(pager_region_save(fd, t->left)) return -1;
+	return pager_region_save(fd, t->right);
+}/*}}}*/
+
+struct pager_sharer * pager_sharer_new(struct pager_proc *proc, int page,/*{{{*/
+		struct pager_sharer *next)
+{
+	struct pager_sharer *sh = slab_alloc(pager->sharer_slab);
+	if(!sh) logea(__FILE__, __LINE__, NULL);
+	sh->proc = proc;
+	sh->page = page;
+	sh->next = next;
+	return sh;
+}/*}}}*/
+
+/****************************************************************************
+ * auxiliary functions
+ ***************************************************************************/
+struct pager_proc * pager_proc_new(pid_t pid)/*{{{*/
+{
+	struct pager_proc *proc = slab_alloc(pager->proc_slab);
+	if(!proc) logea(__FILE__, __LINE__, NULL);
+	proc->pid = pid;
+	proc->shard = 0;
+	proc->frame_hint = 0;
+	proc->block_hint = 0;
+	proc->color = 0;
+	proc->qos = UVM_QOS_NORMAL;
+	proc->npages = 0;
+	proc->nshm = 0;
+	proc->nmapped = 0;
+	proc->pt = NULL;
+	proc->regions = NULL;
+	arena_init(&proc->arena, pager->chunk_slab);
+	pthread_mutex_init(&proc->mutex, NULL);
+	proc->next = NULL;
+	return proc;
+}/*}}}*/
+
+struct pager_proc * pager_proc_get(pid_t pid)/*{{{*/
+{
+	pthread_rwlock_rdlock(&pager->procs_lock);
+	struct pager_proc *proc = pager->procs[(unsigned)pid % PAGER_HASH_SIZE];
+	while(proc && proc->pid != pid) proc = proc->next;
+	pthread_rwlock_unlock(&pager->procs_lock);
+	assert(proc);
+	return proc;
+}/*}}}*/
+
+void pager_proc_free(struct pager_proc *proc)/*{{{*/
+{
+	/* Releases the frames and blocks of a process, or of a segment
+	 * no longer mapped, already out of any list. */
+	pthread_mutex_lock(&proc->mutex);
+	for(int vpn = pager_pte_next(proc, 0); vpn != -1;
+			vpn = pager_pte_next(proc, vpn + 1)) {
+		struct pager_page *pg = pager_pte(proc, vpn);
+		int cache = pager_cache_take(pg);
+		if(cache != -1) {
+			struct pager_shard *s = pager_shard_of(cache);
+			pool_free(s->free, cache - s->first);
+		}
+		for(;;) {
+			int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+			if(frame == -1) break;
+			struct pager_shard *s = pager_shard_of(frame);
+			pthread_mutex_lock(&s->mutex);
+			int freed = 0;
+			if(pg->frame == frame) {
+				freed = pager_frame_drop(frame, proc, vpn);
+				__atomic_store_n(&pg->frame, -1, __ATOMIC_RELEASE);
+			}
+			pthread_mutex_unlock(&s->mutex);
+			if(freed) pool_free(s->free, frame - s->first);
+		}
+		if(pg->shm != -1) pager_shm_put(pg->shm);
+		else if(pg->block != -1) pager_block_put(pg->block);
+	}
+	__atomic_add_fetch(&pager->navail,
+			proc->npages - proc->nshm + proc->nmapped, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&proc->mutex);
+	pthread_mutex_destroy(&proc->mutex);
+	/* the page table and regions go in bulk */
+	arena_release(&proc->arena);
+	slab_free(pager->proc_slab, proc);
+}/*}}}*/
+
+struct pager_shm * pager_shm_get(int id)/*{{{*/
+{
+	/* `pager->shm_lock` must be held.  Returns NULL if there is no
+	 * segment `id`. */
+	struct pager_shm *shm = pager->shms;
+	while(shm && shm->id != id) shm = shm->next;
+	return shm;
+}/*}}}*/
+
+void pager_shm_put(int id)/*{{{*/
+{
+	/* Drops a page's mapping of segment `id`, freeing the segment
+	 * with its last mapping. */
+	pthread_mutex_lock(&pager->shm_lock);
+	struct pager_shm **p = &pager->shms;
+	while((*p)->id != id) p = &(*p)->next;
+	struct pager_shm *shm = *p;
+	if(--shm->refs > 0) {
+		pthread_mutex_unlock(&pager->shm_lock);
+		return;
+	}
+	*p = shm->next;
+	pthread_mutex_unlock(&pager->shm_lock);
+	pager_proc_free(shm->proc);
+	free(shm);
+}/*}}}*/
+
+void * pager_shm_map(struct pager_proc *proc, struct pager_shm *shm)/*{{{*/
+{
+	/* Appends a mapping of every page of `shm`, whose references
+	 * the caller holds, to `proc`.  `proc->mutex` must be held. */
+	int vpn = proc->npages;
+	for(int i = 0; i < shm->proc->npages; ++i) {
+		struct pager_page *pg = pager_pte_add(proc, proc->npages++);
+		pg->shm = shm->id;
+		pg->shm_page = i;
+	}
+	proc->nshm += shm->proc->npages;
+	return pager_vaddr(vpn);
+}/*}}}*/
+
+struct pager_shard * pager_shard_of(int frame)/*{{{*/
+{
+	/* shards are contiguous and sized within one frame of each
+	 * other, so the initial guess is off by at most one. */
+	int i = (int)((long)frame * pager->nshards / pager->nframes);
+	while(frame < pager->shards[i].first) i--;
+	while(frame >= pager->shards[i].first + pager->shards[i].nframes) i++;
+	return &pager->shards[i];
+}/*}}}*/
+
+int pager_frame_take(struct pager_shard *s, struct pager_proc *proc)/*{{{*/
+{
+	int id;
+	if(pager->ncolors) {
+		int n = pager->ncolors;
+		int color = ((proc->color - s->first) % n + n) % n;
+		id = pool_alloc_color(s->free, color, n);
+	} else if(pager->relaxed) {
+		id = pool_alloc_near(s->free, proc->frame_hint - s->first);
+	} else {
+		id = pool_alloc(s->free);
+	}
+	return id == -1 ? -1 : s->first + id;
+}/*}}}*/
+
+int pager_home(struct pager_proc *proc)/*{{{*/
+{
+	if(!pager->numa) return proc->shard;
+	int node = mmu_fault_node(proc->pid);
+	if(node < 0 || node >= pager->nshards) return proc->shard;
+	return node;
+}/*}}}*/
+
+int pager_cache_colors(void)/*{{{*/
+{
+	/* pages of a physically indexed cache that map to disjoint sets */
+	long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	long assoc = sysconf(_SC_LEVEL2_CACHE_ASSOC);
+	if(size <= 0 || assoc <= 0) return PAGER_DEFAULT_COLORS;
+	long colors = size / (assoc * (long)PAGESIZE);
+	return colors > 0 ? (int)colors : PAGER_DEFAULT_COLORS;
+}/*}}}*/
+
+int pager_frame_alloc(struct pager_proc *proc)/*{{{*/
+{
+	/* Returns a frame owned by the caller: neither free nor
+	 * published in the frame table.  Takes a free frame from the home
+	 * shard, else from any other, else runs the home shard's clock. */
+	int homeid = pager_home(proc);
+	struct pager_shard *home = &pager->shards[homeid];
+	int frame = -1;
+	while(frame == -1) {
+		frame = pager_frame_take(home, proc);
+		for(int i = 1; frame == -1 && i < pager->nshards; ++i) {
+			struct pager_shard *s;
+			s = &pager->shards[(homeid + i) % pager->nshards];
+			if(pool_nfree(s->free) == 0) continue;
+			frame = pager_frame_take(s, proc);
+		}
+		if(frame != -1) break;
+
+		if(pager->wmark_low)
+			__atomic_add_fetch(&pager->stats.direct, 1, __ATOMIC_RELAXED);
+		pthread_mutex_lock(&home->mutex);
+		frame = pager_clock(home, &home->hand);
+		if(frame != -1) pager_evict(frame);
+		pthread_mutex_unlock(&home->mutex);
+		/* every frame in the shard is being installed */
+		if(frame == -1) sched_yield();
+	}
+	if(pager->wmark_low && pager_nfree() < pager->wmark_low)
+		mmu_reclaim_wake();
+	return frame;
+}/*}}}*/
+
+int pager_clock(struct pager_shard *s, int *hand)/*{{{*/
+{
+	/* `s->mutex` must be held; `hand` is one of the shard's hands.
+	 * Frames that are free, being installed, or pinned are skipped,
+	 * as are frames of classes not yet admitted in this sweep; returns
+	 * -1 if two sweeps with every class admitted find no candidate. */
+	int lo, hi;
+	pager_qos_range(&lo, &hi);
+	for(int i = 0; i < (2 + hi - lo) * s->nframes; ++i) {
+		int frame = s->first + *hand;
+		*hand = (*hand + 1) % s->nframes;
+		struct pager_frame *fr = &pager->frames[frame];
+		if(!fr->proc || fr->pins) continue;
+		pager_soft_sync(fr->proc, fr->page);
+		for(struct pager_sharer *sh = fr->shared; sh; sh = sh->next)
+			pager_soft_sync(sh->proc, sh->page);
+		if(!fr->ref && __atomic_load_n(&fr->proc->qos, __ATOMIC_RELAXED) >=
+				hi - i / s->nframes)
+			return frame;
+		if(!fr->ref) continue;
+		fr->ref = 0;
+		pager_revoke(fr->proc, fr->page);
+		for(struct pager_sharer *sh = fr->shared; sh; sh = sh->next)
+			pager_revoke(sh->proc, sh->page);
+	}
+	return -1;
+}/*}}}*/
+
+void pager_qos_range(int *lo, int *hi)/*{{{*/
+{
+	/* the most and least important classes with processes */
+	*lo = UVM_QOS_NORMAL;
+	*hi = UVM_QOS_NORMAL;
+	int found = 0;
+	for(int q = 0; q < UVM_QOS_CLASSES; ++q) {
+		if(!__atomic_load_n(&pager->qos_procs[q], __ATOMIC_RELAXED))
+			continue;
+		if(!found++) *lo = q;
+		*hi = q;
+	}
+}/*}}}*/
+
+void pager_revoke(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* The lock of the shard holding the page's frame must be held.
+	 * Revokes access so the next reference faults. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	if(pg->prot == PROT_NONE) return;
+	void *vaddr = pager_vaddr(vpn);
+	if(!pager->softref)
+		mmu_chprot(proc->pid, vaddr, PROT_NONE);
+	else if(mmu_refclear(proc->pid, vaddr, pg->prot))
+		pg->soft = pg->prot;
+	pg->prot = PROT_NONE;
+}/*}}}*/
+
+int pager_evict(int frame)/*{{{*/
+{
+	/* The lock of the shard holding `frame` must be held.  The
+	 * frame is left unpublished, owned by the caller.  Returns 1 if
+	 * the frame was written to disk. */
+	struct pager_frame *fr = &pager->frames[frame];
+	struct pager_page *pg = pager_pte(fr->proc, fr->page);
+	if(pg->cache == frame) { /* never mapped, same as the block */
+		__atomic_store_n(&pg->cache, -1, __ATOMIC_RELEASE);
+		fr->proc = NULL;
+		return 0;
+	}
+	if(fr->proc->pid >= 0) /* segments are only mapped by sharers */
+		mmu_nonresident(fr->proc->pid, pager_vaddr(fr->page));
+	for(struct pager_sharer *sh = fr->shared; sh; sh = sh->next)
+		mmu_nonresident(sh->proc->pid, pager_vaddr(sh->page));
+	/* all mappings share the block, and none can write any more */
+	int fill = -1;
+	if(pg->dirty && pager->uniform) {
+		fill = uniform_byte(pmem + (size_t)frame * PAGESIZE, PAGESIZE);
+		__atomic_add_fetch(&pager->ustats.checked, 1, __ATOMIC_RELAXED);
+		if(fill != -1)
+			__atomic_add_fetch(&pager->ustats.pages, 1, __ATOMIC_RELAXED);
+	}
+	int written = pg->dirty && fill == -1;
+	if(written) mmu_disk_write(frame, pg->block);
+	pager_page_out(pg, written, fill);
+	while(fr->shared) {
+		struct pager_sharer *sh = fr->shared;
+		fr->shared = sh->next;
+		pager_page_out(pager_pte(sh->proc, sh->page), written, fill);
+		slab_free(pager->sharer_slab, sh);
+	}
+	fr->proc = NULL;
+	return written;
+}/*}}}*/
+
+int pager_nfree(void)/*{{{*/
+{
+	int nfree = 0;
+	for(int i = 0; i < pager->nshards; ++i)
+		nfree += pool_nfree(pager->shards[i].free);
+	return nfree;
+}/*}}}*/
+
+void pager_page_out(struct pager_page *pg, int written, int fill)/*{{{*/
+{
+	/* The frame was `written` to the block, or held only byte
+	 * `fill` if it is not -1; otherwise it was clean. */
+	assert(!pg->soft); /* synced by the clock */
+	if(written) pg->ondisk = 1;
+	if(fill != -1) pg->ondisk = 0;
+	if(written || fill != -1) pg->fill = fill;
+	pg->dirty = 0;
+	pg->prot = PROT_NONE;
+	/* last: readers holding only the process mutex see the fields
+	 * above once they see the page nonresident */
+	__atomic_store_n(&pg->frame, -1, __ATOMIC_RELEASE);
+}/*}}}*/
+
+int pager_frame_drop(int frame, struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* The lock of the shard holding `frame` must be held.  Removes
+	 * page `vpn` of `proc` from the frame's mappings; returns 1 if it
+	 * was the last, leaving the frame owned by the caller. */
+	struct pager_frame *fr = &pager->frames[frame];
+	struct pager_sharer *sh;
+	if(fr->proc == proc && fr->page == vpn) {
+		sh = fr->shared;
+		if(!sh) {
+			fr->proc = NULL;
+			return 1;
+		}
+		fr->proc = sh->proc;
+		fr->page = sh->page;
+		fr->shared = sh->next;
+		slab_free(pager->sharer_slab, sh);
+		return 0;
+	}
+	struct pager_sharer **p = &fr->shared;
+	while((*p)->proc != proc || (*p)->page != vpn) p = &(*p)->next;
+	sh = *p;
+	*p = sh->next;
+	slab_free(pager->sharer_slab, sh);
+	return 0;
+}/*}}}*/
+
+void pager_page_in(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* `proc->mutex` must be held and the page not resident.  Once
+	 * published, a clock may evict the page again at any time. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	int ondisk = pg->ondisk;
+	if(pg->block == -1) pg->block = pager_block_alloc(proc);
+	int frame = pager_cache_take(pg);
+	if(frame != -1) {
+		__atomic_add_fetch(&pager->rastats.hits, 1, __ATOMIC_RELAXED);
+	} else {
+		frame = pager_frame_alloc(proc);
+		pager_frame_load(pg, frame);
+	}
+	mmu_resident(proc->pid, pager_vaddr(vpn), frame, PROT_READ);
+
+	struct pager_shard *s = pager_shard_of(frame);
+	struct pager_frame *fr = &pager->frames[frame];
+	pthread_mutex_lock(&s->mutex);
+	fr->proc = proc;
+	fr->page = vpn;
+	fr->ref = 1;
+	pg->prot = PROT_READ;
+	pg->dirty = 0;
+	pg->soft = 0;
+	__atomic_store_n(&pg->frame, frame, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&s->mutex);
+	proc->frame_hint = frame + 1;
+	if(pager->ncolors) proc->color = (frame + 1) % pager->ncolors;
+	if(pager->swapra && ondisk && pg->advice != UVM_ADV_RANDOM)
+		pager_swap_readahead(proc, vpn);
+}/*}}}*/
+
+void pager_frame_load(struct pager_page *pg, int frame)/*{{{*/
+{
+	/* Fills `frame`, owned by the caller, with the contents of
+	 * nonresident page `pg`. */
+	if(pg->fill != -1) mmu_fill(frame, pg->fill);
+	else if(pg->ondisk) mmu_disk_read(pg->block, frame);
+	else mmu_zero_fill(frame);
+}/*}}}*/
+
+void pager_access(struct pager_proc *proc, int vpn, int write)/*{{{*/
+{
+	/* Grants the access that caused a fault (or a syslog read) to
+	 * page `vpn`, which must be mapped.  `proc->mutex` must be held. */
+	struct pager_page *pg = pager_pte_get(proc, vpn);
+	if(pg->shm != -1) {
+		pager_shm_access(proc, vpn, write);
+		return;
+	}
+	for(;;) {
+		int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+		if(frame == -1) {
+			pager_page_in(proc, vpn);
+			return;
+		}
+		struct pager_shard *s = pager_shard_of(frame);
+		pthread_mutex_lock(&s->mutex);
+		if(pg->frame != frame) { /* evicted by another shard */
+			pthread_mutex_unlock(&s->mutex);
+			continue;
+		}
+		pager_soft_sync(proc, vpn);
+		struct pager_frame *fr = &pager->frames[frame];
+		fr->ref = 1;
+		int prot = pg->prot;
+		if(pg->prot == PROT_NONE) {
+			int private = !fr->shared && pager_block_private(pg->block);
+			prot = pg->dirty && private ? PROT_READ | PROT_WRITE :
+					PROT_READ;
+		} else if(write && fr->shared) {
+			fr->pins++;
+			pthread_mutex_unlock(&s->mutex);
+			pager_cow(proc, vpn, frame);
+			continue;
+		} else if(write) {
+			if(!pager_block_private(pg->block)) {
+				/* the frame holds the only copy of our contents */
+				int block = pager_block_alloc(proc);
+				pager_block_put(pg->block);
+				pg->block = block;
+				pg->ondisk = 0;
+			}
+			prot = PROT_READ | PROT_WRITE;
+			pg->dirty = 1;
+		}
+		if(prot != pg->prot) {
+			mmu_chprot(proc->pid, pager_vaddr(vpn), prot);
+			pg->prot = prot;
+		}
+		pthread_mutex_unlock(&s->mutex);
+		return;
+	}
+}/*}}}*/
+
+void pager_shm_access(struct pager_proc *proc, int vpn, int write)/*{{{*/
+{
+	/* Like `pager_access`, for a page mapping a segment.  The
+	 * segment page is faulted in once, and every mapping then maps
+	 * its frame; mappings may write once the frame is dirty. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	pthread_mutex_lock(&pager->shm_lock);
+	struct pager_proc *sp = pager_shm_get(pg->shm)->proc;
+	pthread_mutex_unlock(&pager->shm_lock);
+	int spn = pg->shm_page;
+	struct pager_page *spg = pager_pte(sp, spn);
+	pthread_mutex_lock(&sp->mutex);
+	for(;;) {
+		/* a mapping is either not resident or on the segment's frame */
+		int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+		if(frame == -1)
+			frame = __atomic_load_n(&spg->frame, __ATOMIC_ACQUIRE);
+		if(frame == -1) {
+			frame = pager_frame_alloc(proc);
+			pager_frame_load(spg, frame);
+			struct pager_shard *s = pager_shard_of(frame);
+			struct pager_frame *fr = &pager->frames[frame];
+			pthread_mutex_lock(&s->mutex);
+			fr->proc = sp;
+			fr->page = spn;
+			fr->ref = 1;
+			spg->dirty = 0;
+			__atomic_store_n(&spg->frame, frame, __ATOMIC_RELEASE);
+			pthread_mutex_unlock(&s->mutex);
+			proc->frame_hint = frame + 1;
+			if(pager->ncolors) proc->color = (frame + 1) % pager->ncolors;
+			continue;
+		}
+		struct pager_shard *s = pager_shard_of(frame);
+		pthread_mutex_lock(&s->mutex);
+		if(spg->frame != frame) { /* evicted by another shard */
+			pthread_mutex_unlock(&s->mutex);
+			continue;
+		}
+		struct pager_frame *fr = &pager->frames[frame];
+		fr->ref = 1;
+		void *vaddr = pager_vaddr(vpn);
+		int dirtyprot = spg->dirty ? PROT_READ | PROT_WRITE : PROT_READ;
+		if(pg->frame == -1) {
+			mmu_resident(proc->pid, vaddr, frame, dirtyprot);
+			fr->shared = pager_sharer_new(proc, vpn, fr->shared);
+			pg->prot = dirtyprot;
+			pg->dirty = 0;
+			pg->soft = 0;
+			__atomic_store_n(&pg->frame, frame, __ATOMIC_RELEASE);
+		} else {
+			pager_soft_sync(proc, vpn);
+			int prot = pg->prot;
+			if(prot == PROT_NONE) {
+				prot = dirtyprot;
+			} else if(write) {
+				prot = PROT_READ | PROT_WRITE;
+				spg->dirty = 1;
+			}
+			if(prot != pg->prot) {
+				mmu_chprot(proc->pid, vaddr, prot);
+				pg->prot = prot;
+			}
+		}
+		pthread_mutex_unlock(&s->mutex);
+		break;
+	}
+	pthread_mutex_unlock(&sp->mutex);
+}/*}}}*/
+
+void pager_cow(struct pager_proc *proc, int vpn, int frame)/*{{{*/
+{
+	/* Copies the shared frame of page `vpn`, pinned by the caller,
+	 * to a new block of the page's own and leaves the page
+	 * nonresident, to be faulted back in privately.  `proc->mutex`
+	 * must be held. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	int block = pager_block_alloc(proc);
+	mmu_disk_write(frame, block);
+	struct pager_shard *s = pager_shard_of(frame);
+	pthread_mutex_lock(&s->mutex);
+	pager->frames[frame].pins--;
+	mmu_nonresident(proc->pid, pager_vaddr(vpn));
+	/* the other mappings may have gone away in the meantime */
+	int freed = pager_frame_drop(frame, proc, vpn);
+	pager_block_put(pg->block);
+	pg->block = block;
+	pager_page_out(pg, 1, -1);
+	pthread_mutex_unlock(&s->mutex);
+	if(freed) pool_free(s->free, frame - s->first);
+}/*}}}*/
+
+void pager_dontneed(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Drops page `vpn`'s frame, without writing it back, and its
+	 * block; a segment mapping only drops its own mapping.
+	 * `proc->mutex` must be held. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	int cache = pager_cache_take(pg);
+	if(cache != -1) {
+		struct pager_shard *s = pager_shard_of(cache);
+		pool_free(s->free, cache - s->first);
+	}
+	for(;;) {
+		int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+		if(frame == -1) break;
+		struct pager_shard *s = pager_shard_of(frame);
+		pthread_mutex_lock(&s->mutex);
+		if(pg->frame != frame) { /* evicted by another shard */
+			pthread_mutex_unlock(&s->mutex);
+			continue;
+		}
+		pager_soft_sync(proc, vpn);
+		mmu_nonresident(proc->pid, pager_vaddr(vpn));
+		int freed = pager_frame_drop(frame, proc, vpn);
+		pager_page_out(pg, 0, -1);
+		pthread_mutex_unlock(&s->mutex);
+		if(freed) pool_free(s->free, frame - s->first);
+	}
+	pg->fill = -1;
+	if(pg->shm != -1 || pg->block == -1) return;
+	pager_block_put(pg->block);
+	pg->block = -1;
+	pg->ondisk = 0;
+}/*}}}*/
+
+void pager_readahead(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Page `vpn` was just faulted in during a sequential scan.
+	 * `proc->mutex` must be held. */
+	int n = PAGER_READAHEAD;
+	if(n > pager->nframes / 4) n = pager->nframes / 4;
+	for(int i = vpn + 1; i <= vpn + n; ++i) {
+		/* pages never touched have no advice */
+		struct pager_page *pg = pager_pte(proc, i);
+		if(!pg || pg->advice != UVM_ADV_SEQUENTIAL) break;
+		if(__atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE) == -1)
+			pager_access(proc, i, 0);
+	}
+	/* drop behind: the scan is done with the previous page */
+	struct pager_page *pg = pager_pte(proc, vpn - 1);
+	if(!pg || pg->advice != UVM_ADV_SEQUENTIAL) return;
+	int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+	if(frame == -1) return;
+	struct pager_shard *s = pager_shard_of(frame);
+	pthread_mutex_lock(&s->mutex);
+	if(pg->frame == frame) pager->frames[frame].ref = 0;
+	pthread_mutex_unlock(&s->mutex);
+}/*}}}*/
+
+void pager_swap_readahead(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Page `vpn` was just paged in from disk.  Reads the following
+	 * pages on disk into the swap cache.  `proc->mutex` must be
+	 * held. */
+	for(int i = vpn + 1; i <= vpn + pager->swapra; ++i) {
+		struct pager_page *pg = pager_pte(proc, i);
+		if(!pg || pg->shm != -1 ||
+				__atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE) != -1 ||
+				!pg->ondisk || pg->advice == UVM_ADV_RANDOM)
+			break;
+		if(__atomic_load_n(&pg->cache, __ATOMIC_ACQUIRE) != -1) continue;
+		int frame = pager_frame_spare(proc);
+		if(frame == -1) break;
+		mmu_disk_read(pg->block, frame);
+		struct pager_shard *s = pager_shard_of(frame);
+		struct pager_frame *fr = &pager->frames[frame];
+		pthread_mutex_lock(&s->mutex);
+		fr->proc = proc;
+		fr->page = i;
+		fr->ref = 0;
+		__atomic_store_n(&pg->cache, frame, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&s->mutex);
+		__atomic_add_fetch(&pager->rastats.reads, 1, __ATOMIC_RELAXED);
+	}
+}/*}}}*/
+
+int pager_frame_spare(struct pager_proc *proc)/*{{{*/
+{
+	/* Like `pager_frame_alloc`, but never runs a clock and keeps
+	 * more than `wmark_low` frames free; returns -1 if no frame is
+	 * spare. */
+	if(pager_nfree() <= pager->wmark_low) return -1;
+	int homeid = pager_home(proc);
+	for(int i = 0; i < pager->nshards; ++i) {
+		struct pager_shard *s;
+		s = &pager->shards[(homeid + i) % pager->nshards];
+		int frame = pager_frame_take(s, proc);
+		if(frame != -1) return frame;
+	}
+	return -1;
+}/*}}}*/
+
+int pager_cache_take(struct pager_page *pg)/*{{{*/
+{
+	/* Removes the page's swap cache frame, if any, from the frame
+	 * table and returns it, owned by the caller; returns -1 if the
+	 * page has none.  The mutex of the page's process must be held. */
+	for(;;) {
+		int frame = __atomic_load_n(&pg->cache, __ATOMIC_ACQUIRE);
+		if(frame == -1) return -1;
+		struct pager_shard *s = pager_shard_of(frame);
+		pthread_mutex_lock(&s->mutex);
+		if(pg->cache != frame) { /* evicted by another shard */
+			pthread_mutex_unlock(&s->mutex);
+			continue;
+		}
+		pager->frames[frame].proc = NULL;
+		__atomic_store_n(&pg->cache, -1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&s->mutex);
+		return frame;
+	}
+}/*}}}*/
+
+int pager_block_alloc(struct pager_proc *proc)/*{{{*/
+{
+	/* The caller holds a block reference in `navail`, so a free
+	 * block exists. */
+	int block = pager->relaxed ?
+		pool_alloc_near(pager->blocks, proc->block_hint) :
+		pool_alloc(pager->blocks);
+	assert(block != -1);
+	proc->block_hint = block + 1;
+	__atomic_store_n(&pager->block_refs[block], 1, __ATOMIC_RELEASE);
+	return block;
+}/*}}}*/
+
+void pager_block_put(int block)/*{{{*/
+{
+	if(__atomic_sub_fetch(&pager->block_refs[block], 1,
+				__ATOMIC_ACQ_REL) == 0)
+		pool_free(pager->blocks, block);
+}/*}}}*/
+
+int pager_block_private(int block)/*{{{*/
+{
+	return __atomic_load_n(&pager->block_refs[block],
+			__ATOMIC_ACQUIRE) == 1;
+}/*}}}*/
+
+int pager_pin(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* Pins the frame holding page `vpn` and marks it referenced if
+	 * the process can read the page; returns -1 otherwise.
+	 * `proc->mutex` must be held. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	if(!pg) return -1;
+	int frame = __atomic_load_n(&pg->frame, __ATOMIC_ACQUIRE);
+	if(frame == -1) return -1;
+	struct pager_shard *s = pager_shard_of(frame);
+	pthread_mutex_lock(&s->mutex);
+	if(pg->frame == frame) pager_soft_sync(proc, vpn);
+	if(pg->frame != frame || pg->prot == PROT_NONE) {
+		pthread_mutex_unlock(&s->mutex);
+		return -1;
+	}
+	pager->frames[frame].ref = 1;
+	pager->frames[frame].pins++;
+	pthread_mutex_unlock(&s->mutex);
+	return frame;
+}/*}}}*/
+
+void pager_soft_sync(struct pager_proc *proc, int vpn)/*{{{*/
+{
+	/* The lock of the shard holding the page's frame must be held.
+	 * Withdraws the process's permission to restore the page, and
+	 * records the restored protection and reference if it did. */
+	struct pager_page *pg = pager_pte(proc, vpn);
+	if(!pg->soft) return;
+	if(mmu_reftake(proc->pid, pager_vaddr(vpn))) {
+		pg->prot = pg->soft;
+		pager->frames[pg->frame].ref = 1;
+	}
+	pg->soft = 0;
+}/*}}}*/
+
+void pager_syslog_flush(const struct iovec *iov, const int *frames,/*{{{*/
+		int n, int last)
+{
+	if(n == 0 && !last) return;
+	mmu_syslog_write(iov, n, last);
+	for(int i = 0; i < n; ++i) {
+		struct pager_shard *s = pager_shard_of(frames[i]);
+		pthread_mutex_lock(&s->mutex);
+		pager->frames[frames[i]].pins--;
+		pthread_mutex_unlock(&s->mutex);
+	}
+}/*}}}*/
+
+void * pager_vaddr(int vpn)/*{{{*/
+{
+	return (void *)(UVM_BASEADDR + (intptr_t)(vpn * PAGESIZE));
+}/*}}}*/
+
+int pager_write_all(int fd, const void *buf, size_t len)/*{{{*/
+{
+	const char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = write(fd, p, len);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		len -= cnt;
+	}
+	return 0;
+}/*}}}*/
+
+int pager_read_all(int fd, void *buf, size_t len)/*{{{*/
+{
+	char *p = buf;
+	while(len > 0) {
+		ssize_t cnt = read(fd, p, len);
+		if(cnt == -1 && errno == EINTR) continue;
+		if(cnt == 0) errno = EIO;
+		if(cnt <= 0) return -1;
+		p += cnt;
+		len -= cnt;
+	}
+	return 0;
+}/*}}}*/
@@ -17,6 +17,12 @@ void pager_init(int nframes, int nblocks);
  * manage memory for a new process `pid`. */
 void pager_create(pid_t pid);
 
+/* `pager_set_qos` sets the QoS class of process `pid`, one of the
+ * `UVM_QOS_*` constants in mmu.h (`UVM_QOS_NORMAL` if invalid).
+ * Processes start in `UVM_QOS_NORMAL`, and `pager_fork` copies the
+ * parent's class.  Frames of later classes are evicted first. */
+void pager_set_qos(pid_t pid, int qos);
+
 /* `pager_extend` allocates a new page of memory to process `pid`
  * and returns a pointer to that memory in the process's address
  * space.  `pager_extend` need not zero memory or install mappings
@@ -26,9 +32,40 @@ void pager_create(pid_t pid);
  * use as backing storage. */
 void *pager_extend(pid_t pid);
 
+/* `pager_fork` creates process `child` with a copy of the address
+ * space of process `parent`, as `pager_create` followed by one
+ * `pager_extend` per page of the parent would.  Pages are shared
+ * copy-on-write: frames and disk blocks are shared until either
+ * process writes to the page.  Resident pages are mapped in the
+ * child with at most read access, and write access is revoked from
+ * the parent.  Returns 0 on success; returns -1 and sets errno to
+ * ENOSPC, creating no process, if there are not enough disk blocks
+ * to back a private copy of every page. */
+int pager_fork(pid_t parent, pid_t child);
+
+/* `pager_shm_create` creates a shared memory segment of `npages`
+ * pages and maps it at the end of process `pid`'s address space, as
+ * `npages` calls to `pager_extend` would, storing the address of its
+ * first page in `addr`.  `pager_shm_attach` maps segment `id` at the
+ * end of process `pid`'s address space, which may already map it,
+ * stores its number of pages in `npages`, and returns the address
+ * of its first page.  All mappings of a
+ * segment page share one frame and one disk block, are paged in and
+ * out together, and stay shared across `pager_fork`.  A segment
+ * exists until the last process mapping it is destroyed.
+ * `pager_shm_create` returns the segment's identifier; on failure,
+ * it returns -1 and sets errno to EINVAL if `npages` is not
+ * positive, ENOMEM if the address space has no room for the
+ * segment, or ENOSPC if there are not enough disk blocks.
+ * `pager_shm_attach` returns NULL and sets errno to EINVAL if there
+ * is no segment `id`, or ENOMEM if the address space has no room. */
+int pager_shm_create(pid_t pid, int npages, void **addr);
+void *pager_shm_attach(pid_t pid, int id, int *npages);
+
 /* `pager_fault` is called when process `pid` receives
  * a segmentation fault at address `addr`.  `pager_fault` is only
- * called for addresses previously returned with `pager_extend`.  If
+ * called for addresses previously returned with `pager_extend`, in
+ * shared segments, or in regions added with `pager_map`.  If
  * free memory frames exist, `pager_fault` should use the
  * lowest-numbered frame to service the page fault.  If no free
  * memory frames exist, `pager_fault` should use the second-chance
@@ -49,10 +86,103 @@ void pager_fault(pid_t pid, void *addr);
  * the syslog succeeds, it should return 0. */
 int pager_syslog(pid_t pid, void *addr, size_t len);
 
+/* `pager_release` frees the `npages` pages starting at `addr` in
+ * the address space of process `pid`: their frames and blocks are
+ * freed at once, without writing frames to disk.  Pages released at
+ * the break (the end of the pages from `pager_extend` and segment
+ * mappings) are removed from the address space, and their addresses
+ * are reused by later calls to `pager_extend`; other pages read as
+ * zero-filled pages if accessed again.  Returns the number of pages
+ * left below the break; returns -1 and sets errno to EINVAL if
+ * `addr` is not page-aligned or the range is not mapped.
+ *
+ * `pager_advise` applies hint `advice` (see `UVM_ADV_*` in mmu.h)
+ * to the pages covering `len` bytes from `addr`.  `UVM_ADV_WILLNEED`
+ * pages them in now (up to half of the frames);
+ * `UVM_ADV_DONTNEED` drops them like `pager_release`, but never
+ * shrinks the address space; the other hints are recorded for later
+ * faults.  Pages mapping a shared segment only drop their own
+ * mapping.  Returns 0 on success; returns -1 and sets errno to
+ * EINVAL if `addr` is not page-aligned, the range is not mapped, or
+ * `advice` is unknown. */
+int pager_release(pid_t pid, void *addr, int npages);
+int pager_advise(pid_t pid, void *addr, size_t len, int advice);
+
+/* `pager_map` adds a region of `npages` zero-filled pages to the
+ * address space of process `pid`, above the break, and returns the
+ * address of its first page.  The region starts at `addr` if it is
+ * not NULL and the pages there are free; otherwise it goes in the
+ * highest free range, leaving room for the break to grow.  Like
+ * `pager_extend`, it reserves a block for every page, but pages take
+ * memory in the pager only once accessed.  Returns NULL and sets
+ * errno to EINVAL if `npages` is not positive or `addr` is not
+ * page-aligned, ENOMEM if no free range is large enough, or ENOSPC
+ * if the disk cannot back the region.
+ *
+ * `pager_unmap` removes `npages` pages from `addr`, which must lie
+ * within one region, freeing their frames and blocks; the rest of
+ * the region stays mapped.  Returns 0 on success; returns -1 and sets
+ * errno to EINVAL otherwise. */
+void * pager_map(pid_t pid, void *addr, int npages);
+int pager_unmap(pid_t pid, void *addr, int npages);
+
+/* `pager_reclaim` is called by the MMU's background reclaim thread
+ * some time after the pager calls `mmu_reclaim_wake`, never
+ * concurrently with itself.  It evicts frames until the high
+ * watermark of free frames is reached (see `PAGER_WMARK_LOW` and
+ * `PAGER_WMARK_HIGH` in pager.c) and returns the number of frames
+ * it freed.  `pager_reclaim_stats` reports the watermarks and
+ * reclaim activity so far: wakeups of the reclaim thread, frames it
+ * freed and wrote to disk, and allocations that found no free frame
+ * and ran the clock themselves. */
+struct pager_reclaim_stats {
+	int wmark_low; /* 0 if background reclaim is disabled */
+	int wmark_high;
+	long wakeups;
+	long frames;
+	long written;
+	long direct;
+};
+int pager_reclaim(void);
+void pager_reclaim_stats(struct pager_reclaim_stats *stats);
+
+/* `pager_swapra_stats` reports swap readahead (see
+ * `PAGER_SWAP_READAHEAD` in pager.c): the number of pages read ahead
+ * of each swap-in, pages read ahead into spare frames so far, and
+ * faults serviced from those frames without reading the disk. */
+struct pager_swapra_stats {
+	int window; /* 0 if swap readahead is disabled */
+	long reads;
+	long hits;
+};
+void pager_swapra_stats(struct pager_swapra_stats *stats);
+
+/* `pager_uniform_stats` reports uniform page detection (see
+ * `PAGER_UNIFORM` in pager.c): the kernel used, dirty frames checked
+ * at eviction, and frames found to hold a single repeated byte,
+ * which were not written to disk. */
+struct pager_uniform_stats {
+	const char *impl; /* NULL if detection is disabled */
+	long checked;
+	long pages;
+};
+void pager_uniform_stats(struct pager_uniform_stats *stats);
+
 /* `pager_destroy` is called when the process is already dead.  It
  * should free all resources process `pid` allocated (memory frames
  * and disk blocks).  `pager_destroy` should not call any of the MMU
  * functions. */
 void pager_destroy(pid_t pid);
 
+/* `pager_checkpoint` writes the pager's frame and page tables to
+ * file descriptor `fd`.  It is called while no other pager function
+ * runs.  `pager_restore` reads tables written by `pager_checkpoint`
+ * from `fd`, right after `pager_init` and before any process is
+ * created; processes in the tables exist as if `pager_create` had
+ * been called for them.  Both return 0 on success and -1 on error,
+ * setting errno; `pager_restore` fails with EINVAL if the tables
+ * were written for a different number of frames or blocks. */
+int pager_checkpoint(int fd);
+int pager_restore(int fd);
+
 #endif
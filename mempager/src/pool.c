@@ -0,0 +1,113 @@
+#include "pool.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define POOL_WORD_BITS 64
+
+struct pool {/*{{{*/
+	int n;
+	int nwords;
+	int nfree;
+	uint64_t *words; /* bit set if identifier is in use */
+};/*}}}*/
+
+struct pool * pool_create(int n)/*{{{*/
+{
+	assert(n > 0);
+	struct pool *p = malloc(sizeof(*p));
+	if(!p) return NULL;
+	p->n = n;
+	p->nwords = (n + POOL_WORD_BITS - 1) / POOL_WORD_BITS;
+	p->nfree = n;
+	p->words = calloc(p->nwords, sizeof(p->words[0]));
+	if(!p->words) {
+		free(p);
+		return NULL;
+	}
+	/* bits past `n` are permanently in use: */
+	int tail = n % POOL_WORD_BITS;
+	if(tail) p->words[p->nwords-1] = ~((UINT64_C(1) << tail) - 1);
+	return p;
+}/*}}}*/
+
+void pool_destroy(struct pool *p)/*{{{*/
+{
+	free(p->words);
+	free(p);
+}/*}}}*/
+
+static int pool_take(struct pool *p, int w, uint64_t mask)/*{{{*/
+{
+	/* Claims the lowest free bit of word `w` among those in `mask`;
+	 * returns -1 if there is none. */
+	uint64_t word = __atomic_load_n(&p->words[w], __ATOMIC_RELAXED);
+	while(~word & mask) {
+		int bit = __builtin_ctzll(~word & mask);
+		uint64_t new = word | (UINT64_C(1) << bit);
+		if(__atomic_compare_exchange_n(&p->words[w], &word, new, 1,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_sub_fetch(&p->nfree, 1, __ATOMIC_RELAXED);
+			return w * POOL_WORD_BITS + bit;
+		}
+		/* `word` was reloaded by the failed exchange */
+	}
+	return -1;
+}/*}}}*/
+
+int pool_alloc(struct pool *p)/*{{{*/
+{
+	for(int w = 0; w < p->nwords; ++w) {
+		int id = pool_take(p, w, ~UINT64_C(0));
+		if(id != -1) return id;
+	}
+	return -1;
+}/*}}}*/
+
+int pool_alloc_near(struct pool *p, int hint)/*{{{*/
+{
+	if(hint < 0 || hint >= p->n) hint = 0;
+	int first = hint / POOL_WORD_BITS;
+	int bit = hint % POOL_WORD_BITS;
+	int id = pool_take(p, first, ~UINT64_C(0) << bit);
+	if(id != -1) return id;
+	for(int i = 1; i <= p->nwords; ++i) {
+		/* the last iteration revisits bits below `hint` in `first` */
+		id = pool_take(p, (first + i) % p->nwords, ~UINT64_C(0));
+		if(id != -1) return id;
+	}
+	return -1;
+}/*}}}*/
+
+int pool_alloc_color(struct pool *p, int color, int ncolors)/*{{{*/
+{
+	assert(ncolors > 0 && color >= 0);
+	color %= ncolors;
+	for(int w = 0; w < p->nwords; ++w) {
+		int base = w * POOL_WORD_BITS;
+		uint64_t mask = 0;
+		int bit = ((color - base % ncolors) + ncolors) % ncolors;
+		for(; bit < POOL_WORD_BITS; bit += ncolors)
+			mask |= UINT64_C(1) << bit;
+		int id = pool_take(p, w, mask);
+		if(id != -1) return id;
+	}
+	return pool_alloc_near(p, color);
+}/*}}}*/
+
+void pool_free(struct pool *p, int id)/*{{{*/
+{
+	assert(id >= 0 && id < p->n);
+	uint64_t bit = UINT64_C(1) << (id % POOL_WORD_BITS);
+	uint64_t old = __atomic_fetch_and(&p->words[id / POOL_WORD_BITS], ~bit,
+			__ATOMIC_RELEASE);
+	assert(old & bit);
+	(void)old;
+	__atomic_add_fetch(&p->nfree, 1, __ATOMIC_RELAXED);
+}/*}}}*/
+
+int pool_nfree(const struct pool *p)/*{{{*/
+{
+	return __atomic_load_n(&p->nfree, __ATOMIC_RELAXED);
+}/*}}}*/
@@ -0,0 +1,43 @@
+/* This module implements a lock-free allocator of small integer
+ * identifiers, such as memory frames or disk blocks.  Identifiers
+ * are tracked in a bitmap updated with compare-and-swap, so
+ * allocations and releases never block and may be called
+ * concurrently from any thread.
+ *
+ * `pool_alloc` returns the lowest-numbered free identifier at the
+ * time it is called; concurrent callers contend on the first words
+ * of the bitmap.  `pool_alloc_near` starts searching at a hint and
+ * wraps around, which spreads concurrent callers over the bitmap
+ * when the lowest-numbered rule is not required.  `pool_alloc_color`
+ * prefers identifiers congruent to a color, which lets callers
+ * spread related identifiers over cache sets. */
+
+#ifndef __POOL_HEADER__
+#define __POOL_HEADER__
+
+struct pool;
+
+/* `pool_create` returns a pool with identifiers 0 to `n-1`, all
+ * free.  Returns NULL if memory cannot be allocated. */
+struct pool * pool_create(int n);
+void pool_destroy(struct pool *p);
+
+/* `pool_alloc` and `pool_alloc_near` return a free identifier and
+ * mark it as used, or return -1 if the pool is empty. */
+int pool_alloc(struct pool *p);
+int pool_alloc_near(struct pool *p, int hint);
+
+/* `pool_alloc_color` returns the lowest free identifier `id` with
+ * `id % ncolors == color`, or any free identifier if there is none.
+ * Returns -1 if the pool is empty. */
+int pool_alloc_color(struct pool *p, int color, int ncolors);
+
+/* `pool_free` returns identifier `id` to the pool.  `id` must have
+ * been allocated and not yet freed. */
+void pool_free(struct pool *p, int id);
+
+/* `pool_nfree` returns the number of free identifiers.  The value
+ * may be stale as soon as it is returned. */
+int pool_nfree(const struct pool *p);
+
+#endif
@@ -0,0 +1,101 @@
+/* This module defines static tracepoints (USDT probes) for the MMU
+ * and the UVM module.  `PROBEn(provider, name, args...)` marks a
+ * probe with `n` integer or pointer arguments.  Each probe compiles
+ * to a single nop plus an ELF note (section `.note.stapsdt`) that
+ * tells tracers where the nop is and where its arguments live, so
+ * an untraced probe costs one nop.  bpftrace, perf, SystemTap and
+ * gdb find the probes with, e.g., `bpftrace -l 'usdt:./bin/mmu:*'`
+ * and replace the nop with a breakpoint while attached.
+ *
+ * The macros come from SystemTap's <sys/sdt.h> when it is installed;
+ * otherwise the fallback below emits the same notes on x86-64 and
+ * AArch64.  Defining `NOPROBES` compiles every probe out. */
+
+#ifndef __PROBES_HEADER__
+#define __PROBES_HEADER__
+
+#if defined(NOPROBES)
+#define PROBES_NONE 1
+#elif defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PROBES_SDT 1
+#endif
+#endif
+
+#if !defined(PROBES_NONE) && !defined(PROBES_SDT) && \
+		!defined(__x86_64__) && !defined(__aarch64__)
+#define PROBES_NONE 1
+#endif
+
+#if defined(PROBES_NONE)/*{{{*/
+
+#define PROBE0(p, n) do { } while(0)
+#define PROBE1(p, n, a1) do { (void)(a1); } while(0)
+#define PROBE2(p, n, a1, a2) do { (void)(a1); (void)(a2); } while(0)
+#define PROBE3(p, n, a1, a2, a3) \
+		do { (void)(a1); (void)(a2); (void)(a3); } while(0)
+#define PROBE4(p, n, a1, a2, a3, a4) \
+		do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while(0)
+/*}}}*/
+#elif defined(PROBES_SDT)/*{{{*/
+
+#include <sys/sdt.h>
+#define PROBE0(p, n) STAP_PROBE(p, n)
+#define PROBE1(p, n, a1) STAP_PROBE1(p, n, a1)
+#define PROBE2(p, n, a1, a2) STAP_PROBE2(p, n, a1, a2)
+#define PROBE3(p, n, a1, a2, a3) STAP_PROBE3(p, n, a1, a2, a3)
+#define PROBE4(p, n, a1, a2, a3, a4) STAP_PROBE4(p, n, a1, a2, a3, a4)
+/*}}}*/
+#else/*{{{*/
+
+/* Version 3 stapsdt notes, as <sys/sdt.h> writes them: the probe's
+ * address, the address of `_.stapsdt.base` (so tools can account for
+ * prelinking), a semaphore address (0: probes are always armed, at
+ * the cost of computing their arguments), and the provider, name and
+ * argument descriptions.  Arguments are passed as signed 64-bit
+ * values, described as `-8@` followed by the operand, which the
+ * compiler leaves in a register, in memory, or as a constant. */
+#define PROBES_STR(x) #x
+#define PROBES_ASM(p, n, args) \
+	"990:	nop\n" \
+	".pushsection .note.stapsdt,\"\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991:	.asciz \"stapsdt\"\n" \
+	"992:	.balign 4\n" \
+	"993:	.8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte 0\n" \
+	".asciz \"" PROBES_STR(p) "\"\n" \
+	".asciz \"" PROBES_STR(n) "\"\n" \
+	".asciz \"" args "\"\n" \
+	"994:	.balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n"
+#define PROBES_ARG(a) "nor"((long)(a))
+
+#define PROBE0(p, n) \
+	__asm__ __volatile__(PROBES_ASM(p, n, ""))
+#define PROBE1(p, n, a1) \
+	__asm__ __volatile__(PROBES_ASM(p, n, "-8@%0") :: PROBES_ARG(a1))
+#define PROBE2(p, n, a1, a2) \
+	__asm__ __volatile__(PROBES_ASM(p, n, "-8@%0 -8@%1") \
+			:: PROBES_ARG(a1), PROBES_ARG(a2))
+#define PROBE3(p, n, a1, a2, a3) \
+	__asm__ __volatile__(PROBES_ASM(p, n, "-8@%0 -8@%1 -8@%2") \
+			:: PROBES_ARG(a1), PROBES_ARG(a2), PROBES_ARG(a3))
+#define PROBE4(p, n, a1, a2, a3, a4) \
+	__asm__ __volatile__(PROBES_ASM(p, n, "-8@%0 -8@%1 -8@%2 -8@%3") \
+			:: PROBES_ARG(a1), PROBES_ARG(a2), PROBES_ARG(a3), \
+			PROBES_ARG(a4))
+/*}}}*/
+#endif
+
+#endif
@@ -0,0 +1,269 @@
+#include "slab.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_ALIGN 16 /* of objects, and size of chunk headers */
+#define SLAB_MAGAZINE 32
+#define SLAB_BATCH_BYTES 4096 /* moved between a magazine and its slab */
+#define SLAB_CHUNK_BYTES 65536 /* at most, unless objects are larger */
+#define SLAB_ROUND(size) (((size) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+struct slab {/*{{{*/
+	int id; /* index in `slab_registry` and each thread's magazines */
+	unsigned gen; /* tells magazines of an earlier slab with this id */
+	const char *name;
+	size_t size;
+	int batch; /* objects per refill or flush; magazines hold twice */
+	int chunk_objs;
+	pthread_mutex_t mutex; /* protects the fields below */
+	void *free; /* objects linked through their first word */
+	void *chunks; /* linked through their first word */
+	long nchunks;
+};/*}}}*/
+struct slab_magazine {/*{{{*/
+	unsigned gen; /* of the slab the objects belong to */
+	int n;
+	int want; /* next refill; doubles up to the slab's batch */
+	void *objs[SLAB_MAGAZINE];
+};/*}}}*/
+struct arena_chunk {/*{{{*/
+	struct arena_chunk *next;
+};/*}}}*/
+
+static __thread struct slab_magazine slab_mags[SLAB_MAX];
+static __thread int slab_thread_registered = 0;
+static struct slab *slab_registry[SLAB_MAX];
+static unsigned slab_nextgen = 0;
+static pthread_mutex_t slab_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+
+static void slab_key_init(void);
+static void slab_thread_exit(void *mags);
+static struct slab_magazine * slab_magazine(struct slab *s);
+static int slab_refill(struct slab *s, struct slab_magazine *m);
+static void slab_flush(struct slab *s, struct slab_magazine *m, int n);
+static int arena_class(struct arena *a, size_t size);
+
+/****************************************************************************
+ * slabs
+ ***************************************************************************/
+struct slab * slab_create(const char *name, size_t size)/*{{{*/
+{
+	pthread_once(&slab_key_once, slab_key_init);
+	struct slab *s = malloc(sizeof(*s));
+	if(!s) return NULL;
+	pthread_mutex_lock(&slab_registry_lock);
+	int id = 0;
+	while(id < SLAB_MAX && slab_registry[id]) id++;
+	if(id == SLAB_MAX) {
+		pthread_mutex_unlock(&slab_registry_lock);
+		free(s);
+		return NULL;
+	}
+	s->id = id;
+	s->gen = ++slab_nextgen; /* never 0, the gen of unused magazines */
+	slab_registry[id] = s;
+	pthread_mutex_unlock(&slab_registry_lock);
+	s->name = name;
+	s->size = SLAB_ROUND(size < sizeof(void *) ? sizeof(void *) : size);
+	/* threads come and go with clients, so large objects are cached
+	 * and carved sparingly */
+	s->batch = SLAB_BATCH_BYTES / s->size;
+	if(s->batch > SLAB_MAGAZINE / 2) s->batch = SLAB_MAGAZINE / 2;
+	if(s->batch < 1) s->batch = 1;
+	s->chunk_objs = SLAB_CHUNK_BYTES / s->size;
+	if(s->chunk_objs > SLAB_CHUNK_OBJS) s->chunk_objs = SLAB_CHUNK_OBJS;
+	if(s->chunk_objs < 2 * s->batch) s->chunk_objs = 2 * s->batch;
+	pthread_mutex_init(&s->mutex, NULL);
+	s->free = NULL;
+	s->chunks = NULL;
+	s->nchunks = 0;
+	return s;
+}/*}}}*/
+
+void slab_destroy(struct slab *s)/*{{{*/
+{
+	pthread_mutex_lock(&slab_registry_lock);
+	slab_registry[s->id] = NULL;
+	pthread_mutex_unlock(&slab_registry_lock);
+	while(s->chunks) {
+		void *chunk = s->chunks;
+		s->chunks = *(void **)chunk;
+		free(chunk);
+	}
+	pthread_mutex_destroy(&s->mutex);
+	free(s);
+}/*}}}*/
+
+void * slab_alloc(struct slab *s)/*{{{*/
+{
+	struct slab_magazine *m = slab_magazine(s);
+	if(m->n == 0 && slab_refill(s, m)) return NULL;
+	return m->objs[--m->n];
+}/*}}}*/
+
+void slab_free(struct slab *s, void *obj)/*{{{*/
+{
+	struct slab_magazine *m = slab_magazine(s);
+	if(m->n == 2 * s->batch) slab_flush(s, m, s->batch);
+	m->objs[m->n++] = obj;
+}/*}}}*/
+
+void slab_stats(struct slab *s, struct slab_stats *stats)/*{{{*/
+{
+	pthread_mutex_lock(&s->mutex);
+	stats->name = s->name;
+	stats->size = s->size;
+	stats->chunks = s->nchunks;
+	stats->objects = s->nchunks * s->chunk_objs;
+	pthread_mutex_unlock(&s->mutex);
+}/*}}}*/
+
+void slab_key_init(void)/*{{{*/
+{
+	if(pthread_key_create(&slab_key, slab_thread_exit))
+		abort();
+}/*}}}*/
+
+void slab_thread_exit(void *mags)/*{{{*/
+{
+	/* The thread's magazines are still valid while key destructors
+	 * run.  Objects of destroyed slabs went away with their chunks. */
+	struct slab_magazine *m = mags;
+	pthread_mutex_lock(&slab_registry_lock);
+	for(int id = 0; id < SLAB_MAX; ++id) {
+		struct slab *s = slab_registry[id];
+		if(s && m[id].gen == s->gen && m[id].n)
+			slab_flush(s, &m[id], m[id].n);
+	}
+	pthread_mutex_unlock(&slab_registry_lock);
+}/*}}}*/
+
+struct slab_magazine * slab_magazine(struct slab *s)/*{{{*/
+{
+	struct slab_magazine *m = &slab_mags[s->id];
+	if(m->gen == s->gen) return m;
+	/* first use of the slab by this thread */
+	m->gen = s->gen;
+	m->n = 0;
+	m->want = 1;
+	if(!slab_thread_registered) {
+		pthread_setspecific(slab_key, slab_mags);
+		slab_thread_registered = 1;
+	}
+	return m;
+}/*}}}*/
+
+int slab_refill(struct slab *s, struct slab_magazine *m)/*{{{*/
+{
+	/* Moves up to a batch of objects from the slab to `m`, which is
+	 * empty; returns -1 if the slab cannot grow.  Refills start small
+	 * so that short-lived threads do not hold many objects. */
+	pthread_mutex_lock(&s->mutex);
+	if(!s->free) {
+		char *chunk = malloc(SLAB_ALIGN + s->size * s->chunk_objs);
+		if(!chunk) {
+			pthread_mutex_unlock(&s->mutex);
+			return -1;
+		}
+		*(void **)chunk = s->chunks;
+		s->chunks = chunk;
+		s->nchunks++;
+		for(int i = s->chunk_objs - 1; i >= 0; --i) {
+			void *obj = chunk + SLAB_ALIGN + i * s->size;
+			*(void **)obj = s->free;
+			s->free = obj;
+		}
+	}
+	while(s->free && m->n < m->want) {
+		void *obj = s->free;
+		s->free = *(void **)obj;
+		m->objs[m->n++] = obj;
+	}
+	if(m->want < s->batch) m->want = 2 * m->want < s->batch ?
+			2 * m->want : s->batch;
+	pthread_mutex_unlock(&s->mutex);
+	return 0;
+}/*}}}*/
+
+void slab_flush(struct slab *s, struct slab_magazine *m, int n)/*{{{*/
+{
+	pthread_mutex_lock(&s->mutex);
+	while(n-- > 0) {
+		void *obj = m->objs[--m->n];
+		*(void **)obj = s->free;
+		s->free = obj;
+	}
+	pthread_mutex_unlock(&s->mutex);
+}/*}}}*/
+
+/****************************************************************************
+ * arenas
+ ***************************************************************************/
+void arena_init(struct arena *a, struct slab *chunks)/*{{{*/
+{
+	a->chunks = chunks;
+	a->used = NULL;
+	a->next = NULL;
+	a->left = 0;
+	for(int i = 0; i < ARENA_CLASSES; ++i) {
+		a->sizes[i] = 0;
+		a->free[i] = NULL;
+	}
+}/*}}}*/
+
+void * arena_alloc(struct arena *a, size_t size)/*{{{*/
+{
+	size = SLAB_ROUND(size);
+	assert(size <= ARENA_CHUNK - SLAB_ALIGN);
+	int c = arena_class(a, size);
+	void *p = a->free[c];
+	if(p) {
+		a->free[c] = *(void **)p;
+	} else {
+		if(a->left < size) {
+			struct arena_chunk *chunk = slab_alloc(a->chunks);
+			if(!chunk) return NULL;
+			chunk->next = a->used;
+			a->used = chunk;
+			a->next = (char *)chunk + SLAB_ALIGN;
+			a->left = ARENA_CHUNK - SLAB_ALIGN;
+		}
+		p = a->next;
+		a->next += size;
+		a->left -= size;
+	}
+	memset(p, 0, size);
+	return p;
+}/*}}}*/
+
+void arena_free(struct arena *a, void *p, size_t size)/*{{{*/
+{
+	int c = arena_class(a, SLAB_ROUND(size));
+	*(void **)p = a->free[c];
+	a->free[c] = p;
+}/*}}}*/
+
+void arena_release(struct arena *a)/*{{{*/
+{
+	while(a->used) {
+		struct arena_chunk *chunk = a->used;
+		a->used = chunk->next;
+		slab_free(a->chunks, chunk);
+	}
+	arena_init(a, a->chunks);
+}/*}}}*/
+
+int arena_class(struct arena *a, size_t size)/*{{{*/
+{
+	int c = 0;
+	while(c < ARENA_CLASSES && a->sizes[c] && a->sizes[c] != size) c++;
+	assert(c < ARENA_CLASSES); /* the arena serves too many sizes */
+	a->sizes[c] = size;
+	return c;
+}/*}}}*/
@@ -0,0 +1,77 @@
+/* This module implements allocators for the MMU's and the pager's
+ * fixed-size records, so that servicing requests does not go to the
+ * heap once the allocators are warm.
+ *
+ * A slab hands out objects of one size, carved from chunks taken
+ * from the heap up to `SLAB_CHUNK_OBJS` objects at a time (fewer for
+ * large objects) and only given back when the slab is destroyed.
+ * Each thread keeps a small cache (a magazine) of free objects per
+ * slab, so most allocations and releases take no lock; a thread's
+ * cached objects return to the slab when it exits.  At most
+ * `SLAB_MAX` slabs exist at a time.
+ *
+ * An arena allocates records of a single owner, such as the page
+ * table and regions of one process, from chunks of a slab.  Records
+ * freed individually are kept on per-size free lists for reuse by
+ * the same arena, and `arena_release` gives all of its chunks back at
+ * once.  Arenas are not thread-safe; the owner's lock must be held. */
+
+#ifndef __SLAB_HEADER__
+#define __SLAB_HEADER__
+
+#include <stddef.h>
+
+#define SLAB_MAX 16
+#define SLAB_CHUNK_OBJS 64
+#define ARENA_CHUNK 16384
+#define ARENA_CLASSES 4
+
+struct slab;
+
+/* `slab_create` returns a slab of objects of `size` bytes; `name` is
+ * only used in statistics and must outlive the slab.  Returns NULL
+ * if memory cannot be allocated or `SLAB_MAX` slabs exist.
+ * `slab_destroy` frees every chunk, whether or not its objects were
+ * released. */
+struct slab * slab_create(const char *name, size_t size);
+void slab_destroy(struct slab *s);
+
+/* `slab_alloc` returns an uninitialized object, or NULL if the heap
+ * is exhausted.  `slab_free` releases an object from `slab_alloc` on
+ * the same slab; any thread may release any object. */
+void * slab_alloc(struct slab *s);
+void slab_free(struct slab *s, void *obj);
+
+/* `slab_stats` reports the slab's object size, the chunks it took
+ * from the heap, and the objects they hold. */
+struct slab_stats {
+	const char *name;
+	size_t size;
+	long chunks;
+	long objects;
+};
+void slab_stats(struct slab *s, struct slab_stats *stats);
+
+struct arena_chunk;
+struct arena {
+	struct slab *chunks; /* of `ARENA_CHUNK` bytes */
+	struct arena_chunk *used;
+	char *next; /* free space in the newest chunk */
+	size_t left;
+	size_t sizes[ARENA_CLASSES]; /* 0 if the class is unused */
+	void *free[ARENA_CLASSES];
+};
+
+/* `arena_init` prepares an empty arena taking chunks from `chunks`,
+ * a slab of `ARENA_CHUNK`-byte objects.  `arena_alloc` returns `size`
+ * zeroed bytes, at most `ARENA_CHUNK` minus a header, or NULL if the
+ * heap is exhausted; an arena serves at most `ARENA_CLASSES`
+ * different sizes.  `arena_free` returns a record of `size` bytes to
+ * the arena.  `arena_release` returns every chunk to the slab and
+ * leaves the arena empty. */
+void arena_init(struct arena *a, struct slab *chunks);
+void * arena_alloc(struct arena *a, size_t size);
+void arena_free(struct arena *a, void *p, size_t size);
+void arena_release(struct arena *a);
+
+#endif
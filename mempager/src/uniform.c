@@ -0,0 +1,149 @@
+#include "uniform.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNIFORM_X86 1
+#endif
+
+#define UNIFORM_CHUNK 64
+
+struct uniform_kernel {/*{{{*/
+	const char *name;
+	int (*fn)(const unsigned char *p, size_t len);
+	int (*supported)(void);
+};/*}}}*/
+
+static int uniform_scalar(const unsigned char *p, size_t len);
+static int uniform_always(void);
+#ifdef UNIFORM_X86
+static int uniform_sse2(const unsigned char *p, size_t len);
+static int uniform_avx2(const unsigned char *p, size_t len);
+static int uniform_has_sse2(void);
+static int uniform_has_avx2(void);
+#endif
+static const struct uniform_kernel * uniform_best(void);
+
+/* best first */
+static const struct uniform_kernel uniform_kernels[] = {
+#ifdef UNIFORM_X86
+	{"avx2", uniform_avx2, uniform_has_avx2},
+	{"sse2", uniform_sse2, uniform_has_sse2},
+#endif
+	{"scalar", uniform_scalar, uniform_always},
+};
+#define UNIFORM_NKERNELS \
+		(int)(sizeof(uniform_kernels) / sizeof(uniform_kernels[0]))
+
+/* NULL until first use; any thread may set it, always to the same
+ * kernel unless `uniform_select` is called. */
+static const struct uniform_kernel *uniform_kernel = NULL;
+
+/****************************************************************************
+ * external functions
+ ***************************************************************************/
+int uniform_byte(const void *p, size_t len)/*{{{*/
+{
+	const struct uniform_kernel *k;
+	k = __atomic_load_n(&uniform_kernel, __ATOMIC_ACQUIRE);
+	if(!k) {
+		k = uniform_best();
+		__atomic_store_n(&uniform_kernel, k, __ATOMIC_RELEASE);
+	}
+	return k->fn(p, len);
+}/*}}}*/
+
+const char * uniform_impl(void)/*{{{*/
+{
+	const struct uniform_kernel *k;
+	k = __atomic_load_n(&uniform_kernel, __ATOMIC_ACQUIRE);
+	return k ? k->name : uniform_best()->name;
+}/*}}}*/
+
+int uniform_select(const char *name)/*{{{*/
+{
+	for(int i = 0; i < UNIFORM_NKERNELS; ++i) {
+		const struct uniform_kernel *k = &uniform_kernels[i];
+		if(strcmp(k->name, name) || !k->supported()) continue;
+		__atomic_store_n(&uniform_kernel, k, __ATOMIC_RELEASE);
+		return 0;
+	}
+	return -1;
+}/*}}}*/
+
+/****************************************************************************
+ * kernels
+ ***************************************************************************/
+const struct uniform_kernel * uniform_best(void)/*{{{*/
+{
+	int i = 0;
+	while(!uniform_kernels[i].supported()) i++; /* scalar always is */
+	return &uniform_kernels[i];
+}/*}}}*/
+
+int uniform_always(void)/*{{{*/
+{
+	return 1;
+}/*}}}*/
+
+int uniform_scalar(const unsigned char *p, size_t len)/*{{{*/
+{
+	uint64_t pattern = 0x0101010101010101ULL * p[0];
+	for(size_t off = 0; off < len; off += UNIFORM_CHUNK) {
+		uint64_t w[UNIFORM_CHUNK / sizeof(uint64_t)];
+		memcpy(w, p + off, sizeof(w)); /* no alignment assumed */
+		uint64_t diff = 0;
+		for(size_t i = 0; i < sizeof(w) / sizeof(w[0]); ++i)
+			diff |= w[i] ^ pattern;
+		if(diff) return -1;
+	}
+	return p[0];
+}/*}}}*/
+
+#ifdef UNIFORM_X86
+int uniform_has_sse2(void)/*{{{*/
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}/*}}}*/
+
+int uniform_has_avx2(void)/*{{{*/
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}/*}}}*/
+
+__attribute__((target("sse2")))
+int uniform_sse2(const unsigned char *p, size_t len)/*{{{*/
+{
+	__m128i pattern = _mm_set1_epi8((char)p[0]);
+	for(size_t off = 0; off < len; off += UNIFORM_CHUNK) {
+		const __m128i *v = (const __m128i *)(p + off);
+		__m128i eq = _mm_and_si128(
+				_mm_and_si128(
+					_mm_cmpeq_epi8(_mm_loadu_si128(v), pattern),
+					_mm_cmpeq_epi8(_mm_loadu_si128(v + 1), pattern)),
+				_mm_and_si128(
+					_mm_cmpeq_epi8(_mm_loadu_si128(v + 2), pattern),
+					_mm_cmpeq_epi8(_mm_loadu_si128(v + 3), pattern)));
+		if(_mm_movemask_epi8(eq) != 0xFFFF) return -1;
+	}
+	return p[0];
+}/*}}}*/
+
+__attribute__((target("avx2")))
+int uniform_avx2(const unsigned char *p, size_t len)/*{{{*/
+{
+	__m256i pattern = _mm256_set1_epi8((char)p[0]);
+	for(size_t off = 0; off < len; off += UNIFORM_CHUNK) {
+		const __m256i *v = (const __m256i *)(p + off);
+		__m256i diff = _mm256_or_si256(
+				_mm256_xor_si256(_mm256_loadu_si256(v), pattern),
+				_mm256_xor_si256(_mm256_loadu_si256(v + 1), pattern));
+		if(!_mm256_testz_si256(diff, diff)) return -1;
+	}
+	return p[0];
+}/*}}}*/
+#endif
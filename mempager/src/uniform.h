@@ -0,0 +1,27 @@
+/* This module detects memory filled with a single repeated byte,
+ * such as pages that still hold what `mmu_zero_fill` wrote.  It has
+ * AVX2 and SSE2 kernels and a portable scalar one; the best kernel
+ * the CPU supports is selected at run time, on first use.  All
+ * kernels stop at the first 64-byte chunk holding a different byte,
+ * so ordinary pages are rejected after reading a few cache lines.
+ * Every function may be called concurrently from any thread. */
+
+#ifndef __UNIFORM_HEADER__
+#define __UNIFORM_HEADER__
+
+#include <stddef.h>
+
+/* `uniform_byte` returns the byte repeated over the `len` bytes at
+ * `p`, as an unsigned char, or -1 if two of them differ.  `len` must
+ * be a positive multiple of 64, e.g. a page. */
+int uniform_byte(const void *p, size_t len);
+
+/* `uniform_impl` returns the name of the kernel `uniform_byte` uses:
+ * "avx2", "sse2", or "scalar".  `uniform_select` makes `uniform_byte`
+ * use the kernel called `name` instead; it returns 0, or -1 if the
+ * kernel is unknown or the CPU does not support it.  It is meant for
+ * benchmarks and tests. */
+const char * uniform_impl(void);
+int uniform_select(const char *name);
+
+#endif
@@ -4,15 +4,21 @@
 
 #include "uvm.h"
 
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+
+#include <linux/userfaultfd.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -23,25 +29,81 @@
 
 #include "log.h"
 
+#include "hist.h"
 #include "mmu.h"
 #include "mmuproto.h"
+#include "probes.h"
+
+/* Stages of the faults a client times, from the stamps carried by
+ * SEGV_REQ and SEGV_REP (see mmuproto.h). */
+#define UVM_FAULT_REQUEST 0 /* from the handler's entry to the send */
+#define UVM_FAULT_SEND 1 /* to the MMU's thread for the client */
+#define UVM_FAULT_QUEUE 2 /* waiting for an MMU worker */
+#define UVM_FAULT_PAGER 3 /* in the pager, but for the next two */
+#define UVM_FAULT_ACK 4 /* REMAP and CHPROT round trips */
+#define UVM_FAULT_DISK 5
+#define UVM_FAULT_REPLY 6 /* from the pager's return to `uvm_thread` */
+#define UVM_FAULT_WAKEUP 7 /* to the faulting thread running again */
+#define UVM_FAULT_TOTAL 8
+#define UVM_FAULT_STAGES 9
 
 /****************************************************************************
  * structure definitions and static variables
  ***************************************************************************/
+struct uvm_region {/*{{{*/
+	intptr_t start;
+	intptr_t end;
+};/*}}}*/
+struct uvm_waiter {/*{{{*/
+	/* A request awaiting its reply, on the stack of the thread that
+	 * sent it, and kept so it can be resent to a restarted MMU. */
+	uint32_t tag;
+	int done;
+	intptr_t result;
+	int shm_id; /* SHM_REP only: the segment, or -errno */
+	int shm_npages;
+	pthread_cond_t cond; /* signaled when `done` is set */
+	struct mmu_proto_segv_rep segv; /* SEGV_REP only */
+	uint64_t t_reply; /* when `uvm_thread` got a timed SEGV_REP */
+	struct uvm_waiter *next;
+	size_t len;
+	char req[sizeof(struct mmu_proto_syslog_batch_req)];
+};/*}}}*/
 struct uvm_data {/*{{{*/
 	int running;
 	int npages;
+	struct uvm_region *regions; /* from `uvm_map`, sorted */
+	int nregions;
 	int sock;
 	pthread_t thread;
 	pthread_mutex_t mutex;
-	pthread_cond_t cond;
+	struct uvm_waiter *pending; /* requests awaiting their replies */
+	uint32_t nexttag;
+	int async_pending; /* MMU_PROTO_SYSLOG_ASYNC batch awaiting reply */
+	int async_errors; /* failed async records not yet reported */
+	struct uvm_waiter async; /* the async batch */
+	int forking; /* new requests wait until `pending` drains */
+	pthread_cond_t async_cond;
+	int uffd; /* -1 if first-touch faults arrive as SIGSEGV */
+	int uffd_stop[2]; /* pipe to stop uvm_uffd_thread */
+	pthread_t uffd_thread;
+	int reconnect; /* seconds to wait for a restarted MMU, 0 to exit */
+	int detached; /* pages unmapped, REMAP and CHPROT not applied */
+	int resuming; /* new requests wait for RESUME_REP */
 	char *pmem_fn;
 	int pmem_fd;
-	intptr_t result;
+	uint32_t *refmap; /* NULL if every fault goes to the MMU */
+	char *refmap_base; /* page-aligned mapping holding `refmap` */
+	size_t refmap_size;
+	size_t pagesz;
+	int faultstats; /* time faults, see UVM_FAULTSTATS_ENV */
+	int qos; /* UVM_QOS_*, see UVM_QOS_ENV */
+	struct hist fault_hist[UVM_FAULT_STAGES];
 };/*}}}*/
 
 static struct uvm_data *uvm = NULL;
+static const char *uvm_fault_stages[UVM_FAULT_STAGES] = {"request", "send",
+		"queue", "pager", "ack", "disk", "reply", "wakeup", "total"};
 
 /****************************************************************************
  * static function declarations
@@ -49,16 +111,69 @@ static struct uvm_data *uvm = NULL;
 static void * uvm_thread(void *data);
 static void uvm_exit(int status, void *arg);
 static void uvm_segv_action(int signum, siginfo_t *si, void *context);
+static void * uvm_uffd_thread(void *data);
 
 /* Protocol message handlers assume assume `uvm->mutex` is locked. */
 static void uvm_proto_extend_rep(void);
 static void uvm_proto_syslog_rep(void);
+static void uvm_proto_syslog_batch_rep(void);
 static void uvm_proto_segv_rep(void);
 static void uvm_proto_remap_rep(void);
 static void uvm_proto_chprot_rep(void);
+static void uvm_proto_detach_rep(void);
+static void uvm_proto_resume_rep(void);
+static void uvm_proto_fork_rep(void);
+static void uvm_proto_shm_rep(void);
+static void uvm_proto_release_rep(void);
+static void uvm_proto_advise_rep(void);
+static void uvm_proto_map_rep(void);
+static void uvm_proto_exit_rep(void);
 
 /* Helper functions */
 static void uvm_connect_socket(int sock, const struct sockaddr_un * addr);
+static void uvm_map_pmem(const struct mmu_proto_create_rep *rep);
+static void uvm_map_refmap(uint64_t refmap_off);
+static int uvm_fork_child(pid_t parent);
+static void * uvm_shm(const struct mmu_proto_shm_req *req, int *id);
+static int uvm_request(struct uvm_waiter *w, const void *req, size_t len);
+static void uvm_wait(struct uvm_waiter *w);
+static struct uvm_waiter * uvm_reply(uint32_t tag);
+static void uvm_detach(void);
+static void uvm_reconnect(void);
+static int uvm_syslog_batch(const struct iovec *iov, int iovcnt, uint32_t flags);
+static void uvm_wait_async(void);
+static void uvm_fault(void *addr, int code, uint64_t t_fault);
+static void uvm_fault_account(const struct mmu_proto_segv_req *req,
+		const struct uvm_waiter *w, uint64_t t_wake);
+static void uvm_fault_report(void);
+static int uvm_soft_fault(intptr_t va);
+static void uvm_uffd_init(void);
+static void uvm_mutex_init(void);
+static void uvm_uffd_register(void *addr);
+static void uvm_protnone(void *addr, size_t len);
+static void uvm_protnone_all(void);
+static int uvm_region_index(intptr_t va);
+static int uvm_mapped(intptr_t va);
+static void uvm_region_add(intptr_t start, intptr_t end);
+static void uvm_region_del(intptr_t start, intptr_t end);
+
+/* Set to a non-zero value to deliver first-touch faults through
+ * userfaultfd instead of SIGSEGV, when the kernel allows it. */
+#define UVM_UFFD_ENV "UVM_UFFD"
+
+/* Seconds to keep trying to reach a restarted MMU after the
+ * connection is lost, instead of exiting. */
+#define UVM_RECONNECT_ENV "UVM_RECONNECT"
+#define UVM_RECONNECT_INTERVAL_US 5000
+
+/* Set to a non-zero value to time each fault's stages, reported on
+ * stderr and in the log when the process exits. */
+#define UVM_FAULTSTATS_ENV "UVM_FAULTSTATS"
+
+/* QoS class the process declares to the MMU: "latency", "normal"
+ * (the default), "batch", or the class number.  Children created by
+ * `uvm_fork` keep their parent's class. */
+#define UVM_QOS_ENV "UVM_QOS"
 
 #define NUM_CONNECTION_TRIES 3
 
@@ -72,7 +187,10 @@ static void uvm_connect_socket(int sock, const struct sockaddr_un * addr);
 void uvm_create(void)/*{{{*/
 {
 	#ifdef UVMLOG
-	log_init(LOG_EXTRA, "uvm.log", 1, 1<<20);
+	char log_path[MMU_PROTO_PATH_MAX + 16];
+	mmu_proto_log_path(log_path, sizeof(log_path), mmu_proto_unix_path(),
+			"uvm");
+	log_init(LOG_EXTRA, log_path, 1, 1<<20);
 	#endif
 	logd(LOG_DEBUG, "uvm_create starting\n");
 	assert(uvm == NULL);
@@ -80,15 +198,42 @@ void uvm_create(void)/*{{{*/
 	if(!uvm) prexit();
 	uvm->running = 1;
 	uvm->npages = 0;
+	uvm->pagesz = sysconf(_SC_PAGESIZE);
+	/* regions are at least a page apart, so this many always fit */
+	uvm->regions = malloc((UVM_MAXADDR - UVM_BASEADDR + 1) / uvm->pagesz *
+			sizeof(uvm->regions[0]));
+	if(!uvm->regions) prexit();
+	uvm->nregions = 0;
+	uvm->async_pending = 0;
+	uvm->async_errors = 0;
+	uvm->refmap = NULL;
+	uvm->refmap_base = NULL;
+	uvm->detached = 0;
+	uvm->resuming = 0;
+	uvm->pending = NULL;
+	uvm->nexttag = 0;
+	uvm->forking = 0;
+	const char *reconnect = getenv(UVM_RECONNECT_ENV);
+	uvm->reconnect = reconnect ? atoi(reconnect) : 0;
+	const char *faultstats = getenv(UVM_FAULTSTATS_ENV);
+	uvm->faultstats = faultstats ? atoi(faultstats) : 0;
+	const char *qos = getenv(UVM_QOS_ENV);
+	uvm->qos = UVM_QOS_NORMAL;
+	if(qos && strcmp(qos, "latency") == 0) uvm->qos = UVM_QOS_LATENCY;
+	else if(qos && strcmp(qos, "batch") == 0) uvm->qos = UVM_QOS_BATCH;
+	else if(qos && qos[0] >= '0' && qos[0] <= '9') uvm->qos = atoi(qos);
+	for(int i = 0; i < UVM_FAULT_STAGES; ++i)
+		hist_init(&uvm->fault_hist[i]);
 
-	logd(LOG_DEBUG, "  connecting unix socket [%s]\n", MMU_PROTO_UNIX_PATH);
+	const char *sock_path = mmu_proto_unix_path();
+	logd(LOG_DEBUG, "  connecting unix socket [%s]\n", sock_path);
 	uvm->sock = socket(AF_UNIX, SOCK_STREAM, 0);
 	if(uvm->sock == -1)
 		prexit();
 	struct sockaddr_un addr;
 	addr.sun_family = AF_UNIX;
 	addr.sun_path[0] = '\0';
-	strncat(addr.sun_path, MMU_PROTO_UNIX_PATH, MMU_PROTO_PATH_MAX-1);
+	strncat(addr.sun_path, sock_path, MMU_PROTO_PATH_MAX-1);
 
 	uvm_connect_socket(uvm->sock, &addr);
 
@@ -96,6 +241,8 @@ void uvm_create(void)/*{{{*/
 	struct mmu_proto_create_req req;
 	req.type = MMU_PROTO_CREATE_REQ;
 	req.pid = (uint32_t)getpid();
+	req.flags = 0;
+	req.qos = (uint32_t)uvm->qos;
 	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
 		prexit();
 
@@ -103,12 +250,7 @@ void uvm_create(void)/*{{{*/
 	struct mmu_proto_create_rep rep;
 	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep)) prexit();
 	assert(rep.type == MMU_PROTO_CREATE_REP);
-
-	uvm->pmem_fn = strndup(rep.pmem_fn, MMU_PROTO_PATH_MAX);
-	logd(LOG_DEBUG, "  mapping pmem_fn [%s]\n", uvm->pmem_fn);
-	uvm->pmem_fd = open(uvm->pmem_fn, O_RDWR);
-	if(uvm->pmem_fd == -1)
-		prexit();
+	uvm_map_pmem(&rep);
 
 	logd(LOG_DEBUG, "  setting up SEGV handler\n");
 	struct sigaction new;
@@ -119,9 +261,10 @@ void uvm_create(void)/*{{{*/
 	sigaction(SIGSEGV, &new, NULL);
 
 	logd(LOG_DEBUG, "  starting uvm_thread()\n");
-	pthread_mutex_init(&uvm->mutex, NULL);
-	pthread_cond_init(&uvm->cond, NULL);
+	uvm_mutex_init();
+	pthread_cond_init(&uvm->async_cond, NULL);
 	pthread_create(&uvm->thread, NULL, uvm_thread, NULL);
+	uvm_uffd_init();
 
 	logd(LOG_DEBUG, "  setting up uvm_exit() on_exit()\n");
 	if(on_exit(uvm_exit, NULL)) prexit();
@@ -129,36 +272,344 @@ void uvm_create(void)/*{{{*/
 	logd(LOG_DEBUG, "uvm_create succeeded\n");
 }/*}}}*/
 
+pid_t uvm_fork(void)/*{{{*/
+{
+	int fds[2];
+	if(pipe(fds) == -1) return -1;
+	pid_t parent = getpid();
+	/* no request may be in flight when the child copies our state */
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	uvm->forking = 1;
+	while(uvm->pending)
+		pthread_cond_wait(&uvm->async_cond, &uvm->mutex);
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		int r = uvm_fork_child(parent);
+		if(write(fds[1], &r, sizeof(r)) != sizeof(r) || r != 0)
+			_exit(EXIT_FAILURE);
+		close(fds[1]);
+		return 0;
+	}
+	uvm->forking = 0;
+	pthread_cond_broadcast(&uvm->async_cond);
+	pthread_mutex_unlock(&uvm->mutex);
+	close(fds[1]);
+	if(pid == -1) {
+		close(fds[0]);
+		return -1;
+	}
+	/* our pages must not change until the MMU has shared them */
+	int r = ECHILD;
+	if(read(fds[0], &r, sizeof(r)) != sizeof(r)) r = ECHILD;
+	close(fds[0]);
+	if(r != 0) {
+		waitpid(pid, NULL, 0);
+		errno = r;
+		return -1;
+	}
+	return pid;
+}/*}}}*/
+
 void * uvm_extend(void) {/*{{{*/
 	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
 	struct mmu_proto_extend_req req;
 	req.type = MMU_PROTO_EXTEND_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
-		prexit();
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	if(uvm->result) uvm->npages++;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
+	if(w.result) {
+		uvm->npages++;
+		if(uvm->uffd != -1) uvm_uffd_register((void *)w.result);
+	}
 	pthread_mutex_unlock(&uvm->mutex);
-	return (void *)uvm->result;
+	PROBE1(uvm, extend, w.result);
+	return (void *)w.result;
+}/*}}}*/
+
+void * uvm_shm_create(int npages, int *id)/*{{{*/
+{
+	struct mmu_proto_shm_req req;
+	req.type = MMU_PROTO_SHM_CREATE_REQ;
+	req.npages = npages;
+	req.id = -1;
+	return uvm_shm(&req, id);
+}/*}}}*/
+
+void * uvm_shm_attach(int id)/*{{{*/
+{
+	struct mmu_proto_shm_req req;
+	req.type = MMU_PROTO_SHM_ATTACH_REQ;
+	req.npages = 0;
+	req.id = id;
+	return uvm_shm(&req, &id);
+}/*}}}*/
+
+int uvm_release(void *addr, int npages)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	struct mmu_proto_release_req req;
+	req.type = MMU_PROTO_RELEASE_REQ;
+	req.npages = npages < 0 ? 0 : (uint32_t)npages;
+	req.addr = (intptr_t)addr;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
+	int r = (int)w.result;
+	if(r >= 0 && r < uvm->npages) {
+		/* released pages at the end are no longer ours; also
+		 * drops any userfaultfd registration */
+		void *base = (void *)(UVM_BASEADDR + r * uvm->pagesz);
+		void *m = mmap(base, (uvm->npages - r) * uvm->pagesz, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+		if(m != base) prexit();
+		uvm->npages = r;
+	}
+	pthread_mutex_unlock(&uvm->mutex);
+	if(r >= 0) return 0;
+	errno = -r;
+	return -1;
+}/*}}}*/
+
+int uvm_advise(void *addr, size_t len, int hint)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	struct mmu_proto_advise_req req;
+	req.type = MMU_PROTO_ADVISE_REQ;
+	req.advice = hint;
+	req.addr = (intptr_t)addr;
+	req.len = len;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
+	int r = (int)w.result;
+	pthread_mutex_unlock(&uvm->mutex);
+	if(r == 0) return 0;
+	errno = -r;
+	return -1;
+}/*}}}*/
+
+void * uvm_map(void *addr, int npages)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	struct mmu_proto_map_req req;
+	req.type = MMU_PROTO_MAP_REQ;
+	req.npages = npages;
+	req.addr = (intptr_t)addr;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
+	intptr_t r = w.result;
+	if(r > 0) {
+		/* keeps the range from other mappings until it is touched */
+		size_t len = npages * uvm->pagesz;
+		uvm_protnone((void *)r, len);
+		uvm_region_add(r, r + (intptr_t)len);
+		for(int i = 0; uvm->uffd != -1 && i < npages; ++i)
+			uvm_uffd_register((char *)r + i * uvm->pagesz);
+	}
+	pthread_mutex_unlock(&uvm->mutex);
+	if(r > 0) return (void *)r;
+	errno = (int)-r;
+	return NULL;
+}/*}}}*/
+
+int uvm_unmap(void *addr, int npages)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	struct mmu_proto_map_req req;
+	req.type = MMU_PROTO_UNMAP_REQ;
+	req.npages = npages;
+	req.addr = (intptr_t)addr;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
+	int r = (int)w.result;
+	if(r == 0) {
+		size_t len = npages * uvm->pagesz;
+		uvm_region_del((intptr_t)addr, (intptr_t)addr + (intptr_t)len);
+		/* also drops any userfaultfd registration */
+		uvm_protnone(addr, len);
+	}
+	pthread_mutex_unlock(&uvm->mutex);
+	if(r == 0) return 0;
+	errno = -r;
+	return -1;
 }/*}}}*/
 
 int uvm_syslog(void *addr, size_t len)/*{{{*/
 {
+	PROBE2(uvm, syslog, addr, len);
 	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
 	struct mmu_proto_syslog_req req;
 	req.type = MMU_PROTO_SYSLOG_REQ;
 	req.addr = (intptr_t)addr;
 	req.len = len;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req))
-		prexit();
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
-	if(uvm->result != 0) errno = EINVAL;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
 	pthread_mutex_unlock(&uvm->mutex);
-	return (int)uvm->result;
+	if(w.result != 0) errno = EINVAL;
+	return (int)w.result;
+}/*}}}*/
+
+int uvm_syslogv(const struct iovec *iov, int iovcnt)/*{{{*/
+{
+	return uvm_syslog_batch(iov, iovcnt, 0);
+}/*}}}*/
+
+int uvm_syslogv_async(const struct iovec *iov, int iovcnt)/*{{{*/
+{
+	return uvm_syslog_batch(iov, iovcnt, MMU_PROTO_SYSLOG_ASYNC);
+}/*}}}*/
+
+int uvm_syslog_sync(void)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	int nerrors = uvm->async_errors;
+	uvm->async_errors = 0;
+	pthread_mutex_unlock(&uvm->mutex);
+	if(nerrors == 0) return 0;
+	errno = EINVAL;
+	return -1;
 }/*}}}*/
 
 /****************************************************************************
  * auxiliary functions
  ***************************************************************************/
+int uvm_syslog_batch(const struct iovec *iov, int iovcnt, uint32_t flags)/*{{{*/
+{
+	struct mmu_proto_syslog_batch_req req;
+	req.type = MMU_PROTO_SYSLOG_BATCH_REQ;
+	req.flags = flags;
+	int nerrors = 0;
+	int i = 0;
+	while(i < iovcnt) {
+		int count = iovcnt - i;
+		if(count > MMU_PROTO_SYSLOG_BATCH_MAX)
+			count = MMU_PROTO_SYSLOG_BATCH_MAX;
+		req.count = (uint32_t)count;
+		for(int j = 0; j < count; ++j) {
+			req.recs[j].addr = (intptr_t)iov[i+j].iov_base;
+			req.recs[j].len = (uint32_t)iov[i+j].iov_len;
+		}
+		i += count;
+		size_t sz = MMU_PROTO_SYSLOG_BATCH_SIZE(count);
+
+		pthread_mutex_lock(&uvm->mutex);
+		uvm_wait_async();
+		/* failures of earlier async records are reported here */
+		nerrors += uvm->async_errors;
+		uvm->async_errors = 0;
+		if(flags & MMU_PROTO_SYSLOG_ASYNC) {
+			if(uvm_request(&uvm->async, &req, sz)) prexit();
+			uvm->async_pending = 1;
+		} else {
+			struct uvm_waiter w;
+			if(uvm_request(&w, &req, sz)) prexit();
+			uvm_wait(&w);
+			nerrors += (int)w.result;
+		}
+		pthread_mutex_unlock(&uvm->mutex);
+	}
+	if(nerrors == 0) return 0;
+	errno = EINVAL;
+	return -1;
+}/*}}}*/
+
+int uvm_fork_child(pid_t parent)/*{{{*/
+{
+	/* Runs in the child with `uvm->mutex` held since the fork, and
+	 * no other threads.  Returns 0 or an errno value.  The mutex
+	 * belongs to the parent's thread, so it is made anew. */
+	uvm_mutex_init();
+	pthread_cond_init(&uvm->async_cond, NULL);
+	/* the frames are still mapped shared with the parent; the MMU
+	 * maps them again, read-only, while servicing FORK_REQ */
+	uvm_protnone_all();
+	if(uvm->refmap_base) {
+		munmap(uvm->refmap_base, uvm->refmap_size);
+		uvm->refmap_base = NULL;
+		uvm->refmap = NULL;
+	}
+	if(uvm->uffd != -1) {
+		close(uvm->uffd);
+		close(uvm->uffd_stop[0]);
+		close(uvm->uffd_stop[1]);
+	}
+	close(uvm->sock);
+	/* requests of the parent's other threads were answered before
+	 * the fork */
+	uvm->pending = NULL;
+	uvm->forking = 0;
+	uvm->async_pending = 0;
+	uvm->async_errors = 0;
+	for(int i = 0; i < UVM_FAULT_STAGES; ++i)
+		hist_init(&uvm->fault_hist[i]);
+	uvm->detached = 0;
+	uvm->resuming = 0;
+	uvm->running = 1;
+
+	struct sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	addr.sun_path[0] = '\0';
+	strncat(addr.sun_path, mmu_proto_unix_path(), MMU_PROTO_PATH_MAX-1);
+	uvm->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(uvm->sock == -1) prexit();
+	uvm_connect_socket(uvm->sock, &addr);
+	pthread_create(&uvm->thread, NULL, uvm_thread, NULL);
+	uvm_uffd_init();
+
+	pthread_mutex_lock(&uvm->mutex);
+	struct mmu_proto_fork_req req;
+	req.type = MMU_PROTO_FORK_REQ;
+	req.pid = (uint32_t)getpid();
+	req.parent = (uint32_t)parent;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
+	uvm_wait(&w);
+	int r = (int)w.result;
+	pthread_mutex_unlock(&uvm->mutex);
+	return r;
+}/*}}}*/
+
+void * uvm_shm(const struct mmu_proto_shm_req *req, int *id)/*{{{*/
+{
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
+	struct uvm_waiter w;
+	if(uvm_request(&w, req, sizeof(*req))) prexit();
+	uvm_wait(&w);
+	void *addr = (void *)w.result;
+	for(int i = 0; addr && i < w.shm_npages; ++i) {
+		uvm->npages++;
+		if(uvm->uffd != -1)
+			uvm_uffd_register((char *)addr + i * uvm->pagesz);
+	}
+	pthread_mutex_unlock(&uvm->mutex);
+	if(addr) *id = w.shm_id;
+	else errno = -w.shm_id;
+	return addr;
+}/*}}}*/
+
+void uvm_wait_async(void)/*{{{*/
+{
+	/* Assumes `uvm->mutex` is locked.  Async batches are logged
+	 * before any later request, nothing is sent while the client is
+	 * detached, and `uvm_fork` waits for every request to be
+	 * answered; see mmuproto.h. */
+	while(uvm->async_pending || uvm->resuming || uvm->forking)
+		pthread_cond_wait(&uvm->async_cond, &uvm->mutex);
+}/*}}}*/
+
 void * uvm_thread(void *data) {/*{{{*/
 	logd(LOG_DEBUG, "uvm_thread masking SEGV\n");
 	sigset_t sigset;
@@ -171,8 +622,13 @@ void * uvm_thread(void *data) {/*{{{*/
 		uint32_t type;
 		ssize_t c = recv(uvm->sock, &type, sizeof(type), MSG_PEEK);
 		if(!uvm->running) break;
-		if(c != sizeof(type)) prexit();
+		if(c != sizeof(type) && !uvm->reconnect) prexit();
 		pthread_mutex_lock(&uvm->mutex);
+		if(c != sizeof(type)) {
+			uvm_reconnect();
+			pthread_mutex_unlock(&uvm->mutex);
+			continue;
+		}
 		switch(type) {
 			case MMU_PROTO_EXTEND_REP:
 				uvm_proto_extend_rep();
@@ -180,6 +636,9 @@ void * uvm_thread(void *data) {/*{{{*/
 			case MMU_PROTO_SYSLOG_REP:
 				uvm_proto_syslog_rep();
 				break;
+			case MMU_PROTO_SYSLOG_BATCH_REP:
+				uvm_proto_syslog_batch_rep();
+				break;
 			case MMU_PROTO_SEGV_REP:
 				uvm_proto_segv_rep();
 				break;
@@ -189,8 +648,30 @@ void * uvm_thread(void *data) {/*{{{*/
 			case MMU_PROTO_CHPROT_REP:
 				uvm_proto_chprot_rep();
 				break;
+			case MMU_PROTO_DETACH_REP:
+				uvm_proto_detach_rep();
+				break;
+			case MMU_PROTO_RESUME_REP:
+				uvm_proto_resume_rep();
+				break;
+			case MMU_PROTO_FORK_REP:
+				uvm_proto_fork_rep();
+				break;
+			case MMU_PROTO_SHM_REP:
+				uvm_proto_shm_rep();
+				break;
+			case MMU_PROTO_RELEASE_REP:
+				uvm_proto_release_rep();
+				break;
+			case MMU_PROTO_ADVISE_REP:
+				uvm_proto_advise_rep();
+				break;
+			case MMU_PROTO_MAP_REP:
+			case MMU_PROTO_UNMAP_REP:
+				uvm_proto_map_rep();
+				break;
 			case MMU_PROTO_EXIT_REP:
-				uvm->running = 0;
+				uvm_proto_exit_rep();
 				break;
 			default:
 				prexit();
@@ -202,21 +683,62 @@ void * uvm_thread(void *data) {/*{{{*/
 	pthread_exit(NULL);
 }/*}}}*/
 
+void uvm_mutex_init(void)/*{{{*/
+{
+	/* error-checking, so `uvm_exit` can tell if its thread holds it */
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+	pthread_mutex_init(&uvm->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}/*}}}*/
+
 void uvm_exit(int status, void *arg)/*{{{*/
 {
 	logd(LOG_DEBUG, "uvm_exit running\n");
+	/* A failure may exit from `uvm_thread`, from the userfaultfd
+	 * thread, or with `uvm->mutex` held; the process then exits
+	 * without the EXIT round trip, as the MMU does when a client's
+	 * socket closes, and without joining or freeing anything the
+	 * other threads may still use. */
+	pthread_t self = pthread_self();
+	int on_uffd = uvm->uffd != -1 &&
+			pthread_equal(self, uvm->uffd_thread);
+	if(pthread_equal(self, uvm->thread) || on_uffd ||
+			pthread_mutex_lock(&uvm->mutex)) {
+		logd(LOG_DEBUG, "uvm_exit on failure, skipping EXIT_REQ\n");
+		if(uvm->fault_hist[UVM_FAULT_TOTAL].count) uvm_fault_report();
+		return;
+	}
+	if(uvm->uffd != -1) {
+		/* the userfaultfd thread may be waiting for the lock */
+		pthread_mutex_unlock(&uvm->mutex);
+		char c = 0;
+		if(write(uvm->uffd_stop[1], &c, 1) != 1) prexit();
+		pthread_join(uvm->uffd_thread, NULL);
+		close(uvm->uffd_stop[0]);
+		close(uvm->uffd_stop[1]);
+		close(uvm->uffd);
+		pthread_mutex_lock(&uvm->mutex);
+	}
+	uvm_wait_async();
 	struct mmu_proto_exit_req req;
 	req.type = MMU_PROTO_EXIT_REQ;
 	/* socket may have been closed by the MMU, ignore return value: */
-	send(uvm->sock, &req, sizeof(req), 0);
+	struct uvm_waiter w;
+	uvm_request(&w, &req, sizeof(req));
 	pthread_mutex_unlock(&(uvm->mutex));
 	pthread_join(uvm->thread, NULL);
 	close(uvm->sock);
+	if(uvm->fault_hist[UVM_FAULT_TOTAL].count) uvm_fault_report();
 
+	pthread_cond_destroy(&w.cond);
 	pthread_mutex_destroy(&uvm->mutex);
-	pthread_cond_destroy(&uvm->cond);
+	pthread_cond_destroy(&uvm->async_cond);
 	free(uvm->pmem_fn);
+	if(uvm->refmap_base) munmap(uvm->refmap_base, uvm->refmap_size);
 	close(uvm->pmem_fd);
+	free(uvm->regions);
 	free(uvm);
 	uvm = NULL;
 	#ifdef UVMLOG
@@ -226,8 +748,8 @@ void uvm_exit(int status, void *arg)/*{{{*/
 
 void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 {
-	pthread_mutex_lock(&uvm->mutex);
 	assert(si->si_signo == SIGSEGV);
+	uint64_t t_fault = uvm->faultstats ? hist_now() : 0;
 	logd(LOG_DEBUG, "segv addr %p code %d\n", si->si_addr, si->si_code);
 	intptr_t va = (intptr_t)si->si_addr;
 	if(va < UVM_BASEADDR || va > UVM_MAXADDR) {
@@ -235,26 +757,247 @@ void uvm_segv_action(int signum, siginfo_t *si, void *context)/*{{{*/
 		fprintf(stderr, "(external) segmentation fault\n");
 		exit(EXIT_FAILURE);
 	}
-	size_t pagesz = sysconf(_SC_PAGESIZE);
-	if(va >= UVM_BASEADDR + (uvm->npages * pagesz)) {
+	if(!uvm_mapped(va)) {
 		logd(LOG_DEBUG, "access to unnallocated MMU address.\n");
 		fprintf(stderr, "(internal) segmentation fault.\n");
 		fprintf(stderr, "address %p not allocated.\n", (void *)va);
 		exit(EXIT_FAILURE);
 	}
+	if(uvm_soft_fault(va)) return;
+	uvm_fault(si->si_addr, si->si_code, t_fault);
+}/*}}}*/
 
+int uvm_soft_fault(intptr_t va)/*{{{*/
+{
+	/* Restores access the pager revoked only to track references,
+	 * if the MMU allows it; see mmuproto.h.  Runs in signal context,
+	 * so it takes no locks. */
+	uint32_t *refmap = __atomic_load_n(&uvm->refmap, __ATOMIC_ACQUIRE);
+	if(!refmap) return 0;
+	int vpn = (va - UVM_BASEADDR) / uvm->pagesz;
+	uint32_t *e = &refmap[vpn];
+	uint32_t v = __atomic_load_n(e, __ATOMIC_ACQUIRE);
+	if(!(v & MMU_PROTO_REF_PROT)) return 0;
+	if(v & (MMU_PROTO_REF_USED | MMU_PROTO_REF_BUSY)) return 0;
+	if(!__atomic_compare_exchange_n(e, &v, v | MMU_PROTO_REF_BUSY, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+	void *addr = (void *)(UVM_BASEADDR + vpn * uvm->pagesz);
+	int prot = (int)(v & MMU_PROTO_REF_PROT);
+	if(mprotect(addr, uvm->pagesz, prot) == -1) prexit();
+	__atomic_store_n(e, v | MMU_PROTO_REF_USED, __ATOMIC_RELEASE);
+	return 1;
+}/*}}}*/
+
+void uvm_fault(void *addr, int code, uint64_t t_fault)/*{{{*/
+{
+	/* `t_fault` is when the fault reached us, 0 if not timed */
+	PROBE2(uvm, fault_entry, addr, code);
+	pthread_mutex_lock(&uvm->mutex);
+	uvm_wait_async();
 	struct mmu_proto_segv_req req;
 	req.type = MMU_PROTO_SEGV_REQ;
-	req.addr = (intptr_t)si->si_addr;
-	req.code = si->si_code;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	req.addr = (intptr_t)addr;
+	req.code = code;
+	/* lets the pager allocate the frame on this CPU's node.  With
+	 * userfaultfd this is the fault thread's CPU, which the scheduler
+	 * usually keeps near the faulting thread. */
+	unsigned cpu;
+	req.cpu = -1;
+	if(syscall(SYS_getcpu, &cpu, NULL, NULL) == 0) req.cpu = (int32_t)cpu;
+	req.t_fault = t_fault;
+	req.t_send = t_fault ? hist_now() : 0;
+	struct uvm_waiter w;
+	if(uvm_request(&w, &req, sizeof(req))) prexit();
 
 	logd(LOG_DEBUG, "%s waiting service at condition variable\n", __func__);
-	pthread_cond_wait(&uvm->cond, &uvm->mutex);
+	uvm_wait(&w);
+	if(t_fault) uvm_fault_account(&req, &w, hist_now());
 	pthread_mutex_unlock(&uvm->mutex);
+	PROBE1(uvm, fault_return, addr);
 	logd(LOG_DEBUG, "%s returning\n", __func__);
 }/*}}}*/
 
+void uvm_fault_account(const struct mmu_proto_segv_req *req,/*{{{*/
+		const struct uvm_waiter *w, uint64_t t_wake)
+{
+	/* Assumes `uvm->mutex` is locked. */
+	const struct mmu_proto_segv_rep *rep = &w->segv;
+	struct hist *h = uvm->fault_hist;
+	uint64_t pager = rep->t_done - rep->t_start;
+	pager -= rep->ns_ack + rep->ns_disk;
+	hist_add(&h[UVM_FAULT_REQUEST], req->t_send - req->t_fault);
+	hist_add(&h[UVM_FAULT_SEND], rep->t_recv - req->t_send);
+	hist_add(&h[UVM_FAULT_QUEUE], rep->t_start - rep->t_recv);
+	hist_add(&h[UVM_FAULT_PAGER], pager);
+	hist_add(&h[UVM_FAULT_ACK], rep->ns_ack);
+	hist_add(&h[UVM_FAULT_DISK], rep->ns_disk);
+	hist_add(&h[UVM_FAULT_REPLY], w->t_reply - rep->t_done);
+	hist_add(&h[UVM_FAULT_WAKEUP], t_wake - w->t_reply);
+	hist_add(&h[UVM_FAULT_TOTAL], t_wake - req->t_fault);
+}/*}}}*/
+
+void uvm_fault_report(void)/*{{{*/
+{
+	fprintf(stderr, "faults: stages of pid %d\n", (int)getpid());
+	logd(LOG_INFO, "faults: stages of pid %d\n", (int)getpid());
+	for(int i = 0; i < UVM_FAULT_STAGES; ++i) {
+		hist_print(stderr, uvm_fault_stages[i], &uvm->fault_hist[i]);
+		hist_log(LOG_INFO, uvm_fault_stages[i], &uvm->fault_hist[i]);
+	}
+}/*}}}*/
+
+/****************************************************************************
+ * userfaultfd fault delivery
+ ***************************************************************************/
+void uvm_uffd_init(void)/*{{{*/
+{
+	/* Pages are registered for missing-page faults as they are
+	 * allocated, backed by anonymous memory that is never populated.
+	 * Faults are serviced as if they were SIGSEGVs, and the REMAP_REP
+	 * replaces the anonymous page with the frame before the faulting
+	 * thread is woken.  Protection faults on frames still raise
+	 * SIGSEGV, so the handler stays installed. */
+	uvm->uffd = -1;
+	const char *env = getenv(UVM_UFFD_ENV);
+	if(!env || !atoi(env)) return;
+
+	int flags = O_CLOEXEC | O_NONBLOCK;
+	int fd = syscall(SYS_userfaultfd, flags | UFFD_USER_MODE_ONLY);
+	if(fd == -1 && errno == EINVAL)
+		fd = syscall(SYS_userfaultfd, flags);
+	if(fd == -1) {
+		logd(LOG_WARN, "userfaultfd unavailable (%s), using SIGSEGV\n",
+				strerror(errno));
+		return;
+	}
+	struct uffdio_api api;
+	memset(&api, 0, sizeof(api));
+	api.api = UFFD_API;
+	if(ioctl(fd, UFFDIO_API, &api) == -1) {
+		logd(LOG_WARN, "UFFDIO_API failed (%s), using SIGSEGV\n",
+				strerror(errno));
+		close(fd);
+		return;
+	}
+	if(pipe(uvm->uffd_stop) == -1) prexit();
+	uvm->uffd = fd;
+	pthread_create(&uvm->uffd_thread, NULL, uvm_uffd_thread, NULL);
+	logd(LOG_DEBUG, "  delivering first-touch faults with userfaultfd\n");
+}/*}}}*/
+
+void uvm_uffd_register(void *addr)/*{{{*/
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	void *r = mmap(addr, pagesz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	if(r != addr) prexit();
+	struct uffdio_register reg;
+	reg.range.start = (uintptr_t)addr;
+	reg.range.len = pagesz;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+	if(ioctl(uvm->uffd, UFFDIO_REGISTER, &reg) == -1) prexit();
+}/*}}}*/
+
+void * uvm_uffd_thread(void *data)/*{{{*/
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	struct pollfd fds[2];
+	fds[0].fd = uvm->uffd;
+	fds[0].events = POLLIN;
+	fds[1].fd = uvm->uffd_stop[0];
+	fds[1].events = POLLIN;
+	for(;;) {
+		if(poll(fds, 2, -1) == -1) {
+			if(errno == EINTR) continue;
+			prexit();
+		}
+		if(fds[1].revents) break;
+		struct uffd_msg msg;
+		ssize_t cnt = read(uvm->uffd, &msg, sizeof(msg));
+		if(cnt == -1 && errno == EAGAIN) continue;
+		if(cnt != sizeof(msg)) prexit();
+		if(msg.event != UFFD_EVENT_PAGEFAULT) continue;
+		uint64_t t_fault = uvm->faultstats ? hist_now() : 0;
+
+		uintptr_t va = msg.arg.pagefault.address & ~(uintptr_t)(pagesz-1);
+		logd(LOG_DEBUG, "uffd fault addr %p flags %llu\n", (void *)va,
+				(unsigned long long)msg.arg.pagefault.flags);
+		uvm_fault((void *)va, SEGV_MAPERR, t_fault);
+		struct uffdio_range range;
+		range.start = va;
+		range.len = pagesz;
+		if(ioctl(uvm->uffd, UFFDIO_WAKE, &range) == -1) prexit();
+	}
+	logd(LOG_DEBUG, "uvm_uffd_thread exiting\n");
+	return NULL;
+}/*}}}*/
+
+/****************************************************************************
+ * address space
+ ***************************************************************************/
+void uvm_protnone(void *addr, size_t len)/*{{{*/
+{
+	void *r = mmap(addr, len, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	if(r != addr) prexit();
+}/*}}}*/
+
+void uvm_protnone_all(void)/*{{{*/
+{
+	/* Replaces every page, below the break and in regions, by an
+	 * inaccessible anonymous page. */
+	if(uvm->npages) uvm_protnone((void *)UVM_BASEADDR,
+			uvm->npages * uvm->pagesz);
+	for(int i = 0; i < uvm->nregions; ++i) {
+		struct uvm_region *r = &uvm->regions[i];
+		uvm_protnone((void *)r->start, r->end - r->start);
+	}
+}/*}}}*/
+
+int uvm_region_index(intptr_t va)/*{{{*/
+{
+	/* Returns the index of the first region ending after `va`. */
+	int lo = 0, hi = uvm->nregions;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(uvm->regions[mid].end <= va) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}/*}}}*/
+
+int uvm_mapped(intptr_t va)/*{{{*/
+{
+	/* Runs in signal context. */
+	if(va < UVM_BASEADDR + (intptr_t)(uvm->npages * uvm->pagesz))
+		return 1;
+	int i = uvm_region_index(va);
+	return i < uvm->nregions && uvm->regions[i].start <= va;
+}/*}}}*/
+
+void uvm_region_add(intptr_t start, intptr_t end)/*{{{*/
+{
+	int i = uvm_region_index(start);
+	memmove(&uvm->regions[i+1], &uvm->regions[i],
+			(uvm->nregions - i) * sizeof(uvm->regions[0]));
+	uvm->regions[i].start = start;
+	uvm->regions[i].end = end;
+	uvm->nregions++;
+}/*}}}*/
+
+void uvm_region_del(intptr_t start, intptr_t end)/*{{{*/
+{
+	/* The MMU checked that the range lies within one region. */
+	int i = uvm_region_index(start);
+	struct uvm_region r = uvm->regions[i];
+	memmove(&uvm->regions[i], &uvm->regions[i+1],
+			(uvm->nregions - i - 1) * sizeof(uvm->regions[0]));
+	uvm->nregions--;
+	if(r.start < start) uvm_region_add(r.start, start);
+	if(end < r.end) uvm_region_add(end, r.end);
+}/*}}}*/
+
 /****************************************************************************
  * protocol message handlers
  ***************************************************************************/
@@ -265,8 +1008,9 @@ void uvm_proto_extend_rep(void)/*{{{*/
 	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_EXTEND_REP);
-	uvm->result = (intptr_t)rep.vaddr;
-	pthread_cond_signal(&uvm->cond);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->result = (intptr_t)rep.vaddr;
+	pthread_cond_signal(&w->cond);
 }/*}}}*/
 
 void uvm_proto_syslog_rep(void)/*{{{*/
@@ -276,8 +1020,29 @@ void uvm_proto_syslog_rep(void)/*{{{*/
 	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_SYSLOG_REP);
-	uvm->result = (intptr_t)rep.retcode;
-	pthread_cond_signal(&uvm->cond);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->result = (intptr_t)rep.retcode;
+	pthread_cond_signal(&w->cond);
+}/*}}}*/
+
+void uvm_proto_syslog_batch_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing SYSLOG_BATCH_REP\n");
+	struct mmu_proto_syslog_batch_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_SYSLOG_BATCH_REP);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	if(w == &uvm->async) {
+		/* nobody waits on it */
+		pthread_cond_destroy(&w->cond);
+		uvm->async_errors += (int)rep.nerrors;
+		uvm->async_pending = 0;
+		pthread_cond_broadcast(&uvm->async_cond);
+		return;
+	}
+	w->result = (intptr_t)rep.nerrors;
+	pthread_cond_signal(&w->cond);
 }/*}}}*/
 
 void uvm_proto_segv_rep(void)/*{{{*/
@@ -287,7 +1052,10 @@ void uvm_proto_segv_rep(void)/*{{{*/
 	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_SEGV_REP);
-	pthread_cond_signal(&uvm->cond);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->segv = rep;
+	w->t_reply = rep.t_recv ? hist_now() : 0;
+	pthread_cond_signal(&w->cond);
 }/*}}}*/
 
 void uvm_proto_remap_rep(void)/*{{{*/
@@ -297,7 +1065,6 @@ void uvm_proto_remap_rep(void)/*{{{*/
 	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
 		prexit();
 	assert(rep.type == MMU_PROTO_REMAP_REP);
-	assert(rep.prot != PROT_NONE);
 
 	assert(rep.vaddr < UINTPTR_MAX);
 	void *addr = (void *)(intptr_t)rep.vaddr;
@@ -306,17 +1073,22 @@ void uvm_proto_remap_rep(void)/*{{{*/
 	size_t pagesz = sysconf(_SC_PAGESIZE);
 	logd(LOG_DEBUG, "remapping %p at offset %llu prot %d\n", rep.vaddr,
 			(unsigned long long)rep.offset, prot);
-	munmap(addr, pagesz);
-	void *r = mmap(addr, pagesz, prot, MAP_SHARED, uvm->pmem_fd, off);
-	if(r != addr)
-		prexit();
-	logd(LOG_DEBUG, "mprotect %p prot %d\n", rep.vaddr, prot);
-	if(mprotect(addr, pagesz, prot) == -1)
-		prexit();
+	PROBE3(uvm, remap, addr, off, prot);
+	/* MAP_FIXED atomically replaces whatever is mapped at `addr`
+	 * (usually the page's previous frame at PROT_NONE), so there is
+	 * no need to munmap first or mprotect afterwards. */
+	if(!uvm->detached) {
+		void *r = mmap(addr, pagesz, prot, MAP_SHARED | MAP_FIXED,
+				uvm->pmem_fd, off);
+		if(r != addr)
+			prexit();
+	}
 
 	struct mmu_proto_remap_req req;
 	req.type = MMU_PROTO_REMAP_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	if(send(uvm->sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req) &&
+			!uvm->reconnect)
+		prexit();
 }/*}}}*/
 
 void uvm_proto_chprot_rep(void)/*{{{*/
@@ -332,7 +1104,8 @@ void uvm_proto_chprot_rep(void)/*{{{*/
 	int prot = (int)rep.prot;
 	size_t pagesz = sysconf(_SC_PAGESIZE);
 	logd(LOG_DEBUG, "mprotect %p prot %d\n", addr, prot);
-	if(mprotect(addr, pagesz, prot) == -1)
+	PROBE2(uvm, chprot, addr, prot);
+	if(!uvm->detached && mprotect(addr, pagesz, prot) == -1)
 		prexit();
 	/* if(prot == PROT_NONE) {
 		logd(LOG_DEBUG, "unmaping %p\n", rep.vaddr);
@@ -342,7 +1115,257 @@ void uvm_proto_chprot_rep(void)/*{{{*/
 
 	struct mmu_proto_chprot_req req;
 	req.type = MMU_PROTO_CHPROT_REQ;
-	if(send(uvm->sock, &req, sizeof(req), 0) != sizeof(req)) prexit();
+	if(send(uvm->sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req) &&
+			!uvm->reconnect)
+		prexit();
+}/*}}}*/
+
+void uvm_proto_detach_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing DETACH_REP\n");
+	struct mmu_proto_detach_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_DETACH_REP);
+	uvm_detach();
+
+	struct mmu_proto_detach_req req;
+	req.type = MMU_PROTO_DETACH_REQ;
+	/* the MMU is going away, ignore return value: */
+	send(uvm->sock, &req, sizeof(req), MSG_NOSIGNAL);
+}/*}}}*/
+
+void uvm_proto_fork_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing FORK_REP\n");
+	struct mmu_proto_fork_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_FORK_REP);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	if(rep.retcode == 0 && rep.refmap_off)
+		uvm_map_refmap(rep.refmap_off);
+	w->result = (intptr_t)rep.retcode;
+	pthread_cond_signal(&w->cond);
+}/*}}}*/
+
+void uvm_proto_shm_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing SHM_REP\n");
+	struct mmu_proto_shm_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_SHM_REP);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->result = rep.retcode ? 0 : (intptr_t)rep.vaddr;
+	w->shm_id = rep.retcode ? -rep.retcode : rep.id;
+	w->shm_npages = rep.retcode ? 0 : rep.npages;
+	pthread_cond_signal(&w->cond);
+}/*}}}*/
+
+void uvm_proto_release_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing RELEASE_REP\n");
+	struct mmu_proto_release_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_RELEASE_REP);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->result = rep.retcode ? -rep.retcode : (intptr_t)rep.npages;
+	pthread_cond_signal(&w->cond);
+}/*}}}*/
+
+void uvm_proto_advise_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing ADVISE_REP\n");
+	struct mmu_proto_advise_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_ADVISE_REP);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->result = -rep.retcode;
+	pthread_cond_signal(&w->cond);
+}/*}}}*/
+
+void uvm_proto_map_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing MAP_REP\n");
+	struct mmu_proto_map_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_MAP_REP || rep.type == MMU_PROTO_UNMAP_REP);
+	struct uvm_waiter *w = uvm_reply(rep.tag);
+	w->result = rep.retcode ? -rep.retcode : (intptr_t)rep.vaddr;
+	pthread_cond_signal(&w->cond);
+}/*}}}*/
+
+void uvm_proto_exit_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing EXIT_REP\n");
+	struct mmu_proto_exit_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_EXIT_REP);
+	uvm_reply(rep.tag); /* `uvm_exit` joins this thread instead */
+	uvm->running = 0;
+}/*}}}*/
+
+void uvm_proto_resume_rep(void)/*{{{*/
+{
+	logd(LOG_DEBUG, "processing RESUME_REP\n");
+	struct mmu_proto_resume_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep))
+		prexit();
+	assert(rep.type == MMU_PROTO_RESUME_REP);
+	/* if this fails, the next recv fails and we reconnect again */
+	for(struct uvm_waiter *w = uvm->pending; w; w = w->next)
+		send(uvm->sock, w->req, w->len, MSG_NOSIGNAL);
+	uvm->resuming = 0;
+	pthread_cond_broadcast(&uvm->async_cond);
+}/*}}}*/
+
+/****************************************************************************
+ * MMU restarts
+ ***************************************************************************/
+int uvm_request(struct uvm_waiter *w, const void *req, size_t len)/*{{{*/
+{
+	/* Assumes `uvm->mutex` is locked.  Tags a copy of the request in
+	 * `w` and keeps `w` pending until the reply arrives, so it can be
+	 * resent to a restarted MMU.  When reconnecting is enabled, a
+	 * failed send is left to `uvm_reconnect`. */
+	assert(len <= sizeof(w->req));
+	memcpy(w->req, req, len);
+	w->len = len;
+	w->tag = uvm->nexttag++;
+	((struct mmu_proto_hdr *)w->req)->tag = w->tag;
+	w->done = 0;
+	pthread_cond_init(&w->cond, NULL);
+	w->next = uvm->pending;
+	uvm->pending = w;
+	if(send(uvm->sock, w->req, len, MSG_NOSIGNAL) == (ssize_t)len)
+		return 0;
+	return uvm->reconnect ? 0 : -1;
+}/*}}}*/
+
+void uvm_wait(struct uvm_waiter *w)/*{{{*/
+{
+	/* Assumes `uvm->mutex` is locked. */
+	while(!w->done) pthread_cond_wait(&w->cond, &uvm->mutex);
+	pthread_cond_destroy(&w->cond);
+}/*}}}*/
+
+struct uvm_waiter * uvm_reply(uint32_t tag)/*{{{*/
+{
+	/* Assumes `uvm->mutex` is locked.  Returns the request `tag`
+	 * answers, marked done and no longer pending; the caller fills
+	 * in the results and signals the waiter. */
+	struct uvm_waiter **p = &uvm->pending;
+	while(*p && (*p)->tag != tag) p = &(*p)->next;
+	struct uvm_waiter *w = *p;
+	if(!w) {
+		logd(LOG_FATAL, "reply to unknown request %u\n", tag);
+		exit(EXIT_FAILURE);
+	}
+	*p = w->next;
+	w->done = 1;
+	if(!uvm->pending && uvm->forking)
+		pthread_cond_broadcast(&uvm->async_cond);
+	return w;
+}/*}}}*/
+
+void uvm_map_pmem(const struct mmu_proto_create_rep *rep)/*{{{*/
+{
+	uvm->pmem_fn = strndup(rep->pmem_fn, MMU_PROTO_PATH_MAX);
+	logd(LOG_DEBUG, "  mapping pmem_fn [%s]\n", uvm->pmem_fn);
+	uvm->pmem_fd = open(uvm->pmem_fn, O_RDWR);
+	if(uvm->pmem_fd == -1)
+		prexit();
+	if(rep->refmap_off) uvm_map_refmap(rep->refmap_off);
+}/*}}}*/
+
+void uvm_map_refmap(uint64_t refmap_off)/*{{{*/
+{
+	off_t off = (off_t)refmap_off;
+	off_t base = off & ~(off_t)(uvm->pagesz - 1);
+	size_t npages = (UVM_MAXADDR - UVM_BASEADDR + 1) / uvm->pagesz;
+	size_t size = (off - base) + npages * sizeof(uint32_t);
+	/* A signal handler may still hold a pointer into the previous
+	 * mapping, so it is replaced in place rather than unmapped. */
+	int flags = MAP_SHARED;
+	if(uvm->refmap_base && size == uvm->refmap_size) flags |= MAP_FIXED;
+	char *r = mmap(flags & MAP_FIXED ? uvm->refmap_base : NULL, size,
+			PROT_READ | PROT_WRITE, flags, uvm->pmem_fd, base);
+	if(r == MAP_FAILED) prexit();
+	uvm->refmap_base = r;
+	uvm->refmap_size = size;
+	__atomic_store_n(&uvm->refmap, (uint32_t *)(r + (off - base)),
+			__ATOMIC_RELEASE);
+}/*}}}*/
+
+void uvm_detach(void)/*{{{*/
+{
+	/* Assumes `uvm->mutex` is locked.  Replaces every page by an
+	 * inaccessible anonymous page, so faults wait in `uvm_fault`
+	 * until the client is resumed and the MMU remaps its frames. */
+	if(uvm->detached) return;
+	logd(LOG_DEBUG, "detaching %d pages\n", uvm->npages);
+	uvm->detached = 1;
+	uvm->resuming = 1;
+	uint32_t *refmap = uvm->refmap;
+	__atomic_store_n(&uvm->refmap, NULL, __ATOMIC_RELEASE);
+	int maxpages = (UVM_MAXADDR - UVM_BASEADDR + 1) / uvm->pagesz;
+	for(int vpn = 0; refmap && vpn < maxpages; ++vpn) {
+		/* a soft fault that claimed the entry finishes its mprotect
+		 * before the page is replaced */
+		uint32_t v = __atomic_load_n(&refmap[vpn], __ATOMIC_ACQUIRE);
+		while((v & MMU_PROTO_REF_BUSY) ||
+				!__atomic_compare_exchange_n(&refmap[vpn], &v, 0, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			v = __atomic_load_n(&refmap[vpn], __ATOMIC_ACQUIRE);
+	}
+	uvm_protnone_all();
+}/*}}}*/
+
+void uvm_reconnect(void)/*{{{*/
+{
+	/* Assumes `uvm->mutex` is locked.  The MMU normally detaches us
+	 * before it goes away; if it crashed, we detach now and resume
+	 * from its last checkpoint. */
+	logd(LOG_INFO, "connection to MMU lost, reconnecting\n");
+	uvm_detach();
+	close(uvm->sock);
+	close(uvm->pmem_fd);
+	free(uvm->pmem_fn);
+
+	struct sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	addr.sun_path[0] = '\0';
+	strncat(addr.sun_path, mmu_proto_unix_path(), MMU_PROTO_PATH_MAX-1);
+	int tries = uvm->reconnect * (1000000 / UVM_RECONNECT_INTERVAL_US);
+	for(;;) {
+		uvm->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(uvm->sock == -1) prexit();
+		if(connect(uvm->sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			break;
+		if(--tries <= 0) prexit();
+		close(uvm->sock);
+		usleep(UVM_RECONNECT_INTERVAL_US);
+	}
+
+	struct mmu_proto_create_req req;
+	req.type = MMU_PROTO_CREATE_REQ;
+	req.pid = (uint32_t)getpid();
+	req.flags = MMU_PROTO_CREATE_RESUME;
+	req.qos = (uint32_t)uvm->qos;
+	if(send(uvm->sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+		prexit();
+	struct mmu_proto_create_rep rep;
+	if(recv(uvm->sock, &rep, sizeof(rep), 0) != sizeof(rep)) prexit();
+	assert(rep.type == MMU_PROTO_CREATE_REP);
+	uvm_map_pmem(&rep);
+	/* REMAP messages for our frames follow, then RESUME_REP */
+	uvm->detached = 0;
+	logd(LOG_INFO, "reconnected, resuming\n");
 }/*}}}*/
 
 /****************************************************************************
@@ -357,7 +1380,7 @@ void uvm_connect_socket(int sock, const struct sockaddr_un * addr) {
 		}
 		loge(LOG_ERROR, __FILE__, __LINE__);
 		logd(LOG_FATAL, "%s connection attempt %d/%d failed\n",
-				MMU_PROTO_UNIX_PATH,
+				addr->sun_path,
 				try,
 				NUM_CONNECTION_TRIES);
 		try += 1;
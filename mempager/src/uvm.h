@@ -6,11 +6,25 @@
 #define __UVM_HEADER__
 
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 /* `uvm_create` should be called when a program starts to bind it to
  * the memory management infrastructure.  This function sets up
  * a UNIX socket to communicate with the memory management
- * infrastructure and installs a signal handler for SIGSEGV. */
+ * infrastructure and installs a signal handler for SIGSEGV.  The
+ * socket path is taken from the `MMU_SOCK` environment variable if
+ * set, so programs can be spread over several MMU instances.  If
+ * `UVM_UFFD` is set to a non-zero value, faults on pages that were
+ * never mapped are delivered through userfaultfd(2) to a helper
+ * thread instead of the SIGSEGV handler; the SIGSEGV path is used
+ * for all other faults and whenever userfaultfd is unavailable.  If
+ * `UVM_RECONNECT` is set to N > 0, a program that loses its MMU
+ * keeps trying to reconnect for N seconds and resumes from the MMU's
+ * checkpoint (see `mmu -c`), instead of exiting; memory accesses and
+ * requests block in the meantime.  `UVM_QOS` declares the program's
+ * QoS class, "latency", "normal" (the default), or "batch" (see
+ * `UVM_QOS_*` in mmu.h). */
 void uvm_create(void);
 
 /* `uvm_extend` allocates a new page for the calling process and
@@ -18,10 +32,77 @@ void uvm_create(void);
  * to the `sbrk` system call.  Memory allocated with `uvm_extend` is
  * managed by the memory infrastructure, and must not be `free`d.
  * `uvm_extend` fails, returns NULL, and sets `errno` to ENOSPC if
- * the memory infrastructure swap (disk) is out of space.  The
- * system page size is given by `sysconf(_SC_PAGESIZE)`. */
+ * the memory infrastructure swap (disk) is out of space; it also
+ * returns NULL when the next page belongs to a region added with
+ * `uvm_map`.  The system page size is given by
+ * `sysconf(_SC_PAGESIZE)`. */
 void * uvm_extend(void);
 
+/* `uvm_fork` is like fork(2) for a program bound with `uvm_create`:
+ * the child starts with a copy of the parent's managed memory.
+ * Pages are shared copy-on-write by the memory infrastructure, so
+ * forking is cheap and memory is only copied when either process
+ * writes to a page.  Returns the child's PID in the parent and 0 in
+ * the child.  On failure, returns -1 in the parent, with `errno` set
+ * to ENOSPC if the infrastructure swap (disk) cannot hold a private
+ * copy of every page, and no child is left running. */
+pid_t uvm_fork(void);
+
+/* `uvm_shm_create` allocates a shared memory segment of `npages`
+ * pages at the end of the calling process's managed memory, stores
+ * the segment's identifier in `id`, and returns the address of its
+ * first page.  Any process bound to the same memory infrastructure
+ * can map the segment with `uvm_shm_attach`, which returns the
+ * address where the segment was mapped in the calling process; all
+ * mappings share the same physical memory and swap space.  Segments
+ * are inherited by `uvm_fork` children and are not copied on write.
+ * A segment exists until the last process mapping it exits.  On
+ * failure, both functions return NULL and set `errno`: EINVAL if
+ * `npages` is not positive or there is no segment `id`, ENOMEM if
+ * the managed address space is full, or ENOSPC if the
+ * infrastructure swap (disk) is out of space. */
+void * uvm_shm_create(int npages, int *id);
+void * uvm_shm_attach(int id);
+
+/* `uvm_release` gives the `npages` pages starting at `addr` back to
+ * the memory infrastructure, which frees their physical memory and
+ * swap space at once without saving their contents.  Released pages
+ * at the end of the managed memory are no longer allocated (later
+ * calls to `uvm_extend` reuse their addresses); other released
+ * pages read as new pages if touched again.  Returns 0 on success;
+ * on failure, returns -1 and sets `errno` to EINVAL if `addr` is not
+ * page-aligned or the range is not allocated.
+ *
+ * `uvm_advise` is like madvise(2) for `len` bytes of managed memory
+ * from `addr`, with `hint` one of the `UVM_ADV_*` constants in
+ * mmu.h: `UVM_ADV_WILLNEED` brings the pages into memory now,
+ * `UVM_ADV_DONTNEED` drops their contents like `uvm_release` without
+ * deallocating them, `UVM_ADV_SEQUENTIAL` reads pages ahead of
+ * faults and lets pages already read be paged out first,
+ * `UVM_ADV_RANDOM` asks for no read-ahead, and `UVM_ADV_NORMAL`
+ * restores the default.  Returns 0 on success; on failure, returns
+ * -1 and sets `errno` to EINVAL. */
+int uvm_release(void *addr, int npages);
+int uvm_advise(void *addr, size_t len, int hint);
+
+/* `uvm_map` adds a region of `npages` zero-filled pages to managed
+ * memory, like an anonymous mmap(2), and returns its address.  The
+ * region starts at `addr` if it is not NULL, page-aligned, above
+ * the pages from `uvm_extend`, and free; otherwise it is placed as
+ * high as possible.  Swap space is reserved for the whole region,
+ * but pages only use memory in the infrastructure once touched, so
+ * large, sparsely used regions are cheap.  On failure, returns NULL
+ * and sets `errno` to EINVAL if `npages` is not positive or `addr`
+ * is not page-aligned, ENOMEM if there is no free range large
+ * enough, or ENOSPC if the swap cannot back the region.
+ *
+ * `uvm_unmap` removes the `npages` pages from `addr`, which must lie
+ * within a single region; the rest of the region stays mapped.
+ * Returns 0 on success; on failure, returns -1 and sets `errno` to
+ * EINVAL. */
+void * uvm_map(void *addr, int npages);
+int uvm_unmap(void *addr, int npages);
+
 /* `uvm_syslog` requests the memory infrastructure to write the
  * string at `addr` with `len` bytes.  Memory at `addr` must be
  * managed by the memory infrastructure (i.e., allocated with
@@ -29,4 +110,20 @@ void * uvm_extend(void);
  * sets `errno` to EINVAL. */
 int uvm_syslog(void *addr, size_t len);
 
+/* `uvm_syslogv` logs `iovcnt` records, one per `iov` entry, in as
+ * few exchanges with the memory infrastructure as possible.  Each
+ * record is handled as by `uvm_syslog`, and all records are logged
+ * even if some fail.  Returns 0 on success; if any record fails,
+ * returns -1 and sets `errno` to EINVAL. */
+int uvm_syslogv(const struct iovec *iov, int iovcnt);
+
+/* `uvm_syslogv_async` is like `uvm_syslogv` but returns as soon as
+ * the records are sent, without waiting for them to be logged.
+ * Failures are reported by the next call to `uvm_syslog_sync`,
+ * `uvm_syslogv` or `uvm_syslogv_async`, which returns -1 and sets
+ * `errno` to EINVAL if any record sent asynchronously since the last
+ * report failed.  Records are logged in the order they are sent. */
+int uvm_syslogv_async(const struct iovec *iov, int iovcnt);
+int uvm_syslog_sync(void);
+
 #endif
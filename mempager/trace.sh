@@ -0,0 +1,83 @@
+#!/bin/bash
+set -u
+
+# Traces a running MMU through the USDT probes in src/probes.h with
+# bpftrace (as root).  Prints fault, zero-fill and disk rates every
+# interval, and on Ctrl-C latency histograms in microseconds for MMU
+# faults and REMAP/CHPROT round trips, and faults per client pid.
+# If a client binary linked with uvm.a is given, its faults are also
+# timed from the client's side.
+#
+#   ./trace.sh [-i SECONDS] [-m MMU] [CLIENT]
+
+MMU=./bin/mmu
+INTERVAL=1
+while getopts "i:m:" opt ; do
+    case $opt in
+    i) INTERVAL=$OPTARG ;;
+    m) MMU=$OPTARG ;;
+    *) echo "usage: $0 [-i SECONDS] [-m MMU] [CLIENT]" ; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+CLIENT=${1:-""}
+
+prog=$(cat <<'EOF'
+usdt:@MMU@:mmu:fault_entry {
+    @fault_start[tid] = nsecs;
+    @nfaults++;
+    @faults_by_pid[arg0] = count();
+}
+usdt:@MMU@:mmu:fault_return /@fault_start[tid]/ {
+    @fault_us = hist((nsecs - @fault_start[tid]) / 1000);
+    delete(@fault_start[tid]);
+}
+usdt:@MMU@:mmu:remap_entry { @remap_start[tid] = nsecs; }
+usdt:@MMU@:mmu:remap_return /@remap_start[tid]/ {
+    @remap_us = hist((nsecs - @remap_start[tid]) / 1000);
+    delete(@remap_start[tid]);
+}
+usdt:@MMU@:mmu:chprot_entry { @chprot_start[tid] = nsecs; }
+usdt:@MMU@:mmu:chprot_return /@chprot_start[tid]/ {
+    @chprot_us = hist((nsecs - @chprot_start[tid]) / 1000);
+    delete(@chprot_start[tid]);
+}
+usdt:@MMU@:mmu:zero_fill { @nzero++; }
+usdt:@MMU@:mmu:disk_read { @nread++; }
+usdt:@MMU@:mmu:disk_write { @nwrite++; }
+usdt:@MMU@:mmu:client_create {
+    printf("client %d created (id %d, resumed %d)\n", arg0, arg1, arg2);
+}
+usdt:@MMU@:mmu:client_destroy {
+    printf("client %d destroyed (clean exit %d)\n", arg0, arg1);
+}
+interval:s:@INTERVAL@ {
+    printf("%s faults/s %d zero fills/s %d disk reads/s %d writes/s %d\n",
+            strftime("%H:%M:%S", nsecs), @nfaults / @INTERVAL@,
+            @nzero / @INTERVAL@, @nread / @INTERVAL@,
+            @nwrite / @INTERVAL@);
+    @nfaults = 0; @nzero = 0; @nread = 0; @nwrite = 0;
+}
+END {
+    clear(@nfaults); clear(@nzero); clear(@nread); clear(@nwrite);
+    clear(@fault_start); clear(@remap_start); clear(@chprot_start);
+}
+EOF
+)
+if [ -n "$CLIENT" ] ; then
+    prog+=$(cat <<'EOF'
+
+usdt:@CLIENT@:uvm:fault_entry { @client_start[tid] = nsecs; }
+usdt:@CLIENT@:uvm:fault_return /@client_start[tid]/ {
+    @client_fault_us = hist((nsecs - @client_start[tid]) / 1000);
+    delete(@client_start[tid]);
+}
+END { clear(@client_start); }
+EOF
+)
+fi
+
+prog=${prog//@MMU@/$MMU}
+prog=${prog//@CLIENT@/$CLIENT}
+prog=${prog//@INTERVAL@/$INTERVAL}
+exec bpftrace -e "$prog"